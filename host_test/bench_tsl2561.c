@@ -0,0 +1,448 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file bench_tsl2561.c
+ * @brief Benchmark of the Lux calculation and the measurement path.
+ *
+ * Lux calculation cost is host CPU time per call. The measurement path is run against the
+ * emulated device in virtual time, reporting bus transactions, bytes on the wire and elapsed
+ * device time per read, which are the costs that matter on the target, and host CPU time
+ * per read, which approximates the driver's own overhead.
+ *
+ * The sample log is compared with a dump of the decoded sample structs, for a steady stream of
+ * slowly varying light, by bytes per sample and host CPU time per sample to encode and decode.
+ *
+ * Adaptive sampling is compared with sampling at its minimum period, in 101 ms at 16x, over an hour
+ * of dawn, of passing clouds, and of a lamp switched on and off, by bus transactions and by the
+ * latency from each step in the light to the end of the first integration that reflects it.
+ *
+ * Built against a component with the package and range fixed by configuration, the Lux
+ * calculation is specialised for them, and reads in other ranges are skipped.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "baseline_lux.h"
+#include "tsl2561_adaptive.h"
+#include "tsl2561_record.h"
+#include "test_util.h"
+
+#if defined(CONFIG_TSL2561_FIXED_RANGE)
+#  define LUX_VARIANT "fixed range"
+#else
+#  define LUX_VARIANT "runtime range"
+#endif
+
+static volatile uint32_t _sink;
+
+static void _bench_compute_lux(uint32_t iterations)
+{
+    tsl2561_info_t info;
+    tsl2561_init_detached(&info, TSL2561_DEVICE_TYPE_TSL2561T_FN_CL, TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_16X);
+
+    // the same inputs for each implementation, covering all ratio segments
+    uint32_t sum = 0;
+    uint32_t state = 1;
+    int64_t start = test_wall_ns();
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        state = state * 1664525 + 1013904223;
+        sum += tsl2561_compute_lux(&info, state & 0x7fff, (state >> 16) & 0x3fff);
+    }
+    int64_t elapsed = test_wall_ns() - start;
+
+    state = 1;
+    start = test_wall_ns();
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        state = state * 1664525 + 1013904223;
+        sum += baseline_compute_lux(info.integration_time, info.gain, info.device_type, state & 0x7fff, (state >> 16) & 0x3fff);
+    }
+    int64_t baseline = test_wall_ns() - start;
+
+    state = 1;
+    start = test_wall_ns();
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+        state = state * 1664525 + 1013904223;
+        sum += (uint32_t)tsl2561_compute_lux_precise(&info, state & 0x7fff, (state >> 16) & 0x3fff);
+    }
+    int64_t precise = test_wall_ns() - start;
+    _sink = sum;
+
+    printf("compute_lux, " LUX_VARIANT ": %u calls, %.2f ns/call, original if-chain %.2f ns/call, precise %.2f ns/call\n",
+           iterations, (double)elapsed / iterations, (double)baseline / iterations, (double)precise / iterations);
+}
+
+static void _bench_compute_lux_batch(size_t samples)
+{
+    tsl2561_info_t info;
+    tsl2561_init_detached(&info, TSL2561_DEVICE_TYPE_TSL2561T_FN_CL, TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_16X);
+    tsl2561_visible_t * visible = malloc(samples * sizeof(*visible));
+    tsl2561_infrared_t * infrared = malloc(samples * sizeof(*infrared));
+    uint32_t * lux = malloc(samples * sizeof(*lux));
+    if (visible != NULL && infrared != NULL && lux != NULL)
+    {
+        uint32_t state = 1;
+        for (size_t i = 0; i < samples; ++i)
+        {
+            state = state * 1664525 + 1013904223;
+            visible[i] = state & 0x7fff;
+            infrared[i] = (state >> 16) & 0x3fff;
+        }
+
+        int64_t start = test_wall_ns();
+        for (size_t i = 0; i < samples; ++i)
+        {
+            lux[i] = tsl2561_compute_lux(&info, visible[i], infrared[i]);
+        }
+        int64_t scalar = test_wall_ns() - start;
+        _sink = lux[samples / 2];
+
+        start = test_wall_ns();
+        tsl2561_compute_lux_batch(&info, visible, infrared, lux, samples);
+        int64_t batch = test_wall_ns() - start;
+        _sink = lux[samples / 2];
+
+        printf("compute_lux_batch: %zu samples, scalar loop %.2f ns/sample, batch %.2f ns/sample\n",
+               samples, (double)scalar / samples, (double)batch / samples);
+    }
+    free(visible);
+    free(infrared);
+    free(lux);
+}
+
+static void _bench_record(size_t samples)
+{
+    const size_t block_size = 4096;
+    size_t storage_size = samples * TSL2561_RECORD_SAMPLE_MAX + block_size;
+    tsl2561_record_sample_t * stream = malloc(samples * sizeof(*stream));
+    tsl2561_record_sample_t * dumped = malloc(samples * sizeof(*dumped));
+    storage_size = storage_size > samples * sizeof(*stream) ? storage_size : samples * sizeof(*stream);
+    uint8_t * storage = malloc(storage_size);
+    tsl2561_visible_t visible[256];
+    tsl2561_infrared_t infrared[256];
+    uint32_t lux[256];
+    if (stream != NULL && dumped != NULL && storage != NULL)
+    {
+        // fault in the output buffers, so that neither format pays for first use
+        memset(storage, 0, storage_size);
+        memset(dumped, 0, samples * sizeof(*dumped));
+
+        uint32_t state = 1;
+        int64_t timestamp = 0;
+        int32_t ch0 = 20000;
+        int32_t ch1 = 5000;
+        for (size_t i = 0; i < samples; ++i)
+        {
+            state = state * 1664525 + 1013904223;
+            timestamp += 20000 + (state >> 24) % 64;
+            ch0 += (int32_t)((state >> 8) % 33) - 16;
+            ch1 += (int32_t)((state >> 16) % 9) - 4;
+            stream[i].timestamp_us = timestamp;
+            stream[i].visible = (uint16_t)(ch0 - ch1);
+            stream[i].infrared = (uint16_t)ch1;
+            stream[i].integration_time = TSL2561_INTEGRATION_TIME_13MS;
+            stream[i].gain = TSL2561_GAIN_16X;
+        }
+
+        // encode into consecutive blocks
+        tsl2561_record_encoder_t encoder;
+        size_t blocks = 1;
+        size_t bytes = 0;
+        size_t length = 0;
+        int64_t start = test_wall_ns();
+        tsl2561_record_encoder_init(&encoder, TSL2561_DEVICE_TYPE_TSL2561T_FN_CL, TSL2561_INTEGRATION_TIME_13MS,
+                                    TSL2561_GAIN_16X, storage, block_size);
+        for (size_t i = 0; i < samples; ++i)
+        {
+            const tsl2561_record_sample_t * sample = &stream[i];
+            if (tsl2561_record_encode(&encoder, sample->timestamp_us, sample->integration_time, sample->gain,
+                                      sample->visible, sample->infrared) == ESP_ERR_NO_MEM)
+            {
+                tsl2561_record_encoder_finish(&encoder, &length);
+                bytes += length;
+                tsl2561_record_encoder_next_block(&encoder, &storage[blocks++ * block_size], block_size);
+                tsl2561_record_encode(&encoder, sample->timestamp_us, sample->integration_time, sample->gain,
+                                      sample->visible, sample->infrared);
+            }
+        }
+        tsl2561_record_encoder_finish(&encoder, &length);
+        bytes += length;
+        int64_t encode = test_wall_ns() - start;
+
+        // decode in batches straight into the Lux calculation
+        uint32_t sum = 0;
+        size_t decoded = 0;
+        start = test_wall_ns();
+        for (size_t b = 0; b < blocks; ++b)
+        {
+            tsl2561_record_decoder_t decoder;
+            tsl2561_record_decoder_init(&decoder, &storage[b * block_size], block_size);
+            tsl2561_info_t info;
+            size_t count = 0;
+            tsl2561_integration_time_t integration_time;
+            tsl2561_gain_t gain;
+            while (tsl2561_record_decode_batch(&decoder, NULL, visible, infrared, 256, &count, &integration_time, &gain) == ESP_OK)
+            {
+                tsl2561_init_detached(&info, decoder.device_type, integration_time, gain);
+                tsl2561_compute_lux_batch(&info, visible, infrared, lux, count);
+                sum += lux[count - 1];
+                decoded += count;
+            }
+        }
+        int64_t decode = test_wall_ns() - start;
+
+        // the same samples as a struct dump, read back through the same Lux calculation
+        start = test_wall_ns();
+        memcpy(storage, stream, samples * sizeof(*stream));
+        int64_t dump = test_wall_ns() - start;
+
+        start = test_wall_ns();
+        memcpy(dumped, storage, samples * sizeof(*dumped));
+        tsl2561_info_t info;
+        tsl2561_init_detached(&info, TSL2561_DEVICE_TYPE_TSL2561T_FN_CL, dumped[0].integration_time, dumped[0].gain);
+        for (size_t i = 0; i < samples; i += 256)
+        {
+            size_t count = samples - i < 256 ? samples - i : 256;
+            for (size_t j = 0; j < count; ++j)
+            {
+                visible[j] = dumped[i + j].visible;
+                infrared[j] = dumped[i + j].infrared;
+            }
+            tsl2561_compute_lux_batch(&info, visible, infrared, lux, count);
+            sum += lux[count - 1];
+        }
+        int64_t load = test_wall_ns() - start;
+        _sink = sum;
+
+        printf("record: %zu samples, %zu decoded, %.2f bytes/sample, encode %.2f ns/sample, decode to Lux %.2f ns/sample\n",
+               samples, decoded, (double)bytes / samples, (double)encode / samples, (double)decode / samples);
+        printf("struct dump: %zu bytes/sample, write %.2f ns/sample, read to Lux %.2f ns/sample\n",
+               sizeof(*stream), (double)dump / samples, (double)load / samples);
+    }
+    free(stream);
+    free(dumped);
+    free(storage);
+}
+
+static void _bench_read(tsl2561_integration_time_t integration_time, const char * name, uint32_t reads)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL);
+    fake_tsl2561_set_light(&device, 12000.0, 3000.0);
+    host_log_quiet = true;
+    esp_err_t err = tsl2561_set_integration_time_and_gain(&info, integration_time, TSL2561_GAIN_16X);
+    host_log_quiet = false;
+    if (err == ESP_ERR_NOT_SUPPORTED)
+    {
+        printf("read %-6s: not supported by this configuration\n", name);
+        return;
+    }
+
+    fake_bus_counters_t before = fake_bus_device_counters(&smbus_info);
+    int64_t device_start = esp_timer_get_time();
+    int64_t start = test_wall_ns();
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < reads; ++i)
+    {
+        tsl2561_visible_t visible = 0;
+        tsl2561_infrared_t infrared = 0;
+        failed += tsl2561_read(&info, &visible, &infrared) != ESP_OK;
+    }
+    int64_t elapsed = test_wall_ns() - start;
+    int64_t device_elapsed = esp_timer_get_time() - device_start;
+    fake_bus_counters_t after = fake_bus_device_counters(&smbus_info);
+
+    printf("read %-6s: %u reads, %.2f transactions/read, %.1f bus bytes/read, %.1f us bus/read, %.0f us/read device time, %.0f ns/read host, %u failed\n",
+           name, reads,
+           (double)(after.transactions - before.transactions) / reads,
+           (double)(after.bytes - before.bytes) / reads,
+           (double)(after.busy_us - before.busy_us) / reads,
+           (double)device_elapsed / reads,
+           (double)elapsed / reads,
+           failed);
+}
+
+#define ADAPTIVE_MIN_PERIOD    20     // ticks, 200 ms
+#define ADAPTIVE_MAX_PERIOD    640    // ticks, 6.4 s
+#define ADAPTIVE_STEP_PERCENT  10
+
+// A light profile, with any steps repeating at a fixed period
+typedef struct
+{
+    const char * name;
+    double (*level)(int64_t time_us, int64_t duration_us);  // channel 0 illuminance, as counts for 402 ms at 16x
+    int64_t period_us;                                      // period of the steps, or zero if there are none
+    int64_t steps_us[2];                                    // times of the steps within each period
+    int64_t duration_us;
+} _profile_t;
+
+// Dark for the first sixth, then an exponential rise to daylight over half the run
+static double _dawn(int64_t time_us, int64_t duration_us)
+{
+    double x = (time_us - duration_us / 6) / (duration_us / 2.0);
+    return 20.0 * pow(5000.0, x < 0.0 ? 0.0 : x > 1.0 ? 1.0 : x);
+}
+
+// Daylight, with a cloud passing in 40 s every three minutes
+static double _clouds(int64_t time_us, int64_t duration_us)
+{
+    return time_us % 180000000 >= 140000000 ? 40000.0 : 100000.0;
+}
+
+// A dim room, with a lamp on for half of every five minutes
+static double _lamp(int64_t time_us, int64_t duration_us)
+{
+    return time_us % 300000000 >= 150000000 ? 20000.0 : 200.0;
+}
+
+static void _profile_light(void * context, int64_t time_us, double * channel0, double * channel1)
+{
+    const _profile_t * profile = (const _profile_t *)context;
+    *channel0 = profile->level(time_us, profile->duration_us);
+    *channel1 = *channel0 / 4.0;
+}
+
+// Time of the first step after the given time, or INT64_MAX if there is none
+static int64_t _next_step(const _profile_t * profile, int64_t time_us)
+{
+    int64_t next = INT64_MAX;
+    if (profile->period_us > 0)
+    {
+        int64_t base = time_us / profile->period_us * profile->period_us;
+        for (int64_t start = base; next == INT64_MAX; start += profile->period_us)
+        {
+            for (int i = 0; i < 2; ++i)
+            {
+                int64_t step = start + profile->steps_us[i];
+                next = step > time_us && step < next ? step : next;
+            }
+        }
+    }
+    return next;
+}
+
+typedef struct
+{
+    uint32_t results;
+    uint32_t transactions;
+    uint32_t steps;
+    double latency_total_us;
+    int64_t latency_max_us;
+} _sampling_t;
+
+static _sampling_t _run_profile(_profile_t * profile, bool adaptive_rate)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    tsl2561_adaptive_t adaptive;
+    _sampling_t sampling = { 0 };
+    test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL);
+    host_log_quiet = true;
+    esp_err_t err = tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_16X);
+    host_log_quiet = false;
+    tsl2561_adaptive_init(&adaptive, ADAPTIVE_MIN_PERIOD, ADAPTIVE_MAX_PERIOD, ADAPTIVE_STEP_PERCENT);
+    device.light = _profile_light;
+    device.light_context = profile;
+
+    uint32_t transactions = test_transactions(&smbus_info);
+    int64_t next_step = _next_step(profile, 0);
+    TickType_t wake = xTaskGetTickCount();
+    while (err == ESP_OK && esp_timer_get_time() < profile->duration_us)
+    {
+        tsl2561_visible_t visible = 0;
+        tsl2561_infrared_t infrared = 0;
+        err = adaptive_rate ? tsl2561_adaptive_read(&adaptive, &info, &wake, &visible, &infrared)
+                            : tsl2561_read_periodic(&info, &wake, ADAPTIVE_MIN_PERIOD, &visible, &infrared);
+        if (err == ESP_OK)
+        {
+            ++sampling.results;
+
+            // the emulated device samples the light in the middle of the integration
+            int64_t start_us = 0;
+            int64_t end_us = 0;
+            tsl2561_get_result_timestamps(&info, &start_us, &end_us);
+            while ((start_us + end_us) / 2 >= next_step)
+            {
+                int64_t latency = end_us - next_step;
+                sampling.latency_total_us += latency;
+                sampling.latency_max_us = latency > sampling.latency_max_us ? latency : sampling.latency_max_us;
+                ++sampling.steps;
+                next_step = _next_step(profile, next_step);
+            }
+        }
+    }
+    sampling.transactions = test_transactions(&smbus_info) - transactions;
+    return sampling;
+}
+
+static void _bench_adaptive(int64_t duration_us)
+{
+    _profile_t profiles[] = {
+        { "dawn", _dawn, 0, { 0, 0 }, duration_us },
+        { "clouds", _clouds, 180000000, { 140000000, 180000000 }, duration_us },
+        { "lamp", _lamp, 300000000, { 150000000, 300000000 }, duration_us },
+    };
+    for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); ++i)
+    {
+        _sampling_t fixed = _run_profile(&profiles[i], false);
+        _sampling_t adaptive = _run_profile(&profiles[i], true);
+        if (fixed.results == 0)
+        {
+            printf("adaptive %-6s: not supported by this configuration\n", profiles[i].name);
+            continue;
+        }
+        printf("adaptive %-6s: %.0f min, %u results, %u transactions, %.1f%% saved against %u at the minimum period",
+               profiles[i].name, duration_us / 60e6, adaptive.results, adaptive.transactions,
+               100.0 - 100.0 * adaptive.transactions / fixed.transactions, fixed.transactions);
+        if (adaptive.steps > 0)
+        {
+            printf("; %u steps, latency mean %.0f ms, max %.0f ms, against %.0f ms, %.0f ms",
+                   adaptive.steps, adaptive.latency_total_us / adaptive.steps / 1e3, adaptive.latency_max_us / 1e3,
+                   fixed.latency_total_us / fixed.steps / 1e3, fixed.latency_max_us / 1e3);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    bool quick = test_flag(argc, argv, "--quick");
+    _bench_compute_lux(quick ? 1000000 : 100000000);
+    _bench_compute_lux_batch(1000000);
+    _bench_record(quick ? 100000 : 10000000);
+    _bench_read(TSL2561_INTEGRATION_TIME_13MS, "13ms", quick ? 100 : 10000);
+    _bench_read(TSL2561_INTEGRATION_TIME_101MS, "101ms", quick ? 100 : 10000);
+    _bench_read(TSL2561_INTEGRATION_TIME_402MS, "402ms", quick ? 100 : 10000);
+    _bench_adaptive(quick ? 900000000 : 3600000000LL);
+    return 0;
+}
@@ -0,0 +1,197 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file baseline_lux.c
+ *
+ * Copied from tsl2561.c before coefficient tables were introduced, with the instance fields
+ * replaced by parameters. Only the CS selection for device type 1 differs from the driver's
+ * current behaviour, which also selects the CS coefficients for the TSL2560CS.
+ */
+
+#include <stdint.h>
+
+#include "baseline_lux.h"
+
+#define CH_SCALE       10      // Scale channel values by 2^10
+#define CH_SCALE_TINT0 0x7517  // 322/11 * 2^CH_SCALE
+#define CH_SCALE_TINT1 0x0FE7  // 322/81 * 2^CH_SCALE
+
+#define RATIO_SCALE    9       // Scale ratio by 2^9
+#define LUX_SCALE      14      // Scale by 2^14
+
+// T, FN, and CL Package coefficients
+#define TSL2561_K1T 0x0040
+#define TSL2561_B1T 0x01F2
+#define TSL2561_M1T 0x01BE
+#define TSL2561_K2T 0x0080
+#define TSL2561_B2T 0x0214
+#define TSL2561_M2T 0x02D1
+#define TSL2561_K3T 0x00C0
+#define TSL2561_B3T 0x023F
+#define TSL2561_M3T 0x037B
+#define TSL2561_K4T 0x0100
+#define TSL2561_B4T 0x0270
+#define TSL2561_M4T 0x03FE
+#define TSL2561_K5T 0x0138
+#define TSL2561_B5T 0x016F
+#define TSL2561_M5T 0x01fC
+#define TSL2561_K6T 0x019A
+#define TSL2561_B6T 0x00D2
+#define TSL2561_M6T 0x00FB
+#define TSL2561_K7T 0x029A
+#define TSL2561_B7T 0x0018
+#define TSL2561_M7T 0x0012
+#define TSL2561_K8T 0x029A
+#define TSL2561_B8T 0x0000
+#define TSL2561_M8T 0x0000
+
+// CS Package coefficients
+#define TSL2561_K1C 0x0043
+#define TSL2561_B1C 0x0204
+#define TSL2561_M1C 0x01AD
+#define TSL2561_K2C 0x0085
+#define TSL2561_B2C 0x0228
+#define TSL2561_M2C 0x02C1
+#define TSL2561_K3C 0x00C8
+#define TSL2561_B3C 0x0253
+#define TSL2561_M3C 0x0363
+#define TSL2561_K4C 0x010A
+#define TSL2561_B4C 0x0282
+#define TSL2561_M4C 0x03DF
+#define TSL2561_K5C 0x014D
+#define TSL2561_B5C 0x0177
+#define TSL2561_M5C 0x01DD
+#define TSL2561_K6C 0x019A
+#define TSL2561_B6C 0x0101
+#define TSL2561_M6C 0x0127
+#define TSL2561_K7C 0x029A
+#define TSL2561_B7C 0x0037
+#define TSL2561_M7C 0x002B
+#define TSL2561_K8C 0x029A
+#define TSL2561_B8C 0x0000
+#define TSL2561_M8C 0x0000
+
+uint32_t baseline_compute_lux(uint8_t integration_time, uint8_t gain, uint8_t device_type, uint16_t visible, uint16_t infrared)
+{
+    uint32_t lux = 0;
+    uint32_t scale = 0;
+
+    // scale channel values
+    switch (integration_time)
+    {
+    case 0x00:
+        scale = CH_SCALE_TINT0;
+        break;
+    case 0x01:
+        scale = CH_SCALE_TINT1;
+        break;
+    default:
+        scale = 1 << CH_SCALE;
+    }
+
+    // scale 1x measurement up to 16x
+    if (gain == 0x00)
+    {
+        scale <<= 4;
+    }
+
+    // convert visible/infrared back into channel data
+    uint32_t channel0 = ((visible + infrared) * scale) >> CH_SCALE;
+    uint32_t channel1 = (infrared * scale) >> CH_SCALE;
+
+    // find the ratio of the channel values (channel1/channel0)
+    // protect against divide by zero
+    uint32_t ratio1 = 0;
+    if (channel0 != 0)
+    {
+        ratio1 = (channel1 << (RATIO_SCALE + 1)) / channel0;
+    }
+
+    // round the ratio value
+    uint32_t ratio = (ratio1 + 1) >> 1;
+
+    // is ratio <= eachBreak ?
+    int b = 0, m = 0;
+
+    switch (device_type)
+    {
+    case 1:
+        if (ratio <= TSL2561_K1C) {
+            b = TSL2561_B1C; m = TSL2561_M1C;
+        } else if (ratio <= TSL2561_K2C) {
+            b = TSL2561_B2C; m = TSL2561_M2C;
+        } else if (ratio <= TSL2561_K3C) {
+            b = TSL2561_B3C; m = TSL2561_M3C;
+        } else if (ratio <= TSL2561_K4C) {
+            b = TSL2561_B4C; m = TSL2561_M4C;
+        } else if (ratio <= TSL2561_K5T) {
+            b = TSL2561_B5C; m = TSL2561_M5C;
+        } else if (ratio <= TSL2561_K6T) {
+            b = TSL2561_B6C; m = TSL2561_M6C;
+        } else if (ratio <= TSL2561_K7T) {
+            b = TSL2561_B7C; m = TSL2561_M7C;
+        } else if (ratio > TSL2561_K8C) {
+            b = TSL2561_B8C; m = TSL2561_M8C;
+        }
+        break;
+
+    case 0:
+    default:
+        if (ratio <= TSL2561_K1T) {
+            b = TSL2561_B1T; m = TSL2561_M1T;
+        } else if (ratio <= TSL2561_K2T) {
+            b = TSL2561_B2T; m = TSL2561_M2T;
+        } else if (ratio <= TSL2561_K3T) {
+            b = TSL2561_B3T; m = TSL2561_M3T;
+        } else if (ratio <= TSL2561_K4T) {
+            b = TSL2561_B4T; m = TSL2561_M4T;
+        } else if (ratio <= TSL2561_K5T) {
+            b = TSL2561_B5T; m = TSL2561_M5T;
+        } else if (ratio <= TSL2561_K6T) {
+            b = TSL2561_B6T; m = TSL2561_M6T;
+        } else if (ratio <= TSL2561_K7T) {
+            b = TSL2561_B7T; m = TSL2561_M7T;
+        } else if (ratio > TSL2561_K8T) {
+            b = TSL2561_B8T; m = TSL2561_M8T;
+        }
+        break;
+    }
+
+    uint32_t temp = (channel0 * b) - (channel1 * m);
+
+    // prevent negative lux values
+    if ((channel1 * m) > (channel0 * b))
+    {
+        temp = 0;
+    }
+
+    // round lsb
+    temp += (1 << (LUX_SCALE-1));
+
+    // strip off fractional portion
+    lux = temp >> LUX_SCALE;
+
+    return lux;
+}
@@ -0,0 +1,54 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file baseline_lux.h
+ * @brief The original if-chain implementation of tsl2561_compute_lux(), retained to check that
+ *        the table-driven implementation is bit-exact and to compare their cost.
+ */
+
+#ifndef BASELINE_LUX_H
+#define BASELINE_LUX_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Lux approximation as computed by the original tsl2561_compute_lux().
+ * @param[in] integration_time TIMING register integration field: 0, 1 or 2.
+ * @param[in] gain TIMING register gain bit: 0x00 or 0x10.
+ * @param[in] device_type Device type: 1 selects the CS coefficients, any other value the T coefficients.
+ * @param[in] visible The visible light measurement.
+ * @param[in] infrared The infrared light measurement.
+ */
+uint32_t baseline_compute_lux(uint8_t integration_time, uint8_t gain, uint8_t device_type, uint16_t visible, uint16_t infrared);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // BASELINE_LUX_H
@@ -0,0 +1,283 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file fake_bus.c
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "host_clock.h"
+#include "fake_bus.h"
+
+#define BITS_PER_BYTE 9   // eight data bits and an acknowledge bit
+#define START_STOP_BITS 2 // start and stop conditions, each about one bit time
+
+typedef struct
+{
+    int port;
+    i2c_address_t address;
+    fake_bus_handler_t handler;
+    void * device;
+    uint32_t fail_count;
+    esp_err_t fail_error;
+    fake_bus_counters_t counters;
+} attachment_t;
+
+static attachment_t _attachments[FAKE_BUS_MAX_DEVICES];
+static size_t _num_attachments = 0;
+static fake_bus_counters_t _port_counters[FAKE_BUS_MAX_PORTS];
+static pthread_mutex_t _port_mutex[FAKE_BUS_MAX_PORTS] = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER };
+static uint32_t _clock_hz = FAKE_BUS_DEFAULT_HZ;
+static fake_bus_monitor_t _monitor = NULL;
+static void * _monitor_context = NULL;
+
+static attachment_t * _find(const smbus_info_t * smbus_info)
+{
+    attachment_t * found = NULL;
+    for (size_t i = 0; smbus_info != NULL && i < _num_attachments; ++i)
+    {
+        if (_attachments[i].port == smbus_info->i2c_port && _attachments[i].address == smbus_info->address)
+        {
+            found = &_attachments[i];
+        }
+    }
+    return found;
+}
+
+static void _count(fake_bus_counters_t * counters, fake_bus_op_t op, uint32_t bytes, int64_t busy_us, esp_err_t err)
+{
+    ++counters->transactions;
+    ++counters->ops[op];
+    counters->bytes += bytes;
+    counters->busy_us += busy_us;
+    if (err != ESP_OK)
+    {
+        ++counters->errors;
+    }
+}
+
+// Perform a transaction with the bus held, charging the time it occupies the bus
+static esp_err_t _transfer(const smbus_info_t * smbus_info, fake_bus_op_t op, uint8_t command, uint8_t * data, uint8_t * len)
+{
+    esp_err_t err = ESP_FAIL;
+    int port = smbus_info != NULL && smbus_info->i2c_port >= 0 && smbus_info->i2c_port < FAKE_BUS_MAX_PORTS ? smbus_info->i2c_port : 0;
+    pthread_mutex_lock(&_port_mutex[port]);
+
+    uint8_t request = len != NULL ? *len : 0;
+    uint32_t bytes = fake_bus_transaction_bytes(op, request);
+    int64_t busy_us = _clock_hz > 0 ? (int64_t)(bytes * BITS_PER_BYTE + START_STOP_BITS) * 1000000 / _clock_hz : 0;
+    host_clock_advance_us(busy_us);
+    if (_monitor != NULL)
+    {
+        _monitor(_monitor_context, smbus_info, op, command);
+    }
+
+    attachment_t * attachment = _find(smbus_info);
+    if (attachment == NULL)
+    {
+        err = ESP_FAIL;  // address NACKed
+    }
+    else if (attachment->fail_count > 0)
+    {
+        --attachment->fail_count;
+        err = attachment->fail_error;
+    }
+    else
+    {
+        err = attachment->handler(attachment->device, op, command, data, len);
+    }
+
+    _count(&_port_counters[port], op, bytes, busy_us, err);
+    if (attachment != NULL)
+    {
+        _count(&attachment->counters, op, bytes, busy_us, err);
+    }
+    pthread_mutex_unlock(&_port_mutex[port]);
+    return err;
+}
+
+// Bus control
+
+void fake_bus_reset(void)
+{
+    memset(_attachments, 0, sizeof(_attachments));
+    _num_attachments = 0;
+    memset(_port_counters, 0, sizeof(_port_counters));
+    _clock_hz = FAKE_BUS_DEFAULT_HZ;
+    _monitor = NULL;
+    _monitor_context = NULL;
+}
+
+esp_err_t fake_bus_attach(smbus_info_t * smbus_info, i2c_port_t port, i2c_address_t address,
+                          fake_bus_handler_t handler, void * device)
+{
+    esp_err_t err = ESP_ERR_NO_MEM;
+    if (_num_attachments < FAKE_BUS_MAX_DEVICES && port >= 0 && port < FAKE_BUS_MAX_PORTS)
+    {
+        smbus_init(smbus_info, port, address);
+        attachment_t * attachment = &_attachments[_num_attachments++];
+        memset(attachment, 0, sizeof(*attachment));
+        attachment->port = port;
+        attachment->address = address;
+        attachment->handler = handler;
+        attachment->device = device;
+        err = ESP_OK;
+    }
+    return err;
+}
+
+void fake_bus_set_clock_hz(uint32_t hz)
+{
+    _clock_hz = hz;
+}
+
+void fake_bus_set_monitor(fake_bus_monitor_t monitor, void * context)
+{
+    _monitor = monitor;
+    _monitor_context = context;
+}
+
+void fake_bus_inject_faults(const smbus_info_t * smbus_info, uint32_t count, esp_err_t error)
+{
+    attachment_t * attachment = _find(smbus_info);
+    if (attachment != NULL)
+    {
+        attachment->fail_count = count;
+        attachment->fail_error = error;
+    }
+}
+
+fake_bus_counters_t fake_bus_port_counters(i2c_port_t port)
+{
+    fake_bus_counters_t counters = { 0 };
+    if (port >= 0 && port < FAKE_BUS_MAX_PORTS)
+    {
+        pthread_mutex_lock(&_port_mutex[port]);
+        counters = _port_counters[port];
+        pthread_mutex_unlock(&_port_mutex[port]);
+    }
+    return counters;
+}
+
+fake_bus_counters_t fake_bus_device_counters(const smbus_info_t * smbus_info)
+{
+    fake_bus_counters_t counters = { 0 };
+    attachment_t * attachment = _find(smbus_info);
+    if (attachment != NULL)
+    {
+        pthread_mutex_lock(&_port_mutex[attachment->port]);
+        counters = attachment->counters;
+        pthread_mutex_unlock(&_port_mutex[attachment->port]);
+    }
+    return counters;
+}
+
+uint32_t fake_bus_transaction_bytes(fake_bus_op_t op, uint8_t len)
+{
+    // address byte, then command byte, then for reads a repeated start and address byte
+    static const uint8_t overhead[] = {
+        [FAKE_BUS_SEND_BYTE] = 1,
+        [FAKE_BUS_WRITE_BYTE] = 2,
+        [FAKE_BUS_WRITE_WORD] = 2,
+        [FAKE_BUS_READ_BYTE] = 3,
+        [FAKE_BUS_READ_WORD] = 3,
+        [FAKE_BUS_WRITE_BLOCK] = 3,  // includes byte count
+        [FAKE_BUS_READ_BLOCK] = 4,   // includes byte count
+    };
+    static const uint8_t payload[] = {
+        [FAKE_BUS_SEND_BYTE] = 1,
+        [FAKE_BUS_WRITE_BYTE] = 1,
+        [FAKE_BUS_WRITE_WORD] = 2,
+        [FAKE_BUS_READ_BYTE] = 1,
+        [FAKE_BUS_READ_WORD] = 2,
+        [FAKE_BUS_WRITE_BLOCK] = 0,
+        [FAKE_BUS_READ_BLOCK] = 0,
+    };
+    uint32_t bytes = overhead[op] + payload[op];
+    if (op == FAKE_BUS_WRITE_BLOCK || op == FAKE_BUS_READ_BLOCK)
+    {
+        bytes += len;
+    }
+    return bytes;
+}
+
+// esp32-smbus interface
+
+esp_err_t smbus_init(smbus_info_t * smbus_info, i2c_port_t i2c_port, i2c_address_t address)
+{
+    esp_err_t err = ESP_FAIL;
+    if (smbus_info != NULL)
+    {
+        smbus_info->init = true;
+        smbus_info->i2c_port = i2c_port;
+        smbus_info->address = address;
+        smbus_info->timeout = 1000 / portTICK_PERIOD_MS;
+        err = ESP_OK;
+    }
+    return err;
+}
+
+esp_err_t smbus_send_byte(const smbus_info_t * smbus_info, uint8_t data)
+{
+    return _transfer(smbus_info, FAKE_BUS_SEND_BYTE, data, NULL, NULL);
+}
+
+esp_err_t smbus_write_byte(const smbus_info_t * smbus_info, uint8_t command, uint8_t data)
+{
+    return _transfer(smbus_info, FAKE_BUS_WRITE_BYTE, command, &data, NULL);
+}
+
+esp_err_t smbus_write_word(const smbus_info_t * smbus_info, uint8_t command, uint16_t data)
+{
+    uint8_t bytes[2] = { data & 0xff, data >> 8 };
+    return _transfer(smbus_info, FAKE_BUS_WRITE_WORD, command, bytes, NULL);
+}
+
+esp_err_t smbus_read_byte(const smbus_info_t * smbus_info, uint8_t command, uint8_t * data)
+{
+    return _transfer(smbus_info, FAKE_BUS_READ_BYTE, command, data, NULL);
+}
+
+esp_err_t smbus_read_word(const smbus_info_t * smbus_info, uint8_t command, uint16_t * data)
+{
+    uint8_t bytes[2] = { 0 };
+    esp_err_t err = _transfer(smbus_info, FAKE_BUS_READ_WORD, command, bytes, NULL);
+    if (err == ESP_OK)
+    {
+        *data = bytes[0] | (bytes[1] << 8);
+    }
+    return err;
+}
+
+esp_err_t smbus_write_block(const smbus_info_t * smbus_info, uint8_t command, uint8_t * data, uint8_t len)
+{
+    return _transfer(smbus_info, FAKE_BUS_WRITE_BLOCK, command, data, &len);
+}
+
+esp_err_t smbus_read_block(const smbus_info_t * smbus_info, uint8_t command, uint8_t * data, uint8_t * len)
+{
+    return _transfer(smbus_info, FAKE_BUS_READ_BLOCK, command, data, len);
+}
@@ -0,0 +1,135 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file fake_bus.h
+ * @brief Host implementation of the esp32-smbus interface, routing each transaction to an
+ *        emulated device attached at an I2C port and address.
+ *
+ * The bus counts transactions and bytes on the wire, can inject errors, and charges each
+ * transaction the time it would take at the configured bus clock rate, so that code under
+ * test which polls the bus still sees time advance.
+ */
+
+#ifndef FAKE_BUS_H
+#define FAKE_BUS_H
+
+#include <stdint.h>
+
+#include "smbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FAKE_BUS_MAX_PORTS      2     ///< Number of I2C ports
+#define FAKE_BUS_MAX_DEVICES    8     ///< Maximum number of attached devices, over all ports
+#define FAKE_BUS_DEFAULT_HZ     100000
+
+/**
+ * @brief Enum for SMBus protocols.
+ */
+typedef enum
+{
+    FAKE_BUS_SEND_BYTE = 0,
+    FAKE_BUS_WRITE_BYTE,
+    FAKE_BUS_WRITE_WORD,
+    FAKE_BUS_READ_BYTE,
+    FAKE_BUS_READ_WORD,
+    FAKE_BUS_WRITE_BLOCK,
+    FAKE_BUS_READ_BLOCK,
+} fake_bus_op_t;
+
+/**
+ * @brief Function handling a transaction addressed to a device.
+ *        For reads, data receives the bytes read; for block reads len is the buffer size on entry
+ *        and the number of bytes returned on exit. For writes, data holds the bytes written.
+ *        A device returns ESP_FAIL to NACK the transaction.
+ */
+typedef esp_err_t (*fake_bus_handler_t)(void * device, fake_bus_op_t op, uint8_t command, uint8_t * data, uint8_t * len);
+
+/**
+ * @brief Function called before each transaction is delivered, from the thread performing it.
+ */
+typedef void (*fake_bus_monitor_t)(void * context, const smbus_info_t * smbus_info, fake_bus_op_t op, uint8_t command);
+
+/**
+ * @brief Structure containing bus activity counts.
+ */
+typedef struct
+{
+    uint32_t transactions;   ///< Number of transactions
+    uint32_t bytes;          ///< Number of bytes on the wire, including address and count bytes
+    uint32_t errors;         ///< Number of transactions that failed
+    uint32_t ops[FAKE_BUS_READ_BLOCK + 1];  ///< Number of transactions per protocol
+    int64_t busy_us;         ///< Time the bus was occupied, in microseconds
+} fake_bus_counters_t;
+
+/**
+ * @brief Detach all devices, clear counters and injected faults, and restore the default clock rate.
+ */
+void fake_bus_reset(void);
+
+/**
+ * @brief Initialise an SMBus info instance and attach a device to it.
+ * @return ESP_OK if successful, ESP_ERR_NO_MEM if too many devices are attached.
+ */
+esp_err_t fake_bus_attach(smbus_info_t * smbus_info, i2c_port_t port, i2c_address_t address,
+                          fake_bus_handler_t handler, void * device);
+
+/**
+ * @brief Set the bus clock rate used to charge time for each transaction, or zero for instant transactions.
+ */
+void fake_bus_set_clock_hz(uint32_t hz);
+
+/**
+ * @brief Install a function to observe every transaction, or NULL to remove it. Cleared by fake_bus_reset().
+ */
+void fake_bus_set_monitor(fake_bus_monitor_t monitor, void * context);
+
+/**
+ * @brief Make the next count transactions addressed to the device fail with the given error, as if NACKed.
+ */
+void fake_bus_inject_faults(const smbus_info_t * smbus_info, uint32_t count, esp_err_t error);
+
+/**
+ * @brief Retrieve the activity counts of a port.
+ */
+fake_bus_counters_t fake_bus_port_counters(i2c_port_t port);
+
+/**
+ * @brief Retrieve the activity counts of the device attached to an SMBus info instance.
+ */
+fake_bus_counters_t fake_bus_device_counters(const smbus_info_t * smbus_info);
+
+/**
+ * @brief Number of bytes on the wire for a transaction, including address, command and count bytes.
+ */
+uint32_t fake_bus_transaction_bytes(fake_bus_op_t op, uint8_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // FAKE_BUS_H
@@ -0,0 +1,382 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file fake_tsl2561.c
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "host_clock.h"
+#include "fake_bus.h"
+#include "fake_tsl2561.h"
+
+#define REG_CONTROL        0x00
+#define REG_TIMING         0x01
+#define REG_THRESHLOWLOW   0x02
+#define REG_THRESHHIGHLOW  0x04
+#define REG_INTERRUPT      0x06
+#define REG_ID             0x0A
+#define REG_DATA0LOW       0x0C
+#define REG_DATA1LOW       0x0E
+
+#define COMMAND_CMD        0x80
+#define COMMAND_CLEAR      0x40
+#define COMMAND_BLOCK      0x10
+#define COMMAND_ADDRESS    0x0F
+
+#define TIMING_WRITABLE    0x1B
+#define TIMING_GAIN        0x10
+#define TIMING_MANUAL      0x08
+#define TIMING_INTEG       0x03
+#define INTEG_MANUAL       0x03
+
+#define MANUAL_REFERENCE_US 402155.0  // duration of the 322 oscillator cycles of a nominal 402 ms integration
+
+static fake_tsl2561_t * _devices[FAKE_BUS_MAX_DEVICES];
+static size_t _num_devices = 0;
+
+static void _power_on_reset(fake_tsl2561_t * device)
+{
+    memset(device->regs, 0, sizeof(device->regs));
+    device->regs[REG_TIMING] = 0x02;
+    device->powered = false;
+    device->interrupt = false;
+    device->persist_count = 0;
+    device->data_conversion = 0;
+}
+
+static void _update_all(int64_t now_us)
+{
+    (void)now_us;
+    for (size_t i = 0; i < _num_devices; ++i)
+    {
+        fake_tsl2561_update(_devices[i]);
+    }
+}
+
+static void _check_interrupt(fake_tsl2561_t * device, uint16_t ch0)
+{
+    uint8_t control = device->regs[REG_INTERRUPT];
+    if (((control >> 4) & 0x03) == 0x01)  // level interrupt
+    {
+        uint8_t persist = control & 0x0f;
+        bool fire = true;
+        if (persist > 0)
+        {
+            uint16_t low = device->regs[REG_THRESHLOWLOW] | (device->regs[REG_THRESHLOWLOW + 1] << 8);
+            uint16_t high = device->regs[REG_THRESHHIGHLOW] | (device->regs[REG_THRESHHIGHLOW + 1] << 8);
+            device->persist_count = (ch0 < low || ch0 > high) ? device->persist_count + 1 : 0;
+            fire = device->persist_count >= persist;
+        }
+
+        if (fire && !device->interrupt)
+        {
+            device->interrupt = true;
+            ++device->interrupts;
+            if (device->isr != NULL)
+            {
+                device->isr(device->isr_arg);
+            }
+        }
+    }
+}
+
+// Latch the result of an integration that ended at end_us into the DATA registers
+static void _complete(fake_tsl2561_t * device, int64_t start_us, int64_t end_us)
+{
+    double channel0 = device->channel0;
+    double channel1 = device->channel1;
+    if (device->light != NULL)
+    {
+        device->light(device->light_context, start_us + (end_us - start_us) / 2, &channel0, &channel1);
+    }
+
+    uint16_t ch0 = 0;
+    uint16_t ch1 = 0;
+    fake_tsl2561_counts(device->regs[REG_TIMING], end_us - start_us, channel0, channel1, &ch0, &ch1);
+    device->regs[REG_DATA0LOW] = ch0 & 0xff;
+    device->regs[REG_DATA0LOW + 1] = ch0 >> 8;
+    device->regs[REG_DATA1LOW] = ch1 & 0xff;
+    device->regs[REG_DATA1LOW + 1] = ch1 >> 8;
+    device->data_conversion = ++device->conversions;
+    _check_interrupt(device, ch0);
+}
+
+static void _write_register(fake_tsl2561_t * device, uint8_t reg, uint8_t value)
+{
+    int64_t now = esp_timer_get_time();
+    fake_tsl2561_update(device);
+    switch (reg)
+    {
+    case REG_CONTROL:
+    {
+        bool on = (value & 0x03) == 0x03;
+        device->regs[REG_CONTROL] = value & 0x03;
+        if (on && !device->powered)
+        {
+            // DATA is not valid until the first integration completes
+            device->powered = true;
+            device->cycle_start_us = now;
+            device->data_conversion = 0;
+            memset(&device->regs[REG_DATA0LOW], 0, 4);
+            ++device->power_ups;
+        }
+        device->powered = on;
+        break;
+    }
+    case REG_TIMING:
+    {
+        uint8_t previous = device->regs[REG_TIMING];
+        value &= TIMING_WRITABLE;
+        device->regs[REG_TIMING] = value;
+        if (device->powered)
+        {
+            if ((value & TIMING_INTEG) != INTEG_MANUAL)
+            {
+                // a new integration time or gain takes effect from a new cycle
+                if ((previous & (TIMING_INTEG | TIMING_GAIN)) != (value & (TIMING_INTEG | TIMING_GAIN)))
+                {
+                    device->cycle_start_us = now;
+                }
+            }
+            else if ((value & TIMING_MANUAL) && !(previous & TIMING_MANUAL))
+            {
+                device->manual_start_us = now;
+            }
+            else if (!(value & TIMING_MANUAL) && (previous & TIMING_MANUAL) && (previous & TIMING_INTEG) == INTEG_MANUAL)
+            {
+                device->manual_exposure_us = now - device->manual_start_us;
+                _complete(device, device->manual_start_us, now);
+            }
+        }
+        break;
+    }
+    case REG_INTERRUPT:
+        device->regs[REG_INTERRUPT] = value & 0x3f;
+        device->persist_count = 0;
+        break;
+    case REG_THRESHLOWLOW:
+    case REG_THRESHLOWLOW + 1:
+    case REG_THRESHHIGHLOW:
+    case REG_THRESHHIGHLOW + 1:
+        device->regs[reg] = value;
+        break;
+    default:
+        break;  // read-only or reserved
+    }
+}
+
+static uint8_t _read_register(fake_tsl2561_t * device, uint8_t reg)
+{
+    fake_tsl2561_update(device);
+    uint8_t value = device->regs[reg];
+    if (reg == REG_ID)
+    {
+        value = device->id;
+    }
+    else if (reg == REG_DATA0LOW)
+    {
+        ++device->data_reads;
+        if (device->data_conversion == 0)
+        {
+            ++device->premature_reads;
+        }
+        else if (device->data_conversion == device->last_read_conversion)
+        {
+            ++device->duplicate_reads;
+        }
+        device->last_read_conversion = device->data_conversion;
+    }
+    return value;
+}
+
+static esp_err_t _handler(void * context, fake_bus_op_t op, uint8_t command, uint8_t * data, uint8_t * len)
+{
+    fake_tsl2561_t * device = (fake_tsl2561_t *)context;
+    esp_err_t err = ESP_OK;
+    uint8_t reg = command & COMMAND_ADDRESS;
+    bool block = (command & COMMAND_BLOCK) != 0;
+
+    if (!(command & COMMAND_CMD))
+    {
+        err = ESP_FAIL;  // not a command, so the device does not acknowledge it
+    }
+    else if ((op == FAKE_BUS_WRITE_BLOCK || op == FAKE_BUS_READ_BLOCK) && (!block || !device->block_supported))
+    {
+        err = ESP_FAIL;
+    }
+    else
+    {
+        if (command & COMMAND_CLEAR)
+        {
+            device->interrupt = false;
+            device->persist_count = 0;
+        }
+
+        switch (op)
+        {
+        case FAKE_BUS_SEND_BYTE:
+            break;
+        case FAKE_BUS_WRITE_BYTE:
+            _write_register(device, reg, data[0]);
+            break;
+        case FAKE_BUS_WRITE_WORD:
+            _write_register(device, reg, data[0]);
+            _write_register(device, (reg + 1) & COMMAND_ADDRESS, data[1]);
+            break;
+        case FAKE_BUS_READ_BYTE:
+            data[0] = _read_register(device, reg);
+            break;
+        case FAKE_BUS_READ_WORD:
+            data[0] = _read_register(device, reg);
+            data[1] = _read_register(device, (reg + 1) & COMMAND_ADDRESS);
+            break;
+        case FAKE_BUS_WRITE_BLOCK:
+            for (uint8_t i = 0; i < *len && reg + i <= COMMAND_ADDRESS; ++i)
+            {
+                _write_register(device, reg + i, data[i]);
+            }
+            break;
+        case FAKE_BUS_READ_BLOCK:
+        {
+            uint8_t count = *len < COMMAND_ADDRESS + 1 - reg ? *len : COMMAND_ADDRESS + 1 - reg;
+            for (uint8_t i = 0; i < count; ++i)
+            {
+                data[i] = _read_register(device, reg + i);
+            }
+            *len = count;
+            break;
+        }
+        }
+    }
+    return err;
+}
+
+// Public API
+
+void fake_tsl2561_init(fake_tsl2561_t * device, uint8_t id)
+{
+    memset(device, 0, sizeof(*device));
+    device->id = id;
+    device->oscillator = 1.0;
+    device->block_supported = true;
+    _power_on_reset(device);
+}
+
+esp_err_t fake_tsl2561_attach(fake_tsl2561_t * device, smbus_info_t * smbus_info, i2c_port_t port, i2c_address_t address)
+{
+    esp_err_t err = fake_bus_attach(smbus_info, port, address, _handler, device);
+    if (err == ESP_OK)
+    {
+        if (_num_devices < FAKE_BUS_MAX_DEVICES)
+        {
+            _devices[_num_devices++] = device;
+        }
+        host_clock_set_hook(_update_all);
+    }
+    return err;
+}
+
+void fake_tsl2561_detach_all(void)
+{
+    _num_devices = 0;
+}
+
+void fake_tsl2561_set_light(fake_tsl2561_t * device, double channel0, double channel1)
+{
+    fake_tsl2561_update(device);
+    device->channel0 = channel0;
+    device->channel1 = channel1;
+}
+
+void fake_tsl2561_update(fake_tsl2561_t * device)
+{
+    int64_t period = (int64_t)(fake_tsl2561_period_us(device->regs[REG_TIMING]) * device->oscillator);
+    if (device->powered && period > 0)
+    {
+        int64_t now = esp_timer_get_time();
+        while (now >= device->cycle_start_us + period)
+        {
+            _complete(device, device->cycle_start_us, device->cycle_start_us + period);
+            device->cycle_start_us += period;
+        }
+    }
+}
+
+void fake_tsl2561_brown_out(fake_tsl2561_t * device)
+{
+    _power_on_reset(device);
+}
+
+void fake_tsl2561_response(uint8_t timing, int64_t duration_us, double * fraction, double * clip)
+{
+    // integration length relative to 402 ms, as a number of 322-cycle units, and the clipping level
+    *fraction = 0.0;
+    *clip = 65535.0;
+    switch (timing & TIMING_INTEG)
+    {
+    case 0:
+        *fraction = 11.0 / 322.0;
+        *clip = 5047.0;
+        break;
+    case 1:
+        *fraction = 81.0 / 322.0;
+        *clip = 37177.0;
+        break;
+    case 2:
+        *fraction = 1.0;
+        break;
+    default:
+        // the channel counters saturate at the same rate of counts per integration cycle as the 101 ms limit
+        *fraction = duration_us / MANUAL_REFERENCE_US;
+        *clip = fmin(37177.0 * *fraction * 322.0 / 81.0, 65535.0);
+        break;
+    }
+
+    if (!(timing & TIMING_GAIN))
+    {
+        *fraction /= 16.0;
+    }
+}
+
+void fake_tsl2561_counts(uint8_t timing, int64_t duration_us, double channel0, double channel1, uint16_t * ch0, uint16_t * ch1)
+{
+    double fraction = 0.0;
+    double clip = 0.0;
+    fake_tsl2561_response(timing, duration_us, &fraction, &clip);
+
+    double c0 = floor(channel0 * fraction);
+    double c1 = floor(channel1 * fraction);
+    *ch0 = (uint16_t)(c0 < 0.0 ? 0.0 : c0 > clip ? clip : c0);
+    *ch1 = (uint16_t)(c1 < 0.0 ? 0.0 : c1 > clip ? clip : c1);
+}
+
+int64_t fake_tsl2561_period_us(uint8_t timing)
+{
+    static const int64_t periods[] = { 13700, 101000, 402000, 0 };
+    return periods[timing & TIMING_INTEG];
+}
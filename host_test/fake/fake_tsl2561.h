@@ -0,0 +1,155 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file fake_tsl2561.h
+ * @brief Emulated TSL2561 register model for host tests.
+ *
+ * The model implements the command register protocol (byte, word and block transactions),
+ * the CONTROL, TIMING, threshold, INTERRUPT, ID and DATA registers, free-running ADC
+ * conversions at the selected integration time with channel clipping, manual integration,
+ * and the level interrupt with persistence. Illuminance is given as the channel counts that a
+ * 402 ms integration at 16x gain would produce, either constant or as a function of time.
+ */
+
+#ifndef FAKE_TSL2561_H
+#define FAKE_TSL2561_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "smbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FAKE_TSL2561_ID_TSL2560CS       0x00   ///< ID register value of a TSL2560CS, revision 0
+#define FAKE_TSL2561_ID_TSL2561CS       0x10   ///< ID register value of a TSL2561CS, revision 0
+#define FAKE_TSL2561_ID_TSL2560T_FN_CL  0x40   ///< ID register value of a TSL2560T/FN/CL, revision 0
+#define FAKE_TSL2561_ID_TSL2561T_FN_CL  0x50   ///< ID register value of a TSL2561T/FN/CL, revision 0
+
+/**
+ * @brief Function giving the illuminance at a point in time, as the channel counts of a
+ *        402 ms integration at 16x gain, before clipping.
+ */
+typedef void (*fake_tsl2561_light_t)(void * context, int64_t time_us, double * channel0, double * channel1);
+
+/**
+ * @brief Structure containing the state of an emulated device.
+ */
+typedef struct
+{
+    // configuration, may be changed by the test at any time
+    uint8_t id;                          ///< Value of the ID register
+    double channel0;                     ///< Constant illuminance on channel 0, if light is NULL
+    double channel1;                     ///< Constant illuminance on channel 1, if light is NULL
+    fake_tsl2561_light_t light;          ///< Illuminance as a function of time, or NULL
+    void * light_context;                ///< Context passed to light
+    double oscillator;                   ///< Ratio of actual to nominal integration time
+    bool block_supported;                ///< False to NACK block transactions
+    void (*isr)(void * arg);             ///< Called when the interrupt output is asserted, or NULL
+    void * isr_arg;                      ///< Argument passed to isr
+
+    // device state
+    uint8_t regs[16];                    ///< Register file
+    bool powered;                        ///< True if the device is powered up
+    int64_t cycle_start_us;              ///< Start of the current integration cycle
+    int64_t manual_start_us;             ///< Start of the current manual integration
+    int64_t manual_exposure_us;          ///< Duration of the last completed manual integration
+    uint8_t persist_count;               ///< Consecutive out-of-range conversions
+    bool interrupt;                      ///< True while the interrupt output is asserted
+
+    // observations
+    uint32_t conversions;                ///< Number of conversions completed
+    uint32_t data_conversion;            ///< Conversion number held in the DATA registers, zero if none since power up
+    uint32_t last_read_conversion;       ///< Conversion number returned by the previous DATA read
+    uint32_t data_reads;                 ///< Number of reads of DATA0LOW, including block reads
+    uint32_t premature_reads;            ///< Number of DATA reads with no conversion completed since power up
+    uint32_t duplicate_reads;            ///< Number of DATA reads returning the same conversion as the previous read
+    uint32_t power_ups;                  ///< Number of transitions to the powered state
+    uint32_t interrupts;                 ///< Number of times the interrupt output was asserted
+} fake_tsl2561_t;
+
+/**
+ * @brief Initialise an emulated device in its power-on state, with the given ID register value.
+ */
+void fake_tsl2561_init(fake_tsl2561_t * device, uint8_t id);
+
+/**
+ * @brief Attach an emulated device to the fake bus, initialising the SMBus info instance.
+ *        Attached devices are brought up to date whenever virtual time advances.
+ */
+esp_err_t fake_tsl2561_attach(fake_tsl2561_t * device, smbus_info_t * smbus_info, i2c_port_t port, i2c_address_t address);
+
+/**
+ * @brief Forget all attached devices. Call together with fake_bus_reset().
+ */
+void fake_tsl2561_detach_all(void);
+
+/**
+ * @brief Set a constant illuminance.
+ */
+void fake_tsl2561_set_light(fake_tsl2561_t * device, double channel0, double channel1);
+
+/**
+ * @brief Complete any conversions due by the current time.
+ */
+void fake_tsl2561_update(fake_tsl2561_t * device);
+
+/**
+ * @brief Return the device to its power-on state, as after a brown-out, keeping its configuration.
+ */
+void fake_tsl2561_brown_out(fake_tsl2561_t * device);
+
+/**
+ * @brief Response of the channels to illuminance for an integration.
+ * @param[in] timing TIMING register value.
+ * @param[in] duration_us Integration duration, used for manual integration.
+ * @param[out] fraction Counts per unit of illuminance, relative to 402 ms at 16x.
+ * @param[out] clip Channel count at which the integration saturates.
+ */
+void fake_tsl2561_response(uint8_t timing, int64_t duration_us, double * fraction, double * clip);
+
+/**
+ * @brief Channel counts the device would produce for an integration, after clipping.
+ * @param[in] timing TIMING register value.
+ * @param[in] duration_us Integration duration, used for manual integration.
+ * @param[in] channel0 Illuminance on channel 0, as counts for 402 ms at 16x.
+ * @param[in] channel1 Illuminance on channel 1, as counts for 402 ms at 16x.
+ * @param[out] ch0 Resulting channel 0 count.
+ * @param[out] ch1 Resulting channel 1 count.
+ */
+void fake_tsl2561_counts(uint8_t timing, int64_t duration_us, double channel0, double channel1, uint16_t * ch0, uint16_t * ch1);
+
+/**
+ * @brief Nominal period of a fixed integration, in microseconds, or zero for manual integration.
+ */
+int64_t fake_tsl2561_period_us(uint8_t timing);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // FAKE_TSL2561_H
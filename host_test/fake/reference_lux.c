@@ -0,0 +1,230 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file reference_lux.c
+ *
+ * A direct transcription of CalculateLux() from the TSL2561 datasheet, deliberately sharing no
+ * code or tables with the driver. Two departures from the printed listing:
+ *  - arithmetic is signed 64-bit, so the "prevent negative lux" test is effective;
+ *  - the fifth CS breakpoint is K5T, matching the reference implementations the driver follows.
+ */
+
+#include <math.h>
+#include <stdint.h>
+
+#include "reference_lux.h"
+
+#define LUX_SCALE      14      // scale by 2^14
+#define RATIO_SCALE    9       // scale ratio by 2^9
+#define CH_SCALE       10      // scale channel values by 2^10
+#define CHSCALE_TINT0  0x7517  // 322/11 * 2^CH_SCALE
+#define CHSCALE_TINT1  0x0fe7  // 322/81 * 2^CH_SCALE
+
+// T, FN and CL package coefficients
+#define K1T 0x0040
+#define B1T 0x01f2
+#define M1T 0x01be
+#define K2T 0x0080
+#define B2T 0x0214
+#define M2T 0x02d1
+#define K3T 0x00c0
+#define B3T 0x023f
+#define M3T 0x037b
+#define K4T 0x0100
+#define B4T 0x0270
+#define M4T 0x03fe
+#define K5T 0x0138
+#define B5T 0x016f
+#define M5T 0x01fc
+#define K6T 0x019a
+#define B6T 0x00d2
+#define M6T 0x00fb
+#define K7T 0x029a
+#define B7T 0x0018
+#define M7T 0x0012
+#define K8T 0x029a
+#define B8T 0x0000
+#define M8T 0x0000
+
+// CS package coefficients
+#define K1C 0x0043
+#define B1C 0x0204
+#define M1C 0x01ad
+#define K2C 0x0085
+#define B2C 0x0228
+#define M2C 0x02c1
+#define K3C 0x00c8
+#define B3C 0x0253
+#define M3C 0x0363
+#define K4C 0x010a
+#define B4C 0x0282
+#define M4C 0x03df
+#define K5C K5T
+#define B5C 0x0177
+#define M5C 0x01dd
+#define K6C 0x019a
+#define B6C 0x0101
+#define M6C 0x0127
+#define K7C 0x029a
+#define B7C 0x0037
+#define M7C 0x002b
+#define K8C 0x029a
+#define B8C 0x0000
+#define M8C 0x0000
+
+uint32_t reference_lux_scaled(unsigned gain, unsigned integration, uint32_t ch0, uint32_t ch1, int package)
+{
+    int64_t chScale;
+    int64_t channel1;
+    int64_t channel0;
+
+    switch (integration)
+    {
+    case 0:  // 13.7 msec
+        chScale = CHSCALE_TINT0;
+        break;
+    case 1:  // 101 msec
+        chScale = CHSCALE_TINT1;
+        break;
+    default: // assume no scaling
+        chScale = (1 << CH_SCALE);
+        break;
+    }
+
+    // scale if gain is NOT 16X
+    if (!gain)
+    {
+        chScale = chScale << 4;  // scale 1X to 16X
+    }
+
+    // scale the channel values
+    channel0 = (ch0 * chScale) >> CH_SCALE;
+    channel1 = (ch1 * chScale) >> CH_SCALE;
+
+    // find the ratio of the channel values (Channel1/Channel0)
+    // protect against divide by zero
+    int64_t ratio1 = 0;
+    if (channel0 != 0)
+    {
+        ratio1 = (channel1 << (RATIO_SCALE + 1)) / channel0;
+    }
+
+    // round the ratio value
+    int64_t ratio = (ratio1 + 1) >> 1;
+
+    // is ratio <= eachBreak ?
+    int64_t b = 0;
+    int64_t m = 0;
+    switch (package)
+    {
+    case REFERENCE_PACKAGE_T:
+        if ((ratio >= 0) && (ratio <= K1T))
+            {b=B1T; m=M1T;}
+        else if (ratio <= K2T)
+            {b=B2T; m=M2T;}
+        else if (ratio <= K3T)
+            {b=B3T; m=M3T;}
+        else if (ratio <= K4T)
+            {b=B4T; m=M4T;}
+        else if (ratio <= K5T)
+            {b=B5T; m=M5T;}
+        else if (ratio <= K6T)
+            {b=B6T; m=M6T;}
+        else if (ratio <= K7T)
+            {b=B7T; m=M7T;}
+        else if (ratio > K8T)
+            {b=B8T; m=M8T;}
+        break;
+    case REFERENCE_PACKAGE_CS:
+        if ((ratio >= 0) && (ratio <= K1C))
+            {b=B1C; m=M1C;}
+        else if (ratio <= K2C)
+            {b=B2C; m=M2C;}
+        else if (ratio <= K3C)
+            {b=B3C; m=M3C;}
+        else if (ratio <= K4C)
+            {b=B4C; m=M4C;}
+        else if (ratio <= K5C)
+            {b=B5C; m=M5C;}
+        else if (ratio <= K6C)
+            {b=B6C; m=M6C;}
+        else if (ratio <= K7C)
+            {b=B7C; m=M7C;}
+        else if (ratio > K8C)
+            {b=B8C; m=M8C;}
+        break;
+    default:
+        break;
+    }
+
+    int64_t temp = ((channel0 * b) - (channel1 * m));
+
+    // do not allow negative lux value
+    if (temp < 0)
+    {
+        temp = 0;
+    }
+    return (uint32_t)temp;
+}
+
+uint32_t reference_lux(unsigned gain, unsigned integration, uint32_t ch0, uint32_t ch1, int package)
+{
+    int64_t temp = reference_lux_scaled(gain, integration, ch0, ch1, package);
+
+    // round lsb (2^(LUX_SCALE-1))
+    temp += (1 << (LUX_SCALE - 1));
+
+    // strip off fractional portion
+    return (uint32_t)(temp >> LUX_SCALE);
+}
+
+double reference_lux_empirical(double ch0, double ch1, int package)
+{
+    double lux = 0.0;
+    double ratio = ch0 > 0.0 ? ch1 / ch0 : 0.0;
+    if (package == REFERENCE_PACKAGE_CS)
+    {
+        if (ratio <= 0.52)
+            lux = 0.0315 * ch0 - 0.0593 * ch0 * pow(ratio, 1.4);
+        else if (ratio <= 0.65)
+            lux = 0.0229 * ch0 - 0.0291 * ch1;
+        else if (ratio <= 0.80)
+            lux = 0.0157 * ch0 - 0.0180 * ch1;
+        else if (ratio <= 1.30)
+            lux = 0.00338 * ch0 - 0.00260 * ch1;
+    }
+    else
+    {
+        if (ratio <= 0.50)
+            lux = 0.0304 * ch0 - 0.062 * ch0 * pow(ratio, 1.4);
+        else if (ratio <= 0.61)
+            lux = 0.0224 * ch0 - 0.031 * ch1;
+        else if (ratio <= 0.80)
+            lux = 0.0128 * ch0 - 0.0153 * ch1;
+        else if (ratio <= 1.30)
+            lux = 0.00146 * ch0 - 0.00112 * ch1;
+    }
+    return lux > 0.0 ? lux : 0.0;
+}
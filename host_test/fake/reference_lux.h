@@ -0,0 +1,70 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file reference_lux.h
+ * @brief Independent implementation of the Lux approximation, for comparison with the driver.
+ */
+
+#ifndef REFERENCE_LUX_H
+#define REFERENCE_LUX_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REFERENCE_PACKAGE_T  0   ///< T, FN and CL package coefficients
+#define REFERENCE_PACKAGE_CS 1   ///< CS package coefficients
+
+/**
+ * @brief Lux approximation before final rounding, with 14 fractional bits, following the
+ *        CalculateLux() procedure in the TSL2561 datasheet, computed with 64-bit signed arithmetic.
+ * @param[in] gain 0 for 1x, 1 for 16x.
+ * @param[in] integration 0 for 13.7 ms, 1 for 101 ms, 2 for 402 ms.
+ * @param[in] ch0 Channel 0 count.
+ * @param[in] ch1 Channel 1 count.
+ * @param[in] package REFERENCE_PACKAGE_T or REFERENCE_PACKAGE_CS.
+ */
+uint32_t reference_lux_scaled(unsigned gain, unsigned integration, uint32_t ch0, uint32_t ch1, int package);
+
+/**
+ * @brief Lux approximation, rounded to the nearest Lux, as per CalculateLux().
+ */
+uint32_t reference_lux(unsigned gain, unsigned integration, uint32_t ch0, uint32_t ch1, int package);
+
+/**
+ * @brief The empirical formula from the datasheet that CalculateLux() approximates, in floating point.
+ * @param[in] ch0 Channel 0, normalised to a 402 ms integration at 16x gain.
+ * @param[in] ch1 Channel 1, normalised to a 402 ms integration at 16x gain.
+ * @param[in] package REFERENCE_PACKAGE_T or REFERENCE_PACKAGE_CS.
+ */
+double reference_lux_empirical(double ch0, double ch1, int package);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // REFERENCE_LUX_H
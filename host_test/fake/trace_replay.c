@@ -0,0 +1,328 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file trace_replay.c
+ */
+
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace_replay.h"
+
+#define REG_TIMING       0x01
+#define REG_ID           0x0A
+#define REG_DATA0LOW     0x0C
+#define REG_DATA1LOW     0x0E
+
+#define TIMING_INTEG     0x03
+#define INTEG_MANUAL     0x03
+#define POWER_ON_TIMING  0x02
+#define DEFAULT_ID       0x50
+
+#define PI 3.14159265358979323846
+
+// Ranges a synthesized field device chooses from, ordered from least to most sensitive
+static const uint8_t FIELD_RANGES[] = { 0x00, 0x01, 0x10, 0x02, 0x11, 0x12 };
+
+#define FIELD_INTERVAL_US 1000000
+#define FIELD_HEADROOM    0.75    // fraction of the clipping level a field device aims to stay below
+
+static void _rewind(trace_replay_t * replay)
+{
+    replay->cursor = 0;
+    replay->timing = POWER_ON_TIMING;
+    replay->have_sample = false;
+    replay->query_us = 0;
+}
+
+esp_err_t trace_replay_open(trace_replay_t * replay, const char * path)
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    memset(replay, 0, sizeof(*replay));
+
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(trace_header_t))
+    {
+        void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            const trace_header_t * header = (const trace_header_t *)map;
+            size_t size = st.st_size - sizeof(trace_header_t);
+            if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0)
+            {
+                err = ESP_ERR_INVALID_ARG;
+            }
+            else if (header->version != TRACE_VERSION || header->record_size != sizeof(trace_record_t))
+            {
+                err = ESP_ERR_INVALID_VERSION;
+            }
+            else if (size % sizeof(trace_record_t) != 0)
+            {
+                err = ESP_ERR_INVALID_ARG;
+            }
+            else
+            {
+                madvise(map, st.st_size, MADV_SEQUENTIAL);
+                replay->map = map;
+                replay->map_size = st.st_size;
+                replay->records = (const trace_record_t *)((const uint8_t *)map + sizeof(trace_header_t));
+                replay->count = size / sizeof(trace_record_t);
+                replay->origin_us = replay->count > 0 ? replay->records[0].time_us : 0;
+                replay->id = DEFAULT_ID;
+                err = ESP_OK;
+            }
+
+            if (err != ESP_OK)
+            {
+                munmap(map, st.st_size);
+            }
+        }
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+
+    if (err == ESP_OK)
+    {
+        // the first ID read identifies the device
+        bool id_found = false;
+        for (size_t i = 0; i < replay->count && !id_found; ++i)
+        {
+            const trace_record_t * record = &replay->records[i];
+            id_found = record->op == TRACE_READ && record->reg == REG_ID;
+            replay->id = id_found ? (uint8_t)record->value : replay->id;
+        }
+
+        size_t cursor = 0;
+        uint8_t timing = POWER_ON_TIMING;
+        trace_sample_t sample;
+        while (trace_replay_next_sample(replay, &cursor, &timing, &sample))
+        {
+            ++replay->samples;
+            replay->duration_us = sample.time_us;
+        }
+        _rewind(replay);
+    }
+    return err;
+}
+
+void trace_replay_close(trace_replay_t * replay)
+{
+    if (replay->map != NULL)
+    {
+        munmap(replay->map, replay->map_size);
+    }
+    memset(replay, 0, sizeof(*replay));
+}
+
+void trace_replay_attach(trace_replay_t * replay, fake_tsl2561_t * device)
+{
+    _rewind(replay);
+    device->id = replay->id;
+    device->light = trace_replay_light;
+    device->light_context = replay;
+}
+
+bool trace_replay_next_sample(const trace_replay_t * replay, size_t * cursor, uint8_t * timing, trace_sample_t * sample)
+{
+    bool found = false;
+    bool have_ch0 = false;
+    uint16_t ch0 = 0;
+    while (!found && *cursor < replay->count)
+    {
+        const trace_record_t * record = &replay->records[(*cursor)++];
+        if (record->op == TRACE_WRITE && record->reg == REG_TIMING)
+        {
+            // a range change between the reads of a sample leaves its range uncertain
+            *timing = (uint8_t)record->value;
+            have_ch0 = false;
+        }
+        else if (record->op == TRACE_READ && record->reg == REG_DATA0LOW)
+        {
+            ch0 = record->value;
+            have_ch0 = true;
+        }
+        else if (record->op == TRACE_READ && record->reg == REG_DATA1LOW && have_ch0)
+        {
+            have_ch0 = false;
+            if ((*timing & TIMING_INTEG) != INTEG_MANUAL)
+            {
+                sample->time_us = record->time_us - replay->origin_us;
+                sample->timing = *timing;
+                sample->ch0 = ch0;
+                sample->ch1 = record->value;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+void trace_replay_light(void * context, int64_t time_us, double * channel0, double * channel1)
+{
+    trace_replay_t * replay = (trace_replay_t *)context;
+    if (time_us < replay->query_us)
+    {
+        _rewind(replay);
+    }
+    replay->query_us = time_us;
+
+    // the sample to replay is the first whose integration ends at or after the query
+    trace_sample_t next;
+    while ((!replay->have_sample || replay->sample.time_us < time_us)
+           && trace_replay_next_sample(replay, &replay->cursor, &replay->timing, &next))
+    {
+        replay->sample = next;
+        replay->have_sample = true;
+    }
+
+    *channel0 = 0.0;
+    *channel1 = 0.0;
+    if (replay->have_sample)
+    {
+        // the middle of the illuminance interval that gives the recorded count
+        double fraction = 0.0;
+        double clip = 0.0;
+        fake_tsl2561_response(replay->sample.timing, 0, &fraction, &clip);
+        *channel0 = (replay->sample.ch0 + 0.5) / fraction;
+        *channel1 = (replay->sample.ch1 + 0.5) / fraction;
+    }
+}
+
+esp_err_t trace_writer_open(trace_writer_t * writer, const char * path)
+{
+    esp_err_t err = ESP_FAIL;
+    memset(writer, 0, sizeof(*writer));
+    writer->timing = POWER_ON_TIMING;
+    writer->file = fopen(path, "wb");
+    if (writer->file != NULL)
+    {
+        trace_header_t header = { .version = TRACE_VERSION, .record_size = sizeof(trace_record_t) };
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        err = fwrite(&header, sizeof(header), 1, writer->file) == 1 ? ESP_OK : ESP_FAIL;
+    }
+    return err;
+}
+
+esp_err_t trace_writer_append(trace_writer_t * writer, int64_t time_us, trace_op_t op, uint8_t reg, uint16_t value)
+{
+    trace_record_t record = { .time_us = time_us, .op = op, .reg = reg, .value = value };
+    esp_err_t err = fwrite(&record, sizeof(record), 1, writer->file) == 1 ? ESP_OK : ESP_FAIL;
+    writer->records += err == ESP_OK;
+    return err;
+}
+
+esp_err_t trace_writer_sample(trace_writer_t * writer, int64_t time_us, uint8_t timing, uint16_t ch0, uint16_t ch1)
+{
+    esp_err_t err = ESP_OK;
+    if (timing != writer->timing)
+    {
+        // written when the measurement started, at least one integration before the data is read
+        err = trace_writer_append(writer, time_us - fake_tsl2561_period_us(timing) - 1000, TRACE_WRITE, REG_TIMING, timing);
+        writer->timing = timing;
+    }
+
+    // the word reads take about 600 us each at 100 kHz
+    if (err == ESP_OK && (err = trace_writer_append(writer, time_us - 600, TRACE_READ, REG_DATA0LOW, ch0)) == ESP_OK)
+    {
+        err = trace_writer_append(writer, time_us, TRACE_READ, REG_DATA1LOW, ch1);
+    }
+    return err;
+}
+
+esp_err_t trace_writer_close(trace_writer_t * writer)
+{
+    esp_err_t err = ESP_FAIL;
+    if (writer->file != NULL)
+    {
+        err = fclose(writer->file) == 0 ? ESP_OK : ESP_FAIL;
+        writer->file = NULL;
+    }
+    return err;
+}
+
+esp_err_t trace_synthesize(const char * path, uint8_t id, fake_tsl2561_light_t light, void * context, int64_t duration_us)
+{
+    trace_writer_t writer;
+    esp_err_t err = trace_writer_open(&writer, path);
+    if (err == ESP_OK)
+    {
+        err = trace_writer_append(&writer, 0, TRACE_READ, REG_ID, id);
+
+        size_t range = 3;  // power-on range, 402 ms at 1x
+        for (int64_t start = FIELD_INTERVAL_US; err == ESP_OK && start + FIELD_INTERVAL_US <= duration_us; start += FIELD_INTERVAL_US)
+        {
+            uint8_t timing = FIELD_RANGES[range];
+            int64_t period = fake_tsl2561_period_us(timing);
+            double channel0 = 0.0;
+            double channel1 = 0.0;
+            light(context, start + period / 2, &channel0, &channel1);
+
+            uint16_t ch0 = 0;
+            uint16_t ch1 = 0;
+            fake_tsl2561_counts(timing, period, channel0, channel1, &ch0, &ch1);
+            err = trace_writer_sample(&writer, start + period + 1000, timing, ch0, ch1);
+
+            // the next sample uses the most sensitive range this one shows will not saturate
+            double fraction = 0.0;
+            double clip = 0.0;
+            fake_tsl2561_response(timing, period, &fraction, &clip);
+            double level = (ch0 + 0.5) / fraction;
+            range = 0;
+            for (size_t r = 0; r < sizeof(FIELD_RANGES) / sizeof(FIELD_RANGES[0]); ++r)
+            {
+                fake_tsl2561_response(FIELD_RANGES[r], 0, &fraction, &clip);
+                range = level * fraction < clip * FIELD_HEADROOM ? r : range;
+            }
+        }
+
+        esp_err_t close_err = trace_writer_close(&writer);
+        err = err == ESP_OK ? close_err : err;
+    }
+    return err;
+}
+
+void trace_daylight(void * context, int64_t time_us, double * channel0, double * channel1)
+{
+    (void)context;
+    double hours = fmod(time_us / 3600e6, 24.0);
+    double sun = hours > 6.0 && hours < 18.0 ? sin(PI * (hours - 6.0) / 12.0) : 0.0;
+
+    // passing clouds attenuate the sun by up to three quarters, over seconds to minutes
+    double seconds = time_us / 1e6;
+    double cover = 0.5 + 0.25 * sin(seconds / 97.0) + 0.15 * sin(seconds / 23.0 + 1.0) + 0.1 * sin(seconds / 7.0 + 2.0);
+    double daylight = 1.2e6 * pow(sun, 1.5) * (1.0 - 0.75 * cover);
+
+    // a dim night, richer in infrared
+    const double night = 20.0;
+    *channel0 = night + daylight;
+    *channel1 = 0.6 * night + 0.25 * daylight;
+}
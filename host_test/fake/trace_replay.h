@@ -0,0 +1,207 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file trace_replay.h
+ * @brief Replay of a recorded register-level TSL2561 trace, for running the driver against field data.
+ *
+ * A trace is a file of fixed-size records of the register accesses made in the field: the ID read,
+ * TIMING writes and DATA0/DATA1 word reads, each with its time in microseconds. The file is
+ * memory-mapped and read in place. Each DATA0 and DATA1 read pair is a sample of the illuminance
+ * over the integration that ended before it, in the range set by the preceding TIMING write.
+ *
+ * The driver under test chooses its own ranges and timing, so its transactions cannot be answered
+ * from the recording directly. Instead the trace becomes the light source of an emulated device,
+ * and the driver runs against it in virtual time, as fast as the host allows: each integration
+ * returns the counts of the recorded sample whose integration covers its midpoint, rescaled to
+ * the driver's range. In the recorded range the recorded counts are reproduced exactly. Saturated
+ * recorded counts replay as the least illuminance that saturates that range, and samples taken
+ * with manual integration are skipped.
+ *
+ * Records are in host byte order.
+ */
+
+#ifndef TRACE_REPLAY_H
+#define TRACE_REPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "fake_tsl2561.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACE_MAGIC    "TSLTRACE"   ///< First eight bytes of a trace file
+#define TRACE_VERSION  1            ///< Supported trace format version
+
+/**
+ * @brief Structure of the header at the start of a trace file.
+ */
+typedef struct
+{
+    char magic[8];           ///< TRACE_MAGIC, not terminated
+    uint32_t version;        ///< TRACE_VERSION
+    uint32_t record_size;    ///< Size of each record, sizeof(trace_record_t)
+} trace_header_t;
+
+/**
+ * @brief Enum for recorded register accesses.
+ */
+typedef enum
+{
+    TRACE_READ = 0,          ///< Byte or word read of the register
+    TRACE_WRITE,             ///< Byte write to the register
+} trace_op_t;
+
+/**
+ * @brief Structure of a recorded register access.
+ */
+typedef struct
+{
+    int64_t time_us;         ///< Time of the access, in microseconds from an arbitrary origin
+    uint8_t op;              ///< Access, as trace_op_t
+    uint8_t reg;             ///< Register address
+    uint16_t value;          ///< Byte written or read, or word read
+    uint32_t reserved;       ///< Zero
+} trace_record_t;
+
+/**
+ * @brief Structure containing a recorded sample of the channels.
+ */
+typedef struct
+{
+    int64_t time_us;         ///< Time of the DATA1 read, after the end of the integration
+    uint8_t timing;          ///< TIMING register value in effect
+    uint16_t ch0;            ///< Channel 0 count
+    uint16_t ch1;            ///< Channel 1 count
+} trace_sample_t;
+
+/**
+ * @brief Structure containing a mapped trace and the state of its replay.
+ */
+typedef struct
+{
+    void * map;                      ///< Mapping of the trace file
+    size_t map_size;                 ///< Size of the mapping, in bytes
+    const trace_record_t * records;  ///< Records in the mapping
+    size_t count;                    ///< Number of records
+    uint8_t id;                      ///< ID register value recorded, or that of a TSL2561T/FN/CL if none
+    int64_t origin_us;               ///< Trace time of the first record, which replays at virtual time zero
+    int64_t duration_us;             ///< Trace time from the origin to the last sample
+    size_t samples;                  ///< Number of samples in the trace
+
+    // light source state, advanced as virtual time passes
+    size_t cursor;                   ///< Position of the next record to scan
+    uint8_t timing;                  ///< TIMING register value in effect at the cursor
+    bool have_sample;                ///< True if sample is valid
+    trace_sample_t sample;           ///< First sample ending at or after the latest query
+    int64_t query_us;                ///< Trace time of the latest query
+} trace_replay_t;
+
+/**
+ * @brief Structure containing the state of a trace being written.
+ */
+typedef struct
+{
+    FILE * file;             ///< Trace file
+    uint8_t timing;          ///< TIMING register value last written to the trace
+    uint32_t records;        ///< Number of records written
+} trace_writer_t;
+
+/**
+ * @brief Map a trace file and scan it for its ID, duration and number of samples.
+ * @return ESP_OK if successful, ESP_ERR_NOT_FOUND if the file cannot be opened or mapped,
+ *         ESP_ERR_INVALID_ARG if it is not a trace, ESP_ERR_INVALID_VERSION if the format is not supported.
+ */
+esp_err_t trace_replay_open(trace_replay_t * replay, const char * path);
+
+/**
+ * @brief Unmap a trace.
+ */
+void trace_replay_close(trace_replay_t * replay);
+
+/**
+ * @brief Make a trace the light source and ID of an emulated device, and replay it from virtual time zero.
+ *        Call before the driver is initialised.
+ */
+void trace_replay_attach(trace_replay_t * replay, fake_tsl2561_t * device);
+
+/**
+ * @brief Light source function replaying a trace, for fake_tsl2561_t.light with the trace as context.
+ */
+void trace_replay_light(void * context, int64_t time_us, double * channel0, double * channel1);
+
+/**
+ * @brief Retrieve the next sample of a trace.
+ * @param[in] replay Pointer to an open trace.
+ * @param[in,out] cursor Position in the trace, zero to start from the beginning.
+ * @param[in,out] timing TIMING register value in effect at the cursor, 0x02 at the beginning.
+ * @param[out] sample The next sample, with its time relative to the origin.
+ * @return True if a sample was found, false at the end of the trace.
+ */
+bool trace_replay_next_sample(const trace_replay_t * replay, size_t * cursor, uint8_t * timing, trace_sample_t * sample);
+
+/**
+ * @brief Create a trace file, truncating any existing file.
+ * @return ESP_OK if successful, ESP_FAIL if the file cannot be written.
+ */
+esp_err_t trace_writer_open(trace_writer_t * writer, const char * path);
+
+/**
+ * @brief Append a register access to a trace.
+ */
+esp_err_t trace_writer_append(trace_writer_t * writer, int64_t time_us, trace_op_t op, uint8_t reg, uint16_t value);
+
+/**
+ * @brief Append the accesses of a sample: a TIMING write if the range changed, then DATA0 and DATA1 reads.
+ */
+esp_err_t trace_writer_sample(trace_writer_t * writer, int64_t time_us, uint8_t timing, uint16_t ch0, uint16_t ch1);
+
+/**
+ * @brief Complete a trace file.
+ */
+esp_err_t trace_writer_close(trace_writer_t * writer);
+
+/**
+ * @brief Write a trace of a field device sampling the given light source once a second for the given
+ *        duration. The device takes one-shot measurements, choosing for each the most sensitive range
+ *        that the previous sample shows will not saturate, as a simple application would.
+ * @return ESP_OK if successful, ESP_FAIL if the file cannot be written.
+ */
+esp_err_t trace_synthesize(const char * path, uint8_t id, fake_tsl2561_light_t light, void * context, int64_t duration_us);
+
+/**
+ * @brief Light source function giving a day of outdoor light from midnight, with dawn at 06:00, dusk at 18:00,
+ *        passing clouds and a dim night. The context is unused.
+ */
+void trace_daylight(void * context, int64_t time_us, double * channel0, double * channel1);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // TRACE_REPLAY_H
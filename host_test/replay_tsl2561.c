@@ -0,0 +1,272 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file replay_tsl2561.c
+ * @brief Replay of a recorded register-level trace through the driver, faster than real time.
+ *
+ *   replay_tsl2561 [--quick] [--strategy fixed|auto|filter] [--lux <csv>] [<trace>]
+ *
+ * The trace is the light source of an emulated device, and the driver samples it in virtual time
+ * with one of three strategies: a one-shot read each second in a fixed 101 ms, 1x range; a one-shot
+ * read each second with auto-ranging; and continuous acquisition with auto-ranging, taking the median
+ * of the next five conversions each second. Without a strategy, each is run in turn.
+ *
+ * For each strategy the number of results, virtual and host time, bus transactions per result, the
+ * time-weighted mean Lux and a hash of the Lux series are reported, and with --lux the series is written as
+ * "time_s,lux" lines, with the time at the end of the integration. Without a trace, a day of outdoor
+ * light sampled once a second is synthesized, or with --quick an hour across dawn.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "trace_replay.h"
+#include "tsl2561_filter.h"
+#include "test_util.h"
+
+#define READ_PERIOD_US   1000000
+#define FILTER_SAMPLES   5
+#define FNV_OFFSET       2166136261u
+#define FNV_PRIME        16777619u
+
+#define QUICK_START_US   (int64_t)(5.75 * 3600e6)   // 05:45, a quarter of an hour before dawn
+#define QUICK_DURATION_US  (int64_t)3600e6
+#define DAY_DURATION_US    (int64_t)86400e6
+
+typedef enum
+{
+    STRATEGY_FIXED = 0,
+    STRATEGY_AUTO,
+    STRATEGY_FILTER,
+    STRATEGY_ALL,
+} strategy_t;
+
+static const char * _strategy_names[] = { "fixed", "auto", "filter" };
+
+// Outdoor light from the given offset into the day
+static void _shifted_daylight(void * context, int64_t time_us, double * channel0, double * channel1)
+{
+    trace_daylight(NULL, time_us + *(const int64_t *)context, channel0, channel1);
+}
+
+static esp_err_t _read(strategy_t strategy, tsl2561_info_t * info, tsl2561_filter_t * filter, TickType_t * wake,
+                       tsl2561_visible_t * visible, tsl2561_infrared_t * infrared)
+{
+    esp_err_t err = ESP_FAIL;
+    if (strategy == STRATEGY_FILTER)
+    {
+        // the device converts continuously, and the application takes a result each period
+        vTaskDelayUntil(wake, READ_PERIOD_US / 1000 / portTICK_RATE_MS);
+        err = tsl2561_filter_read(filter, info, FILTER_SAMPLES, visible, infrared);
+    }
+    else
+    {
+        err = tsl2561_read_periodic(info, wake, READ_PERIOD_US / 1000 / portTICK_RATE_MS, visible, infrared);
+    }
+    return err;
+}
+
+static void _replay(trace_replay_t * replay, strategy_t strategy, FILE * lux_file)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    tsl2561_filter_t filter;
+    test_attach(&device, &smbus_info, replay->id);
+    trace_replay_attach(replay, &device);
+
+    esp_err_t err = tsl2561_init(&info, &smbus_info);
+    if (err == ESP_OK && strategy == STRATEGY_FIXED)
+    {
+        err = tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_1X);
+    }
+    else if (err == ESP_OK)
+    {
+        err = tsl2561_set_auto_range(&info, true);
+    }
+    if (err == ESP_OK && strategy == STRATEGY_FILTER)
+    {
+        err = tsl2561_filter_init(&filter, TSL2561_FILTER_MEDIAN, FILTER_SAMPLES);
+        err = err == ESP_OK ? tsl2561_start_continuous(&info) : err;
+    }
+    if (err != ESP_OK)
+    {
+        printf("replay %-6s: set-up failed (%d)\n", _strategy_names[strategy], err);
+        return;
+    }
+
+    uint32_t results = 0;
+    uint32_t failed = 0;
+    uint32_t hash = FNV_OFFSET;
+    double lux_sum = 0.0;
+    int64_t previous_us = esp_timer_get_time();
+    fake_bus_counters_t before = fake_bus_device_counters(&smbus_info);
+    TickType_t wake = xTaskGetTickCount();
+    int64_t start = test_wall_ns();
+    while (esp_timer_get_time() < replay->duration_us)
+    {
+        tsl2561_visible_t visible = 0;
+        tsl2561_infrared_t infrared = 0;
+        if (_read(strategy, &info, &filter, &wake, &visible, &infrared) != ESP_OK)
+        {
+            ++failed;
+            continue;
+        }
+
+        uint32_t lux = tsl2561_compute_lux(&info, visible, infrared);
+        for (int i = 0; i < 4; ++i)
+        {
+            hash = (hash ^ ((lux >> (8 * i)) & 0xff)) * FNV_PRIME;
+        }
+        // weighted by the time since the previous result, as strategies differ in their rate of results
+        lux_sum += (double)lux * (esp_timer_get_time() - previous_us);
+        previous_us = esp_timer_get_time();
+        ++results;
+
+        if (lux_file != NULL)
+        {
+            int64_t start_us = 0;
+            int64_t end_us = 0;
+            tsl2561_get_result_timestamps(&info, &start_us, &end_us);
+            fprintf(lux_file, "%.3f,%u\n", end_us / 1e6, lux);
+        }
+    }
+    int64_t elapsed = test_wall_ns() - start;
+    fake_bus_counters_t after = fake_bus_device_counters(&smbus_info);
+    if (strategy == STRATEGY_FILTER)
+    {
+        tsl2561_stop_measurement(&info);
+    }
+
+    double hours = esp_timer_get_time() / 3600e6;
+    printf("replay %-6s: %u results over %.2f h, %u failed, %.2f transactions/result, %.3f s host, %.0fx real time, mean %.1f lux, series hash %08x\n",
+           _strategy_names[strategy], results, hours, failed,
+           results ? (double)(after.transactions - before.transactions) / results : 0.0,
+           elapsed / 1e9, esp_timer_get_time() * 1e3 / (elapsed > 0 ? elapsed : 1),
+           previous_us > 0 ? lux_sum / previous_us : 0.0, hash);
+}
+
+int main(int argc, char ** argv)
+{
+    bool quick = false;
+    strategy_t strategy = STRATEGY_ALL;
+    const char * lux_path = NULL;
+    const char * trace_path = NULL;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--quick") == 0)
+        {
+            quick = true;
+        }
+        else if (strcmp(argv[i], "--strategy") == 0 && i + 1 < argc)
+        {
+            const char * name = argv[++i];
+            strategy = STRATEGY_ALL + 1;
+            for (int s = STRATEGY_FIXED; s < STRATEGY_ALL; ++s)
+            {
+                strategy = strcmp(name, _strategy_names[s]) == 0 ? (strategy_t)s : strategy;
+            }
+        }
+        else if (strcmp(argv[i], "--lux") == 0 && i + 1 < argc)
+        {
+            lux_path = argv[++i];
+        }
+        else if (argv[i][0] != '-' && trace_path == NULL)
+        {
+            trace_path = argv[i];
+        }
+        else
+        {
+            strategy = STRATEGY_ALL + 1;
+        }
+    }
+    if (strategy > STRATEGY_ALL)
+    {
+        fprintf(stderr, "usage: %s [--quick] [--strategy fixed|auto|filter] [--lux <csv>] [<trace>]\n", argv[0]);
+        return 2;
+    }
+
+    // without a trace, synthesize one from the model of outdoor light
+    char synthesized[] = "/tmp/tsl2561_traceXXXXXX";
+    if (trace_path == NULL)
+    {
+        int fd = mkstemp(synthesized);
+        if (fd < 0)
+        {
+            perror("mkstemp");
+            return 1;
+        }
+        close(fd);
+        trace_path = synthesized;
+
+        int64_t offset = quick ? QUICK_START_US : 0;
+        int64_t duration = quick ? QUICK_DURATION_US : DAY_DURATION_US;
+        int64_t start = test_wall_ns();
+        if (trace_synthesize(trace_path, FAKE_TSL2561_ID_TSL2561T_FN_CL, _shifted_daylight, &offset, duration) != ESP_OK)
+        {
+            fprintf(stderr, "cannot write trace %s\n", trace_path);
+            unlink(synthesized);
+            return 1;
+        }
+        printf("synthesized %.2f h of outdoor light in %.3f s\n", duration / 3600e6, (test_wall_ns() - start) / 1e9);
+    }
+
+    trace_replay_t replay;
+    esp_err_t err = trace_replay_open(&replay, trace_path);
+    if (trace_path == synthesized)
+    {
+        unlink(synthesized);  // the mapping stays valid
+    }
+    if (err != ESP_OK)
+    {
+        fprintf(stderr, "cannot replay trace %s (%d)\n", trace_path, err);
+        return 1;
+    }
+    printf("trace: %zu records, %zu samples over %.2f h, ID 0x%02x\n",
+           replay.count, replay.samples, replay.duration_us / 3600e6, replay.id);
+
+    FILE * lux_file = NULL;
+    if (lux_path != NULL && (lux_file = fopen(lux_path, "w")) == NULL)
+    {
+        perror(lux_path);
+        trace_replay_close(&replay);
+        return 1;
+    }
+
+    for (int s = STRATEGY_FIXED; s < STRATEGY_ALL; ++s)
+    {
+        if (strategy == STRATEGY_ALL || strategy == (strategy_t)s)
+        {
+            _replay(&replay, (strategy_t)s, lux_file);
+        }
+    }
+
+    if (lux_file != NULL)
+    {
+        fclose(lux_file);
+    }
+    trace_replay_close(&replay);
+    return 0;
+}
@@ -0,0 +1,323 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file host_clock.c
+ * @brief Host implementation of the FreeRTOS, esp_timer and ROM delay functions used by the
+ *        TSL2561 component, driven by a virtual or real-time clock.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "rom/ets_sys.h"
+
+#include "host_clock.h"
+
+bool host_log_quiet = false;
+
+struct host_semaphore
+{
+    pthread_mutex_t mutex;
+};
+
+struct host_task
+{
+    uint32_t notifications;
+};
+
+static bool _realtime = false;
+static int64_t _now_us = 0;
+static int64_t _epoch_us = 0;
+static host_clock_hook_t _hook = NULL;
+static uint32_t _idle_reads = 0;
+static host_clock_stats_t _stats;
+static pthread_mutex_t _stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct host_task _current_task;
+
+static int64_t _monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void _sleep_until_us(int64_t time_us)
+{
+    int64_t absolute = _epoch_us + time_us;
+    struct timespec ts = { .tv_sec = absolute / 1000000, .tv_nsec = (absolute % 1000000) * 1000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    {
+    }
+}
+
+static void _record_delay(int64_t duration_us)
+{
+    pthread_mutex_lock(&_stats_mutex);
+    ++_stats.delays;
+    _stats.delayed_us += duration_us;
+    pthread_mutex_unlock(&_stats_mutex);
+}
+
+// Move time on to the given point, sleeping in real-time mode
+static void _advance_to(int64_t time_us)
+{
+    if (_realtime)
+    {
+        _sleep_until_us(time_us);
+    }
+    else if (time_us > _now_us)
+    {
+        _now_us = time_us;
+        _idle_reads = 0;
+        if (_hook != NULL)
+        {
+            _hook(_now_us);
+        }
+    }
+}
+
+// Clock control
+
+void host_clock_reset(void)
+{
+    _now_us = 0;
+    _idle_reads = 0;
+    _epoch_us = _monotonic_us();
+    _hook = NULL;
+    _current_task.notifications = 0;
+    pthread_mutex_lock(&_stats_mutex);
+    _stats = (host_clock_stats_t){ 0 };
+    pthread_mutex_unlock(&_stats_mutex);
+}
+
+void host_clock_set_realtime(bool realtime)
+{
+    _realtime = realtime;
+    host_clock_reset();
+}
+
+bool host_clock_is_realtime(void)
+{
+    return _realtime;
+}
+
+void host_clock_set_us(int64_t now_us)
+{
+    _advance_to(now_us);
+}
+
+void host_clock_advance_us(int64_t duration_us)
+{
+    _advance_to(esp_timer_get_time() + duration_us);
+}
+
+void host_clock_set_hook(host_clock_hook_t hook)
+{
+    _hook = hook;
+}
+
+host_clock_stats_t host_clock_get_stats(void)
+{
+    pthread_mutex_lock(&_stats_mutex);
+    host_clock_stats_t stats = _stats;
+    pthread_mutex_unlock(&_stats_mutex);
+    return stats;
+}
+
+// esp_timer and ROM
+
+int64_t esp_timer_get_time(void)
+{
+    if (!_realtime && ++_idle_reads > HOST_SPIN_READS)
+    {
+        // a spinning loop takes real time on the target
+        pthread_mutex_lock(&_stats_mutex);
+        ++_stats.spins;
+        pthread_mutex_unlock(&_stats_mutex);
+        _advance_to(_now_us + HOST_SPIN_US);
+    }
+    return _realtime ? _monotonic_us() - _epoch_us : _now_us;
+}
+
+void ets_delay_us(uint32_t us)
+{
+    pthread_mutex_lock(&_stats_mutex);
+    ++_stats.busy_waits;
+    _stats.busy_wait_us += us;
+    pthread_mutex_unlock(&_stats_mutex);
+    host_clock_advance_us(us);
+}
+
+// FreeRTOS tasks
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(esp_timer_get_time() / HOST_TICK_US);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (ticks > 0)
+    {
+        // as on the target, the task resumes on the tick interrupt
+        int64_t start = esp_timer_get_time();
+        int64_t wake = ((int64_t)xTaskGetTickCount() + ticks) * HOST_TICK_US;
+        _record_delay(wake - start);
+        _advance_to(wake);
+    }
+}
+
+void vTaskDelayUntil(TickType_t * previous_wake_time, TickType_t increment)
+{
+    TickType_t wake = *previous_wake_time + increment;
+    TickType_t now = xTaskGetTickCount();
+    *previous_wake_time = wake;
+    if ((int32_t)(wake - now) > 0)
+    {
+        int64_t start = esp_timer_get_time();
+        _record_delay((int64_t)wake * HOST_TICK_US - start);
+        _advance_to((int64_t)wake * HOST_TICK_US);
+    }
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return &_current_task;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == &_current_task)
+    {
+        pthread_exit(NULL);
+    }
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t * higher_priority_task_woken)
+{
+    __atomic_add_fetch(&((struct host_task *)task)->notifications, 1, __ATOMIC_RELEASE);
+    if (higher_priority_task_woken != NULL)
+    {
+        *higher_priority_task_woken = pdTRUE;
+    }
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    // wait a tick at a time, so that virtual time advances and emulated devices may interrupt
+    uint32_t count = 0;
+    TickType_t waited = 0;
+    while ((count = __atomic_load_n(&_current_task.notifications, __ATOMIC_ACQUIRE)) == 0 && waited < ticks_to_wait)
+    {
+        vTaskDelay(1);
+        ++waited;
+    }
+
+    if (count > 0)
+    {
+        if (clear_on_exit)
+        {
+            __atomic_store_n(&_current_task.notifications, 0, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            __atomic_sub_fetch(&_current_task.notifications, 1, __ATOMIC_RELEASE);
+        }
+    }
+    return count;
+}
+
+// FreeRTOS mutexes
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t semaphore = malloc(sizeof(*semaphore));
+    if (semaphore != NULL)
+    {
+        pthread_mutex_init(&semaphore->mutex, NULL);
+    }
+    return semaphore;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    if (semaphore != NULL)
+    {
+        pthread_mutex_destroy(&semaphore->mutex);
+        free(semaphore);
+    }
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    BaseType_t taken = pdFALSE;
+    if (pthread_mutex_trylock(&semaphore->mutex) == 0)
+    {
+        taken = pdTRUE;
+    }
+    else if (!_realtime)
+    {
+        // a single thread of execution cannot release the mutex while waiting, so time out
+        if (ticks_to_wait != portMAX_DELAY)
+        {
+            vTaskDelay(ticks_to_wait);
+        }
+        else
+        {
+            fprintf(stderr, "xSemaphoreTake: deadlock waiting forever in virtual time\n");
+            abort();
+        }
+    }
+    else if (ticks_to_wait == portMAX_DELAY)
+    {
+        taken = pthread_mutex_lock(&semaphore->mutex) == 0 ? pdTRUE : pdFALSE;
+    }
+    else
+    {
+        // pthread_mutex_timedlock() takes an absolute CLOCK_REALTIME deadline
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        int64_t absolute = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 + (int64_t)ticks_to_wait * HOST_TICK_US;
+        ts.tv_sec = absolute / 1000000;
+        ts.tv_nsec = (absolute % 1000000) * 1000;
+        taken = pthread_mutex_timedlock(&semaphore->mutex, &ts) == 0 ? pdTRUE : pdFALSE;
+    }
+    return taken;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    return pthread_mutex_unlock(&semaphore->mutex) == 0 ? pdTRUE : pdFALSE;
+}
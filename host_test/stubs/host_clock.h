@@ -0,0 +1,111 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file host_clock.h
+ * @brief Control of the time source behind the host FreeRTOS and esp_timer shims.
+ *
+ * By default time is virtual: it starts at zero, advances only when the code under test sleeps,
+ * busy-waits or performs a bus transaction, and is shared by a single thread of execution, so
+ * tests are deterministic and run much faster than real time. Real-time mode uses the monotonic
+ * clock and real sleeps, for tests with several threads contending for a bus.
+ *
+ * As on the target, a task sleeping with vTaskDelay() or vTaskDelayUntil() wakes on a tick boundary.
+ * Code that polls the clock in a loop without sleeping would never see virtual time move, so after
+ * HOST_SPIN_READS such reads the clock is advanced by HOST_SPIN_US and the spin is counted.
+ */
+
+#ifndef HOST_CLOCK_H
+#define HOST_CLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HOST_TICK_US (portTICK_PERIOD_MS * 1000)   ///< Duration of one tick, in microseconds
+#define HOST_SPIN_READS 10000                      ///< Consecutive clock reads without sleeping that count as a spin
+#define HOST_SPIN_US 10                            ///< Virtual time charged for a spin, in microseconds
+
+/**
+ * @brief Function called whenever virtual time advances, with the new time.
+ */
+typedef void (*host_clock_hook_t)(int64_t now_us);
+
+/**
+ * @brief Structure containing counts of how the code under test spent time.
+ */
+typedef struct
+{
+    uint32_t delays;           ///< Number of calls to vTaskDelay() or vTaskDelayUntil() that slept
+    int64_t delayed_us;        ///< Total time spent sleeping, in microseconds
+    uint32_t busy_waits;       ///< Number of calls to ets_delay_us()
+    int64_t busy_wait_us;      ///< Total time spent busy-waiting, in microseconds
+    uint32_t spins;            ///< Number of times virtual time was advanced because the code under test polled the clock without sleeping
+} host_clock_stats_t;
+
+/**
+ * @brief Return to virtual time zero, clearing statistics, task notifications and the hook.
+ */
+void host_clock_reset(void);
+
+/**
+ * @brief Select real time (true) or virtual time (false). Resets the clock.
+ */
+void host_clock_set_realtime(bool realtime);
+
+/**
+ * @brief Return true if the clock is in real-time mode.
+ */
+bool host_clock_is_realtime(void);
+
+/**
+ * @brief Set the virtual time, which must not be earlier than the current time.
+ */
+void host_clock_set_us(int64_t now_us);
+
+/**
+ * @brief Advance the clock. In virtual mode time moves on immediately; in real-time mode this sleeps.
+ */
+void host_clock_advance_us(int64_t duration_us);
+
+/**
+ * @brief Install a function called whenever virtual time advances, or NULL to remove it.
+ */
+void host_clock_set_hook(host_clock_hook_t hook);
+
+/**
+ * @brief Retrieve the time statistics accumulated since the last reset.
+ */
+host_clock_stats_t host_clock_get_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // HOST_CLOCK_H
@@ -0,0 +1,237 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_adaptive.c
+ * @brief Adaptive sampling: the period backs off while light is stable and returns to the minimum
+ *        on a step, when the integration time is also shortened until the light settles.
+ */
+
+#include "tsl2561_adaptive.h"
+#include "test_util.h"
+
+#define MIN_PERIOD   50     // ticks, 500 ms
+#define MAX_PERIOD   800    // ticks, 8 s
+#define STEP_PERCENT 10
+
+#define BRIGHT       20000.0   // at 402 ms and 1x, 1250 counts, and 42 at 13 ms
+#define DIM          2000.0    // at 13 ms and 1x, 4 counts
+
+static void _setup(fake_tsl2561_t * device, smbus_info_t * smbus_info, tsl2561_info_t * info, tsl2561_adaptive_t * adaptive)
+{
+    CHECK_EQ(test_setup(device, smbus_info, info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(info, TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_1X), ESP_OK);
+    CHECK_EQ(tsl2561_adaptive_init(adaptive, MIN_PERIOD, MAX_PERIOD, STEP_PERCENT), ESP_OK);
+}
+
+static uint32_t _read(tsl2561_adaptive_t * adaptive, tsl2561_info_t * info, TickType_t * wake)
+{
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    CHECK_EQ(tsl2561_adaptive_read(adaptive, info, wake, &visible, &infrared), ESP_OK);
+    return tsl2561_compute_lux(info, visible, infrared);
+}
+
+// Sample stable light until the period reaches the maximum
+static void _settle(tsl2561_adaptive_t * adaptive, tsl2561_info_t * info, TickType_t * wake)
+{
+    for (int i = 0; i < 8 && tsl2561_adaptive_get_period(adaptive) < MAX_PERIOD; ++i)
+    {
+        _read(adaptive, info, wake);
+    }
+    CHECK_EQ(tsl2561_adaptive_get_period(adaptive), MAX_PERIOD);
+}
+
+static void _test_init(void)
+{
+    tsl2561_adaptive_t adaptive = { 0 };
+    host_log_quiet = true;
+    CHECK_EQ(tsl2561_adaptive_get_period(&adaptive), 0);
+    CHECK_EQ(tsl2561_adaptive_init(NULL, MIN_PERIOD, MAX_PERIOD, STEP_PERCENT), ESP_FAIL);
+    CHECK_EQ(tsl2561_adaptive_init(&adaptive, 0, MAX_PERIOD, STEP_PERCENT), ESP_ERR_INVALID_ARG);
+    CHECK_EQ(tsl2561_adaptive_init(&adaptive, MAX_PERIOD, MIN_PERIOD, STEP_PERCENT), ESP_ERR_INVALID_ARG);
+    CHECK_EQ(tsl2561_adaptive_init(&adaptive, MIN_PERIOD, MAX_PERIOD, 0), ESP_ERR_INVALID_ARG);
+    host_log_quiet = false;
+    CHECK_EQ(tsl2561_adaptive_init(&adaptive, MIN_PERIOD, MAX_PERIOD, STEP_PERCENT), ESP_OK);
+    CHECK_EQ(tsl2561_adaptive_get_period(&adaptive), MIN_PERIOD);
+}
+
+static void _test_back_off(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    tsl2561_adaptive_t adaptive;
+    _setup(&device, &smbus_info, &info, &adaptive);
+    fake_tsl2561_set_light(&device, BRIGHT, BRIGHT / 4);
+
+    // the first sample has nothing to compare with, then each stable one doubles the period
+    TickType_t wake = xTaskGetTickCount();
+    TickType_t expected[] = { MIN_PERIOD, 2 * MIN_PERIOD, 4 * MIN_PERIOD, 8 * MIN_PERIOD, MAX_PERIOD, MAX_PERIOD };
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i)
+    {
+        TickType_t start = wake;
+        _read(&adaptive, &info, &wake);
+        CHECK_EQ(wake - start, i == 0 ? MIN_PERIOD : expected[i - 1]);
+        CHECK_EQ(tsl2561_adaptive_get_period(&adaptive), expected[i]);
+    }
+
+    // a slow drift, a quarter to a half of a step per sample, holds the period
+    fake_tsl2561_set_light(&device, BRIGHT * 1.03, BRIGHT / 4 * 1.03);
+    _read(&adaptive, &info, &wake);
+    CHECK_EQ(tsl2561_adaptive_get_period(&adaptive), MAX_PERIOD);
+
+    // and a faster one halves it
+    fake_tsl2561_set_light(&device, BRIGHT * 1.03 * 1.07, BRIGHT / 4 * 1.03 * 1.07);
+    _read(&adaptive, &info, &wake);
+    CHECK_EQ(tsl2561_adaptive_get_period(&adaptive), MAX_PERIOD / 2);
+    CHECK_EQ(info.integration_time, TSL2561_INTEGRATION_TIME_402MS);
+}
+
+static void _test_step(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    tsl2561_adaptive_t adaptive;
+    _setup(&device, &smbus_info, &info, &adaptive);
+    fake_tsl2561_set_light(&device, BRIGHT, BRIGHT / 4);
+    TickType_t wake = xTaskGetTickCount();
+    _settle(&adaptive, &info, &wake);
+
+    // the step returns to the minimum period, and the sample that showed it is in the configured range
+    fake_tsl2561_set_light(&device, 2 * BRIGHT, BRIGHT / 2);
+    uint32_t lux = _read(&adaptive, &info, &wake);
+    CHECK_EQ(tsl2561_adaptive_get_period(&adaptive), MIN_PERIOD);
+    CHECK_EQ(info.integration_time, TSL2561_INTEGRATION_TIME_402MS);
+
+    // the next is taken at the fastest integration time, at the same gain, so is quick, and agrees within half a step
+    int64_t start_us = 0;
+    int64_t end_us = 0;
+    uint32_t fast_lux = _read(&adaptive, &info, &wake);
+    CHECK_EQ(info.integration_time, TSL2561_INTEGRATION_TIME_13MS);
+    CHECK_EQ(info.gain, TSL2561_GAIN_1X);
+    CHECK_EQ(device.regs[1], TSL2561_INTEGRATION_TIME_13MS | TSL2561_GAIN_1X);
+    CHECK_EQ(tsl2561_get_result_timestamps(&info, &start_us, &end_us), ESP_OK);
+    CHECK(end_us - start_us < 15000);
+    CHECK(fast_lux * 20 >= lux * 19 && fast_lux * 20 <= lux * 21);
+
+    // the light has settled, so the configured integration time is restored, and back-off resumes
+    uint32_t settled_lux = _read(&adaptive, &info, &wake);
+    CHECK_EQ(info.integration_time, TSL2561_INTEGRATION_TIME_402MS);
+    CHECK_EQ(device.regs[1], TSL2561_INTEGRATION_TIME_402MS | TSL2561_GAIN_1X);
+    CHECK_EQ(tsl2561_get_result_timestamps(&info, &start_us, &end_us), ESP_OK);
+    CHECK(end_us - start_us > 400000);
+    CHECK_EQ(settled_lux, lux);
+    CHECK_EQ(tsl2561_adaptive_get_period(&adaptive), 4 * MIN_PERIOD);
+}
+
+static void _test_repeated_step(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    tsl2561_adaptive_t adaptive;
+    _setup(&device, &smbus_info, &info, &adaptive);
+    fake_tsl2561_set_light(&device, BRIGHT, BRIGHT / 4);
+    TickType_t wake = xTaskGetTickCount();
+    _settle(&adaptive, &info, &wake);
+
+    // while the light keeps stepping, sampling stays fast
+    for (int i = 1; i <= 4; ++i)
+    {
+        fake_tsl2561_set_light(&device, BRIGHT * (1 + i), BRIGHT / 4 * (1 + i));
+        _read(&adaptive, &info, &wake);
+        CHECK_EQ(tsl2561_adaptive_get_period(&adaptive), MIN_PERIOD);
+        CHECK_EQ(info.integration_time, i == 1 ? TSL2561_INTEGRATION_TIME_402MS : TSL2561_INTEGRATION_TIME_13MS);
+    }
+
+    // a step down into light too dim to resolve at 13 ms restores the configured integration time
+    fake_tsl2561_set_light(&device, DIM, DIM / 4);
+    _read(&adaptive, &info, &wake);
+    CHECK_EQ(info.integration_time, TSL2561_INTEGRATION_TIME_13MS);
+    _read(&adaptive, &info, &wake);
+    CHECK_EQ(tsl2561_adaptive_get_period(&adaptive), MIN_PERIOD);
+    CHECK_EQ(info.integration_time, TSL2561_INTEGRATION_TIME_402MS);
+}
+
+static void _test_dim_step(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    tsl2561_adaptive_t adaptive;
+    _setup(&device, &smbus_info, &info, &adaptive);
+    fake_tsl2561_set_light(&device, DIM, DIM / 4);
+    TickType_t wake = xTaskGetTickCount();
+    _settle(&adaptive, &info, &wake);
+
+    // too dim for 13 ms to resolve a step, so only the period changes
+    uint32_t transactions = test_transactions(&smbus_info);
+    fake_tsl2561_set_light(&device, 2 * DIM, DIM / 2);
+    _read(&adaptive, &info, &wake);
+    CHECK_EQ(tsl2561_adaptive_get_period(&adaptive), MIN_PERIOD);
+    CHECK_EQ(info.integration_time, TSL2561_INTEGRATION_TIME_402MS);
+    CHECK(!adaptive.restart);
+    _read(&adaptive, &info, &wake);
+    CHECK_EQ(info.integration_time, TSL2561_INTEGRATION_TIME_402MS);
+    CHECK_EQ(test_transactions(&smbus_info) - transactions, 6);  // the measurements alone
+}
+
+static void _test_auto_range(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    tsl2561_adaptive_t adaptive;
+    _setup(&device, &smbus_info, &info, &adaptive);
+    CHECK_EQ(tsl2561_set_auto_range(&info, true), ESP_OK);
+    fake_tsl2561_set_light(&device, DIM, DIM / 4);
+    TickType_t wake = xTaskGetTickCount();
+    _settle(&adaptive, &info, &wake);
+    CHECK_EQ(info.integration_time, TSL2561_INTEGRATION_TIME_402MS);
+    CHECK_EQ(info.gain, TSL2561_GAIN_16X);
+
+    // ranging restarts, and settles in the range for the new light rather than returning to a configured one
+    fake_tsl2561_set_light(&device, 200.0 * BRIGHT, 50.0 * BRIGHT);
+    _read(&adaptive, &info, &wake);
+    CHECK_EQ(tsl2561_adaptive_get_period(&adaptive), MIN_PERIOD);
+    CHECK(adaptive.restart);
+    uint32_t lux = _read(&adaptive, &info, &wake);
+    CHECK(!adaptive.fast);
+    CHECK(info.auto_range);
+    CHECK(info.integration_time != TSL2561_INTEGRATION_TIME_402MS || info.gain != TSL2561_GAIN_16X);
+    CHECK_EQ(_read(&adaptive, &info, &wake), lux);
+}
+
+int main(int argc, char ** argv)
+{
+    _test_init();
+    _test_back_off();
+    _test_step();
+    _test_repeated_step();
+    _test_dim_step();
+    _test_auto_range();
+    return test_result("test_adaptive");
+}
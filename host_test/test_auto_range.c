@@ -0,0 +1,115 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_auto_range.c
+ * @brief Auto-ranging: report the number of integrations needed for a valid result in a range of
+ *        scenes, from an unknown range and after a change of scene, and check the result quality.
+ */
+
+#include "test_util.h"
+
+typedef struct
+{
+    const char * name;
+    double channel0;   // counts for 402 ms at 16x
+} scene_t;
+
+static const scene_t SCENES[] = {
+    { "dark",     20.0 },
+    { "dim",      500.0 },
+    { "indoor",   5000.0 },
+    { "bright",   60000.0 },
+    { "daylight", 600000.0 },
+    { "sunlight", 3000000.0 },
+};
+
+#define NUM_SCENES (sizeof(SCENES) / sizeof(SCENES[0]))
+
+// Read a result, returning the number of integrations it took
+static uint32_t _read(tsl2561_info_t * info, fake_tsl2561_t * device, tsl2561_result_t * result)
+{
+    uint32_t reads = device->data_reads;
+    CHECK_EQ(tsl2561_read_result(info, result), ESP_OK);
+    return device->data_reads - reads;
+}
+
+// Check that a result is from the most sensitive range that does not saturate
+static void _check_range(const tsl2561_info_t * info, const tsl2561_result_t * result)
+{
+    bool most_sensitive = info->integration_time == TSL2561_INTEGRATION_TIME_402MS && info->gain == TSL2561_GAIN_16X;
+    bool least_sensitive = info->integration_time == TSL2561_INTEGRATION_TIME_13MS && info->gain == TSL2561_GAIN_1X;
+    CHECK(!(result->flags & TSL2561_RESULT_SATURATED) || least_sensitive);
+
+    // unless at the limit, the range leaves at least a sixteenth of full scale
+    CHECK(most_sensitive || least_sensitive || result->channel0 >= 65535 / 16 / 16);
+}
+
+int main(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    uint32_t worst_initial = 0;
+    uint32_t worst_change = 0;
+
+    printf("%-10s %8s %8s %8s %10s\n", "scene", "initial", "steady", "change", "lux");
+    for (size_t s = 0; s < NUM_SCENES; ++s)
+    {
+        CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+        fake_tsl2561_set_light(&device, SCENES[s].channel0, SCENES[s].channel0 / 4);
+        CHECK_EQ(tsl2561_set_auto_range(&info, true), ESP_OK);
+
+        // from an unknown range
+        tsl2561_result_t result;
+        uint32_t initial = _read(&info, &device, &result);
+        _check_range(&info, &result);
+
+        // in a steady scene every integration yields a result
+        uint32_t steady = _read(&info, &device, &result);
+        CHECK_EQ(steady, 1);
+
+        // after a change from each other scene
+        uint32_t change = 0;
+        for (size_t from = 0; from < NUM_SCENES; ++from)
+        {
+            fake_tsl2561_set_light(&device, SCENES[from].channel0, SCENES[from].channel0 / 4);
+            _read(&info, &device, &result);
+            _read(&info, &device, &result);
+            fake_tsl2561_set_light(&device, SCENES[s].channel0, SCENES[s].channel0 / 4);
+            uint32_t cycles = _read(&info, &device, &result);
+            _check_range(&info, &result);
+            change = cycles > change ? cycles : change;
+        }
+
+        printf("%-10s %8u %8u %8u %10u\n", SCENES[s].name, initial, steady, change, result.lux);
+        worst_initial = initial > worst_initial ? initial : worst_initial;
+        worst_change = change > worst_change ? change : worst_change;
+    }
+
+    // the 13 ms probe locates any scene, so one more integration gives the result
+    CHECK(worst_initial <= 2);
+    CHECK(worst_change <= 3);
+    return test_result("test_auto_range");
+}
@@ -0,0 +1,153 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_block_read.c
+ * @brief Channel data is fetched with one block read where the bus supports it, with a fallback
+ *        to word reads that is latched only when the bus rejects block transactions.
+ */
+
+#include "freertos/task.h"
+
+#include "test_util.h"
+
+// Start a measurement and wait until its result is due, so that the next transaction is the data read
+static void _start_and_wait(tsl2561_info_t * info)
+{
+    CHECK_EQ(tsl2561_start_measurement(info), ESP_OK);
+    TickType_t ready_tick = tsl2561_get_ready_tick(info);
+    vTaskDelay(ready_tick - xTaskGetTickCount() + 1);
+}
+
+static esp_err_t _poll(tsl2561_info_t * info)
+{
+    bool ready = false;
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    esp_err_t err = tsl2561_poll_result(info, &ready, &visible, &infrared);
+    CHECK(err != ESP_OK || ready);
+    return err;
+}
+
+static uint32_t _read_transactions(tsl2561_info_t * info, const smbus_info_t * smbus_info)
+{
+    uint32_t before = test_transactions(smbus_info);
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    CHECK_EQ(tsl2561_read(info, &visible, &infrared), ESP_OK);
+    return test_transactions(smbus_info) - before;
+}
+
+static void _test_transaction_count(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_16X), ESP_OK);
+
+    // power up, data, power down
+    uint32_t block = _read_transactions(&info, &smbus_info);
+    CHECK_EQ(block, 3);
+
+    CHECK_EQ(tsl2561_set_block_read(&info, false), ESP_OK);
+    uint32_t word = _read_transactions(&info, &smbus_info);
+    CHECK_EQ(word, 4);
+    printf("data transactions per read: block %u, word %u\n", block - 2, word - 2);
+
+    // the channels of a block read come from the same conversion in continuous operation
+    CHECK_EQ(tsl2561_set_block_read(&info, true), ESP_OK);
+    CHECK_EQ(tsl2561_start_continuous(&info), ESP_OK);
+    uint32_t before = test_transactions(&smbus_info);
+    for (int i = 0; i < 10; ++i)
+    {
+        tsl2561_visible_t visible = 0;
+        tsl2561_infrared_t infrared = 0;
+        CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+    }
+    CHECK_EQ(test_transactions(&smbus_info) - before, 10);
+    CHECK_EQ(tsl2561_stop_measurement(&info), ESP_OK);
+}
+
+static void _test_rejected(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    test_attach(&device, &smbus_info, FAKE_TSL2561_ID_TSL2561T_FN_CL);
+    device.block_supported = false;
+    CHECK_EQ(tsl2561_init(&info, &smbus_info), ESP_OK);
+    CHECK_EQ(tsl2561_set_retries(&info, 0, 0), ESP_OK);
+
+    // the first read falls back, and later reads use word reads without trying a block read first
+    host_log_quiet = true;
+    CHECK_EQ(_read_transactions(&info, &smbus_info), 5);
+    host_log_quiet = false;
+    CHECK(!info.block_read);
+    CHECK_EQ(_read_transactions(&info, &smbus_info), 4);
+    CHECK_EQ(fake_bus_device_counters(&smbus_info).ops[FAKE_BUS_READ_BLOCK], 1);
+}
+
+static void _test_transient(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_16X), ESP_OK);
+    CHECK_EQ(tsl2561_set_retries(&info, 0, 0), ESP_OK);
+    host_log_quiet = true;
+
+    // a timed-out block read is recovered by word reads, but block reads stay enabled
+    _start_and_wait(&info);
+    fake_bus_inject_faults(&smbus_info, 1, ESP_ERR_TIMEOUT);
+    CHECK_EQ(_poll(&info), ESP_OK);
+    CHECK(info.block_read);
+
+    // a NACK that word reads also get is a bus failure, not a rejection of block reads
+    _start_and_wait(&info);
+    fake_bus_inject_faults(&smbus_info, 2, ESP_FAIL);
+    CHECK(_poll(&info) != ESP_OK);
+    CHECK(info.block_read);
+    fake_bus_inject_faults(&smbus_info, 0, ESP_OK);
+    CHECK_EQ(tsl2561_stop_measurement(&info), ESP_OK);
+
+    // block writes of configuration transactions follow the block read setting
+    CHECK_EQ(tsl2561_config_begin(&info), ESP_OK);
+    CHECK_EQ(tsl2561_set_thresholds(&info, 100, 1000), ESP_OK);
+    CHECK_EQ(tsl2561_set_interrupt(&info, TSL2561_INTERRUPT_LEVEL, 1), ESP_OK);
+    CHECK_EQ(tsl2561_config_commit(&info), ESP_OK);
+    CHECK_EQ(fake_bus_device_counters(&smbus_info).ops[FAKE_BUS_WRITE_BLOCK], 1);
+
+    host_log_quiet = false;
+    CHECK_EQ(_read_transactions(&info, &smbus_info), 3);
+}
+
+int main(void)
+{
+    _test_transaction_count();
+    _test_rejected();
+    _test_transient();
+    return test_result("test_block_read");
+}
@@ -0,0 +1,263 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_bus_lock.c
+ * @brief Shared bus lock: every transaction, from the first of initialisation, is made with the
+ *        lock held, and the lock is never held across an integration. A real-time contention
+ *        benchmark runs several emulated devices and another driver on one bus, checks that no
+ *        transaction escapes the lock and reports the wait and latency figures.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "rom/ets_sys.h"
+#include "test_util.h"
+
+#define CONTENTION_DEVICES  3
+#define CONTENTION_READS    20
+#define FOREIGN_HOLD_US     2000   // another driver's multi-transaction sequence
+#define FOREIGN_PERIOD_US   5000
+
+static const i2c_address_t _addresses[CONTENTION_DEVICES] = { 0x29, 0x39, 0x49 };
+
+// Observes each transaction and counts those made without the lock, or inside another driver's sequence
+typedef struct
+{
+    SemaphoreHandle_t lock;
+    volatile bool foreign_active;
+    uint32_t transactions;
+    uint32_t unlocked;
+    uint32_t interleaved;
+    pthread_mutex_t mutex;
+} monitor_t;
+
+static void _monitor(void * context, const smbus_info_t * smbus_info, fake_bus_op_t op, uint8_t command)
+{
+    monitor_t * monitor = (monitor_t *)context;
+    bool unlocked = xSemaphoreTake(monitor->lock, 0) == pdTRUE;
+    if (unlocked)
+    {
+        xSemaphoreGive(monitor->lock);
+    }
+    pthread_mutex_lock(&monitor->mutex);
+    ++monitor->transactions;
+    monitor->unlocked += unlocked;
+    monitor->interleaved += monitor->foreign_active;
+    pthread_mutex_unlock(&monitor->mutex);
+}
+
+static void _monitor_init(monitor_t * monitor, SemaphoreHandle_t lock)
+{
+    memset(monitor, 0, sizeof(*monitor));
+    monitor->lock = lock;
+    pthread_mutex_init(&monitor->mutex, NULL);
+    fake_bus_set_monitor(_monitor, monitor);
+}
+
+static void _test_init_locked(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+    monitor_t monitor;
+
+    // the monitor sees the unlocked initialisation
+    test_attach(&device, &smbus_info, FAKE_TSL2561_ID_TSL2561T_FN_CL);
+    _monitor_init(&monitor, lock);
+    CHECK_EQ(tsl2561_init(&info, &smbus_info), ESP_OK);
+    CHECK(monitor.transactions > 0);
+    CHECK_EQ(monitor.unlocked, monitor.transactions);
+
+    // every transaction is locked, from the device ID read onwards
+    test_attach(&device, &smbus_info, FAKE_TSL2561_ID_TSL2561T_FN_CL);
+    _monitor_init(&monitor, lock);
+    CHECK_EQ(tsl2561_init_locked(&info, &smbus_info, lock, 10), ESP_OK);
+    CHECK(monitor.transactions > 0);
+    CHECK_EQ(monitor.unlocked, 0);
+
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    fake_tsl2561_set_light(&device, 2000.0, 500.0);
+    CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+    CHECK(visible > 0);
+    CHECK_EQ(monitor.unlocked, 0);
+
+    // a held lock times out the first transaction, so initialisation fails without touching the bus
+    test_attach(&device, &smbus_info, FAKE_TSL2561_ID_TSL2561T_FN_CL);
+    _monitor_init(&monitor, lock);
+    CHECK_EQ(xSemaphoreTake(lock, 0), pdTRUE);
+    host_log_quiet = true;
+    CHECK_EQ(tsl2561_init_locked(&info, &smbus_info, lock, 2), ESP_ERR_TIMEOUT);
+    host_log_quiet = false;
+    CHECK_EQ(monitor.transactions, 0);
+    xSemaphoreGive(lock);
+
+    fake_bus_set_monitor(NULL, NULL);
+    vSemaphoreDelete(lock);
+}
+
+typedef struct
+{
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    SemaphoreHandle_t lock;
+    int64_t latency_us[CONTENTION_READS];
+    esp_err_t err;
+} reader_t;
+
+static volatile bool _readers_done;
+
+static void * _reader(void * arg)
+{
+    reader_t * reader = (reader_t *)arg;
+    reader->err = tsl2561_init_locked(&reader->info, &reader->smbus_info, reader->lock, portMAX_DELAY);
+    if (reader->err == ESP_OK)
+    {
+        reader->err = tsl2561_set_integration_time_and_gain(&reader->info, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_1X);
+    }
+    for (int i = 0; i < CONTENTION_READS && reader->err == ESP_OK; ++i)
+    {
+        tsl2561_visible_t visible = 0;
+        tsl2561_infrared_t infrared = 0;
+        int64_t start = esp_timer_get_time();
+        reader->err = tsl2561_read(&reader->info, &visible, &infrared);
+        reader->latency_us[i] = esp_timer_get_time() - start;
+    }
+    return NULL;
+}
+
+// Another driver on the same bus, holding the lock for a sequence of transactions
+static void * _foreign(void * arg)
+{
+    monitor_t * monitor = (monitor_t *)arg;
+    int64_t * held_us = (int64_t *)calloc(1, sizeof(*held_us));
+    while (!_readers_done)
+    {
+        xSemaphoreTake(monitor->lock, portMAX_DELAY);
+        monitor->foreign_active = true;
+        ets_delay_us(FOREIGN_HOLD_US);
+        *held_us += FOREIGN_HOLD_US;
+        monitor->foreign_active = false;
+        xSemaphoreGive(monitor->lock);
+        ets_delay_us(FOREIGN_PERIOD_US - FOREIGN_HOLD_US);
+    }
+    return held_us;
+}
+
+static int _compare_latency(const void * a, const void * b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void _test_contention(void)
+{
+    fake_tsl2561_t devices[CONTENTION_DEVICES];
+    reader_t readers[CONTENTION_DEVICES];
+    monitor_t monitor;
+
+    host_clock_reset();
+    host_clock_set_realtime(true);
+    fake_bus_reset();
+    fake_tsl2561_detach_all();
+    SemaphoreHandle_t lock = xSemaphoreCreateMutex();
+    _monitor_init(&monitor, lock);
+    for (int i = 0; i < CONTENTION_DEVICES; ++i)
+    {
+        fake_tsl2561_init(&devices[i], FAKE_TSL2561_ID_TSL2561T_FN_CL);
+        fake_tsl2561_set_light(&devices[i], 1000.0 * (i + 1), 250.0 * (i + 1));
+        fake_tsl2561_attach(&devices[i], &readers[i].smbus_info, TEST_PORT, _addresses[i]);
+        readers[i].lock = lock;
+    }
+
+    _readers_done = false;
+    int64_t start = esp_timer_get_time();
+    pthread_t foreign;
+    pthread_t threads[CONTENTION_DEVICES];
+    pthread_create(&foreign, NULL, _foreign, &monitor);
+    for (int i = 0; i < CONTENTION_DEVICES; ++i)
+    {
+        pthread_create(&threads[i], NULL, _reader, &readers[i]);
+    }
+    for (int i = 0; i < CONTENTION_DEVICES; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    _readers_done = true;
+    int64_t * foreign_held_us = NULL;
+    pthread_join(foreign, (void **)&foreign_held_us);
+
+    int64_t latency[CONTENTION_DEVICES * CONTENTION_READS];
+    uint32_t wait_max = 0;
+    uint64_t wait_total = 0;
+    uint32_t acquisitions = 0;
+    for (int i = 0; i < CONTENTION_DEVICES; ++i)
+    {
+        CHECK_EQ(readers[i].err, ESP_OK);
+        memcpy(&latency[i * CONTENTION_READS], readers[i].latency_us, sizeof(readers[i].latency_us));
+
+        tsl2561_stats_t stats;
+        CHECK_EQ(tsl2561_get_stats(&readers[i].info, &stats), ESP_OK);
+        CHECK_EQ(stats.bus_lock_timeouts, 0);
+        wait_max = stats.bus_lock_wait_max_us > wait_max ? stats.bus_lock_wait_max_us : wait_max;
+        wait_total += stats.bus_lock_wait_total_us;
+        acquisitions += stats.bus_lock_acquisitions;
+    }
+    size_t count = sizeof(latency) / sizeof(latency[0]);
+    qsort(latency, count, sizeof(latency[0]), _compare_latency);
+
+    // no transaction was made unlocked or inside the other driver's sequence; the wait and latency
+    // figures depend on the host scheduler, so they are reported rather than checked
+    CHECK(monitor.transactions > 0);
+    CHECK_EQ(monitor.unlocked, 0);
+    CHECK_EQ(monitor.interleaved, 0);
+
+    fake_bus_counters_t port = fake_bus_port_counters(TEST_PORT);
+    printf("%d devices x %d reads at 13 ms, other driver holding %d of every %d us:\n",
+           CONTENTION_DEVICES, CONTENTION_READS, FOREIGN_HOLD_US, FOREIGN_PERIOD_US);
+    printf("  bus utilisation %.1f%% (TSL2561 %.1f%%, other driver %.1f%%), %u transactions\n",
+           100.0 * (port.busy_us + *foreign_held_us) / elapsed, 100.0 * port.busy_us / elapsed,
+           100.0 * *foreign_held_us / elapsed, port.transactions);
+    printf("  read latency p50 %lld us, p99 %lld us, max %lld us\n", (long long)latency[count / 2],
+           (long long)latency[count * 99 / 100], (long long)latency[count - 1]);
+    printf("  lock wait avg %llu us, max %u us over %u acquisitions\n",
+           (unsigned long long)(acquisitions ? wait_total / acquisitions : 0), wait_max, acquisitions);
+
+    free(foreign_held_us);
+    fake_bus_set_monitor(NULL, NULL);
+    vSemaphoreDelete(lock);
+    host_clock_set_realtime(false);
+}
+
+int main(int argc, char ** argv)
+{
+    _test_init_locked();
+    _test_contention();
+    return test_result("test_bus_lock");
+}
@@ -0,0 +1,270 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_config.c
+ * @brief Configuration transactions: collected changes are applied in the fewest transactions,
+ *        a later change supersedes an earlier one, and abort or a failed commit restores the driver state.
+ *        Where the bus rejects block writes, only the changed registers are written, one byte at a time.
+ */
+
+#include "test_util.h"
+
+#define TIMING_402MS_1X (TSL2561_INTEGRATION_TIME_402MS | TSL2561_GAIN_1X)
+#define TIMING_101MS_16X (TSL2561_INTEGRATION_TIME_101MS | TSL2561_GAIN_16X)
+
+typedef struct
+{
+    uint32_t transactions;
+    uint32_t bytes;
+} _cost_t;
+
+static _cost_t _cost_since(const smbus_info_t * smbus_info, const fake_bus_counters_t * start)
+{
+    fake_bus_counters_t counters = fake_bus_device_counters(smbus_info);
+    return (_cost_t){ counters.transactions - start->transactions, counters.bytes - start->bytes };
+}
+
+// Timing, thresholds and interrupt, as an application would set them up from idle
+static void _reconfigure(tsl2561_info_t * info)
+{
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(info, TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_16X), ESP_OK);
+    CHECK_EQ(tsl2561_set_thresholds(info, 100, 1000), ESP_OK);
+    CHECK_EQ(tsl2561_set_interrupt(info, TSL2561_INTERRUPT_LEVEL, 1), ESP_OK);
+}
+
+static void _check_device(const fake_tsl2561_t * device)
+{
+    CHECK_EQ(device->regs[1], TIMING_101MS_16X);
+    CHECK_EQ(device->regs[2] | device->regs[3] << 8, 100);
+    CHECK_EQ(device->regs[4] | device->regs[5] << 8, 1000);
+    CHECK_EQ(device->regs[6], TSL2561_INTERRUPT_LEVEL | 1);
+    CHECK(!device->powered);
+}
+
+static void _test_batched(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+
+    // one call at a time: power up, TIMING, power down, two threshold words and INTERRUPT
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    fake_bus_counters_t start = fake_bus_device_counters(&smbus_info);
+    _reconfigure(&info);
+    _cost_t unbatched = _cost_since(&smbus_info, &start);
+    _check_device(&device);
+    CHECK_EQ(unbatched.transactions, 6);
+    CHECK_EQ(unbatched.bytes, 20);
+
+    // batched: CONTROL to INTERRUPT as one block write, then power down
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    start = fake_bus_device_counters(&smbus_info);
+    CHECK_EQ(tsl2561_config_begin(&info), ESP_OK);
+    _reconfigure(&info);
+    CHECK_EQ(_cost_since(&smbus_info, &start).transactions, 0);
+    CHECK_EQ(tsl2561_config_commit(&info), ESP_OK);
+    _cost_t batched = _cost_since(&smbus_info, &start);
+    _check_device(&device);
+    CHECK_EQ(batched.transactions, 2);
+    CHECK_EQ(batched.bytes, 13);
+    CHECK_EQ(fake_bus_device_counters(&smbus_info).ops[FAKE_BUS_WRITE_BLOCK], 1);
+    printf("timing, thresholds and interrupt from idle: %u transactions, %u bytes; batched %u transactions, %u bytes\n",
+           unbatched.transactions, unbatched.bytes, batched.transactions, batched.bytes);
+
+    // committing the same configuration again costs nothing
+    start = fake_bus_device_counters(&smbus_info);
+    CHECK_EQ(tsl2561_config_begin(&info), ESP_OK);
+    _reconfigure(&info);
+    CHECK_EQ(tsl2561_config_commit(&info), ESP_OK);
+    CHECK_EQ(_cost_since(&smbus_info, &start).transactions, 0);
+}
+
+static void _test_superseded(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_1X), ESP_OK);
+    uint32_t scale = info.channel_scale;
+
+    // a change back to the value the device holds supersedes the earlier change, so nothing is written
+    fake_bus_counters_t start = fake_bus_device_counters(&smbus_info);
+    CHECK_EQ(tsl2561_config_begin(&info), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_1X), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_1X), ESP_OK);
+    CHECK_EQ(tsl2561_config_commit(&info), ESP_OK);
+    CHECK_EQ(_cost_since(&smbus_info, &start).transactions, 0);
+    CHECK_EQ(device.regs[1], TIMING_402MS_1X);
+    CHECK_EQ(info.integration_time, TSL2561_INTEGRATION_TIME_402MS);
+    CHECK_EQ(info.gain, TSL2561_GAIN_1X);
+    CHECK_EQ(info.channel_scale, scale);
+
+    // and measurements use it
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    fake_tsl2561_set_light(&device, 20000.0, 5000.0);
+    CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+    CHECK_EQ(visible + infrared, 20000 / 16);
+    int64_t start_us = 0;
+    int64_t end_us = 0;
+    CHECK_EQ(tsl2561_get_result_timestamps(&info, &start_us, &end_us), ESP_OK);
+    CHECK(end_us - start_us > 400000);
+
+    // the last of several changes is the one applied
+    CHECK_EQ(tsl2561_config_begin(&info), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_1X), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_1X), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_16X), ESP_OK);
+    CHECK_EQ(tsl2561_config_commit(&info), ESP_OK);
+    CHECK_EQ(device.regs[1], TIMING_101MS_16X);
+    CHECK_EQ(info.integration_time, TSL2561_INTEGRATION_TIME_101MS);
+    CHECK_EQ(info.gain, TSL2561_GAIN_16X);
+}
+
+static void _test_abort(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    tsl2561_info_t before = info;
+
+    fake_bus_counters_t start = fake_bus_device_counters(&smbus_info);
+    CHECK_EQ(tsl2561_config_begin(&info), ESP_OK);
+    _reconfigure(&info);
+    CHECK_EQ(tsl2561_config_abort(&info), ESP_OK);
+    CHECK_EQ(_cost_since(&smbus_info, &start).transactions, 0);
+    CHECK_EQ(info.integration_time, before.integration_time);
+    CHECK_EQ(info.gain, before.gain);
+    CHECK_EQ(info.channel_scale, before.channel_scale);
+    CHECK_EQ(device.regs[1], TIMING_402MS_1X);
+
+    // a transaction cannot be nested, committed or aborted unless one is open, nor a measurement started in one
+    host_log_quiet = true;
+    CHECK_EQ(tsl2561_config_commit(&info), ESP_ERR_INVALID_STATE);
+    CHECK_EQ(tsl2561_config_abort(&info), ESP_ERR_INVALID_STATE);
+    CHECK_EQ(tsl2561_config_begin(&info), ESP_OK);
+    CHECK_EQ(tsl2561_config_begin(&info), ESP_ERR_INVALID_STATE);
+    CHECK(tsl2561_start_measurement(&info) != ESP_OK);
+    CHECK_EQ(tsl2561_config_abort(&info), ESP_OK);
+
+    // nor the device powered down, which would only be staged
+    start = fake_bus_device_counters(&smbus_info);
+    CHECK_EQ(tsl2561_config_begin(&info), ESP_OK);
+    CHECK_EQ(tsl2561_stop_measurement(&info), ESP_ERR_INVALID_STATE);
+    CHECK_EQ(tsl2561_config_commit(&info), ESP_OK);
+    CHECK_EQ(_cost_since(&smbus_info, &start).transactions, 0);
+    host_log_quiet = false;
+}
+
+static void _test_block_rejected(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    test_attach(&device, &smbus_info, FAKE_TSL2561_ID_TSL2561T_FN_CL);
+    device.block_supported = false;
+    CHECK_EQ(tsl2561_init(&info, &smbus_info), ESP_OK);
+    CHECK_EQ(tsl2561_set_retries(&info, 0, 0), ESP_OK);
+
+    // the rejected block write falls back to byte writes of the changed registers from CONTROL to
+    // INTERRUPT, which skip the high byte of the low threshold as it already holds zero, then power down
+    fake_bus_counters_t start = fake_bus_device_counters(&smbus_info);
+    CHECK_EQ(tsl2561_config_begin(&info), ESP_OK);
+    _reconfigure(&info);
+    host_log_quiet = true;
+    CHECK_EQ(tsl2561_config_commit(&info), ESP_OK);
+    host_log_quiet = false;
+    _check_device(&device);
+    CHECK_EQ(_cost_since(&smbus_info, &start).transactions, 1 + 6 + 1);
+    CHECK(!info.block_write);
+
+    // the thresholds bridging TIMING and INTERRUPT are not rewritten, and no block write is tried again
+    start = fake_bus_device_counters(&smbus_info);
+    CHECK_EQ(tsl2561_config_begin(&info), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_1X), ESP_OK);
+    CHECK_EQ(tsl2561_set_interrupt(&info, TSL2561_INTERRUPT_DISABLED, 0), ESP_OK);
+    CHECK_EQ(tsl2561_config_commit(&info), ESP_OK);
+    CHECK_EQ(_cost_since(&smbus_info, &start).transactions, 4);
+    CHECK_EQ(fake_bus_device_counters(&smbus_info).ops[FAKE_BUS_WRITE_BLOCK], 1);
+    CHECK_EQ(device.regs[1], TIMING_402MS_1X);
+    CHECK_EQ(device.regs[2] | device.regs[3] << 8, 100);
+    CHECK_EQ(device.regs[4] | device.regs[5] << 8, 1000);
+    CHECK_EQ(device.regs[6], TSL2561_INTERRUPT_DISABLED);
+    CHECK(!device.powered);
+
+    // a timed-out block write is recovered by byte writes, but block writes stay enabled
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_retries(&info, 0, 0), ESP_OK);
+    CHECK_EQ(tsl2561_config_begin(&info), ESP_OK);
+    _reconfigure(&info);
+    fake_bus_inject_faults(&smbus_info, 1, ESP_ERR_TIMEOUT);
+    host_log_quiet = true;
+    CHECK_EQ(tsl2561_config_commit(&info), ESP_OK);
+    host_log_quiet = false;
+    _check_device(&device);
+    CHECK(info.block_write);
+}
+
+static void _test_failed_commit(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_retries(&info, 0, 0), ESP_OK);
+    tsl2561_info_t before = info;
+
+    // the block write and its byte write fallback fail, so the driver state reverts and the cache
+    // no longer vouches for the device
+    CHECK_EQ(tsl2561_config_begin(&info), ESP_OK);
+    _reconfigure(&info);
+    fake_bus_inject_faults(&smbus_info, 16, ESP_FAIL);
+    host_log_quiet = true;
+    CHECK(tsl2561_config_commit(&info) != ESP_OK);
+    host_log_quiet = false;
+    fake_bus_inject_faults(&smbus_info, 0, ESP_OK);
+    CHECK(!info.config_open);
+    CHECK_EQ(info.integration_time, before.integration_time);
+    CHECK_EQ(info.gain, before.gain);
+    CHECK_EQ(info.channel_scale, before.channel_scale);
+
+    // so a retry writes the configuration in full
+    CHECK_EQ(tsl2561_config_begin(&info), ESP_OK);
+    _reconfigure(&info);
+    CHECK_EQ(tsl2561_config_commit(&info), ESP_OK);
+    _check_device(&device);
+}
+
+int main(int argc, char ** argv)
+{
+    _test_batched();
+    _test_superseded();
+    _test_abort();
+    _test_failed_commit();
+    _test_block_rejected();
+    return test_result("test_config");
+}
@@ -0,0 +1,176 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_continuous.c
+ * @brief Continuous acquisition: the device stays powered, each read returns a new conversion
+ *        with a single bus transaction, and the sample rate approaches the native conversion rate.
+ *        An oscillator up to 1/32 slow never yields the same conversion twice.
+ */
+
+#include <stdlib.h>
+
+#include "test_util.h"
+
+#define SAMPLES 200
+#define DRIFT_SAMPLES 10000
+
+static void _test_continuous(tsl2561_integration_time_t integration_time)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, integration_time, TSL2561_GAIN_16X), ESP_OK);
+    fake_tsl2561_set_light(&device, 20000.0, 5000.0);
+
+    uint32_t power_ups = device.power_ups;
+    CHECK_EQ(tsl2561_start_continuous(&info), ESP_OK);
+    host_log_quiet = true;
+    CHECK_EQ(tsl2561_start_measurement(&info), ESP_ERR_INVALID_STATE);
+    CHECK_EQ(tsl2561_start_continuous(&info), ESP_ERR_INVALID_STATE);
+    host_log_quiet = false;
+
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+
+    uint32_t transactions = test_transactions(&smbus_info);
+    uint32_t conversions = device.conversions;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < SAMPLES; ++i)
+    {
+        CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    double rate = SAMPLES * 1e6 / elapsed;
+    double native = 1e6 / fake_tsl2561_period_us(integration_time);
+    printf("continuous %lld us: %.1f samples/s, native %.1f, %.2f transactions/sample\n",
+           (long long)fake_tsl2561_period_us(integration_time), rate, native,
+           (double)(test_transactions(&smbus_info) - transactions) / SAMPLES);
+
+    // a new conversion for each result, skipping at most one in 32 for the oscillator margin,
+    // no power cycling, and one transaction per sample
+    CHECK(rate >= native * 0.95);
+    CHECK_EQ(device.power_ups, power_ups + 1);
+    CHECK(device.powered);
+    CHECK_EQ(device.duplicate_reads, 0);
+    CHECK_EQ(device.premature_reads, 0);
+    CHECK(device.conversions - conversions >= SAMPLES);
+    CHECK(device.conversions - conversions <= SAMPLES + SAMPLES / 32 + 1);
+    CHECK_EQ(test_transactions(&smbus_info) - transactions, SAMPLES);
+
+    CHECK_EQ(tsl2561_stop_measurement(&info), ESP_OK);
+    CHECK(!device.powered);
+}
+
+static void _test_drift(double oscillator)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_16X), ESP_OK);
+    fake_tsl2561_set_light(&device, 20000.0, 5000.0);
+    device.oscillator = oscillator;
+    CHECK_EQ(tsl2561_start_continuous(&info), ESP_OK);
+
+    // reads keep to a grid of slots 1/32 longer than the nominal period, whatever the oscillator,
+    // and with a nominal oscillator each result's timestamps are the device's own
+    int64_t period = fake_tsl2561_period_us(TSL2561_INTEGRATION_TIME_13MS);
+    int64_t slot = period + period / 32;
+    int64_t error_max = 0;
+    int64_t first_us = 0;
+    for (int i = 0; i < DRIFT_SAMPLES; ++i)
+    {
+        tsl2561_visible_t visible = 0;
+        tsl2561_infrared_t infrared = 0;
+        CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+        first_us = i == 1 ? esp_timer_get_time() : first_us;
+
+        // the latest conversion ended where the device's current cycle began
+        int64_t start_us = 0;
+        int64_t end_us = 0;
+        CHECK_EQ(tsl2561_get_result_timestamps(&info, &start_us, &end_us), ESP_OK);
+        int64_t error = end_us > device.cycle_start_us ? end_us - device.cycle_start_us : device.cycle_start_us - end_us;
+        error_max = error > error_max ? error : error_max;
+    }
+    int64_t drift = esp_timer_get_time() - first_us - (DRIFT_SAMPLES - 2) * slot;
+    printf("oscillator %.4f: %u conversions, %u reads, %u duplicate, %u premature, %lld us schedule drift, "
+           "%lld us maximum end time error\n", oscillator, device.conversions, device.data_reads,
+           device.duplicate_reads, device.premature_reads, (long long)drift, (long long)error_max);
+
+    CHECK_EQ(device.duplicate_reads, 0);
+    CHECK_EQ(device.premature_reads, 0);
+    CHECK(llabs(drift) < period / 32);
+    if (oscillator == 1.0)
+    {
+        CHECK(error_max < period / 32);
+    }
+    CHECK_EQ(host_clock_get_stats().spins, 0);
+    CHECK_EQ(tsl2561_stop_measurement(&info), ESP_OK);
+}
+
+static void _test_change_range(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    fake_tsl2561_set_light(&device, 20000.0, 5000.0);
+    uint32_t power_ups = device.power_ups;
+    CHECK_EQ(tsl2561_start_continuous(&info), ESP_OK);
+
+    // a result after changing range comes from an integration in the new range
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_16X), ESP_OK);
+    CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+
+    uint16_t ch0 = 0;
+    uint16_t ch1 = 0;
+    fake_tsl2561_counts(TSL2561_INTEGRATION_TIME_13MS | TSL2561_GAIN_16X, 0, 20000.0, 5000.0, &ch0, &ch1);
+    CHECK_EQ(visible + infrared, ch0);
+    CHECK_EQ(infrared, ch1);
+    CHECK_EQ(device.premature_reads, 0);
+
+    // the range change restarts integration with a power cycle
+    CHECK_EQ(device.power_ups, power_ups + 2);
+    CHECK_EQ(tsl2561_stop_measurement(&info), ESP_OK);
+}
+
+int main(void)
+{
+    _test_continuous(TSL2561_INTEGRATION_TIME_13MS);
+    _test_continuous(TSL2561_INTEGRATION_TIME_101MS);
+    _test_continuous(TSL2561_INTEGRATION_TIME_402MS);
+    _test_drift(1.0);
+    _test_drift(1.03);
+    _test_drift(1.03125);
+    _test_drift(0.97);
+    _test_drift(0.9);
+    _test_change_range();
+    return test_result("test_continuous");
+}
@@ -0,0 +1,107 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_device.c
+ * @brief Drive the emulated device through the basic driver API, checking identification,
+ *        channel values, measurement timing and bus usage.
+ */
+
+#include "test_util.h"
+
+static void _test_identify(uint8_t id, tsl2561_device_type_t expected)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, id), ESP_OK);
+
+    tsl2561_device_type_t type = 0;
+    tsl2561_revision_t revision = 0;
+    CHECK_EQ(tsl2561_device_id(&info, &type, &revision), ESP_OK);
+    CHECK_EQ(type, expected);
+    CHECK_EQ(revision, 0);
+}
+
+static void _test_read(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    fake_tsl2561_set_light(&device, 16000.0, 4000.0);
+
+    for (size_t r = 0; r < 3; ++r)
+    {
+        static const tsl2561_integration_time_t TIMES[] = { TSL2561_INTEGRATION_TIME_13MS, TSL2561_INTEGRATION_TIME_101MS, TSL2561_INTEGRATION_TIME_402MS };
+        CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TIMES[r], TSL2561_GAIN_16X), ESP_OK);
+
+        uint16_t ch0 = 0;
+        uint16_t ch1 = 0;
+        fake_tsl2561_counts(TIMES[r] | TSL2561_GAIN_16X, 0, 16000.0, 4000.0, &ch0, &ch1);
+
+        int64_t start = esp_timer_get_time();
+        tsl2561_visible_t visible = 0;
+        tsl2561_infrared_t infrared = 0;
+        CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+        int64_t elapsed = esp_timer_get_time() - start;
+
+        CHECK_EQ(visible + infrared, ch0);
+        CHECK_EQ(infrared, ch1);
+
+        // a single-shot read waits for one integration, and not much more
+        int64_t period = fake_tsl2561_period_us(TIMES[r]);
+        CHECK(elapsed >= period);
+        CHECK(elapsed <= period + period / 8 + 2 * HOST_TICK_US);
+        CHECK(!device.powered);
+    }
+    CHECK_EQ(device.premature_reads, 0);
+    CHECK_EQ(device.duplicate_reads, 0);
+    CHECK_EQ(fake_bus_device_counters(&smbus_info).errors, 0);
+}
+
+static void _test_absent(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    smbus_info_t other;
+    tsl2561_info_t info;
+    test_attach(&device, &smbus_info, FAKE_TSL2561_ID_TSL2561CS);
+    smbus_init(&other, TEST_PORT, TEST_ADDRESS + 1);
+
+    host_log_quiet = true;
+    CHECK(tsl2561_init(&info, &other) != ESP_OK);
+    host_log_quiet = false;
+}
+
+int main(void)
+{
+    _test_identify(FAKE_TSL2561_ID_TSL2560CS, TSL2561_DEVICE_TYPE_TSL2560CS);
+    _test_identify(FAKE_TSL2561_ID_TSL2561CS, TSL2561_DEVICE_TYPE_TSL2561CS);
+    _test_identify(FAKE_TSL2561_ID_TSL2560T_FN_CL, TSL2561_DEVICE_TYPE_TSL2560T_FN_CL);
+    _test_identify(FAKE_TSL2561_ID_TSL2561T_FN_CL, TSL2561_DEVICE_TYPE_TSL2561T_FN_CL);
+    _test_read();
+    _test_absent();
+    return test_result("test_device");
+}
@@ -0,0 +1,197 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_faults.c
+ * @brief Bus error recovery: a transient error costs one retried transaction rather than a sample,
+ *        retries back off, and every error path leaves the device powered down with the driver's
+ *        power state in agreement with the device.
+ */
+
+#include "test_util.h"
+
+// Transactions of a single measurement with block reads
+#define TRANSACTION_POWER_UP   0
+#define TRANSACTION_DATA       1
+#define TRANSACTION_POWER_DOWN 2
+
+static const char * _transaction_names[] = { "power up", "data", "power down" };
+
+// Fail a run of transactions, counted from when the fault is armed
+typedef struct
+{
+    uint32_t seen;
+    uint32_t first;
+    uint32_t count;
+    esp_err_t error;
+} fault_t;
+
+static void _fault_monitor(void * context, const smbus_info_t * smbus_info, fake_bus_op_t op, uint8_t command)
+{
+    fault_t * fault = (fault_t *)context;
+    if (fault->seen >= fault->first && fault->seen < fault->first + fault->count)
+    {
+        fake_bus_inject_faults(smbus_info, 1, fault->error);
+    }
+    ++fault->seen;
+}
+
+static void _arm(fault_t * fault, uint32_t first, uint32_t count, esp_err_t error)
+{
+    *fault = (fault_t){ .first = first, .count = count, .error = error };
+    fake_bus_set_monitor(_fault_monitor, fault);
+}
+
+static void _setup(fake_tsl2561_t * device, smbus_info_t * smbus_info, tsl2561_info_t * info,
+                   tsl2561_integration_time_t integration_time)
+{
+    CHECK_EQ(test_setup(device, smbus_info, info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(info, integration_time, TSL2561_GAIN_1X), ESP_OK);
+    fake_tsl2561_set_light(device, 20000.0, 5000.0);
+}
+
+// Time and transactions taken by a read
+static esp_err_t _timed_read(tsl2561_info_t * info, const smbus_info_t * smbus_info, int64_t * elapsed, uint32_t * transactions)
+{
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    uint32_t start_transactions = test_transactions(smbus_info);
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = tsl2561_read(info, &visible, &infrared);
+    *elapsed = esp_timer_get_time() - start;
+    *transactions = test_transactions(smbus_info) - start_transactions;
+    return err;
+}
+
+static void _test_transient(esp_err_t error)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    int64_t baseline = 0;
+    uint32_t transactions = 0;
+    _setup(&device, &smbus_info, &info, TSL2561_INTEGRATION_TIME_402MS);
+    CHECK_EQ(_timed_read(&info, &smbus_info, &baseline, &transactions), ESP_OK);
+    CHECK_EQ(transactions, 3);
+
+    for (uint32_t k = TRANSACTION_POWER_UP; k <= TRANSACTION_POWER_DOWN; ++k)
+    {
+        fault_t fault;
+        int64_t elapsed = 0;
+        uint32_t data_reads = device.data_reads;
+        _arm(&fault, k, 1, error);
+        host_log_quiet = true;
+        CHECK_EQ(_timed_read(&info, &smbus_info, &elapsed, &transactions), ESP_OK);
+        host_log_quiet = false;
+        fake_bus_set_monitor(NULL, NULL);
+
+        // one retried transaction, the same sample, and no second integration
+        printf("transient %s on %-10s: %u transactions, %lld us more than without the error\n",
+               error == ESP_ERR_TIMEOUT ? "timeout" : "NACK", _transaction_names[k], transactions,
+               (long long)(elapsed - baseline));
+        CHECK_EQ(transactions, 4);
+        CHECK_EQ(device.data_reads - data_reads, 1);
+        CHECK(elapsed - baseline < HOST_TICK_US);
+        CHECK(!device.powered);
+        CHECK_EQ(info.powered, device.powered);
+    }
+}
+
+static void _test_persistent(void)
+{
+    const uint8_t retries = 2;
+    for (uint32_t k = TRANSACTION_POWER_UP; k <= TRANSACTION_POWER_DOWN; ++k)
+    {
+        fake_tsl2561_t device;
+        smbus_info_t smbus_info;
+        tsl2561_info_t info;
+        _setup(&device, &smbus_info, &info, TSL2561_INTEGRATION_TIME_13MS);
+        CHECK_EQ(tsl2561_set_retries(&info, retries, 100), ESP_OK);
+
+        // the data fetch falls back from the block read to word reads, so both must fail
+        fault_t fault;
+        int64_t elapsed = 0;
+        uint32_t transactions = 0;
+        _arm(&fault, k, k == TRANSACTION_DATA ? 2 * (retries + 1) : retries + 1, ESP_FAIL);
+        host_log_quiet = true;
+        CHECK(_timed_read(&info, &smbus_info, &elapsed, &transactions) != ESP_OK);
+        host_log_quiet = false;
+        fake_bus_set_monitor(NULL, NULL);
+
+        // the device is powered down, even when the power-down itself failed, and the driver agrees
+        printf("persistent NACK on %-10s: %u transactions, device %s\n", _transaction_names[k], transactions,
+               device.powered ? "powered" : "powered down");
+        CHECK(!device.powered);
+        CHECK_EQ(info.powered, device.powered);
+        CHECK_EQ(info.measurement_state, TSL2561_MEASUREMENT_IDLE);
+
+        // and the next measurement succeeds once the bus recovers
+        CHECK_EQ(_timed_read(&info, &smbus_info, &elapsed, &transactions), ESP_OK);
+        CHECK(!device.powered);
+        CHECK(!info.powered);
+    }
+}
+
+static void _test_backoff(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    _setup(&device, &smbus_info, &info, TSL2561_INTEGRATION_TIME_13MS);
+    fake_bus_set_clock_hz(0);
+
+    // each retry waits twice as long as the one before
+    const uint32_t backoff = 1000;
+    CHECK_EQ(tsl2561_set_retries(&info, 3, backoff), ESP_OK);
+    fault_t fault;
+    int64_t elapsed = 0;
+    uint32_t transactions = 0;
+    _arm(&fault, 0, 4, ESP_FAIL);
+    host_log_quiet = true;
+    CHECK(_timed_read(&info, &smbus_info, &elapsed, &transactions) != ESP_OK);
+    host_log_quiet = false;
+    fake_bus_set_monitor(NULL, NULL);
+    CHECK_EQ(transactions, 4 + 1);  // four attempts, then the power state is read back
+    CHECK(elapsed >= backoff + 2 * backoff + 4 * backoff);
+    CHECK(elapsed < backoff + 2 * backoff + 4 * backoff + HOST_TICK_US);
+
+    // errors other than a NACK or timeout are not retried
+    _arm(&fault, 0, 1, ESP_ERR_INVALID_STATE);
+    host_log_quiet = true;
+    CHECK(_timed_read(&info, &smbus_info, &elapsed, &transactions) != ESP_OK);
+    host_log_quiet = false;
+    fake_bus_set_monitor(NULL, NULL);
+    CHECK_EQ(transactions, 1 + 1);
+    CHECK(!device.powered);
+    CHECK_EQ(info.powered, device.powered);
+}
+
+int main(int argc, char ** argv)
+{
+    _test_transient(ESP_FAIL);
+    _test_transient(ESP_ERR_TIMEOUT);
+    _test_persistent();
+    _test_backoff();
+    return test_result("test_faults");
+}
@@ -0,0 +1,282 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_filter.c
+ * @brief Channel data filters: output against a floating-point reference for every window size,
+ *        noise reduction with continuous acquisition, reset on a range change, and cost per sample.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "tsl2561_filter.h"
+#include "test_util.h"
+
+#define REFERENCE_SAMPLES 500
+#define NOISE_OUTPUTS     64
+#define NOISE_WINDOW      8
+#define COST_SAMPLES      1000000
+
+static const char * _type_names[] = { "moving average", "exponential", "median" };
+
+// Deterministic pseudo-random sequence, so that failures are reproducible
+static uint32_t _random(uint32_t * state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+static int _compare_double(const void * a, const void * b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Expected output of the window ending at sample n, in floating point
+static double _reference(tsl2561_filter_type_t type, uint8_t window, const uint16_t * samples, size_t n, double * ema)
+{
+    double result = 0.0;
+    size_t count = n + 1 < window ? n + 1 : window;
+    if (type == TSL2561_FILTER_EXPONENTIAL)
+    {
+        *ema = n == 0 ? samples[0] : *ema + (samples[n] - *ema) / window;
+        result = *ema;
+    }
+    else if (type == TSL2561_FILTER_MEDIAN)
+    {
+        double sorted[TSL2561_FILTER_WINDOW_MAX];
+        for (size_t i = 0; i < count; ++i)
+        {
+            sorted[i] = samples[n - i];
+        }
+        qsort(sorted, count, sizeof(sorted[0]), _compare_double);
+        result = count & 1 ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) / 2.0;
+    }
+    else
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            result += samples[n - i];
+        }
+        result /= count;
+    }
+    return result;
+}
+
+static void _test_reference(tsl2561_filter_type_t type)
+{
+    uint16_t ch0[REFERENCE_SAMPLES];
+    uint16_t ch1[REFERENCE_SAMPLES];
+    uint32_t state = 1;
+    for (size_t i = 0; i < REFERENCE_SAMPLES; ++i)
+    {
+        // a slow ramp with noise, and an occasional spike for the median to reject
+        ch0[i] = (uint16_t)(2000 + 4 * i + _random(&state) % 200 + (i % 37 == 0 ? 30000 : 0));
+        ch1[i] = (uint16_t)(ch0[i] / 4 + _random(&state) % 50);
+    }
+
+    double max_error = 0.0;
+    for (uint8_t window = 1; window <= TSL2561_FILTER_WINDOW_MAX; ++window)
+    {
+        tsl2561_filter_t filter;
+        CHECK_EQ(tsl2561_filter_init(&filter, type, window), ESP_OK);
+        double ema0 = 0.0;
+        double ema1 = 0.0;
+        for (size_t n = 0; n < REFERENCE_SAMPLES; ++n)
+        {
+            tsl2561_visible_t visible = 0;
+            tsl2561_infrared_t infrared = 0;
+            CHECK_EQ(tsl2561_filter_update(&filter, ch0[n] - ch1[n], ch1[n], &visible, &infrared), ESP_OK);
+            double expected0 = _reference(type, window, ch0, n, &ema0);
+            double expected1 = _reference(type, window, ch1, n, &ema1);
+
+            // averages are rounded to the nearest count; the exponential average accumulates truncation
+            double tolerance = type == TSL2561_FILTER_EXPONENTIAL ? 1.0 : 0.5;
+            double error0 = fabs(visible + infrared - expected0);
+            double error1 = fabs(infrared - expected1);
+            CHECK(error0 <= tolerance);
+            CHECK(error1 <= tolerance);
+            max_error = fmax(max_error, fmax(error0, error1));
+        }
+    }
+    printf("%-14s: max error %.2f counts against the reference, windows 1 to %d\n",
+           _type_names[type], max_error, TSL2561_FILTER_WINDOW_MAX);
+}
+
+// Light with approximately normal noise, of 5% standard deviation about a constant level, that varies with time
+static void _noisy_light(void * context, int64_t time_us, double * channel0, double * channel1)
+{
+    // hash the time so that the noise of successive conversions is independent
+    uint32_t state = (uint32_t)(time_us / 1000);
+    state = (state ^ (state >> 16)) * 0x45d9f3bu;
+    state = (state ^ (state >> 16)) * 0x45d9f3bu;
+    state ^= state >> 16;
+
+    // the sum of four uniform variables, each with a variance of 1/12
+    double noise = -2.0;
+    for (int i = 0; i < 4; ++i)
+    {
+        noise += (_random(&state) & 0xffff) / 65536.0;
+    }
+    *channel0 = 20000.0 * (1.0 + 0.05 * noise / sqrt(4.0 / 12.0));
+    *channel1 = 5000.0 * (1.0 + 0.05 * noise / sqrt(4.0 / 12.0));
+}
+
+static double _std_dev(const double * values, size_t count)
+{
+    double mean = 0.0;
+    double squares = 0.0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        mean += values[i];
+    }
+    mean /= count;
+    for (size_t i = 0; i < count; ++i)
+    {
+        squares += (values[i] - mean) * (values[i] - mean);
+    }
+    return sqrt(squares / count);
+}
+
+// N short integrations in continuous acquisition replace one long one
+static void _test_noise(tsl2561_filter_type_t type)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_16X), ESP_OK);
+    device.light = _noisy_light;
+
+    tsl2561_filter_t filter;
+    CHECK_EQ(tsl2561_filter_init(&filter, type, NOISE_WINDOW), ESP_OK);
+    CHECK_EQ(tsl2561_start_continuous(&info), ESP_OK);
+    uint32_t power_ups = device.power_ups;
+
+    double raw[NOISE_OUTPUTS];
+    double filtered[NOISE_OUTPUTS];
+    for (size_t i = 0; i < NOISE_OUTPUTS; ++i)
+    {
+        tsl2561_visible_t visible = 0;
+        tsl2561_infrared_t infrared = 0;
+        CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+        raw[i] = tsl2561_compute_lux(&info, visible, infrared);
+        CHECK_EQ(tsl2561_filter_read(&filter, &info, NOISE_WINDOW, &visible, &infrared), ESP_OK);
+        filtered[i] = tsl2561_compute_lux(&info, visible, infrared);
+    }
+    CHECK_EQ(device.power_ups, power_ups);
+    CHECK_EQ(device.duplicate_reads, 0);
+    CHECK_EQ(tsl2561_stop_measurement(&info), ESP_OK);
+
+    double raw_noise = _std_dev(raw, NOISE_OUTPUTS);
+    double filtered_noise = _std_dev(filtered, NOISE_OUTPUTS);
+    printf("%-14s: lux std dev %.1f from single 13 ms samples, %.1f filtered over %d\n",
+           _type_names[type], raw_noise, filtered_noise, NOISE_WINDOW);
+    // 1/sqrt(8) for the mean, and the median is about 64% as efficient for normal noise
+    CHECK(filtered_noise < raw_noise * (type == TSL2561_FILTER_MEDIAN ? 0.6 : 0.5));
+}
+
+static void _test_range_change(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_16X), ESP_OK);
+    fake_tsl2561_set_light(&device, 2000.0, 500.0);
+
+    tsl2561_filter_t filter;
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    CHECK_EQ(tsl2561_filter_init(&filter, TSL2561_FILTER_MOVING_AVERAGE, NOISE_WINDOW), ESP_OK);
+    CHECK_EQ(tsl2561_start_continuous(&info), ESP_OK);
+    CHECK_EQ(tsl2561_filter_read(&filter, &info, NOISE_WINDOW, &visible, &infrared), ESP_OK);
+    CHECK_EQ(filter.count, NOISE_WINDOW);
+
+    // the channels saturate, so auto-ranging steps down and the filter starts again in the new range
+    fake_tsl2561_set_light(&device, 200000.0, 50000.0);
+    CHECK_EQ(tsl2561_set_auto_range(&info, true), ESP_OK);
+    CHECK_EQ(tsl2561_filter_read(&filter, &info, 1, &visible, &infrared), ESP_OK);
+    CHECK(info.integration_time != TSL2561_INTEGRATION_TIME_101MS || info.gain != TSL2561_GAIN_16X);
+    CHECK_EQ(filter.count, 1);
+    CHECK_EQ(filter.integration_time, info.integration_time);
+    CHECK_EQ(filter.gain, info.gain);
+
+    uint16_t ch0 = 0;
+    uint16_t ch1 = 0;
+    fake_tsl2561_counts(info.integration_time | info.gain, 0, 200000.0, 50000.0, &ch0, &ch1);
+    CHECK_EQ(visible + infrared, ch0);
+    CHECK_EQ(infrared, ch1);
+    CHECK_EQ(tsl2561_stop_measurement(&info), ESP_OK);
+}
+
+static void _test_cost(tsl2561_filter_type_t type)
+{
+    static uint16_t samples[4096];
+    uint32_t state = 7;
+    for (size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); ++i)
+    {
+        samples[i] = (uint16_t)(1000 + _random(&state) % 30000);
+    }
+
+    tsl2561_filter_t filter;
+    CHECK_EQ(tsl2561_filter_init(&filter, type, TSL2561_FILTER_WINDOW_MAX), ESP_OK);
+    uint64_t checksum = 0;
+    int64_t start = test_wall_ns();
+    for (size_t i = 0; i < COST_SAMPLES; ++i)
+    {
+        uint16_t ch0 = samples[i & 4095];
+        uint16_t ch1 = ch0 / 4;
+        tsl2561_visible_t visible = 0;
+        tsl2561_infrared_t infrared = 0;
+        tsl2561_filter_update(&filter, ch0 - ch1, ch1, &visible, &infrared);
+        checksum += visible + infrared;
+    }
+    double ns = (double)(test_wall_ns() - start) / COST_SAMPLES;
+    printf("%-14s: %.1f ns per sample, window %d (checksum %llu)\n",
+           _type_names[type], ns, TSL2561_FILTER_WINDOW_MAX, (unsigned long long)checksum);
+
+    // far below the shortest integration, even on a slow host
+    CHECK(ns < 13700.0 * 1000.0 / 100.0);
+}
+
+int main(int argc, char ** argv)
+{
+    for (int type = TSL2561_FILTER_MOVING_AVERAGE; type <= TSL2561_FILTER_MEDIAN; ++type)
+    {
+        _test_reference(type);
+    }
+    for (int type = TSL2561_FILTER_MOVING_AVERAGE; type <= TSL2561_FILTER_MEDIAN; ++type)
+    {
+        _test_noise(type);
+    }
+    _test_range_change();
+    for (int type = TSL2561_FILTER_MOVING_AVERAGE; type <= TSL2561_FILTER_MEDIAN; ++type)
+    {
+        _test_cost(type);
+    }
+    return test_result("test_filter");
+}
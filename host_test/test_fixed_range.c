@@ -0,0 +1,178 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_fixed_range.c
+ * @brief With the range fixed by configuration, the Lux calculation uses the coefficients of each
+ *        device type, or of the configured package, and the driver keeps the device in the configured
+ *        range through initialisation and resync, whatever range the device held.
+ */
+
+#include "baseline_lux.h"
+#include "test_util.h"
+
+#ifndef CONFIG_TSL2561_FIXED_RANGE
+#  error "test_fixed_range requires a build with CONFIG_TSL2561_FIXED_RANGE"
+#endif
+
+#if defined(CONFIG_TSL2561_FIXED_INTEGRATION_TIME_13MS)
+#  define FIXED_INTEGRATION_TIME TSL2561_INTEGRATION_TIME_13MS
+#elif defined(CONFIG_TSL2561_FIXED_INTEGRATION_TIME_101MS)
+#  define FIXED_INTEGRATION_TIME TSL2561_INTEGRATION_TIME_101MS
+#else
+#  define FIXED_INTEGRATION_TIME TSL2561_INTEGRATION_TIME_402MS
+#endif
+
+#if defined(CONFIG_TSL2561_FIXED_GAIN_16X)
+#  define FIXED_GAIN TSL2561_GAIN_16X
+#else
+#  define FIXED_GAIN TSL2561_GAIN_1X
+#endif
+
+// a range the build does not support
+#define OTHER_INTEGRATION_TIME (FIXED_INTEGRATION_TIME == TSL2561_INTEGRATION_TIME_13MS \
+                                ? TSL2561_INTEGRATION_TIME_402MS : TSL2561_INTEGRATION_TIME_13MS)
+#define OTHER_GAIN             TSL2561_GAIN_1X
+
+#define FIXED_TIMING (FIXED_INTEGRATION_TIME | FIXED_GAIN)
+#define OTHER_TIMING (OTHER_INTEGRATION_TIME | OTHER_GAIN)
+
+// baseline_compute_lux() device type that selects the expected coefficients
+#define BASELINE_CS 1
+#define BASELINE_T  5
+
+typedef struct
+{
+    uint8_t id;
+    tsl2561_device_type_t device_type;
+    uint8_t baseline_type;
+} device_t;
+
+static const device_t DEVICES[] = {
+#if defined(CONFIG_TSL2561_PACKAGE_T_FN_CL)
+    { FAKE_TSL2561_ID_TSL2560CS,      TSL2561_DEVICE_TYPE_TSL2560CS,      BASELINE_T },
+    { FAKE_TSL2561_ID_TSL2561CS,      TSL2561_DEVICE_TYPE_TSL2561CS,      BASELINE_T },
+#else
+    { FAKE_TSL2561_ID_TSL2560CS,      TSL2561_DEVICE_TYPE_TSL2560CS,      BASELINE_CS },
+    { FAKE_TSL2561_ID_TSL2561CS,      TSL2561_DEVICE_TYPE_TSL2561CS,      BASELINE_CS },
+#endif
+#if defined(CONFIG_TSL2561_PACKAGE_CS)
+    { FAKE_TSL2561_ID_TSL2560T_FN_CL, TSL2561_DEVICE_TYPE_TSL2560T_FN_CL, BASELINE_CS },
+    { FAKE_TSL2561_ID_TSL2561T_FN_CL, TSL2561_DEVICE_TYPE_TSL2561T_FN_CL, BASELINE_CS },
+#else
+    { FAKE_TSL2561_ID_TSL2560T_FN_CL, TSL2561_DEVICE_TYPE_TSL2560T_FN_CL, BASELINE_T },
+    { FAKE_TSL2561_ID_TSL2561T_FN_CL, TSL2561_DEVICE_TYPE_TSL2561T_FN_CL, BASELINE_T },
+#endif
+};
+
+#define NUM_DEVICES (sizeof(DEVICES) / sizeof(DEVICES[0]))
+
+static void _test_coefficients(const device_t * device)
+{
+    tsl2561_info_t info;
+    host_log_quiet = true;
+    CHECK_EQ(tsl2561_init_detached(&info, device->device_type, OTHER_INTEGRATION_TIME, OTHER_GAIN), ESP_ERR_NOT_SUPPORTED);
+    host_log_quiet = false;
+    CHECK_EQ(tsl2561_init_detached(&info, device->device_type, FIXED_INTEGRATION_TIME, FIXED_GAIN), ESP_OK);
+
+    // strided over the input space, covering every ratio segment
+    uint32_t mismatches = 0;
+    for (uint32_t visible = 0; visible <= 0xffff; visible += 61)
+    {
+        for (uint32_t infrared = 0; infrared <= 0xffff; infrared += 53)
+        {
+            uint32_t expected = baseline_compute_lux(FIXED_INTEGRATION_TIME, FIXED_GAIN, device->baseline_type, visible, infrared);
+            mismatches += tsl2561_compute_lux(&info, visible, infrared) != expected;
+        }
+    }
+    CHECK_EQ(mismatches, 0);
+}
+
+static void _check_read(fake_tsl2561_t * device, tsl2561_info_t * info, uint8_t baseline_type)
+{
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    CHECK_EQ(tsl2561_read(info, &visible, &infrared), ESP_OK);
+
+    uint16_t ch0 = 0;
+    uint16_t ch1 = 0;
+    fake_tsl2561_counts(FIXED_TIMING, 0, device->channel0, device->channel1, &ch0, &ch1);
+    CHECK_EQ(visible + infrared, ch0);
+    CHECK_EQ(infrared, ch1);
+    CHECK_EQ(tsl2561_compute_lux(info, visible, infrared),
+             baseline_compute_lux(FIXED_INTEGRATION_TIME, FIXED_GAIN, baseline_type, visible, infrared));
+}
+
+static void _test_range_restored(const device_t * type)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+
+    // a device left in another range, as after a processor reset, is returned to the configured range
+    test_attach(&device, &smbus_info, type->id);
+    fake_tsl2561_set_light(&device, 2000.0, 500.0);
+    device.regs[1] = OTHER_TIMING;
+    CHECK_EQ(tsl2561_init(&info, &smbus_info), ESP_OK);
+    CHECK_EQ(device.regs[1], FIXED_TIMING);
+    CHECK_EQ(info.integration_time, FIXED_INTEGRATION_TIME);
+    CHECK_EQ(info.gain, FIXED_GAIN);
+    CHECK(!device.powered);
+    _check_read(&device, &info, type->baseline_type);
+
+    // a brown-out returns the device to its power-on range, which resync replaces
+    fake_tsl2561_brown_out(&device);
+    CHECK(device.regs[1] != FIXED_TIMING);
+    CHECK_EQ(tsl2561_resync(&info), ESP_OK);
+    CHECK_EQ(device.regs[1], FIXED_TIMING);
+    CHECK_EQ(info.integration_time, FIXED_INTEGRATION_TIME);
+    CHECK_EQ(info.gain, FIXED_GAIN);
+    _check_read(&device, &info, type->baseline_type);
+
+    // likewise during continuous acquisition, which restarts in the configured range
+    CHECK_EQ(tsl2561_start_continuous(&info), ESP_OK);
+    _check_read(&device, &info, type->baseline_type);
+    device.regs[1] = OTHER_TIMING;
+    CHECK_EQ(tsl2561_resync(&info), ESP_OK);
+    CHECK_EQ(device.regs[1], FIXED_TIMING);
+    CHECK(device.powered);
+    _check_read(&device, &info, type->baseline_type);
+    CHECK_EQ(device.premature_reads, 0);
+    CHECK_EQ(tsl2561_stop_measurement(&info), ESP_OK);
+
+    // a device already in the configured range is left alone
+    uint32_t transactions = test_transactions(&smbus_info);
+    CHECK_EQ(tsl2561_resync(&info), ESP_OK);
+    CHECK_EQ(test_transactions(&smbus_info) - transactions, 5);
+}
+
+int main(void)
+{
+    for (size_t i = 0; i < NUM_DEVICES; ++i)
+    {
+        _test_coefficients(&DEVICES[i]);
+        _test_range_restored(&DEVICES[i]);
+    }
+    return test_result("test_fixed_range");
+}
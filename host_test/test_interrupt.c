@@ -0,0 +1,133 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_interrupt.c
+ * @brief Threshold interrupts: the emulated device drives the INT line into tsl2561_interrupt_isr(),
+ *        and the waiting task only touches the bus once the light leaves the threshold window.
+ */
+
+#include "test_util.h"
+
+#define STEP_US 5000000   // time at which the light level steps up
+
+static void _light(void * context, int64_t time_us, double * channel0, double * channel1)
+{
+    (void)context;
+    *channel0 = time_us < STEP_US ? 8000.0 : 40000.0;
+    *channel1 = *channel0 / 4;
+}
+
+static void _test_window(uint8_t persistence)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    device.light = _light;
+    device.isr = tsl2561_interrupt_isr;
+    device.isr_arg = &info;
+
+    // 101 ms at 16x: 8000 -> 2012 counts, 40000 -> 10062 counts
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_16X), ESP_OK);
+    CHECK_EQ(tsl2561_set_thresholds(&info, 1000, 4000), ESP_OK);
+    CHECK_EQ(tsl2561_set_interrupt(&info, TSL2561_INTERRUPT_LEVEL, persistence), ESP_OK);
+    CHECK_EQ(tsl2561_start_continuous(&info), ESP_OK);
+
+    // no interrupt, and no bus traffic, while the light stays inside the window
+    uint32_t transactions = test_transactions(&smbus_info);
+    int timeouts = 0;
+    esp_err_t err = ESP_OK;
+    while ((err = tsl2561_wait_for_interrupt(&info, 100)) == ESP_ERR_TIMEOUT)
+    {
+        ++timeouts;
+    }
+    CHECK_EQ(err, ESP_OK);
+    CHECK_EQ(timeouts, STEP_US / (100 * HOST_TICK_US));
+    CHECK_EQ(test_transactions(&smbus_info), transactions);
+
+    // the interrupt follows the step after the configured number of out-of-range conversions
+    int64_t latency = esp_timer_get_time() - STEP_US;
+    int64_t period = fake_tsl2561_period_us(TSL2561_INTEGRATION_TIME_101MS);
+    int64_t conversions = persistence > 0 ? persistence : 1;
+    CHECK(latency >= (conversions - 1) * period);
+    CHECK(latency <= (conversions + 1) * period + HOST_TICK_US);
+    printf("persistence %u: interrupt %lld us after the step\n", persistence, (long long)latency);
+
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    CHECK_EQ(tsl2561_handle_interrupt(&info, &visible, &infrared), ESP_OK);
+    CHECK_EQ(visible + infrared, 10062);
+    CHECK(!device.interrupt);
+    CHECK_EQ(device.interrupts, 1);
+
+    // the level interrupt reasserts while the light stays outside the window
+    CHECK_EQ(tsl2561_wait_for_interrupt(&info, 100), ESP_OK);
+    CHECK_EQ(device.interrupts, 2);
+
+    CHECK_EQ(tsl2561_set_interrupt(&info, TSL2561_INTERRUPT_DISABLED, 0), ESP_OK);
+    CHECK_EQ(tsl2561_clear_interrupt(&info), ESP_OK);
+    CHECK_EQ(tsl2561_wait_for_interrupt(&info, 100), ESP_ERR_TIMEOUT);
+    CHECK_EQ(tsl2561_stop_measurement(&info), ESP_OK);
+}
+
+static void _test_every_conversion(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    device.isr = tsl2561_interrupt_isr;
+    device.isr_arg = &info;
+    fake_tsl2561_set_light(&device, 8000.0, 2000.0);
+
+    // persistence zero interrupts after every integration, regardless of the thresholds
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_16X), ESP_OK);
+    CHECK_EQ(tsl2561_set_interrupt(&info, TSL2561_INTERRUPT_LEVEL, 0), ESP_OK);
+    CHECK_EQ(tsl2561_start_continuous(&info), ESP_OK);
+    for (int i = 0; i < 20; ++i)
+    {
+        tsl2561_visible_t visible = 0;
+        tsl2561_infrared_t infrared = 0;
+        CHECK_EQ(tsl2561_wait_for_interrupt(&info, 10), ESP_OK);
+        CHECK_EQ(tsl2561_handle_interrupt(&info, &visible, &infrared), ESP_OK);
+    }
+    CHECK_EQ(device.duplicate_reads, 0);
+    CHECK_EQ(tsl2561_stop_measurement(&info), ESP_OK);
+
+    host_log_quiet = true;
+    CHECK_EQ(tsl2561_set_interrupt(&info, TSL2561_INTERRUPT_LEVEL, TSL2561_INTERRUPT_PERSISTENCE_MAX + 1), ESP_ERR_INVALID_ARG);
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    CHECK_EQ(tsl2561_handle_interrupt(&info, &visible, &infrared), ESP_ERR_INVALID_STATE);
+    host_log_quiet = false;
+}
+
+int main(void)
+{
+    _test_window(1);
+    _test_window(3);
+    _test_every_conversion();
+    return test_result("test_interrupt");
+}
@@ -0,0 +1,123 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_lux.c
+ * @brief Compare tsl2561_compute_lux() against an independent transcription of the datasheet
+ *        procedure, for every range and both package coefficient sets.
+ *
+ * By default every channel 0 value is paired with a stride of channel 1 values plus the values
+ * either side of each ratio breakpoint. --exhaustive checks every valid pair, ch1 <= ch0 <= clip,
+ * and --quick also strides channel 0.
+ */
+
+#include <stdio.h>
+
+#include "reference_lux.h"
+#include "test_util.h"
+
+#define CH1_STRIDE 97
+
+static const struct
+{
+    tsl2561_integration_time_t integration_time;
+    tsl2561_gain_t gain;
+    unsigned integration;
+    unsigned reference_gain;
+    uint32_t clip;
+} RANGES[] = {
+    { TSL2561_INTEGRATION_TIME_13MS,  TSL2561_GAIN_1X,  0, 0, 5047 },
+    { TSL2561_INTEGRATION_TIME_13MS,  TSL2561_GAIN_16X, 0, 1, 5047 },
+    { TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_1X,  1, 0, 37177 },
+    { TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_16X, 1, 1, 37177 },
+    { TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_1X,  2, 0, 65535 },
+    { TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_16X, 2, 1, 65535 },
+};
+
+static const struct
+{
+    tsl2561_device_type_t device_type;
+    int package;
+} PACKAGES[] = {
+    { TSL2561_DEVICE_TYPE_TSL2561T_FN_CL, REFERENCE_PACKAGE_T },
+    { TSL2561_DEVICE_TYPE_TSL2561CS,      REFERENCE_PACKAGE_CS },
+};
+
+// ratio breakpoints of both packages, as channel 1 / channel 0 in units of 2^-9
+static const uint32_t BREAKPOINTS[] = { 0x40, 0x43, 0x80, 0x85, 0xc0, 0xc8, 0x100, 0x10a, 0x138, 0x19a, 0x29a };
+
+static uint64_t _checked = 0;
+static uint64_t _mismatches = 0;
+
+static void _check(const tsl2561_info_t * info, unsigned integration, unsigned gain, int package, uint32_t ch0, uint32_t ch1)
+{
+    uint32_t actual = tsl2561_compute_lux(info, ch0 - ch1, ch1);
+    uint32_t expected = reference_lux(gain, integration, ch0, ch1, package);
+    ++_checked;
+    if (actual != expected)
+    {
+        if (_mismatches++ < 10)
+        {
+            fprintf(stderr, "mismatch: integration %u gain %u package %d ch0 %u ch1 %u: %u != %u\n",
+                    integration, gain, package, ch0, ch1, actual, expected);
+        }
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    bool exhaustive = test_flag(argc, argv, "--exhaustive");
+    uint32_t ch0_stride = test_flag(argc, argv, "--quick") ? 13 : 1;
+
+    for (size_t p = 0; p < sizeof(PACKAGES) / sizeof(PACKAGES[0]); ++p)
+    {
+        for (size_t r = 0; r < sizeof(RANGES) / sizeof(RANGES[0]); ++r)
+        {
+            tsl2561_info_t info;
+            CHECK_EQ(tsl2561_init_detached(&info, PACKAGES[p].device_type, RANGES[r].integration_time, RANGES[r].gain), ESP_OK);
+            uint64_t before = _mismatches;
+
+            for (uint32_t ch0 = 0; ch0 <= RANGES[r].clip; ch0 += exhaustive ? 1 : ch0_stride)
+            {
+                for (uint32_t ch1 = 0; ch1 <= ch0; ch1 += exhaustive ? 1 : CH1_STRIDE)
+                {
+                    _check(&info, RANGES[r].integration, RANGES[r].reference_gain, PACKAGES[p].package, ch0, ch1);
+                }
+
+                for (size_t k = 0; !exhaustive && k < sizeof(BREAKPOINTS) / sizeof(BREAKPOINTS[0]); ++k)
+                {
+                    uint32_t centre = (uint32_t)(((uint64_t)ch0 * BREAKPOINTS[k]) >> 9);
+                    for (uint32_t ch1 = centre > 2 ? centre - 2 : 0; ch1 <= centre + 2 && ch1 <= ch0; ++ch1)
+                    {
+                        _check(&info, RANGES[r].integration, RANGES[r].reference_gain, PACKAGES[p].package, ch0, ch1);
+                    }
+                }
+            }
+            CHECK_EQ(_mismatches - before, 0);
+        }
+    }
+
+    printf("checked %llu pairs, %llu mismatches\n", (unsigned long long)_checked, (unsigned long long)_mismatches);
+    return test_result("test_lux");
+}
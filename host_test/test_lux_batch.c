@@ -0,0 +1,119 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_lux_batch.c
+ * @brief tsl2561_compute_lux_batch() gives results identical to tsl2561_compute_lux() for a
+ *        million-sample buffer in every configuration, and for every value of each input against
+ *        the extremes of the other, so that each ratio breakpoint is met exactly. It validates
+ *        its arguments once.
+ */
+
+#include <stdlib.h>
+
+#include "test_util.h"
+
+#define SAMPLES 1000000
+#define SWEEP   65536
+
+static const uint16_t EXTREMES[] = { 0, 1, 2, 3, 100, 5047, 37177, 65534, 65535 };
+#define NUM_EXTREMES (sizeof(EXTREMES) / sizeof(EXTREMES[0]))
+
+// Compare the batch with the scalar path, returning the number of mismatches
+static size_t _compare(const tsl2561_info_t * info, const tsl2561_visible_t * visible,
+                       const tsl2561_infrared_t * infrared, uint32_t * lux, size_t count)
+{
+    size_t mismatches = 0;
+    CHECK_EQ(tsl2561_compute_lux_batch(info, visible, infrared, lux, count), ESP_OK);
+    for (size_t i = 0; i < count; ++i)
+    {
+        mismatches += lux[i] != tsl2561_compute_lux(info, visible[i], infrared[i]);
+    }
+    return mismatches;
+}
+
+int main(int argc, char ** argv)
+{
+    size_t samples = test_flag(argc, argv, "--quick") ? SAMPLES / 10 : SAMPLES;
+    size_t capacity = samples > 2 * NUM_EXTREMES * SWEEP ? samples : 2 * NUM_EXTREMES * SWEEP;
+    tsl2561_visible_t * visible = malloc(capacity * sizeof(*visible));
+    tsl2561_infrared_t * infrared = malloc(capacity * sizeof(*infrared));
+    tsl2561_visible_t * sweep_visible = malloc(capacity * sizeof(*sweep_visible));
+    tsl2561_infrared_t * sweep_infrared = malloc(capacity * sizeof(*sweep_infrared));
+    uint32_t * lux = malloc(capacity * sizeof(*lux));
+    CHECK(visible != NULL && infrared != NULL && sweep_visible != NULL && sweep_infrared != NULL && lux != NULL);
+
+    uint32_t state = 12345;
+    for (size_t i = 0; i < samples; ++i)
+    {
+        // full 16-bit range of both inputs, including sums that wrap intermediate values
+        state = state * 1664525 + 1013904223;
+        visible[i] = state >> 16;
+        infrared[i] = i % 4 == 0 ? (uint16_t)state : (state >> 16) / ((i % 7) + 1);
+    }
+
+    size_t sweep = 0;
+    for (size_t e = 0; e < NUM_EXTREMES; ++e)
+    {
+        for (uint32_t v = 0; v < SWEEP; ++v)
+        {
+            sweep_visible[sweep] = EXTREMES[e];
+            sweep_infrared[sweep++] = v;
+            sweep_visible[sweep] = v;
+            sweep_infrared[sweep++] = EXTREMES[e];
+        }
+    }
+
+    static const tsl2561_integration_time_t TIMES[] = { TSL2561_INTEGRATION_TIME_13MS, TSL2561_INTEGRATION_TIME_101MS, TSL2561_INTEGRATION_TIME_402MS };
+    static const tsl2561_device_type_t TYPES[] = { TSL2561_DEVICE_TYPE_TSL2561CS, TSL2561_DEVICE_TYPE_TSL2561T_FN_CL };
+    for (size_t d = 0; d < 2; ++d)
+    {
+        for (size_t t = 0; t < 3; ++t)
+        {
+            for (int g = 0; g < 2; ++g)
+            {
+                tsl2561_info_t info;
+                CHECK_EQ(tsl2561_init_detached(&info, TYPES[d], TIMES[t], g ? TSL2561_GAIN_16X : TSL2561_GAIN_1X), ESP_OK);
+                CHECK_EQ(_compare(&info, visible, infrared, lux, samples), 0);
+                CHECK_EQ(_compare(&info, sweep_visible, sweep_infrared, lux, sweep), 0);
+            }
+        }
+    }
+
+    // an empty batch needs no buffers, and an invalid instance is rejected once, not per sample
+    tsl2561_info_t info;
+    CHECK_EQ(tsl2561_init_detached(&info, TSL2561_DEVICE_TYPE_TSL2561CS, TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_1X), ESP_OK);
+    CHECK_EQ(tsl2561_compute_lux_batch(&info, NULL, NULL, NULL, 0), ESP_OK);
+    CHECK(tsl2561_compute_lux_batch(&info, visible, NULL, lux, samples) != ESP_OK);
+    host_log_quiet = true;
+    CHECK(tsl2561_compute_lux_batch(NULL, visible, infrared, lux, samples) != ESP_OK);
+    host_log_quiet = false;
+
+    free(visible);
+    free(infrared);
+    free(sweep_visible);
+    free(sweep_infrared);
+    free(lux);
+    return test_result("test_lux_batch");
+}
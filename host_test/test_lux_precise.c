@@ -0,0 +1,113 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_lux_precise.c
+ * @brief tsl2561_compute_lux_precise() retains the fractional part of the Lux calculation, in
+ *        either result format, and tracks the datasheet's empirical formula in low light where
+ *        the integer result is dominated by rounding.
+ */
+
+#include <math.h>
+
+#include "reference_lux.h"
+#include "test_util.h"
+
+static double _to_double(tsl2561_lux_precise_t lux)
+{
+#ifdef CONFIG_TSL2561_LUX_PRECISE_FIXED
+    return (double)lux / (1 << TSL2561_LUX_PRECISE_FRACTION_BITS);
+#else
+    return lux;
+#endif
+}
+
+static void _test_fraction(void)
+{
+    static const tsl2561_integration_time_t TIMES[] = { TSL2561_INTEGRATION_TIME_13MS, TSL2561_INTEGRATION_TIME_101MS, TSL2561_INTEGRATION_TIME_402MS };
+    static const uint32_t CLIP[] = { 5047, 37177, 65535 };
+    for (unsigned t = 0; t < 3; ++t)
+    {
+        for (unsigned g = 0; g < 2; ++g)
+        {
+            tsl2561_info_t info;
+            CHECK_EQ(tsl2561_init_detached(&info, TSL2561_DEVICE_TYPE_TSL2561T_FN_CL, TIMES[t], g ? TSL2561_GAIN_16X : TSL2561_GAIN_1X), ESP_OK);
+            uint32_t mismatches = 0;
+            for (uint32_t ch0 = 0; ch0 <= CLIP[t]; ch0 += 3)
+            {
+                for (uint32_t ch1 = 0; ch1 <= ch0; ch1 += 1 + ch0 / 64)
+                {
+                    uint32_t scaled = reference_lux_scaled(g, t, ch0, ch1, REFERENCE_PACKAGE_T);
+                    tsl2561_lux_precise_t precise = tsl2561_compute_lux_precise(&info, ch0 - ch1, ch1);
+#ifdef CONFIG_TSL2561_LUX_PRECISE_FIXED
+                    // Q16.16 is exact, saturating above 65535.99998 Lux
+                    uint64_t expected = (uint64_t)scaled << (TSL2561_LUX_PRECISE_FRACTION_BITS - 14);
+                    mismatches += precise != (expected > UINT32_MAX ? UINT32_MAX : expected);
+#else
+                    // float is exact to its precision
+                    mismatches += fabs(precise - scaled / 16384.0) > scaled / 16384.0 * 1e-7;
+#endif
+                }
+            }
+            CHECK_EQ(mismatches, 0);
+        }
+    }
+}
+
+static void _test_low_light(void)
+{
+    tsl2561_info_t info;
+    CHECK_EQ(tsl2561_init_detached(&info, TSL2561_DEVICE_TYPE_TSL2561T_FN_CL, TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_16X), ESP_OK);
+
+    // below 30 Lux the integer result is quantised to whole Lux, the precise result is not
+    double integer_error = 0.0;
+    double precise_error = 0.0;
+    uint32_t samples = 0;
+    for (uint32_t ch0 = 10; ch0 <= 1000; ++ch0)
+    {
+        for (double ratio = 0.05; ratio <= 0.8; ratio += 0.05)
+        {
+            uint32_t ch1 = (uint32_t)(ch0 * ratio);
+            double empirical = reference_lux_empirical(ch0, ch1, REFERENCE_PACKAGE_T);
+            double precise = _to_double(tsl2561_compute_lux_precise(&info, ch0 - ch1, ch1));
+            uint32_t integer = tsl2561_compute_lux(&info, ch0 - ch1, ch1);
+
+            // piecewise-linear approximation error is under 2%
+            CHECK(fabs(precise - empirical) <= 0.02 * empirical + 0.001);
+            integer_error += fabs(integer - empirical);
+            precise_error += fabs(precise - empirical);
+            ++samples;
+        }
+    }
+    printf("mean absolute error against the empirical formula below 30 Lux: integer %.4f Lux, precise %.4f Lux\n",
+           integer_error / samples, precise_error / samples);
+    CHECK(precise_error * 4 < integer_error);
+}
+
+int main(void)
+{
+    _test_fraction();
+    _test_low_light();
+    return test_result("test_lux_precise");
+}
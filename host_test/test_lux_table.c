@@ -0,0 +1,108 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_lux_table.c
+ * @brief The table-driven tsl2561_compute_lux() is bit-exact with the original if-chain
+ *        implementation over the 16-bit visible by 16-bit infrared input space.
+ *
+ * Inputs include channel sums beyond the clipping limits, where intermediate values wrap.
+ * By default both inputs are strided, with every value of one input paired with the extremes
+ * of the other; --exhaustive checks all 2^32 pairs for every configuration, and --quick uses
+ * wider strides.
+ */
+
+#include <stdio.h>
+
+#include "baseline_lux.h"
+#include "test_util.h"
+
+static const tsl2561_integration_time_t INTEGRATION_TIMES[] = {
+    TSL2561_INTEGRATION_TIME_13MS, TSL2561_INTEGRATION_TIME_101MS, TSL2561_INTEGRATION_TIME_402MS,
+};
+static const tsl2561_gain_t GAINS[] = { TSL2561_GAIN_1X, TSL2561_GAIN_16X };
+
+// device types whose coefficients have not changed since the original implementation
+static const tsl2561_device_type_t DEVICE_TYPES[] = {
+    TSL2561_DEVICE_TYPE_TSL2561CS, TSL2561_DEVICE_TYPE_TSL2560T_FN_CL, TSL2561_DEVICE_TYPE_TSL2561T_FN_CL,
+};
+
+static const uint16_t EXTREMES[] = { 0, 1, 2, 5047, 37177, 65534, 65535 };
+
+static uint64_t _checked = 0;
+static uint64_t _mismatches = 0;
+
+static void _check(const tsl2561_info_t * info, uint16_t visible, uint16_t infrared)
+{
+    uint32_t actual = tsl2561_compute_lux(info, visible, infrared);
+    uint32_t expected = baseline_compute_lux(info->integration_time, info->gain, info->device_type, visible, infrared);
+    ++_checked;
+    if (actual != expected && _mismatches++ < 10)
+    {
+        fprintf(stderr, "mismatch: time %d gain 0x%02x type %d visible %u infrared %u: %u != %u\n",
+                info->integration_time, info->gain, info->device_type, visible, infrared, actual, expected);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    bool exhaustive = test_flag(argc, argv, "--exhaustive");
+    bool quick = test_flag(argc, argv, "--quick");
+    uint32_t visible_stride = exhaustive ? 1 : quick ? 127 : 31;
+    uint32_t infrared_stride = exhaustive ? 1 : quick ? 61 : 7;
+
+    for (size_t d = 0; d < sizeof(DEVICE_TYPES) / sizeof(DEVICE_TYPES[0]); ++d)
+    {
+        for (size_t t = 0; t < sizeof(INTEGRATION_TIMES) / sizeof(INTEGRATION_TIMES[0]); ++t)
+        {
+            for (size_t g = 0; g < sizeof(GAINS) / sizeof(GAINS[0]); ++g)
+            {
+                tsl2561_info_t info;
+                CHECK_EQ(tsl2561_init_detached(&info, DEVICE_TYPES[d], INTEGRATION_TIMES[t], GAINS[g]), ESP_OK);
+                uint64_t before = _mismatches;
+
+                for (uint32_t visible = 0; visible <= 0xffff; visible += visible_stride)
+                {
+                    for (uint32_t infrared = 0; infrared <= 0xffff; infrared += infrared_stride)
+                    {
+                        _check(&info, visible, infrared);
+                    }
+                }
+
+                for (size_t e = 0; !exhaustive && e < sizeof(EXTREMES) / sizeof(EXTREMES[0]); ++e)
+                {
+                    for (uint32_t value = 0; value <= 0xffff; ++value)
+                    {
+                        _check(&info, EXTREMES[e], value);
+                        _check(&info, value, EXTREMES[e]);
+                    }
+                }
+                CHECK_EQ(_mismatches - before, 0);
+            }
+        }
+    }
+
+    printf("checked %llu pairs, %llu mismatches\n", (unsigned long long)_checked, (unsigned long long)_mismatches);
+    return test_result("test_lux_table");
+}
@@ -0,0 +1,132 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_manual.c
+ * @brief Manual integration: the channel scale derived from the measured exposure brings the Lux
+ *        approximation of any exposure into agreement with the fixed integration times, and a
+ *        failed configuration leaves the previous exposure in effect.
+ */
+
+#include <math.h>
+
+#include "reference_lux.h"
+#include "test_util.h"
+
+#define MANUAL_REFERENCE_US 402155.0  // 322 integration cycles at 735 kHz
+#define TARGET_COUNTS       20000.0   // light level chosen for this many counts in each exposure,
+#define TARGET_FRACTION     0.6       // or this fraction of the saturation level if that is lower
+
+static const uint32_t _exposures_us[] = { 5000, 13700, 50000, 402155, 1000000, 2500000 };
+
+static void _test_scale(uint32_t exposure_us, tsl2561_gain_t gain)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_manual_integration(&info, exposure_us, gain), ESP_OK);
+
+    // channel values are those of a 402 ms integration at 16x gain
+    double gain_factor = gain == TSL2561_GAIN_16X ? 1.0 : 16.0;
+    double counts = fmin(TARGET_COUNTS, TARGET_FRACTION * 37177.0 * exposure_us / 101000.0);
+    double channel0 = counts * MANUAL_REFERENCE_US / exposure_us * gain_factor;
+    double channel1 = channel0 * 0.3;
+    fake_tsl2561_set_light(&device, channel0, channel1);
+
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    int64_t busy_waits = host_clock_get_stats().busy_waits;
+    CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+    if (exposure_us < HOST_TICK_US)
+    {
+        CHECK(host_clock_get_stats().busy_waits > busy_waits);
+    }
+
+    // the emulated device integrates between the start and stop writes
+    int64_t exposure = device.manual_exposure_us;
+    CHECK(exposure >= exposure_us);
+    uint16_t ch0 = 0;
+    uint16_t ch1 = 0;
+    fake_tsl2561_counts(TSL2561_INTEGRATION_TIME_MANUAL | gain, exposure, channel0, channel1, &ch0, &ch1);
+    CHECK_EQ(visible + infrared, ch0);
+    CHECK_EQ(infrared, ch1);
+
+    double expected = reference_lux_empirical(channel0, channel1, REFERENCE_PACKAGE_T);
+    uint32_t lux = tsl2561_compute_lux(&info, visible, infrared);
+    double error = fabs(lux - expected) / expected;
+    printf("%7u us at %2sx: exposure %7lld us, counts %5u %5u, lux %6u, expected %8.1f, error %.2f%%\n",
+           exposure_us, gain == TSL2561_GAIN_16X ? "16" : "1", (long long)exposure, visible, infrared,
+           lux, expected, 100.0 * error);
+    CHECK(error < 0.03);
+}
+
+static void _test_failed_configuration(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_retries(&info, 0, 0), ESP_OK);
+
+    // from a fixed integration time, the failed switch leaves no manual exposure behind
+    test_fail_register_write(0x01);  // TIMING
+    host_log_quiet = true;
+    CHECK(tsl2561_set_manual_integration(&info, 5000, TSL2561_GAIN_1X) != ESP_OK);
+    host_log_quiet = false;
+    CHECK(test_register_write_failed());
+    CHECK_EQ(info.integration_time, TSL2561_INTEGRATION_TIME_402MS);
+    CHECK_EQ(info.manual_exposure_us, 0);
+
+    // in manual integration, a failed change keeps the exposure the device is configured for
+    CHECK_EQ(tsl2561_set_manual_integration(&info, 20000, TSL2561_GAIN_1X), ESP_OK);
+    uint32_t scale = info.channel_scale;
+    test_fail_register_write(0x01);
+    host_log_quiet = true;
+    CHECK(tsl2561_set_manual_integration(&info, 80000, TSL2561_GAIN_16X) != ESP_OK);
+    host_log_quiet = false;
+    CHECK(test_register_write_failed());
+    CHECK_EQ(info.gain, TSL2561_GAIN_1X);
+    CHECK_EQ(info.manual_exposure_us, 20000);
+    CHECK_EQ(info.channel_scale, scale);
+
+    // so the next measurement still uses it
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    fake_tsl2561_set_light(&device, 200000.0, 50000.0);
+    CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+    int64_t exposure = device.manual_exposure_us;
+    CHECK(exposure >= 20000 && exposure < 20000 + HOST_TICK_US);
+}
+
+int main(int argc, char ** argv)
+{
+    for (size_t i = 0; i < sizeof(_exposures_us) / sizeof(_exposures_us[0]); ++i)
+    {
+        _test_scale(_exposures_us[i], TSL2561_GAIN_16X);
+        _test_scale(_exposures_us[i], TSL2561_GAIN_1X);
+    }
+    _test_failed_configuration();
+    return test_result("test_manual");
+}
@@ -0,0 +1,126 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_measurement.c
+ * @brief Non-blocking measurement: tsl2561_start_measurement(), tsl2561_get_ready_tick() and
+ *        tsl2561_poll_result(), against the emulated device and the virtual tick source.
+ */
+
+#include "freertos/task.h"
+
+#include "test_util.h"
+
+static void _test_start_poll(tsl2561_integration_time_t integration_time)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, integration_time, TSL2561_GAIN_16X), ESP_OK);
+    fake_tsl2561_set_light(&device, 20000.0, 5000.0);
+
+    bool ready = true;
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    CHECK_EQ(tsl2561_get_ready_tick(&info), 0);
+    host_log_quiet = true;
+    CHECK_EQ(tsl2561_poll_result(&info, &ready, &visible, &infrared), ESP_ERR_INVALID_STATE);
+    host_log_quiet = false;
+
+    int64_t start = esp_timer_get_time();
+    CHECK_EQ(tsl2561_start_measurement(&info), ESP_OK);
+    TickType_t ready_tick = tsl2561_get_ready_tick(&info);
+    CHECK((int64_t)ready_tick * HOST_TICK_US >= start + fake_tsl2561_period_us(integration_time));
+
+    host_log_quiet = true;
+    CHECK_EQ(tsl2561_start_measurement(&info), ESP_ERR_INVALID_STATE);
+    host_log_quiet = false;
+
+    // polling before the result is due performs no bus transactions and does not sleep
+    uint32_t transactions = test_transactions(&smbus_info);
+    host_clock_stats_t clock = host_clock_get_stats();
+    for (int i = 0; i < 10; ++i)
+    {
+        CHECK_EQ(tsl2561_poll_result(&info, &ready, &visible, &infrared), ESP_OK);
+        CHECK(!ready);
+    }
+    CHECK_EQ(test_transactions(&smbus_info), transactions);
+    CHECK_EQ(host_clock_get_stats().delays, clock.delays);
+    CHECK_EQ(host_clock_get_stats().busy_waits, clock.busy_waits);
+
+    // the caller is free to do other work until the ready tick
+    while ((int32_t)(ready_tick - xTaskGetTickCount()) > 0)
+    {
+        vTaskDelay(1);
+    }
+    while (!ready && xTaskGetTickCount() - ready_tick < 10)
+    {
+        CHECK_EQ(tsl2561_poll_result(&info, &ready, &visible, &infrared), ESP_OK);
+        if (!ready)
+        {
+            vTaskDelay(1);
+        }
+    }
+    CHECK(ready);
+
+    uint16_t ch0 = 0;
+    uint16_t ch1 = 0;
+    fake_tsl2561_counts(integration_time | TSL2561_GAIN_16X, 0, 20000.0, 5000.0, &ch0, &ch1);
+    CHECK_EQ(visible + infrared, ch0);
+    CHECK_EQ(infrared, ch1);
+    CHECK_EQ(device.premature_reads, 0);
+    CHECK(!device.powered);
+    CHECK_EQ(tsl2561_get_ready_tick(&info), 0);
+
+    // the single-shot measurement is complete
+    host_log_quiet = true;
+    CHECK_EQ(tsl2561_poll_result(&info, &ready, &visible, &infrared), ESP_ERR_INVALID_STATE);
+    host_log_quiet = false;
+}
+
+static void _test_stop(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+
+    CHECK_EQ(tsl2561_start_measurement(&info), ESP_OK);
+    CHECK(device.powered);
+    CHECK_EQ(tsl2561_stop_measurement(&info), ESP_OK);
+    CHECK(!device.powered);
+    CHECK_EQ(tsl2561_get_ready_tick(&info), 0);
+    CHECK_EQ(tsl2561_start_measurement(&info), ESP_OK);
+    CHECK_EQ(tsl2561_stop_measurement(&info), ESP_OK);
+}
+
+int main(void)
+{
+    _test_start_poll(TSL2561_INTEGRATION_TIME_13MS);
+    _test_start_poll(TSL2561_INTEGRATION_TIME_101MS);
+    _test_start_poll(TSL2561_INTEGRATION_TIME_402MS);
+    _test_stop();
+    return test_result("test_measurement");
+}
@@ -0,0 +1,105 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_periodic.c
+ * @brief Periodic sampling: tsl2561_read_periodic() starts each integration on its delay-until
+ *        deadline, so the sample period does not drift over many samples, and each result carries
+ *        the timestamps of its own integration.
+ */
+
+#include <stdlib.h>
+
+#include "test_util.h"
+
+#define PERIODIC_SAMPLES 10000
+
+static void _test_periodic(tsl2561_integration_time_t integration_time, TickType_t period)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, integration_time, TSL2561_GAIN_16X), ESP_OK);
+    fake_tsl2561_set_light(&device, 20000.0, 5000.0);
+
+    // each integration starts a whole number of periods after the first, however long each read takes
+    const int64_t period_us = (int64_t)period * HOST_TICK_US;
+    const int64_t integration_us = fake_tsl2561_period_us(integration_time);
+    TickType_t previous_wake_time = xTaskGetTickCount();
+    int64_t first_us = 0;
+    int64_t drift_max = 0;
+    uint32_t power_ups = device.power_ups;
+    for (int i = 0; i < PERIODIC_SAMPLES; ++i)
+    {
+        tsl2561_visible_t visible = 0;
+        tsl2561_infrared_t infrared = 0;
+        CHECK_EQ(tsl2561_read_periodic(&info, &previous_wake_time, period, &visible, &infrared), ESP_OK);
+        CHECK(visible > 0);
+
+        int64_t start_us = 0;
+        int64_t end_us = 0;
+        CHECK_EQ(tsl2561_get_result_timestamps(&info, &start_us, &end_us), ESP_OK);
+        CHECK_EQ(end_us - start_us, integration_us);
+        first_us = i == 0 ? start_us : first_us;
+        int64_t drift = llabs(start_us - first_us - i * period_us);
+        drift_max = drift > drift_max ? drift : drift_max;
+    }
+    printf("periodic %lld us every %lld us: %d samples, %lld us maximum drift\n",
+           (long long)integration_us, (long long)period_us, PERIODIC_SAMPLES, (long long)drift_max);
+
+    // a fresh integration for every sample, each within a small fraction of an integration of its deadline
+    CHECK_EQ(device.power_ups, power_ups + PERIODIC_SAMPLES);
+    CHECK_EQ(device.duplicate_reads, 0);
+    CHECK_EQ(device.premature_reads, 0);
+    CHECK(drift_max < integration_us / 32);
+    CHECK_EQ(host_clock_get_stats().spins, 0);
+}
+
+static void _test_continuous_rejected(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_start_continuous(&info), ESP_OK);
+
+    // in continuous acquisition the device sets the period
+    TickType_t previous_wake_time = xTaskGetTickCount();
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    host_log_quiet = true;
+    CHECK_EQ(tsl2561_read_periodic(&info, &previous_wake_time, 50, &visible, &infrared), ESP_ERR_INVALID_STATE);
+    host_log_quiet = false;
+    CHECK_EQ(tsl2561_stop_measurement(&info), ESP_OK);
+}
+
+int main(void)
+{
+    _test_periodic(TSL2561_INTEGRATION_TIME_13MS, 5);
+    _test_periodic(TSL2561_INTEGRATION_TIME_101MS, 13);
+    _test_periodic(TSL2561_INTEGRATION_TIME_402MS, 50);
+    _test_continuous_rejected();
+    return test_result("test_periodic");
+}
@@ -0,0 +1,289 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_record.c
+ * @brief Binary sample log: every sample round-trips exactly through blocks of any size, a full block
+ *        is left unchanged, batches feed the Lux calculation directly, and damaged blocks are rejected.
+ */
+
+#include "tsl2561_record.h"
+#include "test_util.h"
+
+#define STREAM_SAMPLES 10000
+#define BLOCK_SIZE     256
+
+// enough for every sample at its largest, in blocks holding as few as one sample in two of their size
+#define STORAGE_SIZE   (STREAM_SAMPLES * TSL2561_RECORD_SAMPLE_MAX * 2)
+
+static const tsl2561_integration_time_t TIMES[] = {
+    TSL2561_INTEGRATION_TIME_13MS, TSL2561_INTEGRATION_TIME_101MS, TSL2561_INTEGRATION_TIME_402MS,
+};
+
+// Slowly varying light sampled at a jittered steady rate, with occasional range changes and
+// occasional arbitrary values, including channel sums beyond 16 bits
+static void _make_stream(tsl2561_record_sample_t * samples, size_t count)
+{
+    uint32_t state = 1;
+    int64_t timestamp = 1000000;
+    int32_t ch0 = 20000;
+    int32_t ch1 = 5000;
+    tsl2561_integration_time_t integration_time = TSL2561_INTEGRATION_TIME_402MS;
+    tsl2561_gain_t gain = TSL2561_GAIN_1X;
+    for (size_t i = 0; i < count; ++i)
+    {
+        state = state * 1664525 + 1013904223;
+        timestamp += 13700 + (state >> 24) % 64;
+        ch0 += (int32_t)((state >> 8) % 33) - 16;
+        ch1 += (int32_t)((state >> 16) % 9) - 4;
+        ch0 = ch0 < 0 ? 0 : ch0 > 0xffff ? 0xffff : ch0;
+        ch1 = ch1 < 0 ? 0 : ch1 > ch0 ? ch0 : ch1;
+        if (i % 997 == 0)
+        {
+            integration_time = TIMES[(state >> 4) % 3];
+            gain = state & 0x100 ? TSL2561_GAIN_16X : TSL2561_GAIN_1X;
+        }
+
+        samples[i].timestamp_us = timestamp;
+        samples[i].visible = ch0 - ch1;
+        samples[i].infrared = ch1;
+        samples[i].integration_time = integration_time;
+        samples[i].gain = gain;
+        if (i % 101 == 0)
+        {
+            samples[i].visible = state & 0xffff;
+            samples[i].infrared = ~state & 0xffff;
+        }
+    }
+}
+
+static bool _equal(const tsl2561_record_sample_t * a, const tsl2561_record_sample_t * b)
+{
+    return a->timestamp_us == b->timestamp_us && a->visible == b->visible && a->infrared == b->infrared
+        && a->integration_time == b->integration_time && a->gain == b->gain;
+}
+
+// Encode a stream into consecutive blocks of the given size, returning the number of blocks
+static size_t _encode(const tsl2561_record_sample_t * samples, size_t count, uint8_t * blocks, size_t block_size, size_t * bytes)
+{
+    size_t capacity = STORAGE_SIZE / block_size;
+    tsl2561_record_encoder_t encoder;
+    size_t block = 0;
+    *bytes = 0;
+    CHECK_EQ(tsl2561_record_encoder_init(&encoder, TSL2561_DEVICE_TYPE_TSL2561CS, samples[0].integration_time,
+                                         samples[0].gain, blocks, block_size), ESP_OK);
+    for (size_t i = 0; i < count; ++i)
+    {
+        esp_err_t err = tsl2561_record_encode(&encoder, samples[i].timestamp_us, samples[i].integration_time,
+                                              samples[i].gain, samples[i].visible, samples[i].infrared);
+        if (err == ESP_ERR_NO_MEM && block + 1 < capacity)
+        {
+            size_t length = 0;
+            CHECK_EQ(tsl2561_record_encoder_finish(&encoder, &length), ESP_OK);
+            *bytes += length;
+            ++block;
+            CHECK_EQ(tsl2561_record_encoder_next_block(&encoder, &blocks[block * block_size], block_size), ESP_OK);
+            err = tsl2561_record_encode(&encoder, samples[i].timestamp_us, samples[i].integration_time,
+                                        samples[i].gain, samples[i].visible, samples[i].infrared);
+        }
+        CHECK_EQ(err, ESP_OK);
+    }
+
+    size_t length = 0;
+    CHECK_EQ(tsl2561_record_encoder_finish(&encoder, &length), ESP_OK);
+    *bytes += length;
+    return block + 1;
+}
+
+static void _test_round_trip(size_t block_size)
+{
+    static tsl2561_record_sample_t samples[STREAM_SAMPLES];
+    static uint8_t blocks[STORAGE_SIZE];
+    _make_stream(samples, STREAM_SAMPLES);
+
+    size_t bytes = 0;
+    size_t num_blocks = _encode(samples, STREAM_SAMPLES, blocks, block_size, &bytes);
+    printf("block size %zu: %zu blocks, %.2f bytes/sample\n", block_size, num_blocks, (double)bytes / STREAM_SAMPLES);
+
+    // the stream is mostly small steps, so samples average under 6 bytes beside the block headers
+    CHECK(bytes - num_blocks * TSL2561_RECORD_HEADER_SIZE < STREAM_SAMPLES * 6);
+
+    // each block decodes on its own, one sample at a time
+    size_t decoded = 0;
+    size_t mismatches = 0;
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        tsl2561_record_decoder_t decoder;
+        CHECK_EQ(tsl2561_record_decoder_init(&decoder, &blocks[b * block_size], block_size), ESP_OK);
+        CHECK_EQ(decoder.device_type, TSL2561_DEVICE_TYPE_TSL2561CS);
+        tsl2561_record_sample_t sample;
+        esp_err_t err = ESP_OK;
+        while ((err = tsl2561_record_decode(&decoder, &sample)) == ESP_OK)
+        {
+            mismatches += decoded >= STREAM_SAMPLES || !_equal(&sample, &samples[decoded]);
+            ++decoded;
+        }
+        CHECK_EQ(err, ESP_ERR_NOT_FOUND);
+    }
+    CHECK_EQ(decoded, STREAM_SAMPLES);
+    CHECK_EQ(mismatches, 0);
+
+    // batches share a range and give the same Lux as converting each sample
+    decoded = 0;
+    mismatches = 0;
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        tsl2561_record_decoder_t decoder;
+        CHECK_EQ(tsl2561_record_decoder_init(&decoder, &blocks[b * block_size], block_size), ESP_OK);
+        int64_t timestamps[64];
+        tsl2561_visible_t visible[64];
+        tsl2561_infrared_t infrared[64];
+        uint32_t lux[64];
+        size_t count = 0;
+        tsl2561_integration_time_t integration_time;
+        tsl2561_gain_t gain;
+        while (tsl2561_record_decode_batch(&decoder, timestamps, visible, infrared, 64, &count, &integration_time, &gain) == ESP_OK)
+        {
+            tsl2561_info_t info;
+            CHECK_EQ(tsl2561_init_detached(&info, decoder.device_type, integration_time, gain), ESP_OK);
+            CHECK_EQ(tsl2561_compute_lux_batch(&info, visible, infrared, lux, count), ESP_OK);
+            for (size_t i = 0; i < count; ++i, ++decoded)
+            {
+                const tsl2561_record_sample_t * expected = &samples[decoded < STREAM_SAMPLES ? decoded : 0];
+                mismatches += decoded >= STREAM_SAMPLES
+                    || timestamps[i] != expected->timestamp_us
+                    || visible[i] != expected->visible
+                    || infrared[i] != expected->infrared
+                    || integration_time != expected->integration_time
+                    || gain != expected->gain
+                    || lux[i] != tsl2561_compute_lux(&info, expected->visible, expected->infrared);
+            }
+        }
+    }
+    CHECK_EQ(decoded, STREAM_SAMPLES);
+    CHECK_EQ(mismatches, 0);
+}
+
+static void _test_full_block(void)
+{
+    uint8_t block[32];
+    memset(block, 0xa5, sizeof(block));
+    tsl2561_record_encoder_t encoder;
+    CHECK_EQ(tsl2561_record_encoder_init(&encoder, TSL2561_DEVICE_TYPE_TSL2561T_FN_CL, TSL2561_INTEGRATION_TIME_13MS,
+                                         TSL2561_GAIN_16X, block, sizeof(block)), ESP_OK);
+
+    // fill the block, then check that a sample that does not fit writes nothing
+    esp_err_t err = ESP_OK;
+    int64_t timestamp = 0;
+    size_t samples = 0;
+    while ((err = tsl2561_record_encode(&encoder, timestamp, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_16X,
+                                        100 + samples, 10)) == ESP_OK)
+    {
+        timestamp += 13700;
+        ++samples;
+    }
+    CHECK_EQ(err, ESP_ERR_NO_MEM);
+    size_t used = encoder.length;
+    uint8_t copy[sizeof(block)];
+    memcpy(copy, block, sizeof(block));
+    CHECK_EQ(tsl2561_record_encode(&encoder, timestamp, TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_1X, 65535, 65535),
+             ESP_ERR_NO_MEM);
+    CHECK_EQ(encoder.length, used);
+    CHECK_EQ(memcmp(copy, block, sizeof(block)), 0);
+
+    size_t length = 0;
+    CHECK_EQ(tsl2561_record_encoder_finish(&encoder, &length), ESP_OK);
+    CHECK_EQ(length, used);
+    tsl2561_record_decoder_t decoder;
+    CHECK_EQ(tsl2561_record_decoder_init(&decoder, block, sizeof(block)), ESP_OK);
+    tsl2561_record_sample_t sample;
+    size_t decoded = 0;
+    while (tsl2561_record_decode(&decoder, &sample) == ESP_OK)
+    {
+        CHECK_EQ(sample.visible, 100 + decoded);
+        ++decoded;
+    }
+    CHECK_EQ(decoded, samples);
+
+    // time must not run backwards
+    host_log_quiet = true;
+    CHECK_EQ(tsl2561_record_encoder_next_block(&encoder, block, sizeof(block)), ESP_OK);
+    CHECK_EQ(tsl2561_record_encode(&encoder, 1000, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_16X, 1, 1), ESP_OK);
+    CHECK_EQ(tsl2561_record_encode(&encoder, 999, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_16X, 1, 1), ESP_ERR_INVALID_ARG);
+    CHECK_EQ(tsl2561_record_encoder_next_block(&encoder, block, TSL2561_RECORD_HEADER_SIZE - 1), ESP_ERR_INVALID_ARG);
+    host_log_quiet = false;
+}
+
+static void _test_damaged_blocks(void)
+{
+    uint8_t block[64];
+    tsl2561_record_encoder_t encoder;
+    CHECK_EQ(tsl2561_record_encoder_init(&encoder, TSL2561_DEVICE_TYPE_TSL2561T_FN_CL, TSL2561_INTEGRATION_TIME_402MS,
+                                         TSL2561_GAIN_1X, block, sizeof(block)), ESP_OK);
+    CHECK_EQ(tsl2561_record_encode(&encoder, 402000, TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_1X, 3000, 1000), ESP_OK);
+    CHECK_EQ(tsl2561_record_encode(&encoder, 804000, TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_16X, 3000, 1000), ESP_OK);
+
+    host_log_quiet = true;
+    tsl2561_record_decoder_t decoder;
+    CHECK_EQ(tsl2561_record_decoder_init(&decoder, block, sizeof(block)), ESP_ERR_INVALID_SIZE);  // unfinished
+
+    size_t length = 0;
+    CHECK_EQ(tsl2561_record_encoder_finish(&encoder, &length), ESP_OK);
+    CHECK_EQ(tsl2561_record_decoder_init(&decoder, block, length - 1), ESP_ERR_INVALID_SIZE);     // truncated
+    CHECK_EQ(tsl2561_record_decoder_init(&decoder, block, TSL2561_RECORD_HEADER_SIZE - 1), ESP_ERR_INVALID_ARG);
+
+    block[2] += 1;
+    CHECK_EQ(tsl2561_record_decoder_init(&decoder, block, sizeof(block)), ESP_ERR_INVALID_VERSION);
+    block[2] -= 1;
+    block[0] ^= 0xff;
+    CHECK_EQ(tsl2561_record_decoder_init(&decoder, block, sizeof(block)), ESP_ERR_INVALID_ARG);
+    block[0] ^= 0xff;
+
+    // a length that cuts the last sample short leaves the samples before it readable
+    block[5] = (uint8_t)(length - 1);
+    CHECK_EQ(tsl2561_record_decoder_init(&decoder, block, sizeof(block)), ESP_OK);
+    tsl2561_record_sample_t sample;
+    CHECK_EQ(tsl2561_record_decode(&decoder, &sample), ESP_OK);
+    CHECK_EQ(sample.timestamp_us, 402000);
+    CHECK_EQ(tsl2561_record_decode(&decoder, &sample), ESP_ERR_INVALID_SIZE);
+    host_log_quiet = false;
+
+    block[5] = (uint8_t)length;
+    CHECK_EQ(tsl2561_record_decoder_init(&decoder, block, sizeof(block)), ESP_OK);
+    CHECK_EQ(tsl2561_record_decode(&decoder, &sample), ESP_OK);
+    CHECK_EQ(tsl2561_record_decode(&decoder, &sample), ESP_OK);
+    CHECK_EQ(sample.integration_time, TSL2561_INTEGRATION_TIME_101MS);
+    CHECK_EQ(sample.gain, TSL2561_GAIN_16X);
+    CHECK_EQ(tsl2561_record_decode(&decoder, &sample), ESP_ERR_NOT_FOUND);
+}
+
+int main(void)
+{
+    _test_round_trip(64);
+    _test_round_trip(BLOCK_SIZE);
+    _test_round_trip(4096);
+    _test_full_block();
+    _test_damaged_blocks();
+    return test_result("test_record");
+}
@@ -0,0 +1,194 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_register_cache.c
+ * @brief Register shadow: writes of values the device already holds are suppressed, a failed
+ *        write invalidates the cached value, and tsl2561_resync() recovers from a brown-out.
+ */
+
+#include "test_util.h"
+
+#define LOOP_SAMPLES 100
+
+#define TIMING_101MS_1X (TSL2561_INTEGRATION_TIME_101MS | TSL2561_GAIN_1X)
+#define TIMING_13MS_16X (TSL2561_INTEGRATION_TIME_13MS | TSL2561_GAIN_16X)
+
+static const char * _op_names[] = {
+    "send byte", "write byte", "write word", "read byte", "read word", "write block", "read block",
+};
+
+static fake_bus_counters_t _since(const smbus_info_t * smbus_info, const fake_bus_counters_t * start)
+{
+    fake_bus_counters_t counters = fake_bus_device_counters(smbus_info);
+    counters.transactions -= start->transactions;
+    counters.bytes -= start->bytes;
+    counters.errors -= start->errors;
+    counters.busy_us -= start->busy_us;
+    for (size_t i = 0; i < sizeof(counters.ops) / sizeof(counters.ops[0]); ++i)
+    {
+        counters.ops[i] -= start->ops[i];
+    }
+    return counters;
+}
+
+static void _test_unchanged_settings(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+
+    // the first change is written, repeating it costs nothing
+    uint32_t transactions = test_transactions(&smbus_info);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_1X), ESP_OK);
+    CHECK_EQ(test_transactions(&smbus_info) - transactions, 3);  // power up, TIMING, power down
+    CHECK_EQ(device.regs[1], TIMING_101MS_1X);
+
+    transactions = test_transactions(&smbus_info);
+    for (int i = 0; i < 10; ++i)
+    {
+        CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_1X), ESP_OK);
+    }
+    CHECK_EQ(test_transactions(&smbus_info), transactions);
+}
+
+// A fixed-configuration loop that reapplies its settings before every sample
+static fake_bus_counters_t _sampling_loop(bool cached)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    fake_tsl2561_set_light(&device, 2000.0, 500.0);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_1X), ESP_OK);
+
+    fake_bus_counters_t start = fake_bus_device_counters(&smbus_info);
+    for (int i = 0; i < LOOP_SAMPLES; ++i)
+    {
+        tsl2561_visible_t visible = 0;
+        tsl2561_infrared_t infrared = 0;
+        if (!cached)
+        {
+            info.shadow_valid = 0;
+        }
+        CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_1X), ESP_OK);
+        CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+        CHECK(visible > 0);
+    }
+    CHECK_EQ(device.premature_reads, 0);
+    fake_bus_counters_t loop = _since(&smbus_info, &start);
+
+    printf("fixed-configuration loop, %s, per sample: %.2f transactions, %.2f bytes\n",
+           cached ? "cached" : "uncached", (double)loop.transactions / LOOP_SAMPLES, (double)loop.bytes / LOOP_SAMPLES);
+    for (size_t i = 0; i < sizeof(loop.ops) / sizeof(loop.ops[0]); ++i)
+    {
+        if (loop.ops[i] > 0)
+        {
+            printf("  %-11s %.2f\n", _op_names[i], (double)loop.ops[i] / LOOP_SAMPLES);
+        }
+    }
+    return loop;
+}
+
+static void _test_sampling_loop(void)
+{
+    // without the cache: power up, TIMING, power down, then power up, block read, power down
+    fake_bus_counters_t uncached = _sampling_loop(false);
+    CHECK_EQ(uncached.transactions, 6 * LOOP_SAMPLES);
+
+    // with it, only the measurement itself
+    fake_bus_counters_t cached = _sampling_loop(true);
+    CHECK_EQ(cached.transactions, 3 * LOOP_SAMPLES);
+    CHECK_EQ(cached.ops[FAKE_BUS_WRITE_BYTE], 2 * LOOP_SAMPLES);
+    CHECK_EQ(cached.ops[FAKE_BUS_READ_BLOCK], LOOP_SAMPLES);
+}
+
+static void _test_failed_write(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_1X), ESP_OK);
+
+    // the TIMING write fails, without a retry, so the cached value is no longer trusted
+    CHECK_EQ(tsl2561_set_retries(&info, 0, 0), ESP_OK);
+    test_fail_register_write(0x01);  // TIMING
+    host_log_quiet = true;
+    CHECK(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_16X) != ESP_OK);
+    host_log_quiet = false;
+    CHECK(test_register_write_failed());
+    CHECK_EQ(device.regs[1], TIMING_101MS_1X);
+    CHECK(!device.powered);
+    CHECK_EQ(info.integration_time, TSL2561_INTEGRATION_TIME_101MS);
+
+    // so reapplying the settings the device still holds writes them rather than assuming them
+    uint32_t transactions = test_transactions(&smbus_info);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_1X), ESP_OK);
+    CHECK_EQ(test_transactions(&smbus_info) - transactions, 3);
+    CHECK_EQ(device.regs[1], TIMING_101MS_1X);
+
+    transactions = test_transactions(&smbus_info);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_1X), ESP_OK);
+    CHECK_EQ(test_transactions(&smbus_info), transactions);
+}
+
+static void _test_brown_out(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_16X), ESP_OK);
+    CHECK_EQ(device.regs[1], TIMING_13MS_16X);
+
+    // the device resets to 402 ms at 1x without the driver knowing, so the stale cache suppresses the write
+    fake_tsl2561_brown_out(&device);
+    uint32_t transactions = test_transactions(&smbus_info);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_16X), ESP_OK);
+    CHECK_EQ(test_transactions(&smbus_info), transactions);
+    CHECK(device.regs[1] != TIMING_13MS_16X);
+
+    // resync reads the device state back, after which the settings are written again
+    CHECK_EQ(tsl2561_resync(&info), ESP_OK);
+    CHECK_EQ(info.integration_time | info.gain, device.regs[1]);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_16X), ESP_OK);
+    CHECK_EQ(device.regs[1], TIMING_13MS_16X);
+
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    fake_tsl2561_set_light(&device, 2000.0, 500.0);
+    CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+    CHECK(visible > 0);
+}
+
+int main(int argc, char ** argv)
+{
+    _test_unchanged_settings();
+    _test_sampling_loop();
+    _test_failed_write();
+    _test_brown_out();
+    return test_result("test_register_cache");
+}
@@ -0,0 +1,306 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_replay.c
+ * @brief Trace replay: recorded counts are reproduced in the recorded range and rescaled to others,
+ *        saturation and the device ID carry over, and a synthesized day replays through auto-ranging
+ *        deterministically, close to the Lux recorded.
+ */
+
+#include <math.h>
+#include <unistd.h>
+
+#include "baseline_lux.h"
+#include "trace_replay.h"
+#include "test_util.h"
+
+#define TRACE_SAMPLES   50
+#define SAMPLE_US       1000000
+#define SEQUENCE_CH0(i) (100 + 7 * (i))
+#define SEQUENCE_CH1(i) (30 + 3 * (i))
+
+static char _path[] = "/tmp/test_replayXXXXXX";
+
+static void _create_path(void)
+{
+    int fd = mkstemp(_path);
+    CHECK(fd >= 0);
+    close(fd);
+}
+
+// A trace of one range, with counts that identify the sample
+static void _write_sequence(uint8_t id, uint8_t timing)
+{
+    trace_writer_t writer;
+    CHECK_EQ(trace_writer_open(&writer, _path), ESP_OK);
+    CHECK_EQ(trace_writer_append(&writer, 0, TRACE_READ, 0x0A, id), ESP_OK);
+    for (int i = 0; i < TRACE_SAMPLES; ++i)
+    {
+        CHECK_EQ(trace_writer_sample(&writer, (i + 1) * SAMPLE_US, timing, SEQUENCE_CH0(i), SEQUENCE_CH1(i)), ESP_OK);
+    }
+    CHECK_EQ(trace_writer_close(&writer), ESP_OK);
+}
+
+// A trace of one range and constant counts
+static void _write_constant(uint8_t timing, uint16_t ch0, uint16_t ch1)
+{
+    trace_writer_t writer;
+    CHECK_EQ(trace_writer_open(&writer, _path), ESP_OK);
+    for (int i = 0; i < TRACE_SAMPLES; ++i)
+    {
+        CHECK_EQ(trace_writer_sample(&writer, (i + 1) * SAMPLE_US, timing, ch0, ch1), ESP_OK);
+    }
+    CHECK_EQ(trace_writer_close(&writer), ESP_OK);
+}
+
+static void _setup(trace_replay_t * replay, fake_tsl2561_t * device, smbus_info_t * smbus_info, tsl2561_info_t * info)
+{
+    CHECK_EQ(trace_replay_open(replay, _path), ESP_OK);
+    test_attach(device, smbus_info, FAKE_TSL2561_ID_TSL2561T_FN_CL);
+    trace_replay_attach(replay, device);
+    CHECK_EQ(tsl2561_init(info, smbus_info), ESP_OK);
+}
+
+static void _test_recorded_range(void)
+{
+    _write_sequence(FAKE_TSL2561_ID_TSL2561T_FN_CL, TSL2561_INTEGRATION_TIME_101MS | TSL2561_GAIN_16X);
+
+    trace_replay_t replay;
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    _setup(&replay, &device, &smbus_info, &info);
+    CHECK_EQ(replay.samples, TRACE_SAMPLES);
+    CHECK_EQ(replay.duration_us, TRACE_SAMPLES * SAMPLE_US);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_16X), ESP_OK);
+
+    // each result is a recorded sample, exactly, and the samples replay in order
+    int previous = -1;
+    while (esp_timer_get_time() < replay.duration_us)
+    {
+        tsl2561_visible_t visible = 0;
+        tsl2561_infrared_t infrared = 0;
+        CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+        int i = (visible + infrared - SEQUENCE_CH0(0)) / 7;
+        CHECK(i >= previous && i < TRACE_SAMPLES);
+        CHECK_EQ(visible + infrared, SEQUENCE_CH0(i));
+        CHECK_EQ(infrared, SEQUENCE_CH1(i));
+
+        // from the sample whose integration covers the middle of this one
+        int64_t start_us = 0;
+        int64_t end_us = 0;
+        CHECK_EQ(tsl2561_get_result_timestamps(&info, &start_us, &end_us), ESP_OK);
+        CHECK(i == (start_us + end_us) / 2 / SAMPLE_US || i == TRACE_SAMPLES - 1);
+        previous = i;
+    }
+    CHECK_EQ(previous, TRACE_SAMPLES - 1);
+    trace_replay_close(&replay);
+}
+
+static void _test_rescaled(void)
+{
+    // recorded at 13 ms, 1x, replayed at 402 ms, 16x: 16 * 322 / 11 times the counts
+    _write_constant(TSL2561_INTEGRATION_TIME_13MS | TSL2561_GAIN_1X, 20, 5);
+
+    trace_replay_t replay;
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    _setup(&replay, &device, &smbus_info, &info);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_16X), ESP_OK);
+
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+    CHECK_EQ(visible + infrared, (uint32_t)floor(20.5 * 16.0 * 322.0 / 11.0));
+    CHECK_EQ(infrared, (uint32_t)floor(5.5 * 16.0 * 322.0 / 11.0));
+
+    // the Lux agrees within the resolution of the recording, one count in twenty
+    uint32_t recorded = baseline_compute_lux(0, 0, 5, 20 - 5, 5);
+    uint32_t lux = tsl2561_compute_lux(&info, visible, infrared);
+    CHECK(fabs((double)lux - recorded) <= recorded / 20.0);
+    trace_replay_close(&replay);
+}
+
+static void _test_saturated(void)
+{
+    _write_constant(TSL2561_INTEGRATION_TIME_13MS | TSL2561_GAIN_1X, 5047, 1000);
+
+    trace_replay_t replay;
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    _setup(&replay, &device, &smbus_info, &info);
+
+    // saturated in the recorded range, and in any more sensitive one
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_1X), ESP_OK);
+    CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+    CHECK_EQ(visible + infrared, 5047);
+
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_1X), ESP_OK);
+    CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+    CHECK_EQ(visible + infrared, 65535);
+    trace_replay_close(&replay);
+}
+
+static void _test_device_id(void)
+{
+    _write_sequence(FAKE_TSL2561_ID_TSL2561CS, TSL2561_INTEGRATION_TIME_402MS | TSL2561_GAIN_1X);
+
+    trace_replay_t replay;
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    _setup(&replay, &device, &smbus_info, &info);
+    CHECK_EQ(replay.id, FAKE_TSL2561_ID_TSL2561CS);
+    CHECK_EQ(info.device_type, TSL2561_DEVICE_TYPE_TSL2561CS);
+    trace_replay_close(&replay);
+
+    // without an ID read in the trace, a TSL2561T/FN/CL is assumed
+    _write_constant(TSL2561_INTEGRATION_TIME_402MS | TSL2561_GAIN_1X, 100, 10);
+    CHECK_EQ(trace_replay_open(&replay, _path), ESP_OK);
+    CHECK_EQ(replay.id, FAKE_TSL2561_ID_TSL2561T_FN_CL);
+    trace_replay_close(&replay);
+}
+
+// Replay a synthesized day with auto-ranging, returning a hash of the Lux series
+static uint32_t _replay_day(trace_replay_t * replay, bool check)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    test_attach(&device, &smbus_info, FAKE_TSL2561_ID_TSL2561T_FN_CL);
+    trace_replay_attach(replay, &device);
+    CHECK_EQ(tsl2561_init(&info, &smbus_info), ESP_OK);
+    CHECK_EQ(tsl2561_set_auto_range(&info, true), ESP_OK);
+
+    uint32_t hash = 2166136261u;
+    uint32_t results = 0;
+    double max_error = 0.0;
+    size_t cursor = 0;
+    uint8_t timing = TSL2561_INTEGRATION_TIME_402MS | TSL2561_GAIN_1X;
+    trace_sample_t sample = { 0 };
+    TickType_t wake = xTaskGetTickCount();
+    while (esp_timer_get_time() < replay->duration_us)
+    {
+        tsl2561_visible_t visible = 0;
+        tsl2561_infrared_t infrared = 0;
+        CHECK_EQ(tsl2561_read_periodic(&info, &wake, SAMPLE_US / 1000 / portTICK_RATE_MS, &visible, &infrared), ESP_OK);
+        uint32_t lux = tsl2561_compute_lux(&info, visible, infrared);
+        hash = (hash ^ lux) * 16777619u;
+        ++results;
+
+        // against the Lux of the recorded sample the result was replayed from
+        int64_t start_us = 0;
+        int64_t end_us = 0;
+        tsl2561_get_result_timestamps(&info, &start_us, &end_us);
+        while (check && sample.time_us < (start_us + end_us) / 2
+               && trace_replay_next_sample(replay, &cursor, &timing, &sample))
+        {
+        }
+        if (check && end_us < replay->duration_us)
+        {
+            uint32_t recorded = baseline_compute_lux(sample.timing & 0x03, sample.timing & 0x10, 5, sample.ch0 - sample.ch1, sample.ch1);
+            double error = fabs((double)lux - recorded);
+            CHECK(error <= recorded / 50.0 + 1.0);
+            max_error = fmax(max_error, error / (recorded + 1.0));
+        }
+    }
+    CHECK(results >= replay->samples - 1);
+    if (check)
+    {
+        printf("replayed %u results over %.1f h, max Lux error %.2f%% against the recording\n",
+               results, replay->duration_us / 3600e6, 100.0 * max_error);
+    }
+    return hash;
+}
+
+static void _test_day(void)
+{
+    CHECK_EQ(trace_synthesize(_path, FAKE_TSL2561_ID_TSL2561T_FN_CL, trace_daylight, NULL, 86400LL * SAMPLE_US), ESP_OK);
+
+    trace_replay_t replay;
+    CHECK_EQ(trace_replay_open(&replay, _path), ESP_OK);
+    CHECK_EQ(replay.samples, 86399);
+
+    // a replay is repeatable, and so comparable between versions of the driver
+    int64_t start = test_wall_ns();
+    uint32_t first = _replay_day(&replay, true);
+    int64_t elapsed = test_wall_ns() - start;
+    CHECK_EQ(_replay_day(&replay, false), first);
+    printf("day replayed in %.3f s, %.0fx real time\n", elapsed / 1e9, 86400e9 / elapsed);
+    trace_replay_close(&replay);
+}
+
+static void _test_open_errors(void)
+{
+    trace_replay_t replay;
+    CHECK_EQ(trace_replay_open(&replay, "/nonexistent/trace"), ESP_ERR_NOT_FOUND);
+
+    // not a trace
+    FILE * file = fopen(_path, "wb");
+    fputs("not a trace file at all", file);
+    fclose(file);
+    CHECK_EQ(trace_replay_open(&replay, _path), ESP_ERR_INVALID_ARG);
+
+    // an unsupported version
+    trace_header_t header = { .version = TRACE_VERSION + 1, .record_size = sizeof(trace_record_t) };
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    file = fopen(_path, "wb");
+    fwrite(&header, sizeof(header), 1, file);
+    fclose(file);
+    CHECK_EQ(trace_replay_open(&replay, _path), ESP_ERR_INVALID_VERSION);
+
+    // a partial record
+    _write_constant(TSL2561_INTEGRATION_TIME_402MS | TSL2561_GAIN_1X, 100, 10);
+    CHECK_EQ(truncate(_path, sizeof(trace_header_t) + sizeof(trace_record_t) + 1), 0);
+    CHECK_EQ(trace_replay_open(&replay, _path), ESP_ERR_INVALID_ARG);
+
+    // an empty trace has no samples, and replays darkness
+    _write_constant(0, 0, 0);
+    CHECK_EQ(truncate(_path, sizeof(trace_header_t)), 0);
+    CHECK_EQ(trace_replay_open(&replay, _path), ESP_OK);
+    CHECK_EQ(replay.samples, 0);
+    double channel0 = -1.0;
+    double channel1 = -1.0;
+    trace_replay_light(&replay, 0, &channel0, &channel1);
+    CHECK(channel0 == 0.0 && channel1 == 0.0);
+    trace_replay_close(&replay);
+}
+
+int main(int argc, char ** argv)
+{
+    _create_path();
+    _test_recorded_range();
+    _test_rescaled();
+    _test_saturated();
+    _test_device_id();
+    _test_day();
+    _test_open_errors();
+    unlink(_path);
+    return test_result("test_replay");
+}
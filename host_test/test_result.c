@@ -0,0 +1,222 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_result.c
+ * @brief The fused calls tsl2561_read_result() and tsl2561_poll_result_full() return the raw channels,
+ *        a Lux value bit-exact with tsl2561_read() and tsl2561_compute_lux() wherever the infrared channel
+ *        does not exceed the full-spectrum channel, and flags for saturation, underflow and not ready.
+ */
+
+#include "reference_lux.h"
+#include "test_util.h"
+
+#define PAIRS 200
+
+static const tsl2561_integration_time_t _times[] = {
+    TSL2561_INTEGRATION_TIME_13MS, TSL2561_INTEGRATION_TIME_101MS, TSL2561_INTEGRATION_TIME_402MS,
+};
+static const uint32_t _clips[] = { 5047, 37177, 65535 };
+static const tsl2561_gain_t _gains[] = { TSL2561_GAIN_1X, TSL2561_GAIN_16X };
+static const uint8_t _ids[] = { FAKE_TSL2561_ID_TSL2561CS, FAKE_TSL2561_ID_TSL2561T_FN_CL };
+
+static uint32_t _random(uint32_t * state)
+{
+    *state = *state * 1664525 + 1013904223;
+    return *state >> 8;
+}
+
+// Set the light so that the device produces exactly the given counts in its current range
+static void _set_counts(fake_tsl2561_t * device, uint16_t ch0, uint16_t ch1)
+{
+    double fraction = 0.0;
+    double clip = 0.0;
+    fake_tsl2561_response(device->regs[1], 0, &fraction, &clip);
+    fake_tsl2561_set_light(device, (ch0 + 0.5) / fraction, (ch1 + 0.5) / fraction);
+}
+
+static void _check_flags(const tsl2561_result_t * result, uint32_t clip)
+{
+    bool saturated = result->channel0 >= clip || result->channel1 >= clip;
+    CHECK_EQ(!!(result->flags & TSL2561_RESULT_SATURATED), saturated);
+    CHECK_EQ(!!(result->flags & TSL2561_RESULT_UNDERFLOW), result->channel1 > result->channel0);
+    CHECK(!(result->flags & TSL2561_RESULT_NOT_READY));
+}
+
+static void _test_read_result(uint8_t id, size_t t, size_t g)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, id), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, _times[t], _gains[g]), ESP_OK);
+    int package = id == FAKE_TSL2561_ID_TSL2561CS ? REFERENCE_PACKAGE_CS : REFERENCE_PACKAGE_T;
+
+    uint32_t state = id * 97 + t * 7 + g;
+    uint32_t underflows = 0;
+    for (int i = 0; i < PAIRS; ++i)
+    {
+        // valid pairs across the range, with the extremes, saturation and underflow
+        uint16_t ch0 = _random(&state) % (_clips[t] + 1);
+        uint16_t ch1 = ch0 ? _random(&state) % (ch0 + 1) : 0;
+        switch (i % 10)
+        {
+        case 0: ch0 = ch1 = 0; break;
+        case 1: ch0 = _clips[t]; break;
+        case 2: ch1 = ch0; break;
+        case 3: ch1 = ch0 + 1 + _random(&state) % (_clips[t] - ch0 + 1); ch1 = ch1 > _clips[t] ? _clips[t] : ch1; break;
+        default: break;
+        }
+        _set_counts(&device, ch0, ch1);
+
+        tsl2561_result_t result;
+        CHECK_EQ(tsl2561_read_result(&info, &result), ESP_OK);
+        CHECK_EQ(result.channel0, ch0);
+        CHECK_EQ(result.channel1, ch1);
+        _check_flags(&result, _clips[t]);
+
+        if (ch1 <= ch0)
+        {
+            // the same measurement through the two-step path
+            tsl2561_visible_t visible = 0;
+            tsl2561_infrared_t infrared = 0;
+            CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+            CHECK_EQ(visible, ch0 - ch1);
+            CHECK_EQ(infrared, ch1);
+            CHECK_EQ(result.lux, tsl2561_compute_lux(&info, visible, infrared));
+        }
+        else
+        {
+            // visible would wrap, but the fused result is computed from the raw channels
+            CHECK_EQ(result.lux, reference_lux(g, t, ch0, ch1, package));
+            ++underflows;
+        }
+    }
+    CHECK(underflows > 0);
+}
+
+static void _test_poll_result_full(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_16X), ESP_OK);
+    _set_counts(&device, 12345, 2345);
+
+    // no measurement in progress
+    tsl2561_result_t result;
+    host_log_quiet = true;
+    CHECK_EQ(tsl2561_poll_result_full(&info, &result), ESP_ERR_INVALID_STATE);
+    CHECK_EQ(tsl2561_read_result(&info, NULL), ESP_FAIL);
+    CHECK_EQ(tsl2561_poll_result_full(NULL, &result), ESP_FAIL);
+    host_log_quiet = false;
+
+    // not ready: only the flag is set
+    CHECK_EQ(tsl2561_start_measurement(&info), ESP_OK);
+    memset(&result, 0xff, sizeof(result));
+    CHECK_EQ(tsl2561_poll_result_full(&info, &result), ESP_OK);
+    CHECK_EQ(result.flags, TSL2561_RESULT_NOT_READY);
+    CHECK_EQ(result.channel0, 0);
+    CHECK_EQ(result.channel1, 0);
+    CHECK_EQ(result.lux, 0);
+
+    // ready: as read_result
+    while (xTaskGetTickCount() < tsl2561_get_ready_tick(&info))
+    {
+        vTaskDelay(1);
+    }
+    CHECK_EQ(tsl2561_poll_result_full(&info, &result), ESP_OK);
+    CHECK_EQ(result.flags, 0);
+    CHECK_EQ(result.channel0, 12345);
+    CHECK_EQ(result.channel1, 2345);
+    CHECK_EQ(result.lux, tsl2561_compute_lux(&info, 12345 - 2345, 2345));
+
+    // continuously, each conversion in turn, saturated and underflowing as the light changes
+    CHECK_EQ(tsl2561_start_continuous(&info), ESP_OK);
+    static const uint16_t counts[][2] = { { 1000, 200 }, { 37177, 9000 }, { 100, 300 }, { 500, 100 } };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i)
+    {
+        _set_counts(&device, counts[i][0], counts[i][1]);
+        do
+        {
+            vTaskDelay(1);
+            CHECK_EQ(tsl2561_poll_result_full(&info, &result), ESP_OK);
+        } while (result.flags & TSL2561_RESULT_NOT_READY);
+
+        // the light changed during the integration that was under way, so skip to the next
+        do
+        {
+            vTaskDelay(1);
+            CHECK_EQ(tsl2561_poll_result_full(&info, &result), ESP_OK);
+        } while (result.flags & TSL2561_RESULT_NOT_READY);
+        CHECK_EQ(result.channel0, counts[i][0]);
+        CHECK_EQ(result.channel1, counts[i][1]);
+        _check_flags(&result, 37177);
+        if (counts[i][1] <= counts[i][0])
+        {
+            CHECK_EQ(result.lux, tsl2561_compute_lux(&info, counts[i][0] - counts[i][1], counts[i][1]));
+        }
+    }
+    CHECK_EQ(tsl2561_stop_measurement(&info), ESP_OK);
+}
+
+static void _test_manual(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_manual_integration(&info, 50000, TSL2561_GAIN_16X), ESP_OK);
+
+    // the Lux value of a manual integration agrees with the two-step path for the same raw channels
+    uint32_t state = 1;
+    for (int i = 0; i < PAIRS / 10; ++i)
+    {
+        double light = _random(&state) % 100000;
+        fake_tsl2561_set_light(&device, light, light * (_random(&state) % 100) / 100.0);
+        tsl2561_result_t result;
+        CHECK_EQ(tsl2561_read_result(&info, &result), ESP_OK);
+        CHECK(!(result.flags & TSL2561_RESULT_UNDERFLOW));
+        CHECK(!(result.flags & TSL2561_RESULT_SATURATED));
+        CHECK_EQ(result.lux, tsl2561_compute_lux(&info, result.channel0 - result.channel1, result.channel1));
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    for (size_t d = 0; d < sizeof(_ids) / sizeof(_ids[0]); ++d)
+    {
+        for (size_t t = 0; t < sizeof(_times) / sizeof(_times[0]); ++t)
+        {
+            for (size_t g = 0; g < sizeof(_gains) / sizeof(_gains[0]); ++g)
+            {
+                _test_read_result(_ids[d], t, g);
+            }
+        }
+    }
+    _test_poll_result_full();
+    _test_manual();
+    return test_result("test_result");
+}
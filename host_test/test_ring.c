@@ -0,0 +1,204 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_ring.c
+ * @brief Lock-free sample ring: readers never wait for the producer, every sample a reader
+ *        accepts is intact and in order, and samples are either delivered or counted as lost.
+ */
+
+#include <pthread.h>
+
+#include "tsl2561_acquisition.h"
+#include "test_util.h"
+
+#define STRESS_SAMPLES 2000000
+#define STRESS_READERS 3
+
+// A sample whose fields can all be checked against its sequence number
+static tsl2561_sample_t _make_sample(uint32_t n)
+{
+    tsl2561_sample_t sample = {
+        .timestamp = n,
+        .integration_start_us = (int64_t)n * 1000,
+        .integration_end_us = (int64_t)n * 1000 + 13700,
+        .visible = n & 0xffff,
+        .infrared = ~n & 0xffff,
+        .lux = ~n,
+    };
+    return sample;
+}
+
+static bool _intact(const tsl2561_sample_t * sample)
+{
+    tsl2561_sample_t expected = _make_sample(sample->timestamp);
+    return sample->integration_start_us == expected.integration_start_us
+        && sample->integration_end_us == expected.integration_end_us
+        && sample->visible == expected.visible
+        && sample->infrared == expected.infrared
+        && sample->lux == expected.lux;
+}
+
+static void _test_overwrite_in_progress(void)
+{
+    tsl2561_ring_slot_t slots[4];
+    tsl2561_ring_t ring;
+    CHECK_EQ(tsl2561_ring_init(&ring, slots, 4), ESP_OK);
+    for (uint32_t n = 0; n < 4; ++n)
+    {
+        tsl2561_sample_t sample = _make_sample(n);
+        CHECK_EQ(tsl2561_ring_publish(&ring, &sample), ESP_OK);
+    }
+
+    // the producer has started to write sample 4 over sample 0, which a reader a full ring behind wants next
+    slots[0].sequence = (4 << 1) + 1;
+    uint32_t cursor = 0;
+    uint32_t lost = 0;
+    tsl2561_sample_t sample;
+    CHECK_EQ(tsl2561_ring_read(&ring, &cursor, &sample, &lost), ESP_OK);
+    CHECK_EQ(sample.timestamp, 1);
+    CHECK_EQ(lost, 1);
+    CHECK_EQ(cursor, 2);
+
+    // with one slot, the only sample is unavailable while it is replaced
+    tsl2561_ring_slot_t slot;
+    CHECK_EQ(tsl2561_ring_init(&ring, &slot, 1), ESP_OK);
+    CHECK_EQ(tsl2561_ring_latest(&ring, &sample), ESP_ERR_NOT_FOUND);
+    sample = _make_sample(0);
+    CHECK_EQ(tsl2561_ring_publish(&ring, &sample), ESP_OK);
+    CHECK_EQ(tsl2561_ring_latest(&ring, &sample), ESP_OK);
+    slot.sequence = (1 << 1) + 1;
+    CHECK_EQ(tsl2561_ring_latest(&ring, &sample), ESP_ERR_NOT_FOUND);
+}
+
+typedef struct
+{
+    tsl2561_ring_t * ring;
+    uint32_t samples;
+    volatile bool done;
+    uint64_t received;
+    uint64_t lost;
+    uint64_t corrupt;
+    uint64_t disordered;
+    uint64_t latest;
+} stress_t;
+
+static void * _producer(void * arg)
+{
+    stress_t * stress = (stress_t *)arg;
+    for (uint32_t n = 0; n < stress->samples; ++n)
+    {
+        tsl2561_sample_t sample = _make_sample(n);
+        tsl2561_ring_publish(stress->ring, &sample);
+
+        // pace the producer so that readers keep up some of the time
+        for (volatile int i = 0; i < 100; ++i)
+        {
+        }
+    }
+    __atomic_store_n(&stress->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void * _reader(void * arg)
+{
+    stress_t * stress = (stress_t *)arg;
+    stress_t result = { 0 };
+    uint32_t cursor = 0;
+    uint32_t expected = 0;
+    bool done = false;
+    while (!done)
+    {
+        // after the producer finishes, drain everything it published
+        done = __atomic_load_n(&stress->done, __ATOMIC_ACQUIRE);
+        tsl2561_sample_t sample;
+        uint32_t lost = 0;
+        esp_err_t err = ESP_OK;
+        while (err == ESP_OK)
+        {
+            // lost samples are reported whether or not a sample is returned
+            err = tsl2561_ring_read(stress->ring, &cursor, &sample, &lost);
+            result.lost += lost;
+            expected += lost;
+            if (err == ESP_OK)
+            {
+                result.corrupt += !_intact(&sample);
+                result.disordered += sample.timestamp != expected;
+                expected = sample.timestamp + 1;
+                ++result.received;
+            }
+        }
+
+        if (tsl2561_ring_latest(stress->ring, &sample) == ESP_OK)
+        {
+            result.corrupt += !_intact(&sample);
+            ++result.latest;
+        }
+    }
+
+    __atomic_add_fetch(&stress->received, result.received, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stress->lost, result.lost, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stress->corrupt, result.corrupt, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stress->disordered, result.disordered, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stress->latest, result.latest, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void _test_stress(uint32_t capacity, uint32_t samples)
+{
+    static tsl2561_ring_slot_t slots[64];
+    tsl2561_ring_t ring;
+    CHECK_EQ(tsl2561_ring_init(&ring, slots, capacity), ESP_OK);
+
+    stress_t stress = { .ring = &ring, .samples = samples };
+    pthread_t producer;
+    pthread_t readers[STRESS_READERS];
+    for (int i = 0; i < STRESS_READERS; ++i)
+    {
+        pthread_create(&readers[i], NULL, _reader, &stress);
+    }
+    pthread_create(&producer, NULL, _producer, &stress);
+    pthread_join(producer, NULL);
+    for (int i = 0; i < STRESS_READERS; ++i)
+    {
+        pthread_join(readers[i], NULL);
+    }
+
+    printf("capacity %2u: %llu received, %llu lost, %llu latest, %llu corrupt, %llu out of order\n", capacity,
+           (unsigned long long)stress.received, (unsigned long long)stress.lost, (unsigned long long)stress.latest,
+           (unsigned long long)stress.corrupt, (unsigned long long)stress.disordered);
+    CHECK_EQ(stress.corrupt, 0);
+    CHECK_EQ(stress.disordered, 0);
+    CHECK_EQ(stress.received + stress.lost, (uint64_t)samples * STRESS_READERS);
+}
+
+int main(int argc, char ** argv)
+{
+    _test_overwrite_in_progress();
+    uint32_t samples = test_flag(argc, argv, "--quick") ? STRESS_SAMPLES / 10 : STRESS_SAMPLES;
+    _test_stress(1, samples);
+    _test_stress(4, samples);
+    _test_stress(64, samples);
+    return test_result("test_ring");
+}
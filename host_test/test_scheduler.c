@@ -0,0 +1,162 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_scheduler.c
+ * @brief The scheduler overlaps the integrations of several devices, on one bus or two, so a
+ *        round of measurements costs about one integration period rather than one per device.
+ */
+
+#include "tsl2561_scheduler.h"
+#include "test_util.h"
+
+#define ROUNDS 20
+#define NUM_DEVICES 3
+
+static const i2c_address_t ADDRESSES[NUM_DEVICES] = { 0x29, 0x39, 0x49 };
+
+typedef struct
+{
+    fake_tsl2561_t device[NUM_DEVICES];
+    smbus_info_t smbus_info[NUM_DEVICES];
+    tsl2561_info_t info[NUM_DEVICES];
+} bench_t;
+
+static void _setup(bench_t * bench, bool two_buses, tsl2561_integration_time_t integration_time)
+{
+    host_clock_reset();
+    fake_bus_reset();
+    fake_tsl2561_detach_all();
+    for (size_t i = 0; i < NUM_DEVICES; ++i)
+    {
+        fake_tsl2561_init(&bench->device[i], FAKE_TSL2561_ID_TSL2561T_FN_CL);
+        fake_tsl2561_set_light(&bench->device[i], 1000.0 * (i + 1), 250.0 * (i + 1));
+        CHECK_EQ(fake_tsl2561_attach(&bench->device[i], &bench->smbus_info[i], two_buses ? i % 2 : 0, ADDRESSES[i]), ESP_OK);
+        CHECK_EQ(tsl2561_init(&bench->info[i], &bench->smbus_info[i]), ESP_OK);
+        CHECK_EQ(tsl2561_set_integration_time_and_gain(&bench->info[i], integration_time, TSL2561_GAIN_16X), ESP_OK);
+    }
+}
+
+static void _check_results(const bench_t * bench, const tsl2561_visible_t * visible, const tsl2561_infrared_t * infrared,
+                           tsl2561_integration_time_t integration_time)
+{
+    for (size_t i = 0; i < NUM_DEVICES; ++i)
+    {
+        uint16_t ch0 = 0;
+        uint16_t ch1 = 0;
+        fake_tsl2561_counts(integration_time | TSL2561_GAIN_16X, 0, bench->device[i].channel0, bench->device[i].channel1, &ch0, &ch1);
+        CHECK_EQ(visible[i] + infrared[i], ch0);
+        CHECK_EQ(infrared[i], ch1);
+    }
+}
+
+static void _test_rate(bool two_buses, tsl2561_integration_time_t integration_time)
+{
+    bench_t bench;
+    tsl2561_visible_t visible[NUM_DEVICES] = { 0 };
+    tsl2561_infrared_t infrared[NUM_DEVICES] = { 0 };
+
+    // each device in turn
+    _setup(&bench, two_buses, integration_time);
+    int64_t start = esp_timer_get_time();
+    for (int r = 0; r < ROUNDS; ++r)
+    {
+        for (size_t i = 0; i < NUM_DEVICES; ++i)
+        {
+            CHECK_EQ(tsl2561_read(&bench.info[i], &visible[i], &infrared[i]), ESP_OK);
+        }
+    }
+    double sequential = ROUNDS * NUM_DEVICES * 1e6 / (esp_timer_get_time() - start);
+    _check_results(&bench, visible, infrared, integration_time);
+
+    // all devices together
+    _setup(&bench, two_buses, integration_time);
+    tsl2561_scheduler_t scheduler;
+    CHECK_EQ(tsl2561_scheduler_init(&scheduler), ESP_OK);
+    for (size_t i = 0; i < NUM_DEVICES; ++i)
+    {
+        CHECK_EQ(tsl2561_scheduler_add(&scheduler, &bench.info[i]), ESP_OK);
+    }
+    start = esp_timer_get_time();
+    for (int r = 0; r < ROUNDS; ++r)
+    {
+        CHECK_EQ(tsl2561_scheduler_read(&scheduler, visible, infrared), ESP_OK);
+    }
+    double elapsed = esp_timer_get_time() - start;
+    double scheduled = ROUNDS * NUM_DEVICES * 1e6 / elapsed;
+    _check_results(&bench, visible, infrared, integration_time);
+
+    int64_t period = fake_tsl2561_period_us(integration_time);
+    printf("%s, %lld us: sequential %.1f samples/s, scheduled %.1f samples/s, %.0f us per round, %u clock spins\n",
+           two_buses ? "two buses" : "one bus", (long long)period, sequential, scheduled, elapsed / ROUNDS,
+           host_clock_get_stats().spins);
+
+    // a round costs one integration, with its wake-up and bus time, not one per device; sleeping
+    // until the ready tick may cost one tick more than a blocking read, but never a wasted wake-up
+    CHECK(elapsed / ROUNDS <= 1e6 / sequential + HOST_TICK_US + 1000);
+    CHECK_EQ(host_clock_get_stats().spins, 0);
+    CHECK(elapsed / ROUNDS <= period + period / 8 + 3 * HOST_TICK_US);
+    for (size_t i = 0; i < NUM_DEVICES; ++i)
+    {
+        CHECK_EQ(bench.device[i].premature_reads, 0);
+    }
+}
+
+static void _test_continuous(void)
+{
+    bench_t bench;
+    tsl2561_visible_t visible[NUM_DEVICES] = { 0 };
+    tsl2561_infrared_t infrared[NUM_DEVICES] = { 0 };
+    _setup(&bench, false, TSL2561_INTEGRATION_TIME_13MS);
+
+    // devices in continuous acquisition are read without being restarted
+    tsl2561_scheduler_t scheduler;
+    CHECK_EQ(tsl2561_scheduler_init(&scheduler), ESP_OK);
+    for (size_t i = 0; i < NUM_DEVICES; ++i)
+    {
+        CHECK_EQ(tsl2561_start_continuous(&bench.info[i]), ESP_OK);
+        CHECK_EQ(tsl2561_scheduler_add(&scheduler, &bench.info[i]), ESP_OK);
+    }
+    for (int r = 0; r < ROUNDS; ++r)
+    {
+        CHECK_EQ(tsl2561_scheduler_read(&scheduler, visible, infrared), ESP_OK);
+    }
+    _check_results(&bench, visible, infrared, TSL2561_INTEGRATION_TIME_13MS);
+    for (size_t i = 0; i < NUM_DEVICES; ++i)
+    {
+        CHECK_EQ(bench.device[i].power_ups, 2);
+        CHECK_EQ(bench.device[i].duplicate_reads, 0);
+        CHECK_EQ(tsl2561_stop_measurement(&bench.info[i]), ESP_OK);
+    }
+}
+
+int main(void)
+{
+    _test_rate(false, TSL2561_INTEGRATION_TIME_13MS);
+    _test_rate(false, TSL2561_INTEGRATION_TIME_101MS);
+    _test_rate(false, TSL2561_INTEGRATION_TIME_402MS);
+    _test_rate(true, TSL2561_INTEGRATION_TIME_101MS);
+    _test_continuous();
+    return test_result("test_scheduler");
+}
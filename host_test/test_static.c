@@ -0,0 +1,209 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_static.c
+ * @brief With CONFIG_TSL2561_DISABLE_MALLOC, the full lifecycle of every component, in
+ *        caller-supplied storage, makes no heap allocation. Allocation calls are counted by
+ *        wrapping malloc() and friends at link time.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "tsl2561_acquisition.h"
+#include "tsl2561_adaptive.h"
+#include "tsl2561_filter.h"
+#include "tsl2561_record.h"
+#include "tsl2561_scheduler.h"
+#include "test_util.h"
+
+#ifndef CONFIG_TSL2561_DISABLE_MALLOC
+#  error "test_static must be built with CONFIG_TSL2561_DISABLE_MALLOC"
+#endif
+
+#define ACQUISITION_SAMPLES 20
+
+void * __real_malloc(size_t size);
+void * __real_calloc(size_t count, size_t size);
+void * __real_realloc(void * pointer, size_t size);
+void __real_free(void * pointer);
+
+static volatile bool _counting = false;
+static volatile uint32_t _allocations = 0;
+
+void * __wrap_malloc(size_t size)
+{
+    _allocations += _counting;
+    return __real_malloc(size);
+}
+
+void * __wrap_calloc(size_t count, size_t size)
+{
+    _allocations += _counting;
+    return __real_calloc(count, size);
+}
+
+void * __wrap_realloc(void * pointer, size_t size)
+{
+    _allocations += _counting;
+    return __real_realloc(pointer, size);
+}
+
+void __wrap_free(void * pointer)
+{
+    _allocations += _counting && pointer != NULL;
+    __real_free(pointer);
+}
+
+// All instances live in static storage, as on a node that forbids allocation after boot
+static fake_tsl2561_t _devices[2];
+static smbus_info_t _smbus_info[2];
+static tsl2561_info_t _info[2];
+static tsl2561_filter_t _filter;
+static tsl2561_scheduler_t _scheduler;
+static tsl2561_adaptive_t _adaptive;
+static tsl2561_ring_slot_t _slots[16];
+static tsl2561_ring_t _ring;
+static tsl2561_acquisition_t _acquisition;
+static tsl2561_record_encoder_t _encoder;
+static tsl2561_record_decoder_t _decoder;
+static uint8_t _block[512];
+
+// Ask the acquisition task to stop once it has published enough samples
+static void _stop_light(void * context, int64_t time_us, double * channel0, double * channel1)
+{
+    *channel0 = 20000.0;
+    *channel1 = 5000.0;
+    _acquisition.stop = _acquisition.stop || _ring.head >= ACQUISITION_SAMPLES;
+}
+
+static void * _acquisition_thread(void * arg)
+{
+    tsl2561_acquisition_task(arg);
+    return NULL;
+}
+
+static void _lifecycle(void)
+{
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+
+    // driver
+    CHECK_EQ(tsl2561_init(&_info[0], &_smbus_info[0]), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&_info[0], TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_16X), ESP_OK);
+    CHECK_EQ(tsl2561_read(&_info[0], &visible, &infrared), ESP_OK);
+    CHECK(tsl2561_compute_lux(&_info[0], visible, infrared) > 0);
+    CHECK_EQ(tsl2561_config_begin(&_info[0]), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&_info[0], TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_1X), ESP_OK);
+    CHECK_EQ(tsl2561_config_commit(&_info[0]), ESP_OK);
+    CHECK_EQ(tsl2561_set_auto_range(&_info[0], true), ESP_OK);
+    CHECK_EQ(tsl2561_read(&_info[0], &visible, &infrared), ESP_OK);
+    CHECK_EQ(tsl2561_set_auto_range(&_info[0], false), ESP_OK);
+    CHECK_EQ(tsl2561_resync(&_info[0]), ESP_OK);
+
+    // filtering over continuous acquisition
+    CHECK_EQ(tsl2561_filter_init(&_filter, TSL2561_FILTER_MEDIAN, 8), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&_info[0], TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_16X), ESP_OK);
+    CHECK_EQ(tsl2561_start_continuous(&_info[0]), ESP_OK);
+    CHECK_EQ(tsl2561_filter_read(&_filter, &_info[0], 8, &visible, &infrared), ESP_OK);
+    CHECK_EQ(tsl2561_stop_measurement(&_info[0]), ESP_OK);
+
+    // adaptive sampling
+    TickType_t wake = xTaskGetTickCount();
+    CHECK_EQ(tsl2561_adaptive_init(&_adaptive, 5, 50, 10), ESP_OK);
+    for (int i = 0; i < 5; ++i)
+    {
+        CHECK_EQ(tsl2561_adaptive_read(&_adaptive, &_info[0], &wake, &visible, &infrared), ESP_OK);
+    }
+
+    // several devices on one bus
+    tsl2561_visible_t visibles[2] = { 0 };
+    tsl2561_infrared_t infrareds[2] = { 0 };
+    CHECK_EQ(tsl2561_init(&_info[1], &_smbus_info[1]), ESP_OK);
+    CHECK_EQ(tsl2561_scheduler_init(&_scheduler), ESP_OK);
+    CHECK_EQ(tsl2561_scheduler_add(&_scheduler, &_info[0]), ESP_OK);
+    CHECK_EQ(tsl2561_scheduler_add(&_scheduler, &_info[1]), ESP_OK);
+    CHECK_EQ(tsl2561_scheduler_read(&_scheduler, visibles, infrareds), ESP_OK);
+
+    // recording
+    size_t length = 0;
+    tsl2561_record_sample_t sample;
+    CHECK_EQ(tsl2561_record_encoder_init(&_encoder, _info[0].device_type, _info[0].integration_time, _info[0].gain,
+                                         _block, sizeof(_block)), ESP_OK);
+    for (int i = 0; i < 10; ++i)
+    {
+        CHECK_EQ(tsl2561_record_encode(&_encoder, esp_timer_get_time() + i * 13700, _info[0].integration_time, _info[0].gain,
+                                       visibles[0] + i, infrareds[0]), ESP_OK);
+    }
+    CHECK_EQ(tsl2561_record_encoder_finish(&_encoder, &length), ESP_OK);
+    CHECK_EQ(tsl2561_record_decoder_init(&_decoder, _block, length), ESP_OK);
+    CHECK_EQ(tsl2561_record_decode(&_decoder, &sample), ESP_OK);
+
+    // acquisition task publishing to a ring, then powering down and deleting itself
+    CHECK_EQ(tsl2561_ring_init(&_ring, _slots, sizeof(_slots) / sizeof(_slots[0])), ESP_OK);
+    _acquisition = (tsl2561_acquisition_t){ .tsl2561_info = &_info[0], .ring = &_ring, .period = 0, .stop = false };
+    _devices[0].light = _stop_light;
+    pthread_t task;
+    CHECK_EQ(pthread_create(&task, NULL, _acquisition_thread, &_acquisition), 0);
+    pthread_join(task, NULL);
+    CHECK(_ring.head >= ACQUISITION_SAMPLES);
+    CHECK(!_devices[0].powered);
+
+    uint32_t cursor = 0;
+    uint32_t lost = 0;
+    tsl2561_sample_t latest;
+    CHECK_EQ(tsl2561_ring_read(&_ring, &cursor, &latest, &lost), ESP_OK);
+    CHECK_EQ(tsl2561_ring_latest(&_ring, &latest), ESP_OK);
+    CHECK(latest.lux > 0);
+}
+
+int main(int argc, char ** argv)
+{
+    // the bus and devices are the test's own, so are set up before counting begins
+    host_clock_reset();
+    fake_bus_reset();
+    fake_tsl2561_detach_all();
+    for (int i = 0; i < 2; ++i)
+    {
+        fake_tsl2561_init(&_devices[i], FAKE_TSL2561_ID_TSL2561T_FN_CL);
+        fake_tsl2561_set_light(&_devices[i], 20000.0, 5000.0);
+        fake_tsl2561_attach(&_devices[i], &_smbus_info[i], TEST_PORT, TEST_ADDRESS + i * 0x10);
+    }
+
+    // confirm that the wrappers see allocations at all
+    _counting = true;
+    void * probe = malloc(16);
+    free(probe);
+    _counting = false;
+    CHECK_EQ(_allocations, 2);
+
+    _allocations = 0;
+    _counting = true;
+    _lifecycle();
+    _counting = false;
+    printf("full lifecycle: %u heap allocations\n", _allocations);
+    CHECK_EQ(_allocations, 0);
+    return test_result("test_static");
+}
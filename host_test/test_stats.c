@@ -0,0 +1,201 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_stats.c
+ * @brief Driver performance statistics, checked against the fake bus counters and the virtual
+ *        clock. Built with and without CONFIG_TSL2561_STATS.
+ */
+
+#include "test_util.h"
+
+#ifdef CONFIG_TSL2561_STATS
+
+static tsl2561_stats_t _stats(const tsl2561_info_t * info)
+{
+    tsl2561_stats_t stats;
+    memset(&stats, 0xff, sizeof(stats));
+    CHECK_EQ(tsl2561_get_stats(info, &stats), ESP_OK);
+    return stats;
+}
+
+static void _test_latency(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_1X), ESP_OK);
+    fake_tsl2561_set_light(&device, 20000.0, 5000.0);
+
+    // every transaction since initialisation is counted, and none failed
+    tsl2561_stats_t stats = _stats(&info);
+    CHECK_EQ(stats.transactions, test_transactions(&smbus_info));
+    CHECK_EQ(stats.bus_errors, 0);
+    CHECK_EQ(stats.results, 0);
+    CHECK_EQ(stats.latency_avg_us, 0);
+
+    CHECK_EQ(tsl2561_reset_stats(&info), ESP_OK);
+    uint32_t transactions = test_transactions(&smbus_info);
+    int64_t min_latency = INT64_MAX;
+    int64_t max_latency = 0;
+    const int reads = 10;
+    for (int i = 0; i < reads; ++i)
+    {
+        tsl2561_visible_t visible = 0;
+        tsl2561_infrared_t infrared = 0;
+        int64_t start = esp_timer_get_time();
+        CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+        int64_t latency = esp_timer_get_time() - start;
+        min_latency = latency < min_latency ? latency : min_latency;
+        max_latency = latency > max_latency ? latency : max_latency;
+
+        // latency runs from the start of integration, after the power-up write, to the result
+        stats = _stats(&info);
+        CHECK(stats.latency_max_us <= max_latency);
+    }
+
+    stats = _stats(&info);
+    CHECK_EQ(stats.results, reads);
+    CHECK_EQ(stats.saturated, 0);
+    CHECK_EQ(stats.transactions, test_transactions(&smbus_info) - transactions);
+    CHECK(stats.latency_min_us >= fake_tsl2561_period_us(TSL2561_INTEGRATION_TIME_101MS));
+    CHECK(stats.latency_min_us <= stats.latency_avg_us && stats.latency_avg_us <= stats.latency_max_us);
+    CHECK(stats.latency_max_us <= max_latency);
+    CHECK(stats.latency_min_us + 1000 >= min_latency);  // within the power-up and data transactions
+    CHECK_EQ(stats.latency_total_us / reads, stats.latency_avg_us);
+
+    // the wait allows 1/16 for oscillator tolerance and is rounded up to whole ticks
+    int64_t period = fake_tsl2561_period_us(TSL2561_INTEGRATION_TIME_101MS);
+    CHECK(stats.overshoot_max_us < period / 16 + HOST_TICK_US + 1000);
+    CHECK(stats.overshoot_total_us <= (uint64_t)stats.overshoot_max_us * reads);
+    printf("101 ms reads: latency min %u avg %u max %u us, overshoot max %u us, %u transactions\n",
+           stats.latency_min_us, stats.latency_avg_us, stats.latency_max_us, stats.overshoot_max_us, stats.transactions);
+
+    CHECK_EQ(tsl2561_reset_stats(&info), ESP_OK);
+    stats = _stats(&info);
+    CHECK_EQ(stats.results, 0);
+    CHECK_EQ(stats.transactions, 0);
+    CHECK_EQ(stats.latency_max_us, 0);
+    CHECK_EQ(stats.latency_min_us, UINT32_MAX);
+}
+
+static void _test_saturation_and_auto_range(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_16X), ESP_OK);
+    fake_tsl2561_set_light(&device, 1e7, 2e6);
+
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    CHECK_EQ(tsl2561_reset_stats(&info), ESP_OK);
+    CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+    tsl2561_stats_t stats = _stats(&info);
+    CHECK_EQ(stats.results, 1);
+    CHECK_EQ(stats.saturated, 1);
+    CHECK_EQ(stats.auto_range_steps, 0);
+
+    // auto-ranging steps down until the channels are in range, counting each step
+    fake_tsl2561_set_light(&device, 200000.0, 50000.0);
+    CHECK_EQ(tsl2561_set_auto_range(&info, true), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_16X), ESP_OK);
+    CHECK_EQ(tsl2561_reset_stats(&info), ESP_OK);
+    uint32_t power_ups = device.power_ups;
+    CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+    stats = _stats(&info);
+    CHECK(stats.auto_range_steps > 0);
+    CHECK_EQ(stats.auto_range_steps, device.power_ups - power_ups - 1);  // each step restarts the integration
+    CHECK_EQ(stats.results, 1);
+    CHECK_EQ(stats.saturated, 0);
+}
+
+static void _test_errors(void)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_set_integration_time_and_gain(&info, TSL2561_INTEGRATION_TIME_13MS, TSL2561_GAIN_1X), ESP_OK);
+    fake_tsl2561_set_light(&device, 20000.0, 5000.0);
+
+    // a transient error is retried and the read succeeds
+    tsl2561_visible_t visible = 0;
+    tsl2561_infrared_t infrared = 0;
+    CHECK_EQ(tsl2561_reset_stats(&info), ESP_OK);
+    uint32_t transactions = test_transactions(&smbus_info);
+    host_log_quiet = true;
+    fake_bus_inject_faults(&smbus_info, 1, ESP_FAIL);
+    CHECK_EQ(tsl2561_read(&info, &visible, &infrared), ESP_OK);
+    tsl2561_stats_t stats = _stats(&info);
+    CHECK_EQ(stats.transactions, test_transactions(&smbus_info) - transactions);
+    CHECK_EQ(stats.bus_errors, 1);
+    CHECK_EQ(stats.retries, 1);
+    CHECK_EQ(stats.recoveries, 0);
+    CHECK_EQ(stats.results, 1);
+
+    // persistent errors exhaust the retries and abandon the measurement; without block reads
+    // there is no fallback protocol to try
+    CHECK_EQ(tsl2561_set_retries(&info, 1, 0), ESP_OK);
+    CHECK_EQ(tsl2561_set_block_read(&info, false), ESP_OK);
+    CHECK_EQ(tsl2561_reset_stats(&info), ESP_OK);
+    CHECK_EQ(tsl2561_start_measurement(&info), ESP_OK);
+    vTaskDelay(2);
+    fake_bus_inject_faults(&smbus_info, 2, ESP_FAIL);
+    bool ready = false;
+    CHECK(tsl2561_poll_result(&info, &ready, &visible, &infrared) != ESP_OK);
+    host_log_quiet = false;
+    stats = _stats(&info);
+    CHECK_EQ(stats.bus_errors, 2);
+    CHECK_EQ(stats.retries, 1);
+    CHECK_EQ(stats.recoveries, 1);
+    CHECK_EQ(stats.results, 0);
+    CHECK(!device.powered);
+}
+
+int main(int argc, char ** argv)
+{
+    _test_latency();
+    _test_saturation_and_auto_range();
+    _test_errors();
+    return test_result("test_stats");
+}
+
+#else  // CONFIG_TSL2561_STATS
+
+int main(int argc, char ** argv)
+{
+    fake_tsl2561_t device;
+    smbus_info_t smbus_info;
+    tsl2561_info_t info;
+    tsl2561_stats_t stats;
+    CHECK_EQ(test_setup(&device, &smbus_info, &info, FAKE_TSL2561_ID_TSL2561T_FN_CL), ESP_OK);
+    CHECK_EQ(tsl2561_get_stats(&info, &stats), ESP_ERR_NOT_SUPPORTED);
+    CHECK_EQ(tsl2561_reset_stats(&info), ESP_ERR_NOT_SUPPORTED);
+    return test_result("test_stats_disabled");
+}
+
+#endif  // CONFIG_TSL2561_STATS
@@ -0,0 +1,170 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file test_util.h
+ * @brief Assertions, timing and device set-up shared by the host tests and benchmarks.
+ */
+
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "host_clock.h"
+#include "fake_bus.h"
+#include "fake_tsl2561.h"
+#include "tsl2561.h"
+
+#define TEST_PORT     0      ///< I2C port the emulated devices are attached to
+#define TEST_ADDRESS  0x39   ///< Default TSL2561 address, ADDR SEL floating
+
+static int test_failures = 0;
+
+/**
+ * @brief Record a failure, with its location, if the condition is false.
+ */
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            ++test_failures; \
+        } \
+    } while (0)
+
+/**
+ * @brief Record a failure if two integer expressions differ, printing both values.
+ */
+#define CHECK_EQ(actual, expected) \
+    do { \
+        long long _a = (long long)(actual); \
+        long long _e = (long long)(expected); \
+        if (_a != _e) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #actual, #expected, _a, _e); \
+            ++test_failures; \
+        } \
+    } while (0)
+
+/**
+ * @brief Print the outcome and return the process exit status.
+ */
+static inline int test_result(const char * name)
+{
+    printf("%s: %s (%d failures)\n", name, test_failures ? "FAILED" : "passed", test_failures);
+    return test_failures ? 1 : 0;
+}
+
+/**
+ * @brief Return true if the command line contains the given flag.
+ */
+static inline bool test_flag(int argc, char ** argv, const char * flag)
+{
+    bool found = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        found = found || strcmp(argv[i], flag) == 0;
+    }
+    return found;
+}
+
+/**
+ * @brief Host monotonic time in nanoseconds, for benchmarks. Unaffected by the virtual clock.
+ */
+static inline int64_t test_wall_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Reset the virtual clock and the fake bus, and attach an emulated device at the
+ *        default address. The device is not initialised by the driver.
+ */
+static inline void test_attach(fake_tsl2561_t * device, smbus_info_t * smbus_info, uint8_t id)
+{
+    host_clock_reset();
+    fake_bus_reset();
+    fake_tsl2561_detach_all();
+    fake_tsl2561_init(device, id);
+    fake_tsl2561_attach(device, smbus_info, TEST_PORT, TEST_ADDRESS);
+}
+
+/**
+ * @brief As test_attach(), then initialise the driver instance, returning the result.
+ */
+static inline esp_err_t test_setup(fake_tsl2561_t * device, smbus_info_t * smbus_info, tsl2561_info_t * tsl2561_info, uint8_t id)
+{
+    test_attach(device, smbus_info, id);
+    return tsl2561_init(tsl2561_info, smbus_info);
+}
+
+/**
+ * @brief Number of transactions the device has seen so far.
+ */
+static inline uint32_t test_transactions(const smbus_info_t * smbus_info)
+{
+    return fake_bus_device_counters(smbus_info).transactions;
+}
+
+static uint8_t _test_fail_register = 0xff;
+
+static inline void _test_fail_register_monitor(void * context, const smbus_info_t * smbus_info, fake_bus_op_t op, uint8_t command)
+{
+    if (op == FAKE_BUS_WRITE_BYTE && (command & 0x0f) == _test_fail_register)
+    {
+        fake_bus_inject_faults(smbus_info, 1, ESP_FAIL);
+        _test_fail_register = 0xff;
+        fake_bus_set_monitor(NULL, NULL);
+    }
+}
+
+/**
+ * @brief Make the next byte write to the given register fail, as if NACKed, letting the transactions
+ *        before it succeed. Each attempt of a retried write is a separate transaction.
+ */
+static inline void test_fail_register_write(uint8_t reg)
+{
+    _test_fail_register = reg;
+    fake_bus_set_monitor(_test_fail_register_monitor, NULL);
+}
+
+/**
+ * @brief True if the write set up by test_fail_register_write() has been failed.
+ */
+static inline bool test_register_write_failed(void)
+{
+    return _test_fail_register == 0xff;
+}
+
+#endif  // TEST_UTIL_H
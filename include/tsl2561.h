@@ -37,6 +37,10 @@
 #define TSL2561_H
 
 #include <stdbool.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "smbus.h"
 
 #ifdef __cplusplus
@@ -64,6 +68,7 @@ typedef enum
     TSL2561_INTEGRATION_TIME_13MS = 0x00,   ///< Integrate over 13.7 milliseconds
     TSL2561_INTEGRATION_TIME_101MS = 0x01,  ///< Integrate over 101 milliseconds
     TSL2561_INTEGRATION_TIME_402MS = 0x02,  ///< Integrate over 402 milliseconds
+    TSL2561_INTEGRATION_TIME_MANUAL = 0x03, ///< Integrate over a caller-specified duration, see tsl2561_set_manual_integration()
 } tsl2561_integration_time_t;
 
 /**
@@ -75,10 +80,88 @@ typedef enum
     TSL2561_GAIN_16X = 0x10,
 } tsl2561_gain_t;
 
+/**
+ * @brief Enum for supported interrupt modes.
+ */
+typedef enum
+{
+    TSL2561_INTERRUPT_DISABLED = 0x00,  ///< Interrupt output disabled
+    TSL2561_INTERRUPT_LEVEL = 0x10,     ///< Level interrupt, asserted until cleared
+} tsl2561_interrupt_mode_t;
+
+#define TSL2561_NUM_CONFIG_REGISTERS 7        ///< Number of configuration registers, CONTROL to INTERRUPT
+#define TSL2561_RETRIES_MAX 8                 ///< Maximum number of times a failed bus transaction may be retried
+#define TSL2561_INTERRUPT_PERSISTENCE_MAX 15  ///< Maximum number of out-of-range integration periods before an interrupt
+
+/**
+ * @brief Enum for the states of the measurement state machine.
+ */
+typedef enum
+{
+    TSL2561_MEASUREMENT_IDLE = 0,     ///< No measurement in progress
+    TSL2561_MEASUREMENT_INTEGRATING,  ///< Device is powered up and integrating, result not yet available
+    TSL2561_MEASUREMENT_CONTINUOUS,   ///< Device remains powered up and integrates continuously
+} tsl2561_measurement_state_t;
+
 typedef uint8_t tsl2561_revision_t;    ///< The type of the IC's revision value
 typedef uint16_t tsl2561_visible_t;    ///< The type of a visible light measurement value
 typedef uint16_t tsl2561_infrared_t;   ///< The type of an infrared light measurement value
 
+/**
+ * @brief Flags describing the validity of a measurement result.
+ */
+typedef enum
+{
+    TSL2561_RESULT_SATURATED = 0x01,  ///< A channel reached its saturation limit, so the Lux value is unreliable
+    TSL2561_RESULT_UNDERFLOW = 0x02,  ///< Infrared channel exceeds the full-spectrum channel, so there is no visible component
+    TSL2561_RESULT_NOT_READY = 0x04,  ///< No result is available yet; the other fields are not valid
+} tsl2561_result_flags_t;
+
+/**
+ * @brief Structure containing a measurement result, with the Lux value computed from the raw channels.
+ */
+typedef struct
+{
+    uint16_t channel0;  ///< Full-spectrum (visible and infrared) channel value
+    uint16_t channel1;  ///< Infrared channel value
+    uint32_t lux;       ///< Approximation of the light measurement in Lux
+    uint8_t flags;      ///< Bitwise combination of tsl2561_result_flags_t values, zero if the result is valid
+} tsl2561_result_t;
+
+#ifdef CONFIG_TSL2561_LUX_PRECISE_FIXED
+typedef uint32_t tsl2561_lux_precise_t;       ///< The type of a high-precision Lux value, unsigned Q16.16 fixed-point
+#define TSL2561_LUX_PRECISE_FRACTION_BITS 16  ///< Number of fractional bits in a high-precision Lux value
+#else
+typedef float tsl2561_lux_precise_t;          ///< The type of a high-precision Lux value
+#endif
+
+/**
+ * @brief Structure containing driver performance statistics.
+ *        Statistics are only recorded if CONFIG_TSL2561_STATS is set.
+ */
+typedef struct
+{
+    uint32_t transactions;             ///< Number of bus transactions attempted
+    uint32_t bus_errors;               ///< Number of bus transactions that failed
+    uint32_t retries;                  ///< Number of failed bus transactions that were retried
+    uint32_t recoveries;               ///< Number of measurements abandoned after an error, with the device powered down
+    uint32_t results;                  ///< Number of measurement results retrieved
+    uint32_t saturated;                ///< Number of results in which either channel was saturated
+    uint32_t auto_range_steps;         ///< Number of range changes made by auto-ranging
+    uint32_t latency_min_us;           ///< Shortest time from start of integration to result, in microseconds
+    uint32_t latency_avg_us;           ///< Average time from start of integration to result, in microseconds
+    uint32_t latency_max_us;           ///< Longest time from start of integration to result, in microseconds
+    uint64_t latency_total_us;         ///< Total time from start of integration to result, in microseconds
+    uint32_t overshoot_max_us;         ///< Longest time a result was retrieved after the integration completed, in microseconds
+    uint64_t overshoot_total_us;       ///< Total time results were retrieved after the integration completed, in microseconds
+    uint32_t bus_lock_acquisitions;    ///< Number of times the bus lock was acquired
+    uint32_t bus_lock_timeouts;        ///< Number of times the bus lock could not be acquired before the timeout
+    uint32_t bus_lock_wait_max_us;     ///< Longest time spent waiting for the bus lock, in microseconds
+    uint64_t bus_lock_wait_total_us;   ///< Total time spent waiting for the bus lock, in microseconds
+} tsl2561_stats_t;
+
+struct tsl2561_lux_coefficients;  ///< Lux approximation coefficients for a device package (private)
+
 /**
  * @brief Structure containing information related to the SMBus protocol.
  */
@@ -90,8 +173,43 @@ typedef struct
     tsl2561_device_type_t device_type;            ///< Detected type of device (Chipscale vs T/FN/CL)
     tsl2561_integration_time_t integration_time;  ///< Current integration time for measurements
     tsl2561_gain_t gain;                          ///< Current gain for measurements
+    uint32_t channel_scale;                       ///< Channel scale for the current integration time and gain
+    const struct tsl2561_lux_coefficients * lux_coefficients;  ///< Lux coefficients for the detected device package
+    tsl2561_measurement_state_t measurement_state;  ///< Current state of the measurement state machine
+    TickType_t ready_tick;                        ///< Tick count at which the current measurement result is available
+    int64_t ready_us;                             ///< Time at which the current measurement result is available
+    int64_t integration_start_us;                 ///< Time at which the current integration started
+    int64_t result_start_us;                      ///< Time at which the integration of the latest result started
+    int64_t result_end_us;                        ///< Time at which the integration of the latest result ended
+    bool block_read;                              ///< True if channel data is fetched with a single block read
+    bool block_write;                             ///< True if configuration runs are written with a single block write
+    TaskHandle_t interrupt_task;                  ///< Task notified by tsl2561_interrupt_isr(), or NULL
+    bool auto_range;                              ///< True if integration time and gain are selected automatically
+    uint8_t auto_range_steps;                     ///< Number of consecutive range changes for the current result
+    uint32_t manual_exposure_us;                  ///< Requested duration of a manual integration, in microseconds
+    SemaphoreHandle_t bus_lock;                   ///< Mutex shared by all drivers on the bus, or NULL
+    TickType_t bus_lock_timeout;                  ///< Maximum number of ticks to wait for the bus lock
+    uint8_t retries;                              ///< Number of times a failed bus transaction is retried
+    uint32_t retry_backoff_us;                    ///< Delay before the first retry, doubling for each subsequent retry
+    uint8_t shadow[TSL2561_NUM_CONFIG_REGISTERS]; ///< Cached values of the device configuration registers
+    uint8_t shadow_valid;                         ///< Bit mask of cached registers known to match the device
+    bool config_open;                             ///< True while a configuration transaction collects register changes
+    uint8_t config_pending[TSL2561_NUM_CONFIG_REGISTERS]; ///< Register values collected by the open configuration transaction
+    uint8_t config_dirty;                         ///< Bit mask of registers collected by the open configuration transaction
+    struct
+    {
+        tsl2561_integration_time_t integration_time;
+        tsl2561_gain_t gain;
+        uint32_t channel_scale;
+        uint32_t manual_exposure_us;
+        TaskHandle_t interrupt_task;
+    } config_saved;                               ///< Driver state restored if the configuration transaction is not applied
+#ifdef CONFIG_TSL2561_STATS
+    tsl2561_stats_t stats;                        ///< Driver performance statistics
+#endif
 } tsl2561_info_t;
 
+#ifndef CONFIG_TSL2561_DISABLE_MALLOC
 /**
  * @brief Construct a new TSL2561 info instance.
  *        New instance should be initialised before calling other functions.
@@ -104,14 +222,43 @@ tsl2561_info_t * tsl2561_malloc(void);
  * @param[in,out] tsl2561_info Pointer to TSL2561 info instance that will be freed and set to NULL.
  */
 void tsl2561_free(tsl2561_info_t ** tsl2561_info);
+#endif  // CONFIG_TSL2561_DISABLE_MALLOC
 
 /**
  * @brief Initialise a TSL2561 info instance with the specified SMBus information.
+ *        The current integration time, gain and power state are read from the device.
+ *        Every field is initialised, so the instance may be caller-supplied storage,
+ *        such as a static variable, rather than allocated with tsl2561_malloc().
  * @param[in] tsl2561_info Pointer to TSL2561 info instance.
  * @param[in] smbus_info Pointer to SMBus info instance.
  */
 esp_err_t tsl2561_init(tsl2561_info_t * tsl2561_info, smbus_info_t * smbus_info);
 
+/**
+ * @brief Initialise a TSL2561 info instance as tsl2561_init() does, holding a shared bus lock
+ *        for every transaction from the first, including the device ID read.
+ *        See tsl2561_set_bus_lock() for the locking behaviour.
+ * @param[in] tsl2561_info Pointer to TSL2561 info instance.
+ * @param[in] smbus_info Pointer to SMBus info instance.
+ * @param[in] bus_lock Mutex shared by all drivers on the bus, or NULL to disable locking.
+ * @param[in] timeout Maximum number of ticks to wait for the mutex before a transaction fails with ESP_ERR_TIMEOUT.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_init_locked(tsl2561_info_t * tsl2561_info, smbus_info_t * smbus_info,
+                              SemaphoreHandle_t bus_lock, TickType_t timeout);
+
+/**
+ * @brief Initialise a TSL2561 info instance that is not associated with a device, for use only with
+ *        the Lux calculation functions, such as when processing previously recorded measurements.
+ * @param[in] tsl2561_info Pointer to TSL2561 info instance.
+ * @param[in] device_type The device type that took the measurements, which selects the package coefficients.
+ * @param[in] integration_time The integration time of the measurements. Manual integration is not supported.
+ * @param[in] gain The gain of the measurements.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_init_detached(tsl2561_info_t * tsl2561_info, tsl2561_device_type_t device_type,
+                                tsl2561_integration_time_t integration_time, tsl2561_gain_t gain);
+
 /**
  * @brief Retrieve the Device Type ID and Revision number from the device.
  * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
@@ -123,7 +270,8 @@ esp_err_t tsl2561_device_id(const tsl2561_info_t * tsl2561_info, tsl2561_device_
 
 /**
  * @brief Set the integration time and gain. These values are set together
- *        as they are programmed via the same register.
+ *        as they are programmed via the same register. No bus transactions are
+ *        performed if the device is already configured with these values.
  * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
  * @param[out] integration_time The integration time to use for the next measurement.
  * @param[out] infrared The gain setting to use for the next measurement.
@@ -131,9 +279,24 @@ esp_err_t tsl2561_device_id(const tsl2561_info_t * tsl2561_info, tsl2561_device_
  */
 esp_err_t tsl2561_set_integration_time_and_gain(tsl2561_info_t * tsl2561_info, tsl2561_integration_time_t integration_time, tsl2561_gain_t gain);
 
+/**
+ * @brief Select manual integration with a caller-specified exposure. Subsequent measurements start
+ *        and stop integration explicitly, and the channel scale used by tsl2561_compute_lux() is
+ *        derived from the measured exposure. Exposures shorter than a tick are timed by busy-waiting
+ *        in tsl2561_read(). Manual integration cannot be combined with continuous acquisition or auto-ranging.
+ *        Call tsl2561_set_integration_time_and_gain() to return to a fixed integration time.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[in] exposure_us The exposure duration in microseconds.
+ * @param[in] gain The gain setting to use for the next measurement.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_set_manual_integration(tsl2561_info_t * tsl2561_info, uint32_t exposure_us, tsl2561_gain_t gain);
+
 /**
  * @brief Retrieve a visible and infrared light measurement from the device.
  *        This function will sleep until the integration time has passed.
+ *        If continuous acquisition is active, the device is not power cycled and
+ *        this function sleeps until the next conversion is complete.
  * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
  * @param[out] visible The resultant visible light measurement.
  * @param[out] infrared The resultant infrared light measurement.
@@ -141,6 +304,283 @@ esp_err_t tsl2561_set_integration_time_and_gain(tsl2561_info_t * tsl2561_info, t
  */
 esp_err_t tsl2561_read(tsl2561_info_t * tsl2561_info, tsl2561_visible_t * visible, tsl2561_infrared_t * infrared);
 
+/**
+ * @brief Retrieve a visible and infrared light measurement from the device at a fixed period.
+ *        Sleeps until one period after the previous wake time, as vTaskDelayUntil(), then
+ *        starts a measurement. Because each integration starts against an absolute deadline
+ *        rather than relative to the previous result, the sampling period does not drift.
+ *        Not for use with continuous acquisition, in which the device sets the period.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[in,out] previous_wake_time Tick count at which the previous period began. Initialise
+ *                with xTaskGetTickCount() before the first call; updated on return.
+ * @param[in] period Sampling period in ticks. Must exceed the integration time.
+ * @param[out] visible The resultant visible light measurement.
+ * @param[out] infrared The resultant infrared light measurement.
+ * @return ESP_OK if successful, ESP_ERR_INVALID_STATE if continuous acquisition is active,
+ *         ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_read_periodic(tsl2561_info_t * tsl2561_info, TickType_t * previous_wake_time, TickType_t period,
+                                tsl2561_visible_t * visible, tsl2561_infrared_t * infrared);
+
+/**
+ * @brief Retrieve the times at which the integration of the most recent result started and ended,
+ *        as given by esp_timer_get_time(). For fixed integration times the end is the nominal
+ *        integration time after the start; for manual integration it is when the integration was stopped.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[out] start_us Time at which the integration started, in microseconds.
+ * @param[out] end_us Time at which the integration ended, in microseconds.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_get_result_timestamps(const tsl2561_info_t * tsl2561_info, int64_t * start_us, int64_t * end_us);
+
+/**
+ * @brief Start a measurement without waiting for the integration time to pass.
+ *        The device is powered up and begins integrating. Use tsl2561_poll_result()
+ *        to retrieve the result once the tick returned by tsl2561_get_ready_tick() has been reached.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @return ESP_OK if successful, ESP_ERR_INVALID_STATE if a measurement is already in progress,
+ *         ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_start_measurement(tsl2561_info_t * tsl2561_info);
+
+/**
+ * @brief Start continuous acquisition. The device remains powered up and completes a new
+ *        conversion every integration period. Each call to tsl2561_read() or tsl2561_poll_result()
+ *        returns the latest completed conversion without power cycling the device.
+ *        Results are read on a schedule 1/32 slower than the nominal period, busy-waiting
+ *        the last partial tick, so that a device oscillator up to 1/32 slow never yields
+ *        the same conversion twice.
+ *        Integration time and gain may be changed while continuous acquisition is active.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @return ESP_OK if successful, ESP_ERR_INVALID_STATE if a measurement is already in progress,
+ *         ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_start_continuous(tsl2561_info_t * tsl2561_info);
+
+/**
+ * @brief Stop continuous acquisition, or abandon a measurement in progress, and power down the device.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @return ESP_OK if successful, ESP_ERR_INVALID_STATE if a configuration transaction is in progress,
+ *         ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_stop_measurement(tsl2561_info_t * tsl2561_info);
+
+/**
+ * @brief Retrieve the tick count at which the current measurement result becomes available.
+ *        The result is certain to be available once this tick is reached, so a task that
+ *        sleeps until then need poll only once. It may be available up to a tick earlier.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @return The tick count at which the result is available, or zero if no measurement is in progress.
+ */
+TickType_t tsl2561_get_ready_tick(const tsl2561_info_t * tsl2561_info);
+
+/**
+ * @brief Retrieve the result of a measurement started with tsl2561_start_measurement(), if available.
+ *        This function does not sleep. If the integration time has not yet passed, no bus
+ *        transaction is performed and ready is set to false.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[out] ready Set to true if the result was retrieved, otherwise false.
+ * @param[out] visible The resultant visible light measurement, valid if ready is true.
+ * @param[out] infrared The resultant infrared light measurement, valid if ready is true.
+ * @return ESP_OK if successful, ESP_ERR_INVALID_STATE if no measurement is in progress,
+ *         ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_poll_result(tsl2561_info_t * tsl2561_info, bool * ready, tsl2561_visible_t * visible, tsl2561_infrared_t * infrared);
+
+/**
+ * @brief Retrieve a measurement and its Lux approximation in one call, as tsl2561_read().
+ *        The Lux value is computed directly from the raw channels with the configuration of the
+ *        measurement, so no information is lost when the infrared channel exceeds the full-spectrum channel.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[out] result The resultant measurement, with flags set for saturation and underflow.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_read_result(tsl2561_info_t * tsl2561_info, tsl2561_result_t * result);
+
+/**
+ * @brief Retrieve a measurement and its Lux approximation in one call, if available, as tsl2561_poll_result().
+ *        This function does not sleep. If the result is not yet available, TSL2561_RESULT_NOT_READY is set.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[out] result The resultant measurement, with flags set for saturation, underflow and not ready.
+ * @return ESP_OK if successful, ESP_ERR_INVALID_STATE if no measurement is in progress,
+ *         ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_poll_result_full(tsl2561_info_t * tsl2561_info, tsl2561_result_t * result);
+
+/**
+ * @brief Refresh the cached device state by reading back the configuration registers.
+ *        The driver suppresses writes of values that the cached state shows the device already holds.
+ *        Call this after a brown-out or bus error may have changed the device state without the
+ *        driver's knowledge. Integration time, gain and power state are updated from the device,
+ *        except that if the range is fixed by configuration and the device holds another, the
+ *        configured range is written back to the device.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_resync(tsl2561_info_t * tsl2561_info);
+
+/**
+ * @brief Set the number of times a failed bus transaction is retried before the error is returned.
+ *        Each retry waits for the backoff delay, which doubles with every retry, and is made without
+ *        holding the bus lock. A transaction that cannot acquire the bus lock is not retried.
+ *        The timeout of each transaction is set by the SMBus info instance.
+ *        By default, failed transactions are retried twice, starting with a 100 microsecond delay.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[in] retries The number of retries, from 0 to TSL2561_RETRIES_MAX.
+ * @param[in] backoff_us The delay before the first retry, in microseconds.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_set_retries(tsl2561_info_t * tsl2561_info, uint8_t retries, uint32_t backoff_us);
+
+/**
+ * @brief Begin a configuration transaction. Until tsl2561_config_commit() or tsl2561_config_abort(),
+ *        tsl2561_set_integration_time_and_gain(), tsl2561_set_manual_integration(), tsl2561_set_thresholds()
+ *        and tsl2561_set_interrupt() collect their register changes instead of writing them, and
+ *        measurements cannot be started.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @return ESP_OK if successful, ESP_ERR_INVALID_STATE if a transaction or measurement is in progress,
+ *         ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_config_begin(tsl2561_info_t * tsl2561_info);
+
+/**
+ * @brief Apply the register changes collected by a configuration transaction, in as few bus
+ *        transactions as possible. Each run of consecutive changed registers is written with a single
+ *        word or block write, and the device is powered up as part of the same write if required.
+ *        If the changes cannot be applied, the driver state is restored to that before the transaction,
+ *        and the device configuration may be partially changed until tsl2561_resync() is called.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @return ESP_OK if successful, ESP_ERR_INVALID_STATE if no transaction is in progress,
+ *         ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_config_commit(tsl2561_info_t * tsl2561_info);
+
+/**
+ * @brief Discard the register changes collected by a configuration transaction, without bus transactions.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @return ESP_OK if successful, ESP_ERR_INVALID_STATE if no transaction is in progress,
+ *         ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_config_abort(tsl2561_info_t * tsl2561_info);
+
+/**
+ * @brief Enable or disable fetching both channels with a single SMBus block read.
+ *        Block reads are enabled by default. If a block read fails, the driver falls back to two
+ *        word reads. If the bus rejects the block read, with a short read or a NACK while word reads
+ *        succeed, block reads are disabled for subsequent measurements; other errors are treated as transient.
+ *        Configuration transactions also use block writes only while block reads are enabled, falling
+ *        back to byte writes of the changed registers; a NACK of a block write while byte writes
+ *        succeed likewise disables block writes. Enabling block reads enables block writes again.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[in] enable True to use block reads, false to use word reads.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_set_block_read(tsl2561_info_t * tsl2561_info, bool enable);
+
+/**
+ * @brief Set a mutex to be held during bus transactions. The mutex should be shared with all other
+ *        drivers that use the same I2C bus. It is held only for the duration of each individual
+ *        transaction, never while waiting for an integration to complete.
+ *        tsl2561_init() performs its transactions without a lock; if other drivers may already be
+ *        using the bus, initialise with tsl2561_init_locked() instead.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[in] bus_lock Mutex created with xSemaphoreCreateMutex() or xSemaphoreCreateMutexStatic(), or NULL to disable locking.
+ * @param[in] timeout Maximum number of ticks to wait for the mutex before a transaction fails with ESP_ERR_TIMEOUT.
+ *            Wait times are recorded in the driver statistics, if enabled.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_set_bus_lock(tsl2561_info_t * tsl2561_info, SemaphoreHandle_t bus_lock, TickType_t timeout);
+
+/**
+ * @brief Retrieve a snapshot of the driver performance statistics.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[out] stats The driver performance statistics.
+ * @return ESP_OK if successful, ESP_ERR_NOT_SUPPORTED if CONFIG_TSL2561_STATS is not set,
+ *         ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_get_stats(const tsl2561_info_t * tsl2561_info, tsl2561_stats_t * stats);
+
+/**
+ * @brief Reset the driver performance statistics.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @return ESP_OK if successful, ESP_ERR_NOT_SUPPORTED if CONFIG_TSL2561_STATS is not set,
+ *         ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_reset_stats(tsl2561_info_t * tsl2561_info);
+
+/**
+ * @brief Enable or disable automatic selection of integration time and gain.
+ *        When enabled, each result is checked for saturation and low counts. If a better range
+ *        is available, the result is discarded and the measurement repeated in the new range,
+ *        so tsl2561_read() and tsl2561_poll_result() only return results from a suitable range.
+ *        Ranging starts with a 13ms, 1x probe and typically converges within two integrations.
+ *        The selected range is reflected in the integration_time and gain fields.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[in] enable True to enable auto-ranging, false to retain the current integration time and gain.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_set_auto_range(tsl2561_info_t * tsl2561_info, bool enable);
+
+/**
+ * @brief Set the low and high interrupt thresholds. An interrupt is generated when
+ *        the channel 0 value falls outside the inclusive range [low, high].
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[in] low The low threshold, in channel 0 counts.
+ * @param[in] high The high threshold, in channel 0 counts.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_set_thresholds(tsl2561_info_t * tsl2561_info, uint16_t low, uint16_t high);
+
+/**
+ * @brief Configure the interrupt output. The calling task becomes the task notified
+ *        by tsl2561_interrupt_isr() when the interrupt is asserted.
+ *        Interrupts are only generated while the device is powered, so this is
+ *        normally used with continuous acquisition.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[in] mode The interrupt mode.
+ * @param[in] persistence Zero to interrupt after every integration, one to interrupt on any
+ *            value outside the thresholds, or N to interrupt after N consecutive
+ *            out-of-range integrations, up to TSL2561_INTERRUPT_PERSISTENCE_MAX.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_set_interrupt(tsl2561_info_t * tsl2561_info, tsl2561_interrupt_mode_t mode, uint8_t persistence);
+
+/**
+ * @brief Clear a pending interrupt, releasing the interrupt output.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_clear_interrupt(tsl2561_info_t * tsl2561_info);
+
+/**
+ * @brief ISR-safe handler for the device's interrupt output. Performs no bus transactions,
+ *        only notifies the task that called tsl2561_set_interrupt().
+ *        Suitable for registration with gpio_isr_handler_add(), with the
+ *        TSL2561 info instance as the argument.
+ * @param[in] arg Pointer to initialised TSL2561 info instance.
+ */
+void tsl2561_interrupt_isr(void * arg);
+
+/**
+ * @brief Block the calling task until tsl2561_interrupt_isr() is invoked or the timeout expires.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[in] timeout Maximum number of ticks to wait.
+ * @return ESP_OK if an interrupt occurred, ESP_ERR_TIMEOUT if the timeout expired,
+ *         ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_wait_for_interrupt(tsl2561_info_t * tsl2561_info, TickType_t timeout);
+
+/**
+ * @brief Handle an interrupt from task context: retrieve the latest visible and infrared light
+ *        measurement and clear the interrupt. The device must be powered.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[out] visible The resultant visible light measurement.
+ * @param[out] infrared The resultant infrared light measurement.
+ * @return ESP_OK if successful, ESP_ERR_INVALID_STATE if the device is not powered,
+ *         ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_handle_interrupt(tsl2561_info_t * tsl2561_info, tsl2561_visible_t * visible, tsl2561_infrared_t * infrared);
+
 /**
  * @brief Compute the Lux approximation from a visible and infrared light measurement.
  *        The calculation is performed according to the procedure given in the datasheet.
@@ -151,6 +591,34 @@ esp_err_t tsl2561_read(tsl2561_info_t * tsl2561_info, tsl2561_visible_t * visibl
  */
 uint32_t tsl2561_compute_lux(const tsl2561_info_t * tsl2561_info, tsl2561_visible_t visible, tsl2561_infrared_t infrared);
 
+/**
+ * @brief Compute the Lux approximation from a visible and infrared light measurement,
+ *        retaining the fractional part. The calculation is identical to tsl2561_compute_lux()
+ *        apart from the final rounding, so tsl2561_compute_lux() incurs no additional cost.
+ *        The result type is float, or Q16.16 fixed-point (saturating) if CONFIG_TSL2561_LUX_PRECISE_FIXED is set.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[in] visible The visible light measurement.
+ * @param[in] infrared The infrared light measurement.
+ * @return The resulting approximation of the light measurement in Lux, with sub-Lux resolution.
+ */
+tsl2561_lux_precise_t tsl2561_compute_lux_precise(const tsl2561_info_t * tsl2561_info, tsl2561_visible_t visible, tsl2561_infrared_t infrared);
+
+/**
+ * @brief Compute the Lux approximation for arrays of visible and infrared light measurements.
+ *        The results are identical to calling tsl2561_compute_lux() for each pair, but the
+ *        instance is validated once, the configuration lookup is hoisted out of the loop, and
+ *        the loop has no branches, division or table lookups, so the compiler may vectorize it.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[in] visible Array of count visible light measurements.
+ * @param[in] infrared Array of count infrared light measurements.
+ * @param[out] lux Array of count resulting approximations of the light measurements in Lux.
+ *             Must not overlap the input arrays.
+ * @param[in] count Number of measurements to convert.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_compute_lux_batch(const tsl2561_info_t * tsl2561_info, const tsl2561_visible_t * __restrict visible,
+                                    const tsl2561_infrared_t * __restrict infrared, uint32_t * __restrict lux, size_t count);
+
 #ifdef __cplusplus
 }
 #endif
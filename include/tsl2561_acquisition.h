@@ -0,0 +1,152 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file tsl2561_acquisition.h
+ * @brief Interface definitions for background acquisition of TSL2561 measurements.
+ *
+ * An acquisition task owns a TSL2561 info instance and publishes timestamped samples into a
+ * single-producer, multiple-consumer lock-free ring buffer. Consumers retrieve the latest sample,
+ * or drain the sample history, without taking a mutex or accessing the I2C bus.
+ */
+
+#ifndef TSL2561_ACQUISITION_H
+#define TSL2561_ACQUISITION_H
+
+#include "tsl2561.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Structure containing a single timestamped measurement.
+ */
+typedef struct
+{
+    TickType_t timestamp;                         ///< Tick count at which the measurement was retrieved
+    int64_t integration_start_us;                 ///< Time at which the integration started, in microseconds
+    int64_t integration_end_us;                   ///< Time at which the integration ended, in microseconds
+    tsl2561_visible_t visible;                    ///< Visible light measurement
+    tsl2561_infrared_t infrared;                  ///< Infrared light measurement
+    uint32_t lux;                                 ///< Lux approximation of the measurement
+    tsl2561_gain_t gain;                          ///< Gain used for the measurement
+    tsl2561_integration_time_t integration_time;  ///< Integration time used for the measurement
+} tsl2561_sample_t;
+
+/**
+ * @brief Structure containing a ring buffer slot. The sequence number identifies the
+ *        sample held, and is odd while the slot is being written.
+ */
+typedef struct
+{
+    uint32_t sequence;         ///< Sequence number of the slot
+    tsl2561_sample_t sample;   ///< Sample held in the slot
+} tsl2561_ring_slot_t;
+
+/**
+ * @brief Structure containing information related to a lock-free sample ring buffer.
+ *        Samples are published by a single producer and may be read concurrently by any number of consumers.
+ *        When the ring is full, the oldest samples are overwritten.
+ */
+typedef struct
+{
+    bool init;                     ///< True if struct has been initialised, otherwise false
+    tsl2561_ring_slot_t * slots;   ///< Caller-supplied array of slots
+    uint32_t capacity;             ///< Number of slots, a power of two
+    uint32_t head;                 ///< Total number of samples published
+} tsl2561_ring_t;
+
+/**
+ * @brief Structure containing the configuration of an acquisition task.
+ */
+typedef struct
+{
+    tsl2561_info_t * tsl2561_info;   ///< Pointer to initialised TSL2561 info instance, owned by the task
+    tsl2561_ring_t * ring;           ///< Pointer to initialised ring buffer that receives the samples
+    TickType_t period;               ///< Sampling period in ticks, or zero to use continuous acquisition
+    volatile bool stop;              ///< Set to true to request that the task power down the device and delete itself
+} tsl2561_acquisition_t;
+
+/**
+ * @brief Initialise a ring buffer using caller-supplied storage.
+ * @param[in] ring Pointer to ring buffer instance.
+ * @param[in] slots Array of slots used to hold samples.
+ * @param[in] capacity Number of slots in the array. Must be a power of two.
+ * @return ESP_OK if successful, ESP_ERR_INVALID_ARG if capacity is not a power of two, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_ring_init(tsl2561_ring_t * ring, tsl2561_ring_slot_t * slots, uint32_t capacity);
+
+/**
+ * @brief Publish a sample into the ring buffer, overwriting the oldest sample if the ring is full.
+ *        Must only be called by a single producer.
+ * @param[in] ring Pointer to initialised ring buffer instance.
+ * @param[in] sample The sample to publish.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_ring_publish(tsl2561_ring_t * ring, const tsl2561_sample_t * sample);
+
+/**
+ * @brief Retrieve the most recently published sample. Does not block.
+ *        With a capacity of one, the only sample may be unavailable while the producer replaces it.
+ * @param[in] ring Pointer to initialised ring buffer instance.
+ * @param[out] sample The most recently published sample.
+ * @return ESP_OK if successful, ESP_ERR_NOT_FOUND if no sample is available, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_ring_latest(const tsl2561_ring_t * ring, tsl2561_sample_t * sample);
+
+/**
+ * @brief Retrieve a cursor positioned after the most recently published sample,
+ *        for use with tsl2561_ring_read(). Each consumer maintains its own cursor.
+ * @param[in] ring Pointer to initialised ring buffer instance.
+ * @return The cursor value.
+ */
+uint32_t tsl2561_ring_cursor(const tsl2561_ring_t * ring);
+
+/**
+ * @brief Retrieve the next sample after the cursor, and advance the cursor. Does not block.
+ *        If the consumer has fallen behind and samples have been overwritten,
+ *        the cursor skips to the oldest sample still held. A sample that the producer
+ *        is overwriting while it is read is also skipped and counted as lost.
+ * @param[in] ring Pointer to initialised ring buffer instance.
+ * @param[in,out] cursor The consumer's cursor.
+ * @param[out] sample The next sample.
+ * @param[out] lost Number of samples skipped because they were overwritten. May be NULL.
+ * @return ESP_OK if successful, ESP_ERR_NOT_FOUND if there are no new samples, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_ring_read(const tsl2561_ring_t * ring, uint32_t * cursor, tsl2561_sample_t * sample, uint32_t * lost);
+
+/**
+ * @brief Acquisition task function. Create with xTaskCreate() or xTaskCreateStatic(), passing
+ *        a pointer to an acquisition configuration that remains valid for the life of the task.
+ *        The task takes ownership of the TSL2561 info instance; no other task should use it.
+ * @param[in] arg Pointer to acquisition configuration.
+ */
+void tsl2561_acquisition_task(void * arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // TSL2561_ACQUISITION_H
@@ -0,0 +1,106 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file tsl2561_adaptive.h
+ * @brief Interface definitions for sampling a TSL2561 at a rate adapted to the rate of light change.
+ *
+ * The sampling period starts at the minimum. While successive Lux values change slowly enough
+ * that a sample twice as far apart would still change by less than half the step threshold,
+ * the period doubles, up to the maximum. A faster change halves the period, and a change
+ * exceeding the step threshold returns it immediately to the minimum.
+ *
+ * On a step the device also returns to the fastest integration time, so that the next sample is quick.
+ * With auto-ranging enabled, ranging restarts from its fastest range. Otherwise the integration time
+ * is set to 13 ms at the same gain, and the configured integration time is restored after the first
+ * sample that is not a step. Range changes are made at the start of the next sample, so each sample
+ * is returned in the range it was taken in. As 13 ms collects 11/322 of the counts of 402 ms, this is only done when
+ * the step's new level still gives enough counts at 13 ms that one count is less than half the step
+ * threshold; in dimmer light the configured integration time is kept. Manual integration, and a range
+ * fixed by CONFIG_TSL2561_FIXED_RANGE, are never changed.
+ */
+
+#ifndef TSL2561_ADAPTIVE_H
+#define TSL2561_ADAPTIVE_H
+
+#include "tsl2561.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Structure containing the state of an adaptive sampler.
+ */
+typedef struct
+{
+    bool init;                 ///< True if struct has been initialised, otherwise false
+    TickType_t min_period;     ///< Shortest sampling period, in ticks
+    TickType_t max_period;     ///< Longest sampling period, in ticks
+    uint32_t step_permille;    ///< Relative change between successive samples that is treated as a step, in 1/1000
+    TickType_t period;         ///< Current sampling period, in ticks
+    bool have_previous;        ///< True if a previous sample is available
+    uint32_t previous_lux;     ///< Lux value of the previous sample
+    bool restart;              ///< True if the next sample is to be taken in the fastest range
+    bool fast;                 ///< True if the integration time was shortened after a step
+    tsl2561_integration_time_t integration_time;  ///< Integration time to restore once the light settles
+} tsl2561_adaptive_t;
+
+/**
+ * @brief Initialise an adaptive sampler.
+ * @param[in] adaptive Pointer to adaptive sampler instance.
+ * @param[in] min_period Shortest sampling period in ticks, used after a step. Must exceed the integration time.
+ * @param[in] max_period Longest sampling period in ticks, used while light is stable.
+ * @param[in] step_percent Relative change between successive samples, in percent, that is treated as a step.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_adaptive_init(tsl2561_adaptive_t * adaptive, TickType_t min_period, TickType_t max_period, uint32_t step_percent);
+
+/**
+ * @brief Wait for the current sampling period, retrieve a measurement and adapt the period to the
+ *        observed rate of change. Sampling periods are scheduled as by tsl2561_read_periodic().
+ *        The integration time may be changed and restored around a step, as described above.
+ * @param[in] adaptive Pointer to initialised adaptive sampler instance.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[in,out] previous_wake_time Tick count at which the previous period began. Initialise
+ *                with xTaskGetTickCount() before the first call; updated on return.
+ * @param[out] visible The resultant visible light measurement.
+ * @param[out] infrared The resultant infrared light measurement.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_adaptive_read(tsl2561_adaptive_t * adaptive, tsl2561_info_t * tsl2561_info, TickType_t * previous_wake_time,
+                                tsl2561_visible_t * visible, tsl2561_infrared_t * infrared);
+
+/**
+ * @brief Retrieve the current sampling period.
+ * @param[in] adaptive Pointer to initialised adaptive sampler instance.
+ * @return The period in ticks until the next sample, or zero if the sampler is not initialised.
+ */
+TickType_t tsl2561_adaptive_get_period(const tsl2561_adaptive_t * adaptive);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // TSL2561_ADAPTIVE_H
@@ -0,0 +1,141 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file tsl2561_filter.h
+ * @brief Interface definitions for digital filtering of TSL2561 channel data.
+ *
+ * A filter smooths the raw channel counts of successive measurements before they are
+ * converted to Lux. Combined with continuous acquisition, several short integrations
+ * can replace one long one, trading rate for noise without a power cycle per sample.
+ * Each filter holds a fixed-size window of samples and does not allocate per sample.
+ */
+
+#ifndef TSL2561_FILTER_H
+#define TSL2561_FILTER_H
+
+#include "tsl2561.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TSL2561_FILTER_WINDOW_MAX 16   ///< Maximum number of samples in a filter window
+
+/**
+ * @brief Enumerated filter types.
+ */
+typedef enum
+{
+    TSL2561_FILTER_MOVING_AVERAGE = 0,  ///< Mean of the most recent window samples
+    TSL2561_FILTER_EXPONENTIAL,         ///< Exponential moving average with smoothing factor 1 / window
+    TSL2561_FILTER_MEDIAN,              ///< Median of the most recent window samples
+} tsl2561_filter_type_t;
+
+/**
+ * @brief Structure containing the state of a channel data filter.
+ */
+typedef struct
+{
+    bool init;                                    ///< True if struct has been initialised, otherwise false
+    tsl2561_filter_type_t type;                   ///< Filter type
+    uint8_t window;                               ///< Number of samples in the window, or inverse smoothing factor
+    uint8_t count;                                ///< Number of samples currently held
+    uint8_t index;                                ///< Position of the next sample in the window
+    uint16_t ch0[TSL2561_FILTER_WINDOW_MAX];      ///< Recent broadband (channel 0) samples
+    uint16_t ch1[TSL2561_FILTER_WINDOW_MAX];      ///< Recent infrared (channel 1) samples
+    uint32_t sum0;                                ///< Sum of channel 0 samples in the window (moving average)
+    uint32_t sum1;                                ///< Sum of channel 1 samples in the window (moving average)
+    int32_t ema0;                                 ///< Channel 0 average, scaled by 2^8 (exponential)
+    int32_t ema1;                                 ///< Channel 1 average, scaled by 2^8 (exponential)
+    tsl2561_integration_time_t integration_time;  ///< Integration time of the held samples
+    tsl2561_gain_t gain;                          ///< Gain of the held samples
+} tsl2561_filter_t;
+
+#ifndef CONFIG_TSL2561_DISABLE_MALLOC
+/**
+ * @brief Construct a new filter instance.
+ *        New instance should be initialised before calling other functions.
+ * @return Pointer to new filter instance, or NULL if it cannot be created.
+ */
+tsl2561_filter_t * tsl2561_filter_malloc(void);
+
+/**
+ * @brief Delete an existing filter instance.
+ * @param[in,out] filter Pointer to filter instance that will be freed and set to NULL.
+ */
+void tsl2561_filter_free(tsl2561_filter_t ** filter);
+#endif  // CONFIG_TSL2561_DISABLE_MALLOC
+
+/**
+ * @brief Initialise a filter instance with no samples.
+ * @param[in] filter Pointer to filter instance.
+ * @param[in] type The filter type.
+ * @param[in] window The number of samples in the window, from 1 to TSL2561_FILTER_WINDOW_MAX.
+ *                   For the exponential filter, the inverse of the smoothing factor.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_filter_init(tsl2561_filter_t * filter, tsl2561_filter_type_t type, uint8_t window);
+
+/**
+ * @brief Discard all samples held by the filter.
+ * @param[in] filter Pointer to initialised filter instance.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_filter_reset(tsl2561_filter_t * filter);
+
+/**
+ * @brief Add a measurement to the filter and retrieve the filtered measurement.
+ *        Filtering is applied to the raw channel counts, so all samples held by the filter
+ *        must have been taken with the same integration time and gain.
+ * @param[in] filter Pointer to initialised filter instance.
+ * @param[in] visible The visible light measurement to add.
+ * @param[in] infrared The infrared light measurement to add.
+ * @param[out] filtered_visible The resultant filtered visible light measurement.
+ * @param[out] filtered_infrared The resultant filtered infrared light measurement.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_filter_update(tsl2561_filter_t * filter, tsl2561_visible_t visible, tsl2561_infrared_t infrared,
+                                tsl2561_visible_t * filtered_visible, tsl2561_infrared_t * filtered_infrared);
+
+/**
+ * @brief Retrieve several measurements from the device and return the filtered result.
+ *        Intended for use with continuous acquisition and a short integration time, so that
+ *        successive measurements are not separated by a power cycle. The filter is reset
+ *        whenever auto-ranging changes the integration time or gain.
+ * @param[in] filter Pointer to initialised filter instance.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @param[in] samples The number of measurements to retrieve, at least 1.
+ * @param[out] visible The resultant filtered visible light measurement.
+ * @param[out] infrared The resultant filtered infrared light measurement.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_filter_read(tsl2561_filter_t * filter, tsl2561_info_t * tsl2561_info, size_t samples,
+                              tsl2561_visible_t * visible, tsl2561_infrared_t * infrared);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // TSL2561_FILTER_H
@@ -0,0 +1,192 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file tsl2561_record.h
+ * @brief Interface definitions for a compact binary log of TSL2561 measurements.
+ *
+ * Measurements are encoded into caller-supplied blocks. Each block begins with a header
+ * carrying the device type, integration time and gain, so it can be decoded independently.
+ * Each sample is stored as the difference from the previous sample in the block:
+ *
+ *   varint  (timestamp delta << 1) | range changed
+ *   [uint8  new TIMING register value, if range changed]
+ *   varint  zigzag(channel 0 delta)
+ *   varint  zigzag(channel 1 delta)
+ *
+ * Slowly changing light levels sampled at a steady rate typically take about 5 bytes per sample,
+ * of which 3 are the microsecond timestamp delta.
+ */
+
+#ifndef TSL2561_RECORD_H
+#define TSL2561_RECORD_H
+
+#include "tsl2561.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TSL2561_RECORD_HEADER_SIZE 7       ///< Size of the header at the start of each block, in bytes
+#define TSL2561_RECORD_SAMPLE_MAX  17      ///< Maximum encoded size of a sample, in bytes
+#define TSL2561_RECORD_BLOCK_MAX   65535   ///< Maximum size of a block, in bytes
+
+/**
+ * @brief Structure containing a single decoded measurement.
+ */
+typedef struct
+{
+    int64_t timestamp_us;                         ///< Caller-supplied timestamp, in microseconds
+    tsl2561_visible_t visible;                    ///< Visible light measurement
+    tsl2561_infrared_t infrared;                  ///< Infrared light measurement
+    tsl2561_integration_time_t integration_time;  ///< Integration time used for the measurement
+    tsl2561_gain_t gain;                          ///< Gain used for the measurement
+} tsl2561_record_sample_t;
+
+/**
+ * @brief Structure containing the state of an encoder writing into a block.
+ */
+typedef struct
+{
+    bool init;                          ///< True if struct has been initialised, otherwise false
+    uint8_t * block;                    ///< Block being written
+    size_t size;                        ///< Size of the block, in bytes
+    size_t length;                      ///< Number of bytes written to the block
+    tsl2561_device_type_t device_type;  ///< Device type recorded in each block header
+    uint8_t timing;                     ///< Integration time and gain of the previous sample
+    int64_t timestamp_us;               ///< Timestamp of the previous sample
+    uint16_t ch0;                       ///< Channel 0 value of the previous sample
+    uint16_t ch1;                       ///< Channel 1 value of the previous sample
+} tsl2561_record_encoder_t;
+
+/**
+ * @brief Structure containing the state of a decoder reading from a block.
+ */
+typedef struct
+{
+    bool init;                                    ///< True if struct has been initialised, otherwise false
+    const uint8_t * block;                        ///< Block being read
+    size_t length;                                ///< Number of encoded bytes in the block
+    size_t offset;                                ///< Position of the next sample in the block
+    tsl2561_device_type_t device_type;            ///< Device type recorded in the block header
+    tsl2561_integration_time_t integration_time;  ///< Integration time of the previous sample
+    tsl2561_gain_t gain;                          ///< Gain of the previous sample
+    int64_t timestamp_us;                         ///< Timestamp of the previous sample
+    uint16_t ch0;                                 ///< Channel 0 value of the previous sample
+    uint16_t ch1;                                 ///< Channel 1 value of the previous sample
+} tsl2561_record_decoder_t;
+
+/**
+ * @brief Initialise an encoder and begin the first block.
+ * @param[in] encoder Pointer to encoder instance.
+ * @param[in] device_type The device type that takes the measurements.
+ * @param[in] integration_time The initial integration time.
+ * @param[in] gain The initial gain.
+ * @param[in] block Caller-supplied storage for the block.
+ * @param[in] size Size of the block, from TSL2561_RECORD_HEADER_SIZE to TSL2561_RECORD_BLOCK_MAX bytes.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_record_encoder_init(tsl2561_record_encoder_t * encoder, tsl2561_device_type_t device_type,
+                                      tsl2561_integration_time_t integration_time, tsl2561_gain_t gain,
+                                      uint8_t * block, size_t size);
+
+/**
+ * @brief Append a measurement to the current block.
+ * @param[in] encoder Pointer to initialised encoder instance.
+ * @param[in] timestamp_us Timestamp of the measurement, in microseconds. Must not be earlier than the previous measurement.
+ * @param[in] integration_time The integration time used for the measurement.
+ * @param[in] gain The gain used for the measurement.
+ * @param[in] visible The visible light measurement.
+ * @param[in] infrared The infrared light measurement.
+ * @return ESP_OK if successful, ESP_ERR_NO_MEM if the block is full, in which case nothing is written and
+ *         the block should be finished and a new one begun, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_record_encode(tsl2561_record_encoder_t * encoder, int64_t timestamp_us,
+                                tsl2561_integration_time_t integration_time, tsl2561_gain_t gain,
+                                tsl2561_visible_t visible, tsl2561_infrared_t infrared);
+
+/**
+ * @brief Complete the current block by recording its length in the header. The block may then be stored.
+ * @param[in] encoder Pointer to initialised encoder instance.
+ * @param[out] length The number of bytes in the block.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_record_encoder_finish(tsl2561_record_encoder_t * encoder, size_t * length);
+
+/**
+ * @brief Begin a new block, carrying the current integration time and gain in its header.
+ *        The previous block is no longer referenced and its storage may be reused.
+ * @param[in] encoder Pointer to initialised encoder instance.
+ * @param[in] block Caller-supplied storage for the block.
+ * @param[in] size Size of the block, from TSL2561_RECORD_HEADER_SIZE to TSL2561_RECORD_BLOCK_MAX bytes.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_record_encoder_next_block(tsl2561_record_encoder_t * encoder, uint8_t * block, size_t size);
+
+/**
+ * @brief Initialise a decoder to read a finished block.
+ * @param[in] decoder Pointer to decoder instance.
+ * @param[in] block The block to read.
+ * @param[in] size Size of the storage holding the block, which may exceed the block length.
+ * @return ESP_OK if successful, ESP_ERR_INVALID_ARG if the block has no valid header,
+ *         ESP_ERR_INVALID_VERSION if the format version is not supported,
+ *         ESP_ERR_INVALID_SIZE if the block is not finished or is truncated, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_record_decoder_init(tsl2561_record_decoder_t * decoder, const uint8_t * block, size_t size);
+
+/**
+ * @brief Decode the next measurement in the block.
+ * @param[in] decoder Pointer to initialised decoder instance.
+ * @param[out] sample The decoded measurement.
+ * @return ESP_OK if successful, ESP_ERR_NOT_FOUND at the end of the block,
+ *         ESP_ERR_INVALID_SIZE if the block is corrupt, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_record_decode(tsl2561_record_decoder_t * decoder, tsl2561_record_sample_t * sample);
+
+/**
+ * @brief Decode consecutive measurements that share an integration time and gain, stopping early at a
+ *        range change or the end of the block. The output may be passed directly to tsl2561_compute_lux_batch(),
+ *        with an info instance initialised by tsl2561_init_detached() from the decoder's device type and
+ *        the returned integration time and gain.
+ * @param[in] decoder Pointer to initialised decoder instance.
+ * @param[out] timestamps_us Array of resultant timestamps, or NULL if not required.
+ * @param[out] visible Array of resultant visible light measurements.
+ * @param[out] infrared Array of resultant infrared light measurements.
+ * @param[in] max_count Maximum number of measurements to decode.
+ * @param[out] count Number of measurements decoded.
+ * @param[out] integration_time The integration time of the decoded measurements.
+ * @param[out] gain The gain of the decoded measurements.
+ * @return ESP_OK if at least one measurement was decoded, ESP_ERR_NOT_FOUND at the end of the block,
+ *         ESP_ERR_INVALID_SIZE if the block is corrupt, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_record_decode_batch(tsl2561_record_decoder_t * decoder, int64_t * timestamps_us,
+                                      tsl2561_visible_t * visible, tsl2561_infrared_t * infrared,
+                                      size_t max_count, size_t * count,
+                                      tsl2561_integration_time_t * integration_time, tsl2561_gain_t * gain);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // TSL2561_RECORD_H
@@ -0,0 +1,102 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file tsl2561_scheduler.h
+ * @brief Interface definitions for measuring several TSL2561 devices concurrently.
+ *
+ * The scheduler starts the integrations of all of its devices together, then collects
+ * each result as soon as it is available, so that N devices take approximately
+ * one integration period rather than N.
+ */
+
+#ifndef TSL2561_SCHEDULER_H
+#define TSL2561_SCHEDULER_H
+
+#include "tsl2561.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TSL2561_SCHEDULER_MAX_DEVICES 8   ///< Maximum number of devices managed by a scheduler
+
+/**
+ * @brief Structure containing information related to a set of concurrently measured devices.
+ */
+typedef struct
+{
+    bool init;                                                  ///< True if struct has been initialised, otherwise false
+    size_t count;                                               ///< Number of devices added to the scheduler
+    tsl2561_info_t * devices[TSL2561_SCHEDULER_MAX_DEVICES];    ///< Pointers to the initialised TSL2561 info instances
+} tsl2561_scheduler_t;
+
+#ifndef CONFIG_TSL2561_DISABLE_MALLOC
+/**
+ * @brief Construct a new scheduler instance.
+ *        New instance should be initialised before calling other functions.
+ * @return Pointer to new scheduler instance, or NULL if it cannot be created.
+ */
+tsl2561_scheduler_t * tsl2561_scheduler_malloc(void);
+
+/**
+ * @brief Delete an existing scheduler instance. The devices are not affected.
+ * @param[in,out] scheduler Pointer to scheduler instance that will be freed and set to NULL.
+ */
+void tsl2561_scheduler_free(tsl2561_scheduler_t ** scheduler);
+#endif  // CONFIG_TSL2561_DISABLE_MALLOC
+
+/**
+ * @brief Initialise a scheduler instance with no devices.
+ * @param[in] scheduler Pointer to scheduler instance.
+ * @return ESP_OK if successful, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_scheduler_init(tsl2561_scheduler_t * scheduler);
+
+/**
+ * @brief Add a device to the scheduler. The device may be on any I2C bus.
+ * @param[in] scheduler Pointer to initialised scheduler instance.
+ * @param[in] tsl2561_info Pointer to initialised TSL2561 info instance.
+ * @return ESP_OK if successful, ESP_ERR_NO_MEM if the scheduler is full, ESP_FAIL or ESP_ERR_* if an error occurred.
+ */
+esp_err_t tsl2561_scheduler_add(tsl2561_scheduler_t * scheduler, tsl2561_info_t * tsl2561_info);
+
+/**
+ * @brief Retrieve a visible and infrared light measurement from every device in the scheduler.
+ *        All integrations are started together, then this function sleeps until the earliest
+ *        outstanding result is available and collects every ready result in a single pass, until
+ *        all devices have been read. Devices in continuous acquisition mode are not restarted.
+ * @param[in] scheduler Pointer to initialised scheduler instance.
+ * @param[out] visible Array of resultant visible light measurements, in the order the devices were added.
+ * @param[out] infrared Array of resultant infrared light measurements, in the order the devices were added.
+ * @return ESP_OK if all devices were read successfully, otherwise the first error that occurred.
+ *         Results from devices that failed are not written.
+ */
+esp_err_t tsl2561_scheduler_read(tsl2561_scheduler_t * scheduler, tsl2561_visible_t * visible, tsl2561_infrared_t * infrared);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // TSL2561_SCHEDULER_H
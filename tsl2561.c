@@ -34,13 +34,27 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_system.h"
+#include "esp_attr.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "rom/ets_sys.h"
 
 #include "tsl2561.h"
 
 static const char * TAG = "tsl2561";
 
+#ifdef CONFIG_TSL2561_STATS
+#  define STATS_INC(info, field)       (++(info)->stats.field)
+#  define STATS_MAX(info, field, value) ((info)->stats.field = (value) > (info)->stats.field ? (value) : (info)->stats.field)
+#  define STATS_ADD(info, field, value) ((info)->stats.field += (value))
+#else
+#  define STATS_INC(info, field)
+#  define STATS_MAX(info, field, value)
+#  define STATS_ADD(info, field, value)
+#endif
+
 // Register addresses
 #define REG_CONTROL         0x00
 #define REG_TIMING          0x01
@@ -64,68 +78,129 @@ static const char * TAG = "tsl2561";
 #define TSL2561_CONTROL_POWER_UP   0x03
 #define TSL2561_CONTROL_POWER_DOWN 0x00
 
+#define TSL2561_INTERRUPT_PERSIST_MASK 0x0F
+#define TSL2561_TIMING_INTEG_MASK      0x03
+#define TSL2561_TIMING_GAIN_MASK       0x10
+#define TSL2561_TIMING_MANUAL_START    0x08
+
+// Auto-range: step to a more sensitive range only if the predicted channel 0 count
+// stays below 1/2 of its clip limit, step to a less sensitive range above 7/8 of the clip limit
+#define AUTO_RANGE_TARGET_SHIFT   1
+#define AUTO_RANGE_HIGH_NUM       7
+#define AUTO_RANGE_HIGH_SHIFT     3
+#define AUTO_RANGE_MAX_STEPS      3     // maximum consecutive re-measurements per result
+
+#define INTEGRATION_MARGIN_SHIFT  4     // allow a fixed integration to run up to 2^-4 longer than nominal
+#define CONTINUOUS_MARGIN_SHIFT   5     // space continuous reads 2^-5 longer than the nominal period
+
+// Channel values at which each integration time saturates
+#define CLIP_TINT0     5047
+#define CLIP_TINT1     37177
+#define CLIP_TINT2     65535
+
 // Device defaults:
-#define DEFAULT_INTEGRATION_TIME TSL2561_INTEGRATION_TIME_402MS
-#define DEFAULT_GAIN             TSL2561_GAIN_1X
+#if defined(CONFIG_TSL2561_FIXED_RANGE)
+#  define DEFAULT_INTEGRATION_TIME FIXED_INTEGRATION_TIME
+#  define DEFAULT_GAIN             FIXED_GAIN
+#else
+#  define DEFAULT_INTEGRATION_TIME TSL2561_INTEGRATION_TIME_402MS
+#  define DEFAULT_GAIN             TSL2561_GAIN_1X
+#endif
+
+// Driver defaults:
+#define DEFAULT_RETRIES          2
+#define DEFAULT_RETRY_BACKOFF_US 100
 
 #define CH_SCALE       10      // Scale channel values by 2^10
 #define CH_SCALE_TINT0 0x7517  // 322/11 * 2^CH_SCALE
 #define CH_SCALE_TINT1 0x0FE7  // 322/81 * 2^CH_SCALE
 
+#define MANUAL_REFERENCE_US 402155  // Duration of 322 integration cycles at 735 kHz, to which CH_SCALE is relative
+
+// Build-time range, if configured
+#if defined(CONFIG_TSL2561_FIXED_INTEGRATION_TIME_13MS)
+#  define FIXED_INTEGRATION_TIME TSL2561_INTEGRATION_TIME_13MS
+#  define FIXED_CH_SCALE         CH_SCALE_TINT0
+#elif defined(CONFIG_TSL2561_FIXED_INTEGRATION_TIME_101MS)
+#  define FIXED_INTEGRATION_TIME TSL2561_INTEGRATION_TIME_101MS
+#  define FIXED_CH_SCALE         CH_SCALE_TINT1
+#else
+#  define FIXED_INTEGRATION_TIME TSL2561_INTEGRATION_TIME_402MS
+#  define FIXED_CH_SCALE         (1 << CH_SCALE)
+#endif
+
+#if defined(CONFIG_TSL2561_FIXED_GAIN_16X)
+#  define FIXED_GAIN             TSL2561_GAIN_16X
+#  define FIXED_CHANNEL_SCALE    FIXED_CH_SCALE
+#else
+#  define FIXED_GAIN             TSL2561_GAIN_1X
+#  define FIXED_CHANNEL_SCALE    (FIXED_CH_SCALE << 4)
+#endif
+
 #define RATIO_SCALE    9       // Scale ratio by 2^9
 #define LUX_SCALE      14      // Scale by 2^14
 
+#define LUX_SEGMENTS   8       // Number of piecewise-linear segments in the lux approximation
+
+// Lux approximation coefficients for a device package, for each ratio segment:
+//   lux = channel0 * b[i] - channel1 * m[i], where i is the number of breakpoints k[] below the ratio
+struct tsl2561_lux_coefficients
+{
+    uint32_t k[LUX_SEGMENTS - 1];  // ratio breakpoints, inclusive upper bound of each segment
+    uint32_t b[LUX_SEGMENTS];
+    uint32_t m[LUX_SEGMENTS];
+};
+
 // T, FN, and CL Package coefficients
-#define TSL2561_K1T 0x0040
-#define TSL2561_B1T 0x01F2
-#define TSL2561_M1T 0x01BE
-#define TSL2561_K2T 0x0080
-#define TSL2561_B2T 0x0214
-#define TSL2561_M2T 0x02D1
-#define TSL2561_K3T 0x00C0
-#define TSL2561_B3T 0x023F
-#define TSL2561_M3T 0x037B
-#define TSL2561_K4T 0x0100
-#define TSL2561_B4T 0x0270
-#define TSL2561_M4T 0x03FE
-#define TSL2561_K5T 0x0138
-#define TSL2561_B5T 0x016F
-#define TSL2561_M5T 0x01fC
-#define TSL2561_K6T 0x019A
-#define TSL2561_B6T 0x00D2
-#define TSL2561_M6T 0x00FB
-#define TSL2561_K7T 0x029A
-#define TSL2561_B7T 0x0018
-#define TSL2561_M7T 0x0012
-#define TSL2561_K8T 0x029A
-#define TSL2561_B8T 0x0000
-#define TSL2561_M8T 0x0000
+static const struct tsl2561_lux_coefficients LUX_COEFFICIENTS_T = {
+    .k = { 0x0040, 0x0080, 0x00C0, 0x0100, 0x0138, 0x019A, 0x029A },
+    .b = { 0x01F2, 0x0214, 0x023F, 0x0270, 0x016F, 0x00D2, 0x0018, 0x0000 },
+    .m = { 0x01BE, 0x02D1, 0x037B, 0x03FE, 0x01FC, 0x00FB, 0x0012, 0x0000 },
+};
 
 // CS Package coefficients
-#define TSL2561_K1C 0x0043
-#define TSL2561_B1C 0x0204
-#define TSL2561_M1C 0x01AD
-#define TSL2561_K2C 0x0085
-#define TSL2561_B2C 0x0228
-#define TSL2561_M2C 0x02C1
-#define TSL2561_K3C 0x00C8
-#define TSL2561_B3C 0x0253
-#define TSL2561_M3C 0x0363
-#define TSL2561_K4C 0x010A
-#define TSL2561_B4C 0x0282
-#define TSL2561_M4C 0x03DF
-#define TSL2561_K5C 0x014D
-#define TSL2561_B5C 0x0177
-#define TSL2561_M5C 0x01DD
-#define TSL2561_K6C 0x019A
-#define TSL2561_B6C 0x0101
-#define TSL2561_M6C 0x0127
-#define TSL2561_K7C 0x029A
-#define TSL2561_B7C 0x0037
-#define TSL2561_M7C 0x002B
-#define TSL2561_K8C 0x029A
-#define TSL2561_B8C 0x0000
-#define TSL2561_M8C 0x0000
+// The fifth breakpoint is the T package value (0x0138 rather than 0x014D), as per the reference implementations
+static const struct tsl2561_lux_coefficients LUX_COEFFICIENTS_CS = {
+    .k = { 0x0043, 0x0085, 0x00C8, 0x010A, 0x0138, 0x019A, 0x029A },
+    .b = { 0x0204, 0x0228, 0x0253, 0x0282, 0x0177, 0x0101, 0x0037, 0x0000 },
+    .m = { 0x01AD, 0x02C1, 0x0363, 0x03DF, 0x01DD, 0x0127, 0x002B, 0x0000 },
+};
+
+// Channel scale and coefficients used by the lux calculation. If the package or range is fixed
+// at build time these are constants, and the calculation is specialised for them.
+#if defined(CONFIG_TSL2561_PACKAGE_CS)
+#  define LUX_COEFFICIENTS(info) (&LUX_COEFFICIENTS_CS)
+#elif defined(CONFIG_TSL2561_PACKAGE_T_FN_CL)
+#  define LUX_COEFFICIENTS(info) (&LUX_COEFFICIENTS_T)
+#else
+#  define LUX_COEFFICIENTS(info) ((info)->lux_coefficients)
+#endif
+
+#if defined(CONFIG_TSL2561_FIXED_RANGE)
+#  define CHANNEL_SCALE(info)    FIXED_CHANNEL_SCALE
+#else
+#  define CHANNEL_SCALE(info)    ((info)->channel_scale)
+#endif
+
+// Auto-range ladder, ordered from least to most sensitive
+typedef struct
+{
+    tsl2561_integration_time_t integration_time;
+    tsl2561_gain_t gain;
+    uint32_t scale;   // channel scale relative to 402ms/16x, as per CH_SCALE_*
+    uint32_t clip;    // channel value at which the range saturates
+} range_t;
+
+static const range_t RANGES[] = {
+    { TSL2561_INTEGRATION_TIME_13MS,  TSL2561_GAIN_1X,  CH_SCALE_TINT0 << 4, CLIP_TINT0 },
+    { TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_1X,  CH_SCALE_TINT1 << 4, CLIP_TINT1 },
+    { TSL2561_INTEGRATION_TIME_13MS,  TSL2561_GAIN_16X, CH_SCALE_TINT0,      CLIP_TINT0 },
+    { TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_1X,  (1 << CH_SCALE) << 4, CLIP_TINT2 },
+    { TSL2561_INTEGRATION_TIME_101MS, TSL2561_GAIN_16X, CH_SCALE_TINT1,      CLIP_TINT1 },
+    { TSL2561_INTEGRATION_TIME_402MS, TSL2561_GAIN_16X, 1 << CH_SCALE,       CLIP_TINT2 },
+};
+
+#define NUM_RANGES (sizeof(RANGES) / sizeof(RANGES[0]))
 
 static bool _is_init(const tsl2561_info_t * tsl2561_info)
 {
@@ -170,321 +245,1873 @@ static bool _check_device_id(tsl2561_device_type_t device)
     return name != NULL;
 }
 
-static esp_err_t _power_up(tsl2561_info_t * tsl2561_info)
+// Acquire the shared bus lock, if any, recording the time spent waiting
+static esp_err_t _bus_acquire(tsl2561_info_t * tsl2561_info)
 {
-    esp_err_t err = ESP_FAIL;
-    if (tsl2561_info != NULL)
+    esp_err_t err = ESP_OK;
+    if (tsl2561_info->bus_lock != NULL)
     {
-        if (!tsl2561_info->powered)
+#ifdef CONFIG_TSL2561_STATS
+        int64_t start = esp_timer_get_time();
+#endif
+        BaseType_t taken = xSemaphoreTake(tsl2561_info->bus_lock, tsl2561_info->bus_lock_timeout);
+#ifdef CONFIG_TSL2561_STATS
+        uint32_t wait = (uint32_t)(esp_timer_get_time() - start);
+        STATS_ADD(tsl2561_info, bus_lock_wait_total_us, wait);
+        STATS_MAX(tsl2561_info, bus_lock_wait_max_us, wait);
+#endif
+        if (taken == pdTRUE)
         {
-            if ((err = smbus_write_byte(tsl2561_info->smbus_info, REG_CONTROL | SMB_COMMAND, TSL2561_CONTROL_POWER_UP)) == ESP_OK)
-            {
-                tsl2561_info->powered = true;
-            }
+            STATS_INC(tsl2561_info, bus_lock_acquisitions);
         }
         else
         {
-            ESP_LOGW(TAG, "Device already powered");
-            err = ESP_OK;  // not an error
+            ESP_LOGE(TAG, "Timed out waiting for bus lock");
+            STATS_INC(tsl2561_info, bus_lock_timeouts);
+            err = ESP_ERR_TIMEOUT;
         }
     }
     return err;
 }
 
-static esp_err_t _power_down(tsl2561_info_t * tsl2561_info)
+static void _bus_release(tsl2561_info_t * tsl2561_info, esp_err_t err)
+{
+    if (tsl2561_info->bus_lock != NULL)
+    {
+        xSemaphoreGive(tsl2561_info->bus_lock);
+    }
+
+    STATS_INC(tsl2561_info, transactions);
+    if (err != ESP_OK)
+    {
+        STATS_INC(tsl2561_info, bus_errors);
+    }
+}
+
+// Delay for a duration that need not be a whole number of ticks
+static void _delay_us(uint32_t duration_us)
+{
+    const uint32_t tick_us = portTICK_RATE_MS * 1000;
+    if (duration_us >= tick_us)
+    {
+        vTaskDelay(duration_us / tick_us);
+    }
+    else if (duration_us > 0)
+    {
+        ets_delay_us(duration_us);
+    }
+}
+
+// True if a bus transaction should be attempted: always the first time, then after each bus error
+// until the retry budget is spent, backing off for twice as long before each successive retry
+static bool _attempt(tsl2561_info_t * tsl2561_info, uint8_t attempt, esp_err_t err)
+{
+    bool proceed = attempt == 0;
+    if (!proceed && (err == ESP_FAIL || err == ESP_ERR_TIMEOUT) && attempt <= tsl2561_info->retries)
+    {
+        _delay_us(tsl2561_info->retry_backoff_us << (attempt - 1));
+        STATS_INC(tsl2561_info, retries);
+        proceed = true;
+    }
+    return proceed;
+}
+
+// Bus transactions. The bus lock is held only for the duration of each transaction,
+// and is released while backing off before a retry.
+
+static esp_err_t _send_byte(tsl2561_info_t * tsl2561_info, uint8_t data)
 {
     esp_err_t err = ESP_FAIL;
-    if (tsl2561_info != NULL)
+    for (uint8_t attempt = 0; _attempt(tsl2561_info, attempt, err); ++attempt)
     {
-        if (tsl2561_info->powered)
-        {
-            if ((err = smbus_write_byte(tsl2561_info->smbus_info, REG_CONTROL | SMB_COMMAND, TSL2561_CONTROL_POWER_DOWN)) == ESP_OK)
-            {
-                tsl2561_info->powered = false;
-            }
-        }
-        else
+        if ((err = _bus_acquire(tsl2561_info)) != ESP_OK)
         {
-            ESP_LOGW(TAG, "Device not powered");
-            err = ESP_OK;  // not an error
+            break;
         }
+        err = smbus_send_byte(tsl2561_info->smbus_info, data);
+        _bus_release(tsl2561_info, err);
     }
     return err;
 }
 
-// Assumes device is already powered up
-static esp_err_t _set_integration_time_and_gain(tsl2561_info_t * tsl2561_info, tsl2561_integration_time_t integration_time, tsl2561_gain_t gain)
+static esp_err_t _write_byte(tsl2561_info_t * tsl2561_info, uint8_t command, uint8_t data)
 {
     esp_err_t err = ESP_FAIL;
-    if (tsl2561_info != NULL && tsl2561_info->powered)
+    for (uint8_t attempt = 0; _attempt(tsl2561_info, attempt, err); ++attempt)
     {
-        if ((err = smbus_write_byte(tsl2561_info->smbus_info, REG_TIMING | SMB_COMMAND, integration_time | gain)) == ESP_OK)
+        if ((err = _bus_acquire(tsl2561_info)) != ESP_OK)
         {
-            tsl2561_info->integration_time = integration_time;
-            tsl2561_info->gain = gain;
+            break;
         }
+        err = smbus_write_byte(tsl2561_info->smbus_info, command, data);
+        _bus_release(tsl2561_info, err);
     }
     return err;
 }
 
-// Public API
-
-tsl2561_info_t * tsl2561_malloc(void)
+static esp_err_t _write_word(tsl2561_info_t * tsl2561_info, uint8_t command, uint16_t data)
 {
-    tsl2561_info_t * tsl2561_info = malloc(sizeof(*tsl2561_info));
-    if (tsl2561_info != NULL)
-    {
-        memset(tsl2561_info, 0, sizeof(*tsl2561_info));
-        ESP_LOGD(TAG, "malloc tsl2561_info_t %p", tsl2561_info);
-    }
-    else
+    esp_err_t err = ESP_FAIL;
+    for (uint8_t attempt = 0; _attempt(tsl2561_info, attempt, err); ++attempt)
     {
-        ESP_LOGE(TAG, "malloc tsl2561_info_t failed");
+        if ((err = _bus_acquire(tsl2561_info)) != ESP_OK)
+        {
+            break;
+        }
+        err = smbus_write_word(tsl2561_info->smbus_info, command, data);
+        _bus_release(tsl2561_info, err);
     }
-    return tsl2561_info;
+    return err;
 }
 
-void tsl2561_free(tsl2561_info_t ** tsl2561_info)
+static esp_err_t _write_block(tsl2561_info_t * tsl2561_info, uint8_t command, uint8_t * data, uint8_t len)
 {
-    if (tsl2561_info != NULL && (*tsl2561_info != NULL))
+    esp_err_t err = ESP_FAIL;
+    for (uint8_t attempt = 0; _attempt(tsl2561_info, attempt, err); ++attempt)
     {
-        ESP_LOGD(TAG, "free tsl2561_info_t %p", *tsl2561_info);
-        free(*tsl2561_info);
-        *tsl2561_info = NULL;
+        if ((err = _bus_acquire(tsl2561_info)) != ESP_OK)
+        {
+            break;
+        }
+        err = smbus_write_block(tsl2561_info->smbus_info, command, data, len);
+        _bus_release(tsl2561_info, err);
     }
-    else
+    return err;
+}
+
+static esp_err_t _read_byte(tsl2561_info_t * tsl2561_info, uint8_t command, uint8_t * data)
+{
+    esp_err_t err = ESP_FAIL;
+    for (uint8_t attempt = 0; _attempt(tsl2561_info, attempt, err); ++attempt)
     {
-        ESP_LOGE(TAG, "free tsl2561_info_t failed");
+        if ((err = _bus_acquire(tsl2561_info)) != ESP_OK)
+        {
+            break;
+        }
+        err = smbus_read_byte(tsl2561_info->smbus_info, command, data);
+        _bus_release(tsl2561_info, err);
     }
+    return err;
 }
 
-esp_err_t tsl2561_init(tsl2561_info_t * tsl2561_info, smbus_info_t * smbus_info)
+static esp_err_t _read_word(tsl2561_info_t * tsl2561_info, uint8_t command, uint16_t * data)
 {
     esp_err_t err = ESP_FAIL;
-    if (tsl2561_info != NULL)
+    for (uint8_t attempt = 0; _attempt(tsl2561_info, attempt, err); ++attempt)
     {
-        tsl2561_info->smbus_info = smbus_info;
-        tsl2561_info->powered = false;
-        tsl2561_info->integration_time = DEFAULT_INTEGRATION_TIME;
-        tsl2561_info->gain = DEFAULT_GAIN;
-        tsl2561_info->device_type= TSL2561_DEVICE_TYPE_INVALID;
-
-        tsl2561_info->init = true;
-
-        // read the ID register and confirm that it is as expected for this device
-        tsl2561_device_type_t device_type = TSL2561_DEVICE_TYPE_INVALID;
-        tsl2561_revision_t revision = 0;
-        err = tsl2561_device_id(tsl2561_info, &device_type, &revision);
-        if (err == ESP_OK)
+        if ((err = _bus_acquire(tsl2561_info)) != ESP_OK)
         {
-            ESP_LOGI(TAG, "Detected device ID 0x%02x, revision %d on I2C address 0x%02x", device_type, revision, smbus_info->address);
-            if (_check_device_id(device_type))
-            {
-                tsl2561_info->device_type = device_type;
-                err = ESP_OK;
-            }
-            else
-            {
-                ESP_LOGE(TAG, "Unsupported device detected");
-            }
+            break;
         }
+        err = smbus_read_word(tsl2561_info->smbus_info, command, data);
+        _bus_release(tsl2561_info, err);
     }
-    else
+    return err;
+}
+
+static esp_err_t _read_block(tsl2561_info_t * tsl2561_info, uint8_t command, uint8_t * data, uint8_t * len)
+{
+    esp_err_t err = ESP_FAIL;
+    for (uint8_t attempt = 0; _attempt(tsl2561_info, attempt, err); ++attempt)
     {
-        ESP_LOGE(TAG, "tsl2561_info is NULL");
-        err = ESP_FAIL;
+        if ((err = _bus_acquire(tsl2561_info)) != ESP_OK)
+        {
+            break;
+        }
+        err = smbus_read_block(tsl2561_info->smbus_info, command, data, len);
+        _bus_release(tsl2561_info, err);
     }
     return err;
 }
 
-esp_err_t tsl2561_device_id(const tsl2561_info_t * tsl2561_info, tsl2561_device_type_t * device, tsl2561_revision_t * revision)
+// True if the cached device state shows that the register already holds the value
+static bool _register_matches(const tsl2561_info_t * tsl2561_info, uint8_t reg, uint8_t value)
 {
-    esp_err_t err = ESP_FAIL;
-    if (_is_init(tsl2561_info) && device && revision)
+    return (tsl2561_info->shadow_valid & (1 << reg)) && tsl2561_info->shadow[reg] == value;
+}
+
+static void _register_update(tsl2561_info_t * tsl2561_info, uint8_t reg, uint8_t value)
+{
+    tsl2561_info->shadow[reg] = value;
+    tsl2561_info->shadow_valid |= 1 << reg;
+}
+
+// Collect a register change for the open configuration transaction, superseding any earlier change
+static void _register_stage(tsl2561_info_t * tsl2561_info, uint8_t reg, uint8_t value)
+{
+    tsl2561_info->config_pending[reg] = value;
+    tsl2561_info->config_dirty |= 1 << reg;
+}
+
+// Write a configuration register, unless the cached device state shows it already holds the value
+static esp_err_t _write_register(tsl2561_info_t * tsl2561_info, uint8_t reg, uint8_t value)
+{
+    esp_err_t err = ESP_OK;
+    if (tsl2561_info->config_open)
     {
-        uint8_t id = 0;
-        err = smbus_read_byte(tsl2561_info->smbus_info, REG_ID | SMB_COMMAND, &id);
-        if (err == ESP_OK)
+        _register_stage(tsl2561_info, reg, value);
+    }
+    else if (!_register_matches(tsl2561_info, reg, value))
+    {
+        if ((err = _write_byte(tsl2561_info, reg | SMB_COMMAND, value)) == ESP_OK)
         {
-            *device = (tsl2561_device_type_t)((id >> 4) & 0x0f);
-            *revision = (tsl2561_revision_t)(id & 0x0f);
+            _register_update(tsl2561_info, reg, value);
         }
         else
         {
-            ESP_LOGE(TAG, "Failed to read device ID");
+            // device state is unknown until the next successful write or resync
+            tsl2561_info->shadow_valid &= ~(1 << reg);
         }
     }
     return err;
 }
 
-esp_err_t tsl2561_read(tsl2561_info_t * tsl2561_info, tsl2561_visible_t * visible, tsl2561_infrared_t * infrared)
+// Write a pair of configuration registers, low byte first, unless both already hold the value
+static esp_err_t _write_register_word(tsl2561_info_t * tsl2561_info, uint8_t reg, uint16_t value)
 {
-    esp_err_t err = ESP_FAIL;
-    if (_is_init(tsl2561_info) && visible && infrared)
+    esp_err_t err = ESP_OK;
+    if (tsl2561_info->config_open)
     {
-        if ((err = _power_up(tsl2561_info)) == ESP_OK)
+        _register_stage(tsl2561_info, reg, value & 0xff);
+        _register_stage(tsl2561_info, reg + 1, value >> 8);
+    }
+    else if (!_register_matches(tsl2561_info, reg, value & 0xff) || !_register_matches(tsl2561_info, reg + 1, value >> 8))
+    {
+        if ((err = _write_word(tsl2561_info, reg | SMB_COMMAND | SMB_WORD, value)) == ESP_OK)
         {
-            TickType_t delay = 0;
-            switch (tsl2561_info->integration_time)
-            {
-            case TSL2561_INTEGRATION_TIME_13MS:
-                // wait at least 15ms according to Adafruit driver
-                delay = 15;
-                break;
-            case TSL2561_INTEGRATION_TIME_101MS:
-                // wait at least 120ms according to Adafruit driver
-                delay = 120;
-                break;
-            default:
-                ESP_LOGW(TAG, "Invalid integration time: %d", tsl2561_info->integration_time);
-                /* fall through */
-            case TSL2561_INTEGRATION_TIME_402MS:
-                // wait at least 450ms according to Adafruit driver
-                delay = 450;
-                break;
-            }
-            vTaskDelay((delay - 1) / portTICK_RATE_MS + 1);
-
-            uint16_t ch0 = 0;
-            uint16_t ch1 = 0;
-            if ((err = smbus_read_word(tsl2561_info->smbus_info, REG_DATA0LOW | SMB_COMMAND | SMB_WORD, &ch0)) == ESP_OK)
-            {
-                if ((err = smbus_read_word(tsl2561_info->smbus_info, REG_DATA1LOW | SMB_COMMAND | SMB_WORD, &ch1)) == ESP_OK)
-                {
-                    if ((err = _power_down(tsl2561_info)) == ESP_OK)
-                    {
-                        *visible = ch0 - ch1;
-                        *infrared = ch1;
-                    }
-                }
-            }
+            _register_update(tsl2561_info, reg, value & 0xff);
+            _register_update(tsl2561_info, reg + 1, value >> 8);
+        }
+        else
+        {
+            tsl2561_info->shadow_valid &= ~((1 << reg) | (1 << (reg + 1)));
         }
     }
     return err;
 }
 
-esp_err_t tsl2561_set_integration_time_and_gain(tsl2561_info_t * tsl2561_info, tsl2561_integration_time_t integration_time, tsl2561_gain_t gain)
+// Write a run of consecutive configuration registers in a single transaction where possible.
+// Bit i of dirty is set if register reg + i changes; the others bridge the run with the values the device holds.
+static esp_err_t _write_register_run(tsl2561_info_t * tsl2561_info, uint8_t reg, uint8_t * values, uint8_t len, uint8_t dirty)
 {
     esp_err_t err = ESP_FAIL;
-    if (_is_init(tsl2561_info))
+    bool rejected = false;
+    if (len == 1)
     {
-        if ((err = _power_up(tsl2561_info)) == ESP_OK)
+        err = _write_byte(tsl2561_info, reg | SMB_COMMAND, values[0]);
+    }
+    else if (len == 2)
+    {
+        err = _write_word(tsl2561_info, reg | SMB_COMMAND | SMB_WORD, values[0] | (values[1] << 8));
+    }
+    else if (tsl2561_info->block_write)
+    {
+        // a NACK that byte writes do not also get means the bus rejects block transactions;
+        // anything else may be transient, so block writes are tried again next time
+        err = _write_block(tsl2561_info, reg | SMB_COMMAND | SMB_BLOCK, values, len);
+        rejected = err == ESP_FAIL;
+    }
+
+    if (err != ESP_OK && len > 2)
+    {
+        // block protocol disabled or not supported: fall back to byte writes of the changed registers
+        err = ESP_OK;
+        for (uint8_t i = 0; err == ESP_OK && i < len; ++i)
         {
-            if ((err = _set_integration_time_and_gain(tsl2561_info, integration_time, gain)) == ESP_OK)
+            if (dirty & (1 << i))
             {
-                tsl2561_info->integration_time = integration_time;
-                tsl2561_info->gain = gain;
+                err = _write_byte(tsl2561_info, (reg + i) | SMB_COMMAND, values[i]);
             }
+        }
 
-            esp_err_t pderr = _power_down(tsl2561_info);
-            err = pderr != ESP_OK ? pderr : err;
+        if (err == ESP_OK && rejected)
+        {
+            ESP_LOGW(TAG, "Block write rejected, falling back to byte writes");
+            tsl2561_info->block_write = false;
+        }
+    }
+
+    // bridging registers are rewritten with the value they hold, so their cached value stands
+    for (uint8_t i = 0; i < len; ++i)
+    {
+        if ((dirty & (1 << i)) && err == ESP_OK)
+        {
+            _register_update(tsl2561_info, reg + i, values[i]);
+        }
+        else if (dirty & (1 << i))
+        {
+            // device state is unknown until the next successful write or resync
+            tsl2561_info->shadow_valid &= ~(1 << (reg + i));
         }
     }
     return err;
 }
 
-uint32_t tsl2561_compute_lux(const tsl2561_info_t * tsl2561_info, tsl2561_visible_t visible, tsl2561_infrared_t infrared)
+// After a failed write to CONTROL the device may or may not have been powered, so read it back
+static void _resync_power(tsl2561_info_t * tsl2561_info)
 {
-    uint32_t lux = 0;
-    if (_is_init(tsl2561_info))
+    uint8_t control = 0;
+    if (_read_byte(tsl2561_info, REG_CONTROL | SMB_COMMAND, &control) == ESP_OK)
+    {
+        // only the power bits of CONTROL are significant
+        control &= TSL2561_CONTROL_POWER_UP;
+        _register_update(tsl2561_info, REG_CONTROL, control);
+        tsl2561_info->powered = control == TSL2561_CONTROL_POWER_UP;
+    }
+    else
     {
-        uint32_t scale = 0;
+        ESP_LOGE(TAG, "Failed to read device power state");
+    }
+}
 
-        // scale channel values
-        switch (tsl2561_info->integration_time)
+static esp_err_t _power_up(tsl2561_info_t * tsl2561_info)
+{
+    esp_err_t err = ESP_FAIL;
+    if (tsl2561_info != NULL)
+    {
+        if (!tsl2561_info->powered)
         {
-        case TSL2561_INTEGRATION_TIME_13MS:
-            scale = CH_SCALE_TINT0;
-            break;
-        case TSL2561_INTEGRATION_TIME_101MS:
-            scale = CH_SCALE_TINT1;
-            break;
-        default:
-            scale = 1 << CH_SCALE;
+            if ((err = _write_register(tsl2561_info, REG_CONTROL, TSL2561_CONTROL_POWER_UP)) == ESP_OK)
+            {
+                tsl2561_info->powered = true;
+            }
+            else
+            {
+                _resync_power(tsl2561_info);
+            }
         }
-
-        // scale 1x measurement up to 16x
-        if (tsl2561_info->gain == TSL2561_GAIN_1X)
+        else
         {
-            scale <<= 4;
+            ESP_LOGW(TAG, "Device already powered");
+            err = ESP_OK;  // not an error
         }
+    }
+    return err;
+}
 
-        // convert visible/infrared back into channel data
-        uint32_t channel0 = ((visible + infrared) * scale) >> CH_SCALE;
-        uint32_t channel1 = (infrared * scale) >> CH_SCALE;
-
-        // find the ratio of the channel values (channel1/channel0)
-        // protect against divide by zero
-        uint32_t ratio1 = 0;
-        if (channel0 != 0)
-        {
-            ratio1 = (channel1 << (RATIO_SCALE + 1)) / channel0;
-        }
-
-        // round the ratio value
-        uint32_t ratio = (ratio1 + 1) >> 1;
-
-        // is ratio <= eachBreak ?
-        int b = 0, m = 0;
-
-        switch (tsl2561_info->device_type)
-        {
-        case 1:
-            if (ratio <= TSL2561_K1C) {
-                b = TSL2561_B1C; m = TSL2561_M1C;
-            } else if (ratio <= TSL2561_K2C) {
-                b = TSL2561_B2C; m = TSL2561_M2C;
-            } else if (ratio <= TSL2561_K3C) {
-                b = TSL2561_B3C; m = TSL2561_M3C;
-            } else if (ratio <= TSL2561_K4C) {
-                b = TSL2561_B4C; m = TSL2561_M4C;
-            } else if (ratio <= TSL2561_K5T) {
-                b = TSL2561_B5C; m = TSL2561_M5C;
-            } else if (ratio <= TSL2561_K6T) {
-                b = TSL2561_B6C; m = TSL2561_M6C;
-            } else if (ratio <= TSL2561_K7T) {
-                b = TSL2561_B7C; m = TSL2561_M7C;
-            } else if (ratio > TSL2561_K8C) {
-                b = TSL2561_B8C; m = TSL2561_M8C;
+static esp_err_t _power_down(tsl2561_info_t * tsl2561_info)
+{
+    esp_err_t err = ESP_FAIL;
+    if (tsl2561_info != NULL)
+    {
+        // power down if the device may be powered, even if a failed transaction left the flag clear
+        if (tsl2561_info->powered || !(tsl2561_info->shadow_valid & (1 << REG_CONTROL)))
+        {
+            if ((err = _write_register(tsl2561_info, REG_CONTROL, TSL2561_CONTROL_POWER_DOWN)) == ESP_OK)
+            {
+                tsl2561_info->powered = false;
             }
-            break;
-
-        case 0:
-        default:
-            if (ratio <= TSL2561_K1T) {
-                b = TSL2561_B1T; m = TSL2561_M1T;
-            } else if (ratio <= TSL2561_K2T) {
-                b = TSL2561_B2T; m = TSL2561_M2T;
-            } else if (ratio <= TSL2561_K3T) {
-                b = TSL2561_B3T; m = TSL2561_M3T;
-            } else if (ratio <= TSL2561_K4T) {
-                b = TSL2561_B4T; m = TSL2561_M4T;
-            } else if (ratio <= TSL2561_K5T) {
-                b = TSL2561_B5T; m = TSL2561_M5T;
-            } else if (ratio <= TSL2561_K6T) {
-                b = TSL2561_B6T; m = TSL2561_M6T;
-            } else if (ratio <= TSL2561_K7T) {
-                b = TSL2561_B7T; m = TSL2561_M7T;
-            } else if (ratio > TSL2561_K8T) {
-                b = TSL2561_B8T; m = TSL2561_M8T;
+            else
+            {
+                _resync_power(tsl2561_info);
             }
-            break;
         }
-
-        uint32_t temp = (channel0 * b) - (channel1 * m);
-
-        // prevent negative lux values
-        if ((channel1 * m) > (channel0 * b))
+        else
         {
-            temp = 0;
+            ESP_LOGW(TAG, "Device not powered");
+            err = ESP_OK;  // not an error
         }
+    }
+    return err;
+}
 
-        // round lsb
-        temp += (1 << (LUX_SCALE-1));
+// True if the integration time and gain may be selected, which is only the configured range if it is fixed
+static bool _range_supported(tsl2561_integration_time_t integration_time, tsl2561_gain_t gain)
+{
+#ifdef CONFIG_TSL2561_FIXED_RANGE
+    return integration_time == FIXED_INTEGRATION_TIME && gain == FIXED_GAIN;
+#else
+    (void)integration_time;
+    (void)gain;
+    return true;
+#endif
+}
 
-        // strip off fractional portion
-        lux = temp >> LUX_SCALE;
+// Channel scale factor for the given integration time and gain, relative to 402ms/16x
+static uint32_t _channel_scale(tsl2561_integration_time_t integration_time, tsl2561_gain_t gain)
+{
+    uint32_t scale = 0;
+    switch (integration_time)
+    {
+    case TSL2561_INTEGRATION_TIME_13MS:
+        scale = CH_SCALE_TINT0;
+        break;
+    case TSL2561_INTEGRATION_TIME_101MS:
+        scale = CH_SCALE_TINT1;
+        break;
+    default:
+        scale = 1 << CH_SCALE;
+    }
 
+    // scale 1x measurement up to 16x
+    if (gain == TSL2561_GAIN_1X)
+    {
+        scale <<= 4;
     }
-    return lux;
+    return scale;
+}
+
+// Channel scale factor for a manual integration of the given duration, relative to 402ms/16x
+static uint32_t _manual_channel_scale(uint32_t exposure_us, tsl2561_gain_t gain)
+{
+    uint32_t scale = exposure_us > 0 ? (uint32_t)(((uint64_t)MANUAL_REFERENCE_US << CH_SCALE) / exposure_us) : 1 << CH_SCALE;
+
+    // scale 1x measurement up to 16x
+    if (gain == TSL2561_GAIN_1X)
+    {
+        scale <<= 4;
+    }
+    return scale;
+}
+
+static const struct tsl2561_lux_coefficients * _lux_coefficients(tsl2561_device_type_t device_type)
+{
+    bool chipscale = device_type == TSL2561_DEVICE_TYPE_TSL2560CS || device_type == TSL2561_DEVICE_TYPE_TSL2561CS;
+    return chipscale ? &LUX_COEFFICIENTS_CS : &LUX_COEFFICIENTS_T;
+}
+
+// Compute lux from channel values, using a precomputed channel scale and package coefficients.
+// The result has LUX_SCALE fractional bits and is not rounded.
+// Intermediate values are unsigned 32-bit and wrap on overflow, as per the datasheet procedure.
+static inline uint32_t _compute_lux_scaled(uint32_t scale, const struct tsl2561_lux_coefficients * coefficients, uint32_t ch0, uint32_t ch1)
+{
+    uint32_t channel0 = (ch0 * scale) >> CH_SCALE;
+    uint32_t channel1 = (ch1 * scale) >> CH_SCALE;
+
+    // find the ratio of the channel values (channel1/channel0)
+    // protect against divide by zero
+    uint32_t ratio1 = 0;
+    if (channel0 != 0)
+    {
+        ratio1 = (channel1 << (RATIO_SCALE + 1)) / channel0;
+    }
+
+    // round the ratio value
+    uint32_t ratio = (ratio1 + 1) >> 1;
+
+    // segment index is the number of breakpoints the ratio exceeds, found by a binary search
+    // over the seven breakpoints: compare with the middle one, then the middle of the half above
+    // or below it, then the one remaining
+    size_t segment = 0;
+    segment += (size_t)(ratio > coefficients->k[segment + 3]) << 2;
+    segment += (size_t)(ratio > coefficients->k[segment + 1]) << 1;
+    segment += ratio > coefficients->k[segment];
+
+    uint32_t positive = channel0 * coefficients->b[segment];
+    uint32_t negative = channel1 * coefficients->m[segment];
+
+    // prevent negative lux values
+    uint32_t temp = 0;
+    if (positive > negative)
+    {
+        temp = positive - negative;
+    }
+    return temp;
+}
+
+static inline uint32_t _compute_lux(uint32_t scale, const struct tsl2561_lux_coefficients * coefficients, uint32_t ch0, uint32_t ch1)
+{
+    uint32_t temp = _compute_lux_scaled(scale, coefficients, ch0, ch1);
+
+    // round lsb
+    temp += (1 << (LUX_SCALE - 1));
+
+    // strip off fractional portion
+    return temp >> LUX_SCALE;
+}
+
+// Assumes device is already powered up
+static esp_err_t _set_integration_time_and_gain(tsl2561_info_t * tsl2561_info, tsl2561_integration_time_t integration_time, tsl2561_gain_t gain)
+{
+    esp_err_t err = ESP_FAIL;
+    if (tsl2561_info != NULL && (tsl2561_info->powered || tsl2561_info->config_open))
+    {
+        if ((err = _write_register(tsl2561_info, REG_TIMING, integration_time | gain)) == ESP_OK)
+        {
+            tsl2561_info->integration_time = integration_time;
+            tsl2561_info->gain = gain;
+            tsl2561_info->channel_scale = integration_time == TSL2561_INTEGRATION_TIME_MANUAL
+                                          ? _manual_channel_scale(tsl2561_info->manual_exposure_us, gain)
+                                          : _channel_scale(integration_time, gain);
+        }
+    }
+    return err;
+}
+
+// Read both channels, preferably as a single block read of DATA0LOW..DATA1HIGH
+static esp_err_t _read_channels(tsl2561_info_t * tsl2561_info, uint16_t * ch0, uint16_t * ch1)
+{
+    esp_err_t err = ESP_FAIL;
+    bool word_read = !tsl2561_info->block_read;
+    bool rejected = false;
+    if (tsl2561_info->block_read)
+    {
+        uint8_t data[4] = { 0 };
+        uint8_t len = sizeof(data);
+        if ((err = _read_block(tsl2561_info, REG_DATA0LOW | SMB_COMMAND | SMB_BLOCK, data, &len)) == ESP_OK
+            && len == sizeof(data))
+        {
+            *ch0 = data[0] | (data[1] << 8);
+            *ch1 = data[2] | (data[3] << 8);
+        }
+        else
+        {
+            // a short read, or a NACK that word reads do not also get, means the bus rejects block
+            // transactions; anything else may be transient, so block reads are tried again next time
+            word_read = true;
+            rejected = err == ESP_OK || err == ESP_FAIL;
+        }
+    }
+
+    if (word_read)
+    {
+        if ((err = _read_word(tsl2561_info, REG_DATA0LOW | SMB_COMMAND | SMB_WORD, ch0)) == ESP_OK)
+        {
+            err = _read_word(tsl2561_info, REG_DATA1LOW | SMB_COMMAND | SMB_WORD, ch1);
+        }
+
+        if (err == ESP_OK && rejected)
+        {
+            ESP_LOGW(TAG, "Block read rejected, falling back to word reads");
+            tsl2561_info->block_read = false;
+        }
+    }
+    return err;
+}
+
+// Nominal integration duration in microseconds
+static inline uint32_t _integration_us(const tsl2561_info_t * tsl2561_info)
+{
+    uint32_t duration = 0;
+    switch (tsl2561_info->integration_time)
+    {
+    case TSL2561_INTEGRATION_TIME_13MS:
+        duration = 13700;
+        break;
+    case TSL2561_INTEGRATION_TIME_101MS:
+        duration = 101000;
+        break;
+    case TSL2561_INTEGRATION_TIME_MANUAL:
+        duration = tsl2561_info->manual_exposure_us;
+        break;
+    default:
+    case TSL2561_INTEGRATION_TIME_402MS:
+        duration = 402000;
+        break;
+    }
+    return duration;
+}
+
+// Time from the start of an integration until its result may be read, in microseconds.
+// The device oscillator is not trimmed, so allow a fixed integration to run up to 1/16 long;
+// a manual integration ends when the driver stops it.
+static inline uint32_t _ready_delay_us(const tsl2561_info_t * tsl2561_info)
+{
+    uint32_t delay = _integration_us(tsl2561_info);
+    if (tsl2561_info->integration_time != TSL2561_INTEGRATION_TIME_MANUAL)
+    {
+        delay += delay >> INTEGRATION_MARGIN_SHIFT;
+    }
+    return delay;
+}
+
+// Number of ticks to sleep from now until the given time. A manual integration is timed by the
+// driver, and continuous acquisition keeps pace with the device, so round down and busy-wait the
+// remainder; otherwise round up, and read the result late.
+static TickType_t _ticks_until_us(const tsl2561_info_t * tsl2561_info, int64_t time_us, int64_t now_us)
+{
+    const int64_t tick_us = portTICK_RATE_MS * 1000;
+    bool precise = tsl2561_info->integration_time == TSL2561_INTEGRATION_TIME_MANUAL
+                   || tsl2561_info->measurement_state == TSL2561_MEASUREMENT_CONTINUOUS;
+    int64_t round = precise ? 0 : tick_us - 1;
+    return time_us > now_us ? (TickType_t)((time_us - now_us + round) / tick_us) : 0;
+}
+
+// First tick by which the given time has certainly passed. The tick count is not in phase with
+// esp_timer, so the current tick may have started up to a whole tick before now.
+static TickType_t _tick_after_us(int64_t time_us, int64_t now_us)
+{
+    const int64_t tick_us = portTICK_RATE_MS * 1000;
+    TickType_t now = xTaskGetTickCount();
+    return time_us > now_us ? now + (TickType_t)((time_us - now_us + 2 * tick_us - 2) / tick_us) : now;
+}
+
+// Channel value at which the integration saturates
+static inline uint32_t _saturation_limit(const tsl2561_info_t * tsl2561_info)
+{
+    uint32_t limit = 0;
+    switch (tsl2561_info->integration_time)
+    {
+    case TSL2561_INTEGRATION_TIME_13MS:
+        limit = CLIP_TINT0;
+        break;
+    case TSL2561_INTEGRATION_TIME_101MS:
+        limit = CLIP_TINT1;
+        break;
+    case TSL2561_INTEGRATION_TIME_MANUAL:
+    {
+        // pro rata to the 101ms limit, which is below full scale
+        uint64_t manual_limit = (uint64_t)tsl2561_info->manual_exposure_us * CLIP_TINT1 / 101000;
+        limit = manual_limit < CLIP_TINT2 ? (uint32_t)manual_limit : CLIP_TINT2;
+        break;
+    }
+    default:
+    case TSL2561_INTEGRATION_TIME_402MS:
+        limit = CLIP_TINT2;
+        break;
+    }
+    return limit;
+}
+
+// Record the start of an integration with the current settings, and when its result will be available
+static void _begin_integration(tsl2561_info_t * tsl2561_info)
+{
+    int64_t now = esp_timer_get_time();
+    tsl2561_info->integration_start_us = now;
+    tsl2561_info->ready_us = now + _ready_delay_us(tsl2561_info);
+    tsl2561_info->ready_tick = _tick_after_us(tsl2561_info->ready_us, now);
+}
+
+// Start a manual integration. Assumes device is already powered up.
+static esp_err_t _start_manual_integration(tsl2561_info_t * tsl2561_info)
+{
+    esp_err_t err = ESP_FAIL;
+    uint8_t timing = TSL2561_INTEGRATION_TIME_MANUAL | tsl2561_info->gain | TSL2561_TIMING_MANUAL_START;
+    if ((err = _write_register(tsl2561_info, REG_TIMING, timing)) == ESP_OK)
+    {
+        _begin_integration(tsl2561_info);
+    }
+    return err;
+}
+
+// Stop a manual integration, and derive the channel scale from the measured exposure
+static esp_err_t _stop_manual_integration(tsl2561_info_t * tsl2561_info)
+{
+    esp_err_t err = ESP_FAIL;
+    if ((err = _write_register(tsl2561_info, REG_TIMING, TSL2561_INTEGRATION_TIME_MANUAL | tsl2561_info->gain)) == ESP_OK)
+    {
+        tsl2561_info->result_end_us = esp_timer_get_time();
+        uint32_t exposure_us = (uint32_t)(tsl2561_info->result_end_us - tsl2561_info->integration_start_us);
+        tsl2561_info->channel_scale = _manual_channel_scale(exposure_us, tsl2561_info->gain);
+    }
+    return err;
+}
+
+// True if the result of the current measurement is available
+static bool _result_available(const tsl2561_info_t * tsl2561_info)
+{
+    return esp_timer_get_time() >= tsl2561_info->ready_us;
+}
+
+// Sleep until the result of the current measurement is expected to be available.
+// The result need not be available on a tick boundary, so a manual exposure or
+// continuous acquisition spends the last partial tick busy-waiting.
+static void _wait_for_result(const tsl2561_info_t * tsl2561_info)
+{
+    const int64_t tick_us = portTICK_RATE_MS * 1000;
+    int64_t now_us = esp_timer_get_time();
+    TickType_t ticks = _ticks_until_us(tsl2561_info, tsl2561_info->ready_us, now_us);
+    if (ticks > 0)
+    {
+        vTaskDelay(ticks);
+    }
+    else if (tsl2561_info->ready_us > now_us && tsl2561_info->ready_us - now_us < tick_us)
+    {
+        ets_delay_us((uint32_t)(tsl2561_info->ready_us - now_us));
+    }
+}
+
+// Record the integration interval of the result just read, in a read that began at read_us.
+// In continuous mode the device integrates back to back from the start of acquisition, so the
+// latest completed integration is the last whole period before the data was read. Reads are
+// scheduled on a grid anchored to the same start, with slots 1/32 longer than the nominal period:
+// the device keeps its native cadence, and an oscillator up to 1/32 slow completes a new conversion
+// between reads however long acquisition runs. The next read takes the first slot at least a period
+// after this one began, so a late read does not return the same conversion twice.
+static void _end_integration(tsl2561_info_t * tsl2561_info, int64_t read_us)
+{
+    if (tsl2561_info->measurement_state == TSL2561_MEASUREMENT_CONTINUOUS)
+    {
+        int64_t now = esp_timer_get_time();
+        uint32_t period = _integration_us(tsl2561_info);
+        int64_t periods = (now - tsl2561_info->integration_start_us) / period;
+        periods = periods > 0 ? periods : 1;
+        tsl2561_info->result_end_us = tsl2561_info->integration_start_us + periods * period;
+        tsl2561_info->result_start_us = tsl2561_info->result_end_us - period;
+
+        uint32_t slot = period + (period >> CONTINUOUS_MARGIN_SHIFT);
+        int64_t next = (read_us - tsl2561_info->integration_start_us + period + slot - 1) / slot;
+        tsl2561_info->ready_us = tsl2561_info->integration_start_us + next * slot;
+        tsl2561_info->ready_tick = _tick_after_us(tsl2561_info->ready_us, now);
+    }
+    else
+    {
+        tsl2561_info->result_start_us = tsl2561_info->integration_start_us;
+        if (tsl2561_info->integration_time != TSL2561_INTEGRATION_TIME_MANUAL)
+        {
+            // a manual integration records its own end when stopped
+            tsl2561_info->result_end_us = tsl2561_info->integration_start_us + _integration_us(tsl2561_info);
+        }
+    }
+}
+
+#ifdef CONFIG_TSL2561_STATS
+// Record the latency and saturation of a retrieved result
+static void _record_result(tsl2561_info_t * tsl2561_info, uint16_t ch0, uint16_t ch1)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t latency = (uint32_t)(now - tsl2561_info->result_start_us);
+    uint32_t integration = _integration_us(tsl2561_info);
+    uint32_t overshoot = latency > integration ? latency - integration : 0;
+
+    tsl2561_stats_t * stats = &tsl2561_info->stats;
+    ++stats->results;
+    stats->latency_total_us += latency;
+    stats->latency_min_us = latency < stats->latency_min_us ? latency : stats->latency_min_us;
+    stats->latency_max_us = latency > stats->latency_max_us ? latency : stats->latency_max_us;
+    stats->overshoot_total_us += overshoot;
+    stats->overshoot_max_us = overshoot > stats->overshoot_max_us ? overshoot : stats->overshoot_max_us;
+
+    uint32_t limit = _saturation_limit(tsl2561_info);
+    if (ch0 >= limit || ch1 >= limit)
+    {
+        ++stats->saturated;
+    }
+}
+#endif
+
+// Power cycle the device so that a new integration starts now with the current settings
+static esp_err_t _restart_integration(tsl2561_info_t * tsl2561_info)
+{
+    esp_err_t err = ESP_FAIL;
+    if ((err = _power_down(tsl2561_info)) == ESP_OK)
+    {
+        if ((err = _power_up(tsl2561_info)) == ESP_OK)
+        {
+            _begin_integration(tsl2561_info);
+        }
+    }
+    return err;
+}
+
+// Abandon a single measurement after an error, so that no error path leaves the device powered
+static void _abort_measurement(tsl2561_info_t * tsl2561_info)
+{
+    ESP_LOGW(TAG, "Measurement failed, powering down");
+    if (_power_down(tsl2561_info) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to power down device");
+    }
+    tsl2561_info->measurement_state = TSL2561_MEASUREMENT_IDLE;
+    STATS_INC(tsl2561_info, recoveries);
+}
+
+// Select the range for the next measurement, based on the channel values measured in the current range
+static size_t _auto_range_select(const tsl2561_info_t * tsl2561_info, uint16_t ch0, uint16_t ch1)
+{
+    size_t current = NUM_RANGES;
+    for (size_t i = 0; i < NUM_RANGES; ++i)
+    {
+        if (RANGES[i].integration_time == tsl2561_info->integration_time && RANGES[i].gain == tsl2561_info->gain)
+        {
+            current = i;
+        }
+    }
+
+    size_t next = 0;  // range unknown or saturated: probe with the least sensitive, fastest range
+    if (current < NUM_RANGES && ch0 < RANGES[current].clip && ch1 < RANGES[current].clip)
+    {
+        // find the most sensitive range in which this light level is comfortably measurable
+        size_t target = 0;
+        for (size_t i = 0; i < NUM_RANGES; ++i)
+        {
+            uint64_t predicted = (uint64_t)ch0 * RANGES[current].scale / RANGES[i].scale;
+            if (predicted <= (RANGES[i].clip >> AUTO_RANGE_TARGET_SHIFT))
+            {
+                target = i;
+            }
+        }
+
+        next = current;
+        if (target > current || ch0 > ((RANGES[current].clip * AUTO_RANGE_HIGH_NUM) >> AUTO_RANGE_HIGH_SHIFT))
+        {
+            next = target;
+        }
+    }
+    return next;
+}
+
+// Apply auto-ranging to a result. If the range changes, the result must be discarded,
+// as a new integration has been started in the new range.
+static esp_err_t _auto_range(tsl2561_info_t * tsl2561_info, uint16_t ch0, uint16_t ch1, bool * changed)
+{
+    esp_err_t err = ESP_OK;
+    *changed = false;
+    if (tsl2561_info->auto_range_steps < AUTO_RANGE_MAX_STEPS && tsl2561_info->integration_time != TSL2561_INTEGRATION_TIME_MANUAL)
+    {
+        const range_t * range = &RANGES[_auto_range_select(tsl2561_info, ch0, ch1)];
+        if (range->integration_time != tsl2561_info->integration_time || range->gain != tsl2561_info->gain)
+        {
+            ESP_LOGD(TAG, "Auto-range to integration time %d, gain 0x%02x", range->integration_time, range->gain);
+            ++tsl2561_info->auto_range_steps;
+            STATS_INC(tsl2561_info, auto_range_steps);
+            *changed = true;
+            if ((err = _set_integration_time_and_gain(tsl2561_info, range->integration_time, range->gain)) == ESP_OK)
+            {
+                err = _restart_integration(tsl2561_info);
+            }
+        }
+    }
+
+    if (!*changed)
+    {
+        tsl2561_info->auto_range_steps = 0;
+    }
+    return err;
+}
+
+// Retrieve the channel values of the current measurement, if available
+static esp_err_t _poll(tsl2561_info_t * tsl2561_info, bool * ready, uint16_t * ch0, uint16_t * ch1)
+{
+    esp_err_t err = ESP_FAIL;
+    *ready = false;
+    if (tsl2561_info->measurement_state == TSL2561_MEASUREMENT_IDLE)
+    {
+        ESP_LOGE(TAG, "No measurement in progress");
+        err = ESP_ERR_INVALID_STATE;
+    }
+    else if (!_result_available(tsl2561_info))
+    {
+        err = ESP_OK;  // still integrating
+    }
+    else
+    {
+        bool rerange = false;
+        err = ESP_OK;
+        if (tsl2561_info->integration_time == TSL2561_INTEGRATION_TIME_MANUAL)
+        {
+            err = _stop_manual_integration(tsl2561_info);
+        }
+
+        int64_t read_us = esp_timer_get_time();
+        if (err == ESP_OK && (err = _read_channels(tsl2561_info, ch0, ch1)) == ESP_OK && tsl2561_info->auto_range)
+        {
+            err = _auto_range(tsl2561_info, *ch0, *ch1, &rerange);
+        }
+
+        if (err == ESP_OK && !rerange)
+        {
+            _end_integration(tsl2561_info, read_us);
+            if (tsl2561_info->measurement_state != TSL2561_MEASUREMENT_CONTINUOUS
+                && (err = _power_down(tsl2561_info)) == ESP_OK)
+            {
+                tsl2561_info->measurement_state = TSL2561_MEASUREMENT_IDLE;
+            }
+
+            if (err == ESP_OK)
+            {
+#ifdef CONFIG_TSL2561_STATS
+                _record_result(tsl2561_info, *ch0, *ch1);
+#endif
+                *ready = true;
+            }
+        }
+
+        // a continuous acquisition keeps running, so that the next result may succeed
+        if (err != ESP_OK && tsl2561_info->measurement_state == TSL2561_MEASUREMENT_INTEGRATING)
+        {
+            _abort_measurement(tsl2561_info);
+        }
+    }
+    return err;
+}
+
+// Wait for and retrieve the channel values of a measurement, starting one unless continuous acquisition is active
+static esp_err_t _read(tsl2561_info_t * tsl2561_info, uint16_t * ch0, uint16_t * ch1)
+{
+    // in continuous mode the device is already integrating, so just wait for the next result
+    esp_err_t err = ESP_OK;
+    if (tsl2561_info->measurement_state != TSL2561_MEASUREMENT_CONTINUOUS)
+    {
+        err = tsl2561_start_measurement(tsl2561_info);
+    }
+
+    bool ready = false;
+    while (err == ESP_OK && !ready)
+    {
+        _wait_for_result(tsl2561_info);
+        err = _poll(tsl2561_info, &ready, ch0, ch1);
+    }
+    return err;
+}
+
+// Compute the Lux value and validity of a result from its raw channels, with the configuration of the result
+static void _make_result(const tsl2561_info_t * tsl2561_info, uint16_t ch0, uint16_t ch1, tsl2561_result_t * result)
+{
+    uint32_t limit = _saturation_limit(tsl2561_info);
+    result->channel0 = ch0;
+    result->channel1 = ch1;
+    result->lux = _compute_lux(CHANNEL_SCALE(tsl2561_info), LUX_COEFFICIENTS(tsl2561_info), ch0, ch1);
+    result->flags = 0;
+    if (ch0 >= limit || ch1 >= limit)
+    {
+        result->flags |= TSL2561_RESULT_SATURATED;
+    }
+    if (ch1 > ch0)
+    {
+        result->flags |= TSL2561_RESULT_UNDERFLOW;
+    }
+}
+
+// Public API
+
+#ifndef CONFIG_TSL2561_DISABLE_MALLOC
+tsl2561_info_t * tsl2561_malloc(void)
+{
+    tsl2561_info_t * tsl2561_info = malloc(sizeof(*tsl2561_info));
+    if (tsl2561_info != NULL)
+    {
+        memset(tsl2561_info, 0, sizeof(*tsl2561_info));
+        ESP_LOGD(TAG, "malloc tsl2561_info_t %p", tsl2561_info);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "malloc tsl2561_info_t failed");
+    }
+    return tsl2561_info;
+}
+
+void tsl2561_free(tsl2561_info_t ** tsl2561_info)
+{
+    if (tsl2561_info != NULL && (*tsl2561_info != NULL))
+    {
+        ESP_LOGD(TAG, "free tsl2561_info_t %p", *tsl2561_info);
+        free(*tsl2561_info);
+        *tsl2561_info = NULL;
+    }
+    else
+    {
+        ESP_LOGE(TAG, "free tsl2561_info_t failed");
+    }
+}
+#endif  // CONFIG_TSL2561_DISABLE_MALLOC
+
+// Set every field to its initial state, without communicating with the device
+static void _init_info(tsl2561_info_t * tsl2561_info, smbus_info_t * smbus_info,
+                       SemaphoreHandle_t bus_lock, TickType_t bus_lock_timeout)
+{
+    tsl2561_info->smbus_info = smbus_info;
+    tsl2561_info->powered = false;
+    tsl2561_info->integration_time = DEFAULT_INTEGRATION_TIME;
+    tsl2561_info->gain = DEFAULT_GAIN;
+    tsl2561_info->device_type= TSL2561_DEVICE_TYPE_INVALID;
+    tsl2561_info->channel_scale = _channel_scale(DEFAULT_INTEGRATION_TIME, DEFAULT_GAIN);
+    tsl2561_info->lux_coefficients = _lux_coefficients(TSL2561_DEVICE_TYPE_INVALID);
+    tsl2561_info->measurement_state = TSL2561_MEASUREMENT_IDLE;
+    tsl2561_info->ready_tick = 0;
+    tsl2561_info->ready_us = 0;
+    tsl2561_info->integration_start_us = 0;
+    tsl2561_info->result_start_us = 0;
+    tsl2561_info->result_end_us = 0;
+    tsl2561_info->block_read = true;
+    tsl2561_info->block_write = true;
+    tsl2561_info->interrupt_task = NULL;
+    tsl2561_info->auto_range = false;
+    tsl2561_info->auto_range_steps = 0;
+    tsl2561_info->manual_exposure_us = 0;
+    tsl2561_info->bus_lock = bus_lock;
+    tsl2561_info->bus_lock_timeout = bus_lock_timeout;
+    tsl2561_info->retries = DEFAULT_RETRIES;
+    tsl2561_info->retry_backoff_us = DEFAULT_RETRY_BACKOFF_US;
+#ifdef CONFIG_TSL2561_STATS
+    memset(&tsl2561_info->stats, 0, sizeof(tsl2561_info->stats));
+    tsl2561_info->stats.latency_min_us = UINT32_MAX;
+#endif
+    memset(tsl2561_info->shadow, 0, sizeof(tsl2561_info->shadow));
+    tsl2561_info->shadow_valid = 0;
+    tsl2561_info->config_open = false;
+    tsl2561_info->config_dirty = 0;
+}
+
+esp_err_t tsl2561_init(tsl2561_info_t * tsl2561_info, smbus_info_t * smbus_info)
+{
+    return tsl2561_init_locked(tsl2561_info, smbus_info, NULL, portMAX_DELAY);
+}
+
+esp_err_t tsl2561_init_locked(tsl2561_info_t * tsl2561_info, smbus_info_t * smbus_info,
+                              SemaphoreHandle_t bus_lock, TickType_t timeout)
+{
+    esp_err_t err = ESP_FAIL;
+    if (tsl2561_info != NULL)
+    {
+        _init_info(tsl2561_info, smbus_info, bus_lock, timeout);
+        tsl2561_info->init = true;
+
+        // read the ID register and confirm that it is as expected for this device
+        tsl2561_device_type_t device_type = TSL2561_DEVICE_TYPE_INVALID;
+        tsl2561_revision_t revision = 0;
+        err = tsl2561_device_id(tsl2561_info, &device_type, &revision);
+        if (err == ESP_OK)
+        {
+            ESP_LOGI(TAG, "Detected device ID 0x%02x, revision %d on I2C address 0x%02x", device_type, revision, smbus_info->address);
+            if (_check_device_id(device_type))
+            {
+                tsl2561_info->device_type = device_type;
+                tsl2561_info->lux_coefficients = _lux_coefficients(device_type);
+                if (tsl2561_info->lux_coefficients != LUX_COEFFICIENTS(tsl2561_info))
+                {
+                    ESP_LOGW(TAG, "Detected device package differs from configured package");
+                }
+
+                // the device may have been configured before a processor reset
+                err = tsl2561_resync(tsl2561_info);
+            }
+            else
+            {
+                ESP_LOGE(TAG, "Unsupported device detected");
+            }
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "tsl2561_info is NULL");
+        err = ESP_FAIL;
+    }
+    return err;
+}
+
+esp_err_t tsl2561_init_detached(tsl2561_info_t * tsl2561_info, tsl2561_device_type_t device_type,
+                                tsl2561_integration_time_t integration_time, tsl2561_gain_t gain)
+{
+    esp_err_t err = ESP_FAIL;
+    if (tsl2561_info != NULL)
+    {
+        if (!_check_device_id(device_type))
+        {
+            ESP_LOGE(TAG, "Unsupported device type: %d", device_type);
+            err = ESP_ERR_INVALID_ARG;
+        }
+        else if (integration_time == TSL2561_INTEGRATION_TIME_MANUAL || !_range_supported(integration_time, gain))
+        {
+            ESP_LOGE(TAG, "Unsupported integration time and gain: %d, %d", integration_time, gain);
+            err = ESP_ERR_NOT_SUPPORTED;
+        }
+        else
+        {
+            _init_info(tsl2561_info, NULL, NULL, portMAX_DELAY);
+            tsl2561_info->device_type = device_type;
+            tsl2561_info->lux_coefficients = _lux_coefficients(device_type);
+            tsl2561_info->integration_time = integration_time;
+            tsl2561_info->gain = gain;
+            tsl2561_info->channel_scale = _channel_scale(integration_time, gain);
+            tsl2561_info->init = true;
+            err = ESP_OK;
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "tsl2561_info is NULL");
+    }
+    return err;
+}
+
+esp_err_t tsl2561_device_id(const tsl2561_info_t * tsl2561_info, tsl2561_device_type_t * device, tsl2561_revision_t * revision)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info) && device && revision)
+    {
+        // bus access modifies only the bus lock statistics
+        uint8_t id = 0;
+        err = _read_byte((tsl2561_info_t *)tsl2561_info, REG_ID | SMB_COMMAND, &id);
+        if (err == ESP_OK)
+        {
+            *device = (tsl2561_device_type_t)((id >> 4) & 0x0f);
+            *revision = (tsl2561_revision_t)(id & 0x0f);
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Failed to read device ID");
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_read(tsl2561_info_t * tsl2561_info, tsl2561_visible_t * visible, tsl2561_infrared_t * infrared)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info) && visible && infrared)
+    {
+        uint16_t ch0 = 0;
+        uint16_t ch1 = 0;
+        if ((err = _read(tsl2561_info, &ch0, &ch1)) == ESP_OK)
+        {
+            *visible = ch0 - ch1;
+            *infrared = ch1;
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_read_result(tsl2561_info_t * tsl2561_info, tsl2561_result_t * result)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info) && result)
+    {
+        uint16_t ch0 = 0;
+        uint16_t ch1 = 0;
+        if ((err = _read(tsl2561_info, &ch0, &ch1)) == ESP_OK)
+        {
+            _make_result(tsl2561_info, ch0, ch1, result);
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_read_periodic(tsl2561_info_t * tsl2561_info, TickType_t * previous_wake_time, TickType_t period,
+                                tsl2561_visible_t * visible, tsl2561_infrared_t * infrared)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info) && previous_wake_time && visible && infrared)
+    {
+        if (tsl2561_info->measurement_state == TSL2561_MEASUREMENT_CONTINUOUS)
+        {
+            ESP_LOGE(TAG, "Periodic measurement is not supported with continuous acquisition");
+            err = ESP_ERR_INVALID_STATE;
+        }
+        else
+        {
+            vTaskDelayUntil(previous_wake_time, period);
+            err = tsl2561_read(tsl2561_info, visible, infrared);
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_get_result_timestamps(const tsl2561_info_t * tsl2561_info, int64_t * start_us, int64_t * end_us)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info) && start_us && end_us)
+    {
+        *start_us = tsl2561_info->result_start_us;
+        *end_us = tsl2561_info->result_end_us;
+        err = ESP_OK;
+    }
+    return err;
+}
+
+esp_err_t tsl2561_start_measurement(tsl2561_info_t * tsl2561_info)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+        if (tsl2561_info->config_open)
+        {
+            ESP_LOGE(TAG, "Configuration transaction in progress");
+            err = ESP_ERR_INVALID_STATE;
+        }
+        else if (tsl2561_info->measurement_state == TSL2561_MEASUREMENT_IDLE)
+        {
+            if ((err = _power_up(tsl2561_info)) == ESP_OK)
+            {
+                if (tsl2561_info->integration_time == TSL2561_INTEGRATION_TIME_MANUAL)
+                {
+                    err = _start_manual_integration(tsl2561_info);
+                }
+                else
+                {
+                    _begin_integration(tsl2561_info);
+                }
+
+                if (err == ESP_OK)
+                {
+                    tsl2561_info->measurement_state = TSL2561_MEASUREMENT_INTEGRATING;
+                }
+            }
+
+            if (err != ESP_OK)
+            {
+                _abort_measurement(tsl2561_info);
+            }
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Measurement already in progress");
+            err = ESP_ERR_INVALID_STATE;
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_start_continuous(tsl2561_info_t * tsl2561_info)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+        if (tsl2561_info->integration_time == TSL2561_INTEGRATION_TIME_MANUAL)
+        {
+            ESP_LOGE(TAG, "Continuous acquisition is not supported with manual integration");
+            err = ESP_ERR_NOT_SUPPORTED;
+        }
+        else if (tsl2561_info->config_open)
+        {
+            ESP_LOGE(TAG, "Configuration transaction in progress");
+            err = ESP_ERR_INVALID_STATE;
+        }
+        else if (tsl2561_info->measurement_state == TSL2561_MEASUREMENT_IDLE)
+        {
+            if ((err = _power_up(tsl2561_info)) == ESP_OK)
+            {
+                _begin_integration(tsl2561_info);
+                tsl2561_info->measurement_state = TSL2561_MEASUREMENT_CONTINUOUS;
+            }
+            else
+            {
+                _abort_measurement(tsl2561_info);
+            }
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Measurement already in progress");
+            err = ESP_ERR_INVALID_STATE;
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_stop_measurement(tsl2561_info_t * tsl2561_info)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+        if (tsl2561_info->config_open)
+        {
+            // the power down would be staged, leaving the device powered
+            ESP_LOGE(TAG, "Configuration transaction in progress");
+            err = ESP_ERR_INVALID_STATE;
+        }
+        else if ((err = _power_down(tsl2561_info)) == ESP_OK)
+        {
+            tsl2561_info->measurement_state = TSL2561_MEASUREMENT_IDLE;
+        }
+    }
+    return err;
+}
+
+TickType_t tsl2561_get_ready_tick(const tsl2561_info_t * tsl2561_info)
+{
+    TickType_t ready_tick = 0;
+    if (_is_init(tsl2561_info) && tsl2561_info->measurement_state != TSL2561_MEASUREMENT_IDLE)
+    {
+        ready_tick = tsl2561_info->ready_tick;
+    }
+    return ready_tick;
+}
+
+esp_err_t tsl2561_poll_result(tsl2561_info_t * tsl2561_info, bool * ready, tsl2561_visible_t * visible, tsl2561_infrared_t * infrared)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info) && ready && visible && infrared)
+    {
+        uint16_t ch0 = 0;
+        uint16_t ch1 = 0;
+        if ((err = _poll(tsl2561_info, ready, &ch0, &ch1)) == ESP_OK && *ready)
+        {
+            *visible = ch0 - ch1;
+            *infrared = ch1;
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_poll_result_full(tsl2561_info_t * tsl2561_info, tsl2561_result_t * result)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info) && result)
+    {
+        bool ready = false;
+        uint16_t ch0 = 0;
+        uint16_t ch1 = 0;
+        if ((err = _poll(tsl2561_info, &ready, &ch0, &ch1)) == ESP_OK)
+        {
+            if (ready)
+            {
+                _make_result(tsl2561_info, ch0, ch1, result);
+            }
+            else
+            {
+                memset(result, 0, sizeof(*result));
+                result->flags = TSL2561_RESULT_NOT_READY;
+            }
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_set_integration_time_and_gain(tsl2561_info_t * tsl2561_info, tsl2561_integration_time_t integration_time, tsl2561_gain_t gain)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+        if (!_range_supported(integration_time, gain))
+        {
+            ESP_LOGE(TAG, "Integration time and gain are fixed by configuration");
+            err = ESP_ERR_NOT_SUPPORTED;
+        }
+        else if (!tsl2561_info->config_open && _register_matches(tsl2561_info, REG_TIMING, integration_time | gain))
+        {
+            // already configured; within a transaction the change must still be staged, to supersede any earlier one
+            err = ESP_OK;
+        }
+        else if (tsl2561_info->measurement_state == TSL2561_MEASUREMENT_CONTINUOUS && integration_time == TSL2561_INTEGRATION_TIME_MANUAL)
+        {
+            ESP_LOGE(TAG, "Continuous acquisition is not supported with manual integration");
+            err = ESP_ERR_NOT_SUPPORTED;
+        }
+        else if (tsl2561_info->measurement_state == TSL2561_MEASUREMENT_CONTINUOUS)
+        {
+            // restart integration so that the next result is entirely from the new settings
+            if ((err = _set_integration_time_and_gain(tsl2561_info, integration_time, gain)) == ESP_OK)
+            {
+                err = _restart_integration(tsl2561_info);
+            }
+        }
+        else if (tsl2561_info->measurement_state != TSL2561_MEASUREMENT_IDLE)
+        {
+            ESP_LOGE(TAG, "Cannot change integration time or gain during a measurement");
+            err = ESP_ERR_INVALID_STATE;
+        }
+        else if (tsl2561_info->config_open)
+        {
+            // the device is powered for the write by tsl2561_config_commit()
+            err = _set_integration_time_and_gain(tsl2561_info, integration_time, gain);
+        }
+        else if ((err = _power_up(tsl2561_info)) == ESP_OK)
+        {
+            if ((err = _set_integration_time_and_gain(tsl2561_info, integration_time, gain)) == ESP_OK)
+            {
+                tsl2561_info->integration_time = integration_time;
+                tsl2561_info->gain = gain;
+            }
+
+            esp_err_t pderr = _power_down(tsl2561_info);
+            err = pderr != ESP_OK ? pderr : err;
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_set_manual_integration(tsl2561_info_t * tsl2561_info, uint32_t exposure_us, tsl2561_gain_t gain)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+        if (exposure_us == 0)
+        {
+            ESP_LOGE(TAG, "Invalid manual exposure: %u us", exposure_us);
+            err = ESP_ERR_INVALID_ARG;
+        }
+        else if (tsl2561_info->measurement_state != TSL2561_MEASUREMENT_IDLE)
+        {
+            ESP_LOGE(TAG, "Cannot change integration time or gain during a measurement");
+            err = ESP_ERR_INVALID_STATE;
+        }
+        else
+        {
+            uint32_t previous = tsl2561_info->manual_exposure_us;
+            tsl2561_info->manual_exposure_us = exposure_us;
+            if ((err = tsl2561_set_integration_time_and_gain(tsl2561_info, TSL2561_INTEGRATION_TIME_MANUAL, gain)) == ESP_OK)
+            {
+                // nominal scale until the first exposure is measured
+                tsl2561_info->channel_scale = _manual_channel_scale(exposure_us, gain);
+            }
+            else if (tsl2561_info->integration_time != TSL2561_INTEGRATION_TIME_MANUAL || tsl2561_info->gain != gain)
+            {
+                // the TIMING write failed, so the previous settings, including the exposure, remain in effect
+                tsl2561_info->manual_exposure_us = previous;
+            }
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_resync(tsl2561_info_t * tsl2561_info)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+        tsl2561_info->shadow_valid = 0;
+
+        uint8_t control = 0;
+        uint8_t timing = 0;
+        uint8_t interrupt = 0;
+        uint16_t low = 0;
+        uint16_t high = 0;
+        if ((err = _read_byte(tsl2561_info, REG_CONTROL | SMB_COMMAND, &control)) == ESP_OK
+            && (err = _read_byte(tsl2561_info, REG_TIMING | SMB_COMMAND, &timing)) == ESP_OK
+            && (err = _read_byte(tsl2561_info, REG_INTERRUPT | SMB_COMMAND, &interrupt)) == ESP_OK
+            && (err = _read_word(tsl2561_info, REG_THRESHLOWLOW | SMB_COMMAND | SMB_WORD, &low)) == ESP_OK
+            && (err = _read_word(tsl2561_info, REG_THRESHHIGHLOW | SMB_COMMAND | SMB_WORD, &high)) == ESP_OK)
+        {
+            // only the power bits of CONTROL are significant
+            control &= TSL2561_CONTROL_POWER_UP;
+            _register_update(tsl2561_info, REG_CONTROL, control);
+            _register_update(tsl2561_info, REG_TIMING, timing);
+            _register_update(tsl2561_info, REG_INTERRUPT, interrupt);
+            _register_update(tsl2561_info, REG_THRESHLOWLOW, low & 0xff);
+            _register_update(tsl2561_info, REG_THRESHLOWHIGH, low >> 8);
+            _register_update(tsl2561_info, REG_THRESHHIGHLOW, high & 0xff);
+            _register_update(tsl2561_info, REG_THRESHHIGHHIGH, high >> 8);
+
+            tsl2561_info->powered = control == TSL2561_CONTROL_POWER_UP;
+            tsl2561_info->integration_time = (tsl2561_integration_time_t)(timing & TSL2561_TIMING_INTEG_MASK);
+            tsl2561_info->gain = (tsl2561_gain_t)(timing & TSL2561_TIMING_GAIN_MASK);
+            tsl2561_info->channel_scale = tsl2561_info->integration_time == TSL2561_INTEGRATION_TIME_MANUAL
+                                          ? _manual_channel_scale(tsl2561_info->manual_exposure_us, tsl2561_info->gain)
+                                          : _channel_scale(tsl2561_info->integration_time, tsl2561_info->gain);
+
+            if (!tsl2561_info->powered && tsl2561_info->measurement_state != TSL2561_MEASUREMENT_IDLE)
+            {
+                ESP_LOGW(TAG, "Device lost power, measurement abandoned");
+                tsl2561_info->measurement_state = TSL2561_MEASUREMENT_IDLE;
+            }
+
+#ifdef CONFIG_TSL2561_FIXED_RANGE
+            // the Lux calculation assumes the configured range, so restore it if the device holds another
+            if (!_range_supported(tsl2561_info->integration_time, tsl2561_info->gain))
+            {
+                ESP_LOGW(TAG, "Device range differs from configured range, restoring");
+                err = tsl2561_set_integration_time_and_gain(tsl2561_info, FIXED_INTEGRATION_TIME, FIXED_GAIN);
+            }
+#endif
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Failed to read device state");
+        }
+    }
+    return err;
+}
+
+// Return the driver state to that before the configuration transaction, discarding its changes
+static void _config_rollback(tsl2561_info_t * tsl2561_info)
+{
+    tsl2561_info->integration_time = tsl2561_info->config_saved.integration_time;
+    tsl2561_info->gain = tsl2561_info->config_saved.gain;
+    tsl2561_info->channel_scale = tsl2561_info->config_saved.channel_scale;
+    tsl2561_info->manual_exposure_us = tsl2561_info->config_saved.manual_exposure_us;
+    tsl2561_info->interrupt_task = tsl2561_info->config_saved.interrupt_task;
+}
+
+esp_err_t tsl2561_config_begin(tsl2561_info_t * tsl2561_info)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+        if (tsl2561_info->config_open)
+        {
+            ESP_LOGE(TAG, "Configuration transaction already in progress");
+            err = ESP_ERR_INVALID_STATE;
+        }
+        else if (tsl2561_info->measurement_state != TSL2561_MEASUREMENT_IDLE)
+        {
+            ESP_LOGE(TAG, "Cannot begin a configuration transaction during a measurement");
+            err = ESP_ERR_INVALID_STATE;
+        }
+        else
+        {
+            tsl2561_info->config_saved.integration_time = tsl2561_info->integration_time;
+            tsl2561_info->config_saved.gain = tsl2561_info->gain;
+            tsl2561_info->config_saved.channel_scale = tsl2561_info->channel_scale;
+            tsl2561_info->config_saved.manual_exposure_us = tsl2561_info->manual_exposure_us;
+            tsl2561_info->config_saved.interrupt_task = tsl2561_info->interrupt_task;
+            tsl2561_info->config_dirty = 0;
+            tsl2561_info->config_open = true;
+            err = ESP_OK;
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_config_commit(tsl2561_info_t * tsl2561_info)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+        if (tsl2561_info->config_open)
+        {
+            tsl2561_info->config_open = false;
+
+            // registers to write are those staged with a value the device is not known to hold
+            uint8_t values[TSL2561_NUM_CONFIG_REGISTERS];
+            uint8_t dirty = 0;
+            for (uint8_t reg = 0; reg < TSL2561_NUM_CONFIG_REGISTERS; ++reg)
+            {
+                values[reg] = tsl2561_info->shadow[reg];
+                if (tsl2561_info->config_dirty & (1 << reg))
+                {
+                    values[reg] = tsl2561_info->config_pending[reg];
+                    dirty |= _register_matches(tsl2561_info, reg, values[reg]) ? 0 : 1 << reg;
+                }
+            }
+
+            // TIMING is only written while powered, so power up within the same transaction
+            bool power_cycle = (dirty & (1 << REG_TIMING)) && !tsl2561_info->powered;
+            if (power_cycle)
+            {
+                values[REG_CONTROL] = TSL2561_CONTROL_POWER_UP;
+                dirty |= 1 << REG_CONTROL;
+            }
+
+            // write each run of changed registers in one transaction, bridging unchanged registers with known values
+            err = ESP_OK;
+            uint8_t reg = 0;
+            while (err == ESP_OK && (dirty >> reg) != 0)
+            {
+                if (dirty & (1 << reg))
+                {
+                    uint8_t end = reg + 1;
+                    while ((dirty >> end) != 0 && ((dirty | tsl2561_info->shadow_valid) & (1 << end)))
+                    {
+                        ++end;
+                    }
+                    err = _write_register_run(tsl2561_info, reg, &values[reg], end - reg, dirty >> reg);
+                    reg = end;
+                }
+                else
+                {
+                    ++reg;
+                }
+            }
+
+            if (power_cycle)
+            {
+                // the device may have been powered up even if the transaction failed
+                tsl2561_info->powered = true;
+                esp_err_t pderr = _power_down(tsl2561_info);
+                err = err == ESP_OK ? pderr : err;
+            }
+
+            if (err != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Failed to apply configuration transaction");
+                _config_rollback(tsl2561_info);
+            }
+            tsl2561_info->config_dirty = 0;
+        }
+        else
+        {
+            ESP_LOGE(TAG, "No configuration transaction in progress");
+            err = ESP_ERR_INVALID_STATE;
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_config_abort(tsl2561_info_t * tsl2561_info)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+        if (tsl2561_info->config_open)
+        {
+            _config_rollback(tsl2561_info);
+            tsl2561_info->config_open = false;
+            tsl2561_info->config_dirty = 0;
+            err = ESP_OK;
+        }
+        else
+        {
+            ESP_LOGE(TAG, "No configuration transaction in progress");
+            err = ESP_ERR_INVALID_STATE;
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_set_retries(tsl2561_info_t * tsl2561_info, uint8_t retries, uint32_t backoff_us)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+        if (retries <= TSL2561_RETRIES_MAX)
+        {
+            tsl2561_info->retries = retries;
+            tsl2561_info->retry_backoff_us = backoff_us;
+            err = ESP_OK;
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Invalid number of retries: %d", retries);
+            err = ESP_ERR_INVALID_ARG;
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_set_block_read(tsl2561_info_t * tsl2561_info, bool enable)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+        tsl2561_info->block_read = enable;
+        tsl2561_info->block_write = enable;
+        err = ESP_OK;
+    }
+    return err;
+}
+
+esp_err_t tsl2561_set_bus_lock(tsl2561_info_t * tsl2561_info, SemaphoreHandle_t bus_lock, TickType_t timeout)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+        tsl2561_info->bus_lock = bus_lock;
+        tsl2561_info->bus_lock_timeout = timeout;
+        err = ESP_OK;
+    }
+    return err;
+}
+
+esp_err_t tsl2561_get_stats(const tsl2561_info_t * tsl2561_info, tsl2561_stats_t * stats)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info) && stats)
+    {
+#ifdef CONFIG_TSL2561_STATS
+        *stats = tsl2561_info->stats;
+        stats->latency_avg_us = stats->results ? (uint32_t)(stats->latency_total_us / stats->results) : 0;
+        err = ESP_OK;
+#else
+        err = ESP_ERR_NOT_SUPPORTED;
+#endif
+    }
+    return err;
+}
+
+esp_err_t tsl2561_reset_stats(tsl2561_info_t * tsl2561_info)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+#ifdef CONFIG_TSL2561_STATS
+        memset(&tsl2561_info->stats, 0, sizeof(tsl2561_info->stats));
+        tsl2561_info->stats.latency_min_us = UINT32_MAX;
+        err = ESP_OK;
+#else
+        err = ESP_ERR_NOT_SUPPORTED;
+#endif
+    }
+    return err;
+}
+
+esp_err_t tsl2561_set_auto_range(tsl2561_info_t * tsl2561_info, bool enable)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+        err = ESP_OK;
+        // auto-ranging needs every range, so is unavailable if the range is fixed
+        if (enable && (!_range_supported(RANGES[0].integration_time, RANGES[0].gain)
+                       || !_range_supported(RANGES[NUM_RANGES - 1].integration_time, RANGES[NUM_RANGES - 1].gain)))
+        {
+            ESP_LOGE(TAG, "Integration time and gain are fixed by configuration");
+            err = ESP_ERR_NOT_SUPPORTED;
+        }
+        else if (enable && !tsl2561_info->auto_range)
+        {
+            // range is unknown, so start with the cheapest probe
+            err = tsl2561_set_integration_time_and_gain(tsl2561_info, RANGES[0].integration_time, RANGES[0].gain);
+        }
+
+        if (err == ESP_OK)
+        {
+            tsl2561_info->auto_range = enable;
+            tsl2561_info->auto_range_steps = 0;
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_set_thresholds(tsl2561_info_t * tsl2561_info, uint16_t low, uint16_t high)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+        if (low <= high)
+        {
+            if ((err = _write_register_word(tsl2561_info, REG_THRESHLOWLOW, low)) == ESP_OK)
+            {
+                err = _write_register_word(tsl2561_info, REG_THRESHHIGHLOW, high);
+            }
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Low threshold %d exceeds high threshold %d", low, high);
+            err = ESP_ERR_INVALID_ARG;
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_set_interrupt(tsl2561_info_t * tsl2561_info, tsl2561_interrupt_mode_t mode, uint8_t persistence)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+        if (persistence <= TSL2561_INTERRUPT_PERSISTENCE_MAX)
+        {
+            // register the task before the interrupt can be asserted
+            tsl2561_info->interrupt_task = mode != TSL2561_INTERRUPT_DISABLED ? xTaskGetCurrentTaskHandle() : NULL;
+            if ((err = _write_register(tsl2561_info, REG_INTERRUPT, mode | (persistence & TSL2561_INTERRUPT_PERSIST_MASK))) != ESP_OK)
+            {
+                tsl2561_info->interrupt_task = NULL;
+            }
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Invalid interrupt persistence: %d", persistence);
+            err = ESP_ERR_INVALID_ARG;
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_clear_interrupt(tsl2561_info_t * tsl2561_info)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+        err = _send_byte(tsl2561_info, REG_INTERRUPT | SMB_COMMAND | SMB_CLEAR);
+    }
+    return err;
+}
+
+void IRAM_ATTR tsl2561_interrupt_isr(void * arg)
+{
+    // no logging or bus access permitted here
+    tsl2561_info_t * tsl2561_info = (tsl2561_info_t *)arg;
+    if (tsl2561_info != NULL && tsl2561_info->interrupt_task != NULL)
+    {
+        BaseType_t task_woken = pdFALSE;
+        vTaskNotifyGiveFromISR(tsl2561_info->interrupt_task, &task_woken);
+        if (task_woken == pdTRUE)
+        {
+            portYIELD_FROM_ISR();
+        }
+    }
+}
+
+esp_err_t tsl2561_wait_for_interrupt(tsl2561_info_t * tsl2561_info, TickType_t timeout)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info))
+    {
+        err = ulTaskNotifyTake(pdTRUE, timeout) > 0 ? ESP_OK : ESP_ERR_TIMEOUT;
+    }
+    return err;
+}
+
+esp_err_t tsl2561_handle_interrupt(tsl2561_info_t * tsl2561_info, tsl2561_visible_t * visible, tsl2561_infrared_t * infrared)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info) && visible && infrared)
+    {
+        if (tsl2561_info->powered)
+        {
+            uint16_t ch0 = 0;
+            uint16_t ch1 = 0;
+            if ((err = _read_channels(tsl2561_info, &ch0, &ch1)) == ESP_OK)
+            {
+                if ((err = tsl2561_clear_interrupt(tsl2561_info)) == ESP_OK)
+                {
+                    *visible = ch0 - ch1;
+                    *infrared = ch1;
+                }
+            }
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Device not powered");
+            err = ESP_ERR_INVALID_STATE;
+        }
+    }
+    return err;
+}
+
+uint32_t tsl2561_compute_lux(const tsl2561_info_t * tsl2561_info, tsl2561_visible_t visible, tsl2561_infrared_t infrared)
+{
+    uint32_t lux = 0;
+    if (_is_init(tsl2561_info))
+    {
+        // convert visible/infrared back into channel data
+        lux = _compute_lux(CHANNEL_SCALE(tsl2561_info), LUX_COEFFICIENTS(tsl2561_info), (uint32_t)(visible + infrared), infrared);
+    }
+    return lux;
+}
+
+tsl2561_lux_precise_t tsl2561_compute_lux_precise(const tsl2561_info_t * tsl2561_info, tsl2561_visible_t visible, tsl2561_infrared_t infrared)
+{
+    tsl2561_lux_precise_t lux = 0;
+    if (_is_init(tsl2561_info))
+    {
+        uint32_t temp = _compute_lux_scaled(CHANNEL_SCALE(tsl2561_info), LUX_COEFFICIENTS(tsl2561_info), (uint32_t)(visible + infrared), infrared);
+#ifdef CONFIG_TSL2561_LUX_PRECISE_FIXED
+        // convert to Q16.16, saturating above 65535.99998 Lux
+        const int shift = TSL2561_LUX_PRECISE_FRACTION_BITS - LUX_SCALE;
+        lux = temp <= (UINT32_MAX >> shift) ? temp << shift : UINT32_MAX;
+#else
+        lux = (float)temp * (1.0f / (1 << LUX_SCALE));
+#endif
+    }
+    return lux;
+}
+
+esp_err_t tsl2561_compute_lux_batch(const tsl2561_info_t * tsl2561_info, const tsl2561_visible_t * __restrict visible,
+                                    const tsl2561_infrared_t * __restrict infrared, uint32_t * __restrict lux, size_t count)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(tsl2561_info) && (count == 0 || (visible && infrared && lux)))
+    {
+        // Hoist configuration out of the loop, and keep the loop free of branches and division so
+        // that it vectorizes. The rounded ratio exceeds breakpoint k exactly when
+        // (channel1 << 10) / channel0 >= 2k + 1, that is when (channel1 << 10) >= (2k + 1) * channel0.
+        // That product fits in 32 bits only for channel0 up to a limit, above which the comparison
+        // is false; a zero channel0 wraps above every limit, so it selects the first segment.
+        const uint32_t scale = CHANNEL_SCALE(tsl2561_info);
+        const struct tsl2561_lux_coefficients * coefficients = LUX_COEFFICIENTS(tsl2561_info);
+        uint32_t threshold[LUX_SEGMENTS - 1];
+        uint32_t limit[LUX_SEGMENTS - 1];
+        uint32_t b[LUX_SEGMENTS];
+        uint32_t m[LUX_SEGMENTS];
+        for (size_t j = 0; j < LUX_SEGMENTS - 1; ++j)
+        {
+            threshold[j] = 2 * coefficients->k[j] + 1;
+            limit[j] = UINT32_MAX / threshold[j];
+        }
+        memcpy(b, coefficients->b, sizeof(b));
+        memcpy(m, coefficients->m, sizeof(m));
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            uint32_t channel0 = ((uint32_t)(visible[i] + infrared[i]) * scale) >> CH_SCALE;
+            uint32_t channel1 = ((uint32_t)infrared[i] * scale) >> CH_SCALE;
+            uint32_t numerator = channel1 << (RATIO_SCALE + 1);
+
+            // the segment is the number of breakpoints the ratio exceeds, which indexes the local tables
+            uint32_t segment = 0;
+            for (size_t j = 0; j < LUX_SEGMENTS - 1; ++j)
+            {
+                segment += (channel0 - 1 < limit[j]) & (numerator >= threshold[j] * channel0);
+            }
+            uint32_t bs = b[segment];
+            uint32_t ms = m[segment];
+
+            uint32_t positive = channel0 * bs;
+            uint32_t negative = channel1 * ms;
+            uint32_t temp = positive > negative ? positive - negative : 0;
+            lux[i] = (temp + (1 << (LUX_SCALE - 1))) >> LUX_SCALE;
+        }
+        err = ESP_OK;
+    }
+    return err;
 }
@@ -0,0 +1,253 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file tsl2561_acquisition.c
+ *
+ * The ring buffer uses a sequence lock per slot. The producer marks a slot odd while writing it,
+ * then publishes the slot's sequence number and the head count with release semantics.
+ * A consumer copies a slot and accepts it only if the slot's sequence number identifies the
+ * expected sample both before and after the copy, so consumers never block the producer.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_log.h"
+
+#include "tsl2561_acquisition.h"
+
+static const char * TAG = "tsl2561_acquisition";
+
+static bool _is_init(const tsl2561_ring_t * ring)
+{
+    bool ok = false;
+    if (ring != NULL)
+    {
+        if (ring->init)
+        {
+            ok = true;
+        }
+        else
+        {
+            ESP_LOGE(TAG, "ring is not initialised");
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "ring is NULL");
+    }
+    return ok;
+}
+
+// Sequence number of a slot once the Nth sample (counting from zero) has been written to it
+static inline uint32_t _sequence(uint32_t n)
+{
+    return (n << 1) + 2;
+}
+
+// Copy the Nth sample from the ring, returning false if it is not present or was overwritten during the copy
+static bool _copy_sample(const tsl2561_ring_t * ring, uint32_t n, tsl2561_sample_t * sample)
+{
+    const tsl2561_ring_slot_t * slot = &ring->slots[n & (ring->capacity - 1)];
+    bool ok = false;
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) == _sequence(n))
+    {
+        memcpy(sample, &slot->sample, sizeof(*sample));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        ok = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == _sequence(n);
+    }
+    return ok;
+}
+
+// Public API
+
+esp_err_t tsl2561_ring_init(tsl2561_ring_t * ring, tsl2561_ring_slot_t * slots, uint32_t capacity)
+{
+    esp_err_t err = ESP_FAIL;
+    if (ring != NULL && slots != NULL)
+    {
+        if (capacity > 0 && (capacity & (capacity - 1)) == 0)
+        {
+            memset(slots, 0, capacity * sizeof(*slots));
+            ring->slots = slots;
+            ring->capacity = capacity;
+            ring->head = 0;
+            ring->init = true;
+            err = ESP_OK;
+        }
+        else
+        {
+            ESP_LOGE(TAG, "ring capacity %u is not a power of two", capacity);
+            err = ESP_ERR_INVALID_ARG;
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "ring or slots is NULL");
+    }
+    return err;
+}
+
+esp_err_t tsl2561_ring_publish(tsl2561_ring_t * ring, const tsl2561_sample_t * sample)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(ring) && sample)
+    {
+        uint32_t n = ring->head;
+        tsl2561_ring_slot_t * slot = &ring->slots[n & (ring->capacity - 1)];
+
+        // mark slot as being written before modifying the sample
+        __atomic_store_n(&slot->sequence, _sequence(n) - 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(&slot->sample, sample, sizeof(slot->sample));
+        __atomic_store_n(&slot->sequence, _sequence(n), __ATOMIC_RELEASE);
+        __atomic_store_n(&ring->head, n + 1, __ATOMIC_RELEASE);
+        err = ESP_OK;
+    }
+    return err;
+}
+
+esp_err_t tsl2561_ring_latest(const tsl2561_ring_t * ring, tsl2561_sample_t * sample)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(ring) && sample)
+    {
+        err = ESP_ERR_NOT_FOUND;
+        uint32_t previous = 0;
+        uint32_t head = 0;
+        while ((head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) != previous)
+        {
+            // retry if the producer published a newer sample during the copy
+            if (_copy_sample(ring, head - 1, sample))
+            {
+                err = ESP_OK;
+                break;
+            }
+            previous = head;
+        }
+    }
+    return err;
+}
+
+uint32_t tsl2561_ring_cursor(const tsl2561_ring_t * ring)
+{
+    uint32_t cursor = 0;
+    if (_is_init(ring))
+    {
+        cursor = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    }
+    return cursor;
+}
+
+esp_err_t tsl2561_ring_read(const tsl2561_ring_t * ring, uint32_t * cursor, tsl2561_sample_t * sample, uint32_t * lost)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(ring) && cursor && sample)
+    {
+        uint32_t skipped = 0;
+        err = ESP_ERR_NOT_FOUND;
+        uint32_t head = 0;
+        while ((head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) != *cursor)
+        {
+            // skip samples that have already been overwritten
+            if (head - *cursor > ring->capacity)
+            {
+                skipped += head - ring->capacity - *cursor;
+                *cursor = head - ring->capacity;
+            }
+
+            if (_copy_sample(ring, *cursor, sample))
+            {
+                ++*cursor;
+                err = ESP_OK;
+                break;
+            }
+
+            // being overwritten, or overwritten during the copy: rather than wait for the producer, count it as lost
+            ++skipped;
+            ++*cursor;
+        }
+
+        if (lost != NULL)
+        {
+            *lost = skipped;
+        }
+    }
+    return err;
+}
+
+void tsl2561_acquisition_task(void * arg)
+{
+    tsl2561_acquisition_t * acquisition = (tsl2561_acquisition_t *)arg;
+    tsl2561_info_t * tsl2561_info = acquisition->tsl2561_info;
+
+    if (acquisition->period == 0)
+    {
+        if (tsl2561_start_continuous(tsl2561_info) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to start continuous acquisition");
+        }
+    }
+
+    TickType_t last_wake_time = xTaskGetTickCount();
+    while (!acquisition->stop)
+    {
+        tsl2561_sample_t sample = { 0 };
+        esp_err_t err = ESP_FAIL;
+        if (acquisition->period > 0)
+        {
+            err = tsl2561_read_periodic(tsl2561_info, &last_wake_time, acquisition->period, &sample.visible, &sample.infrared);
+        }
+        else
+        {
+            err = tsl2561_read(tsl2561_info, &sample.visible, &sample.infrared);
+        }
+
+        if (err == ESP_OK)
+        {
+            sample.timestamp = xTaskGetTickCount();
+            tsl2561_get_result_timestamps(tsl2561_info, &sample.integration_start_us, &sample.integration_end_us);
+            sample.lux = tsl2561_compute_lux(tsl2561_info, sample.visible, sample.infrared);
+            sample.gain = tsl2561_info->gain;
+            sample.integration_time = tsl2561_info->integration_time;
+            tsl2561_ring_publish(acquisition->ring, &sample);
+        }
+        else
+        {
+            ESP_LOGE(TAG, "Failed to read device: %d", err);
+            if (acquisition->period == 0)
+            {
+                // avoid spinning on a persistent error
+                vTaskDelay(1);
+            }
+        }
+    }
+
+    tsl2561_stop_measurement(tsl2561_info);
+    vTaskDelete(NULL);
+}
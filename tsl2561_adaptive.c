@@ -0,0 +1,220 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file tsl2561_adaptive.c
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_log.h"
+
+#include "tsl2561_adaptive.h"
+
+#define LUX_FLOOR 10  // Changes are relative to at least this many Lux, so that noise in the dark is not a step
+
+// Channel counts at 13 ms for each fixed integration time, per 322 counts
+static const uint32_t FAST_COUNTS[] = { 322, 322 * 11 / 81, 11 };
+
+static const char * TAG = "tsl2561_adaptive";
+
+static bool _is_init(const tsl2561_adaptive_t * adaptive)
+{
+    bool ok = false;
+    if (adaptive != NULL)
+    {
+        if (adaptive->init)
+        {
+            ok = true;
+        }
+        else
+        {
+            ESP_LOGE(TAG, "adaptive is not initialised");
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "adaptive is NULL");
+    }
+    return ok;
+}
+
+// Adapt the sampling period to the change from the previous sample. Returns true on a step.
+static bool _update(tsl2561_adaptive_t * adaptive, uint32_t lux)
+{
+    bool step = false;
+    if (adaptive->have_previous)
+    {
+        uint32_t previous = adaptive->previous_lux;
+        uint32_t reference = previous > LUX_FLOOR ? previous : LUX_FLOOR;
+        uint64_t difference = lux > previous ? lux - previous : previous - lux;
+        uint64_t change = difference * 1000 / reference;  // relative change over one period, in 1/1000
+
+        if (change >= adaptive->step_permille)
+        {
+            adaptive->period = adaptive->min_period;
+            step = true;
+        }
+        else if (change * 4 < adaptive->step_permille)
+        {
+            // at this rate, twice the period would still change by less than half a step
+            TickType_t period = adaptive->period * 2;
+            adaptive->period = period < adaptive->max_period ? period : adaptive->max_period;
+        }
+        else if (change * 2 > adaptive->step_permille)
+        {
+            TickType_t period = adaptive->period / 2;
+            adaptive->period = period > adaptive->min_period ? period : adaptive->min_period;
+        }
+    }
+    adaptive->previous_lux = lux;
+    adaptive->have_previous = true;
+    return step;
+}
+
+// True if a channel 0 value in the current range would resolve changes of half a step at 13 ms
+static bool _fast_resolves(const tsl2561_adaptive_t * adaptive, const tsl2561_info_t * tsl2561_info, uint32_t channel0)
+{
+    bool resolves = false;
+    if (tsl2561_info->integration_time != TSL2561_INTEGRATION_TIME_MANUAL)
+    {
+        uint32_t counts = channel0 * FAST_COUNTS[tsl2561_info->integration_time] / 322;
+        resolves = (uint64_t)counts * adaptive->step_permille >= 2000;
+    }
+    return resolves;
+}
+
+// Before a sample, return to the fastest range after a step, or restore the configured range once the light settles.
+// Done before rather than after the previous sample, so that the caller computes its Lux in the range it was taken in.
+static esp_err_t _apply_range(tsl2561_adaptive_t * adaptive, tsl2561_info_t * tsl2561_info)
+{
+    esp_err_t err = ESP_OK;
+    if (tsl2561_info->auto_range)
+    {
+        // auto-ranging owns the range, so there is nothing to restore
+        adaptive->fast = false;
+        if (adaptive->restart)
+        {
+            // re-enabling auto-ranging restarts it from the fastest range
+            if ((err = tsl2561_set_auto_range(tsl2561_info, false)) == ESP_OK)
+            {
+                err = tsl2561_set_auto_range(tsl2561_info, true);
+            }
+            adaptive->restart = err != ESP_OK;
+        }
+    }
+#ifndef CONFIG_TSL2561_FIXED_RANGE
+    else if (adaptive->restart && !adaptive->fast && tsl2561_info->integration_time != TSL2561_INTEGRATION_TIME_13MS)
+    {
+        tsl2561_integration_time_t integration_time = tsl2561_info->integration_time;
+        if ((err = tsl2561_set_integration_time_and_gain(tsl2561_info, TSL2561_INTEGRATION_TIME_13MS, tsl2561_info->gain)) == ESP_OK)
+        {
+            adaptive->integration_time = integration_time;
+            adaptive->fast = true;
+        }
+    }
+    else if (!adaptive->restart && adaptive->fast)
+    {
+        if ((err = tsl2561_set_integration_time_and_gain(tsl2561_info, adaptive->integration_time, tsl2561_info->gain)) == ESP_OK)
+        {
+            adaptive->fast = false;
+        }
+    }
+#endif  // CONFIG_TSL2561_FIXED_RANGE
+    return err;
+}
+
+// Public API
+
+esp_err_t tsl2561_adaptive_init(tsl2561_adaptive_t * adaptive, TickType_t min_period, TickType_t max_period, uint32_t step_percent)
+{
+    esp_err_t err = ESP_FAIL;
+    if (adaptive != NULL)
+    {
+        if (min_period == 0 || max_period < min_period || max_period > (portMAX_DELAY >> 1))
+        {
+            ESP_LOGE(TAG, "Invalid sampling period bounds: %u, %u", (unsigned)min_period, (unsigned)max_period);
+            err = ESP_ERR_INVALID_ARG;
+        }
+        else if (step_percent == 0 || step_percent > UINT32_MAX / 1000)
+        {
+            ESP_LOGE(TAG, "Invalid step threshold: %u%%", step_percent);
+            err = ESP_ERR_INVALID_ARG;
+        }
+        else
+        {
+            memset(adaptive, 0, sizeof(*adaptive));
+            adaptive->min_period = min_period;
+            adaptive->max_period = max_period;
+            adaptive->step_permille = step_percent * 1000 / 100;
+            adaptive->period = min_period;
+            adaptive->init = true;
+            err = ESP_OK;
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "adaptive is NULL");
+    }
+    return err;
+}
+
+esp_err_t tsl2561_adaptive_read(tsl2561_adaptive_t * adaptive, tsl2561_info_t * tsl2561_info, TickType_t * previous_wake_time,
+                                tsl2561_visible_t * visible, tsl2561_infrared_t * infrared)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(adaptive) && tsl2561_info != NULL)
+    {
+        if ((err = _apply_range(adaptive, tsl2561_info)) == ESP_OK
+            && (err = tsl2561_read_periodic(tsl2561_info, previous_wake_time, adaptive->period, visible, infrared)) == ESP_OK)
+        {
+            uint32_t previous_lux = adaptive->previous_lux;
+            uint32_t lux = tsl2561_compute_lux(tsl2561_info, *visible, *infrared);
+            bool step = _update(adaptive, lux);
+            if (step)
+            {
+                ESP_LOGD(TAG, "Step from %u to %u Lux", previous_lux, lux);
+            }
+
+            // in a fixed range, the next sample is only taken at 13 ms while steps continue and it can resolve them
+            adaptive->restart = step && (tsl2561_info->auto_range
+                                         || _fast_resolves(adaptive, tsl2561_info, (uint32_t)*visible + *infrared));
+        }
+    }
+    return err;
+}
+
+TickType_t tsl2561_adaptive_get_period(const tsl2561_adaptive_t * adaptive)
+{
+    TickType_t period = 0;
+    if (_is_init(adaptive))
+    {
+        period = adaptive->period;
+    }
+    return period;
+}
@@ -0,0 +1,272 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file tsl2561_filter.c
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "esp_system.h"
+#include "esp_log.h"
+
+#include "tsl2561_filter.h"
+
+#define EMA_SCALE 8  // Scale exponential average by 2^8
+
+static const char * TAG = "tsl2561_filter";
+
+static bool _is_init(const tsl2561_filter_t * filter)
+{
+    bool ok = false;
+    if (filter != NULL)
+    {
+        if (filter->init)
+        {
+            ok = true;
+        }
+        else
+        {
+            ESP_LOGE(TAG, "filter is not initialised");
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "filter is NULL");
+    }
+    return ok;
+}
+
+static void _reset(tsl2561_filter_t * filter)
+{
+    filter->count = 0;
+    filter->index = 0;
+    filter->sum0 = 0;
+    filter->sum1 = 0;
+    filter->ema0 = 0;
+    filter->ema1 = 0;
+}
+
+// Median of count values, leaving the window itself in arrival order
+static uint16_t _median(const uint16_t * values, uint8_t count)
+{
+    uint16_t sorted[TSL2561_FILTER_WINDOW_MAX];
+
+    // insertion sort is cheapest for windows this small
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        uint16_t value = values[i];
+        uint8_t j = i;
+        while (j > 0 && sorted[j - 1] > value)
+        {
+            sorted[j] = sorted[j - 1];
+            --j;
+        }
+        sorted[j] = value;
+    }
+
+    uint8_t mid = count / 2;
+    return count & 1 ? sorted[mid] : (uint16_t)(((uint32_t)sorted[mid - 1] + sorted[mid] + 1) / 2);
+}
+
+// Filter one sample of raw channel data
+static void _filter(tsl2561_filter_t * filter, uint16_t ch0, uint16_t ch1, uint16_t * out0, uint16_t * out1)
+{
+    if (filter->type == TSL2561_FILTER_EXPONENTIAL)
+    {
+        if (filter->count == 0)
+        {
+            filter->ema0 = (int32_t)ch0 << EMA_SCALE;
+            filter->ema1 = (int32_t)ch1 << EMA_SCALE;
+            filter->count = 1;
+        }
+        else
+        {
+            filter->ema0 += (((int32_t)ch0 << EMA_SCALE) - filter->ema0) / filter->window;
+            filter->ema1 += (((int32_t)ch1 << EMA_SCALE) - filter->ema1) / filter->window;
+        }
+        *out0 = (filter->ema0 + (1 << (EMA_SCALE - 1))) >> EMA_SCALE;
+        *out1 = (filter->ema1 + (1 << (EMA_SCALE - 1))) >> EMA_SCALE;
+    }
+    else
+    {
+        // replace the oldest sample in the window
+        if (filter->count == filter->window)
+        {
+            filter->sum0 -= filter->ch0[filter->index];
+            filter->sum1 -= filter->ch1[filter->index];
+        }
+        else
+        {
+            ++filter->count;
+        }
+        filter->ch0[filter->index] = ch0;
+        filter->ch1[filter->index] = ch1;
+        filter->sum0 += ch0;
+        filter->sum1 += ch1;
+        filter->index = filter->index + 1 < filter->window ? filter->index + 1 : 0;
+
+        if (filter->type == TSL2561_FILTER_MEDIAN)
+        {
+            *out0 = _median(filter->ch0, filter->count);
+            *out1 = _median(filter->ch1, filter->count);
+        }
+        else
+        {
+            *out0 = (filter->sum0 + filter->count / 2) / filter->count;
+            *out1 = (filter->sum1 + filter->count / 2) / filter->count;
+        }
+    }
+}
+
+// Public API
+
+#ifndef CONFIG_TSL2561_DISABLE_MALLOC
+tsl2561_filter_t * tsl2561_filter_malloc(void)
+{
+    tsl2561_filter_t * filter = malloc(sizeof(*filter));
+    if (filter != NULL)
+    {
+        memset(filter, 0, sizeof(*filter));
+        ESP_LOGD(TAG, "malloc tsl2561_filter_t %p", filter);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "malloc tsl2561_filter_t failed");
+    }
+    return filter;
+}
+
+void tsl2561_filter_free(tsl2561_filter_t ** filter)
+{
+    if (filter != NULL && (*filter != NULL))
+    {
+        ESP_LOGD(TAG, "free tsl2561_filter_t %p", *filter);
+        free(*filter);
+        *filter = NULL;
+    }
+    else
+    {
+        ESP_LOGE(TAG, "free tsl2561_filter_t failed");
+    }
+}
+#endif  // CONFIG_TSL2561_DISABLE_MALLOC
+
+esp_err_t tsl2561_filter_init(tsl2561_filter_t * filter, tsl2561_filter_type_t type, uint8_t window)
+{
+    esp_err_t err = ESP_FAIL;
+    if (filter != NULL)
+    {
+        if (window < 1 || window > TSL2561_FILTER_WINDOW_MAX)
+        {
+            ESP_LOGE(TAG, "Invalid filter window: %d", window);
+            err = ESP_ERR_INVALID_ARG;
+        }
+        else if (type != TSL2561_FILTER_MOVING_AVERAGE && type != TSL2561_FILTER_EXPONENTIAL && type != TSL2561_FILTER_MEDIAN)
+        {
+            ESP_LOGE(TAG, "Invalid filter type: %d", type);
+            err = ESP_ERR_INVALID_ARG;
+        }
+        else
+        {
+            memset(filter, 0, sizeof(*filter));
+            filter->type = type;
+            filter->window = window;
+            filter->init = true;
+            err = ESP_OK;
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "filter is NULL");
+    }
+    return err;
+}
+
+esp_err_t tsl2561_filter_reset(tsl2561_filter_t * filter)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(filter))
+    {
+        _reset(filter);
+        err = ESP_OK;
+    }
+    return err;
+}
+
+esp_err_t tsl2561_filter_update(tsl2561_filter_t * filter, tsl2561_visible_t visible, tsl2561_infrared_t infrared,
+                                tsl2561_visible_t * filtered_visible, tsl2561_infrared_t * filtered_infrared)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(filter) && filtered_visible != NULL && filtered_infrared != NULL)
+    {
+        // filter the channels themselves, as visible is their difference
+        uint16_t ch0 = 0;
+        uint16_t ch1 = 0;
+        _filter(filter, visible + infrared, infrared, &ch0, &ch1);
+
+        // channels filtered independently by the median may not preserve ch0 >= ch1
+        *filtered_visible = ch0 > ch1 ? ch0 - ch1 : 0;
+        *filtered_infrared = ch1;
+        err = ESP_OK;
+    }
+    return err;
+}
+
+esp_err_t tsl2561_filter_read(tsl2561_filter_t * filter, tsl2561_info_t * tsl2561_info, size_t samples,
+                              tsl2561_visible_t * visible, tsl2561_infrared_t * infrared)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(filter) && tsl2561_info != NULL && visible != NULL && infrared != NULL)
+    {
+        if (samples == 0)
+        {
+            ESP_LOGE(TAG, "Invalid number of samples: %d", (int)samples);
+            err = ESP_ERR_INVALID_ARG;
+        }
+        else
+        {
+            err = ESP_OK;
+            for (size_t i = 0; err == ESP_OK && i < samples; ++i)
+            {
+                tsl2561_visible_t sample_visible = 0;
+                tsl2561_infrared_t sample_infrared = 0;
+                if ((err = tsl2561_read(tsl2561_info, &sample_visible, &sample_infrared)) == ESP_OK)
+                {
+                    // samples taken at different ranges cannot be combined
+                    if (filter->count > 0
+                        && (filter->integration_time != tsl2561_info->integration_time || filter->gain != tsl2561_info->gain))
+                    {
+                        _reset(filter);
+                    }
+                    filter->integration_time = tsl2561_info->integration_time;
+                    filter->gain = tsl2561_info->gain;
+                    err = tsl2561_filter_update(filter, sample_visible, sample_infrared, visible, infrared);
+                }
+            }
+        }
+    }
+    return err;
+}
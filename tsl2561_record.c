@@ -0,0 +1,408 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file tsl2561_record.c
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "esp_system.h"
+#include "esp_log.h"
+
+#include "tsl2561_record.h"
+
+#define RECORD_MAGIC0     'T'
+#define RECORD_MAGIC1     'S'
+#define RECORD_VERSION    1
+
+// Header layout
+#define HEADER_MAGIC0     0
+#define HEADER_MAGIC1     1
+#define HEADER_VERSION    2
+#define HEADER_DEVICE     3
+#define HEADER_TIMING     4
+#define HEADER_LENGTH     5   // block length including header, little-endian, zero until finished
+
+#define TIMING_INTEG_MASK 0x03
+#define TIMING_GAIN_MASK  0x10
+
+static const char * TAG = "tsl2561_record";
+
+static bool _is_init_encoder(const tsl2561_record_encoder_t * encoder)
+{
+    bool ok = false;
+    if (encoder != NULL)
+    {
+        if (encoder->init)
+        {
+            ok = true;
+        }
+        else
+        {
+            ESP_LOGE(TAG, "encoder is not initialised");
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "encoder is NULL");
+    }
+    return ok;
+}
+
+static bool _is_init_decoder(const tsl2561_record_decoder_t * decoder)
+{
+    bool ok = false;
+    if (decoder != NULL)
+    {
+        if (decoder->init)
+        {
+            ok = true;
+        }
+        else
+        {
+            ESP_LOGE(TAG, "decoder is not initialised");
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "decoder is NULL");
+    }
+    return ok;
+}
+
+// Write an unsigned LEB128 varint, returning the number of bytes written
+static size_t _put_varint(uint8_t * data, uint64_t value)
+{
+    size_t length = 0;
+    while (value >= 0x80)
+    {
+        data[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    data[length++] = (uint8_t)value;
+    return length;
+}
+
+// Read an unsigned LEB128 varint, returning false if it runs past the end of the data
+static bool _get_varint(const uint8_t * data, size_t length, size_t * offset, uint64_t * value)
+{
+    uint64_t result = 0;
+    bool complete = false;
+    for (unsigned shift = 0; !complete && *offset < length && shift < 64; shift += 7)
+    {
+        uint8_t byte = data[(*offset)++];
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        complete = !(byte & 0x80);
+    }
+    *value = result;
+    return complete;
+}
+
+// Map signed deltas to unsigned so that small magnitudes encode to few bytes
+static inline uint32_t _zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t _unzigzag(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static esp_err_t _begin_block(tsl2561_record_encoder_t * encoder, uint8_t * block, size_t size)
+{
+    esp_err_t err = ESP_FAIL;
+    if (block == NULL || size < TSL2561_RECORD_HEADER_SIZE || size > TSL2561_RECORD_BLOCK_MAX)
+    {
+        ESP_LOGE(TAG, "Invalid block size: %d", (int)size);
+        err = ESP_ERR_INVALID_ARG;
+    }
+    else
+    {
+        block[HEADER_MAGIC0] = RECORD_MAGIC0;
+        block[HEADER_MAGIC1] = RECORD_MAGIC1;
+        block[HEADER_VERSION] = RECORD_VERSION;
+        block[HEADER_DEVICE] = encoder->device_type;
+        block[HEADER_TIMING] = encoder->timing;
+        block[HEADER_LENGTH] = 0;
+        block[HEADER_LENGTH + 1] = 0;
+
+        // samples in each block are relative to zero, so blocks decode independently
+        encoder->block = block;
+        encoder->size = size;
+        encoder->length = TSL2561_RECORD_HEADER_SIZE;
+        encoder->timestamp_us = 0;
+        encoder->ch0 = 0;
+        encoder->ch1 = 0;
+        err = ESP_OK;
+    }
+    return err;
+}
+
+// Decode the next sample into the decoder state
+static esp_err_t _decode(tsl2561_record_decoder_t * decoder)
+{
+    esp_err_t err = ESP_ERR_INVALID_SIZE;
+    uint64_t timestamp = 0;
+    uint64_t delta0 = 0;
+    uint64_t delta1 = 0;
+    size_t offset = decoder->offset;
+    if (offset >= decoder->length)
+    {
+        err = ESP_ERR_NOT_FOUND;
+    }
+    else if (_get_varint(decoder->block, decoder->length, &offset, &timestamp))
+    {
+        uint8_t timing = 0;
+        bool changed = timestamp & 1;
+        bool complete = !changed || offset < decoder->length;
+        if (changed && complete)
+        {
+            timing = decoder->block[offset++];
+        }
+
+        if (complete
+            && _get_varint(decoder->block, decoder->length, &offset, &delta0)
+            && _get_varint(decoder->block, decoder->length, &offset, &delta1))
+        {
+            if (changed)
+            {
+                decoder->integration_time = (tsl2561_integration_time_t)(timing & TIMING_INTEG_MASK);
+                decoder->gain = (tsl2561_gain_t)(timing & TIMING_GAIN_MASK);
+            }
+            decoder->timestamp_us += (int64_t)(timestamp >> 1);
+            decoder->ch0 += _unzigzag((uint32_t)delta0);
+            decoder->ch1 += _unzigzag((uint32_t)delta1);
+            decoder->offset = offset;
+            err = ESP_OK;
+        }
+    }
+
+    if (err == ESP_ERR_INVALID_SIZE)
+    {
+        ESP_LOGE(TAG, "Corrupt sample at offset %d", (int)decoder->offset);
+    }
+    return err;
+}
+
+// Public API
+
+esp_err_t tsl2561_record_encoder_init(tsl2561_record_encoder_t * encoder, tsl2561_device_type_t device_type,
+                                      tsl2561_integration_time_t integration_time, tsl2561_gain_t gain,
+                                      uint8_t * block, size_t size)
+{
+    esp_err_t err = ESP_FAIL;
+    if (encoder != NULL)
+    {
+        memset(encoder, 0, sizeof(*encoder));
+        encoder->device_type = device_type;
+        encoder->timing = integration_time | gain;
+        if ((err = _begin_block(encoder, block, size)) == ESP_OK)
+        {
+            encoder->init = true;
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "encoder is NULL");
+    }
+    return err;
+}
+
+esp_err_t tsl2561_record_encode(tsl2561_record_encoder_t * encoder, int64_t timestamp_us,
+                                tsl2561_integration_time_t integration_time, tsl2561_gain_t gain,
+                                tsl2561_visible_t visible, tsl2561_infrared_t infrared)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init_encoder(encoder))
+    {
+        if (timestamp_us < encoder->timestamp_us)
+        {
+            ESP_LOGE(TAG, "Timestamp precedes previous sample");
+            err = ESP_ERR_INVALID_ARG;
+        }
+        else
+        {
+            // convert visible/infrared back into channel data
+            uint16_t ch0 = visible + infrared;
+            uint16_t ch1 = infrared;
+            uint8_t timing = integration_time | gain;
+            bool changed = timing != encoder->timing;
+
+            uint8_t sample[TSL2561_RECORD_SAMPLE_MAX];
+            size_t length = _put_varint(sample, ((uint64_t)(timestamp_us - encoder->timestamp_us) << 1) | changed);
+            if (changed)
+            {
+                sample[length++] = timing;
+            }
+            length += _put_varint(&sample[length], _zigzag((int32_t)ch0 - encoder->ch0));
+            length += _put_varint(&sample[length], _zigzag((int32_t)ch1 - encoder->ch1));
+
+            if (encoder->length + length <= encoder->size)
+            {
+                memcpy(&encoder->block[encoder->length], sample, length);
+                encoder->length += length;
+                encoder->timing = timing;
+                encoder->timestamp_us = timestamp_us;
+                encoder->ch0 = ch0;
+                encoder->ch1 = ch1;
+                err = ESP_OK;
+            }
+            else
+            {
+                err = ESP_ERR_NO_MEM;
+            }
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_record_encoder_finish(tsl2561_record_encoder_t * encoder, size_t * length)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init_encoder(encoder) && length != NULL)
+    {
+        encoder->block[HEADER_LENGTH] = encoder->length & 0xff;
+        encoder->block[HEADER_LENGTH + 1] = encoder->length >> 8;
+        *length = encoder->length;
+        err = ESP_OK;
+    }
+    return err;
+}
+
+esp_err_t tsl2561_record_encoder_next_block(tsl2561_record_encoder_t * encoder, uint8_t * block, size_t size)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init_encoder(encoder))
+    {
+        err = _begin_block(encoder, block, size);
+    }
+    return err;
+}
+
+esp_err_t tsl2561_record_decoder_init(tsl2561_record_decoder_t * decoder, const uint8_t * block, size_t size)
+{
+    esp_err_t err = ESP_FAIL;
+    if (decoder != NULL && block != NULL)
+    {
+        memset(decoder, 0, sizeof(*decoder));
+        size_t length = size >= TSL2561_RECORD_HEADER_SIZE ? block[HEADER_LENGTH] | (block[HEADER_LENGTH + 1] << 8) : 0;
+        if (size < TSL2561_RECORD_HEADER_SIZE || block[HEADER_MAGIC0] != RECORD_MAGIC0 || block[HEADER_MAGIC1] != RECORD_MAGIC1)
+        {
+            ESP_LOGE(TAG, "Invalid block header");
+            err = ESP_ERR_INVALID_ARG;
+        }
+        else if (block[HEADER_VERSION] != RECORD_VERSION)
+        {
+            ESP_LOGE(TAG, "Unsupported format version: %d", block[HEADER_VERSION]);
+            err = ESP_ERR_INVALID_VERSION;
+        }
+        else if (length < TSL2561_RECORD_HEADER_SIZE || length > size)
+        {
+            ESP_LOGE(TAG, "Block is unfinished or truncated");
+            err = ESP_ERR_INVALID_SIZE;
+        }
+        else
+        {
+            decoder->block = block;
+            decoder->length = length;
+            decoder->offset = TSL2561_RECORD_HEADER_SIZE;
+            decoder->device_type = (tsl2561_device_type_t)block[HEADER_DEVICE];
+            decoder->integration_time = (tsl2561_integration_time_t)(block[HEADER_TIMING] & TIMING_INTEG_MASK);
+            decoder->gain = (tsl2561_gain_t)(block[HEADER_TIMING] & TIMING_GAIN_MASK);
+            decoder->init = true;
+            err = ESP_OK;
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "decoder or block is NULL");
+    }
+    return err;
+}
+
+esp_err_t tsl2561_record_decode(tsl2561_record_decoder_t * decoder, tsl2561_record_sample_t * sample)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init_decoder(decoder) && sample != NULL)
+    {
+        if ((err = _decode(decoder)) == ESP_OK)
+        {
+            sample->timestamp_us = decoder->timestamp_us;
+            sample->visible = decoder->ch0 - decoder->ch1;
+            sample->infrared = decoder->ch1;
+            sample->integration_time = decoder->integration_time;
+            sample->gain = decoder->gain;
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_record_decode_batch(tsl2561_record_decoder_t * decoder, int64_t * timestamps_us,
+                                      tsl2561_visible_t * visible, tsl2561_infrared_t * infrared,
+                                      size_t max_count, size_t * count,
+                                      tsl2561_integration_time_t * integration_time, tsl2561_gain_t * gain)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init_decoder(decoder) && visible && infrared && count && integration_time && gain)
+    {
+        *count = 0;
+        err = ESP_OK;
+        while (err == ESP_OK && *count < max_count)
+        {
+            // decode into a copy, so that a sample in a different range is left for the next batch
+            tsl2561_record_decoder_t next = *decoder;
+            if ((err = _decode(&next)) == ESP_OK)
+            {
+                if (*count == 0)
+                {
+                    *integration_time = next.integration_time;
+                    *gain = next.gain;
+                }
+                else if (next.integration_time != *integration_time || next.gain != *gain)
+                {
+                    break;
+                }
+
+                *decoder = next;
+                if (timestamps_us != NULL)
+                {
+                    timestamps_us[*count] = decoder->timestamp_us;
+                }
+                visible[*count] = decoder->ch0 - decoder->ch1;
+                infrared[*count] = decoder->ch1;
+                ++*count;
+            }
+        }
+
+        // the end of the block completes a non-empty batch
+        if (err == ESP_ERR_NOT_FOUND && *count > 0)
+        {
+            err = ESP_OK;
+        }
+    }
+    return err;
+}
@@ -0,0 +1,206 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 David Antliff
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * @file tsl2561_scheduler.c
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_log.h"
+
+#include "tsl2561_scheduler.h"
+
+static const char * TAG = "tsl2561_scheduler";
+
+static bool _is_init(const tsl2561_scheduler_t * scheduler)
+{
+    bool ok = false;
+    if (scheduler != NULL)
+    {
+        if (scheduler->init)
+        {
+            ok = true;
+        }
+        else
+        {
+            ESP_LOGE(TAG, "scheduler is not initialised");
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "scheduler is NULL");
+    }
+    return ok;
+}
+
+// Number of ticks from now until tick, or zero if tick has been reached, allowing for tick count overflow
+static TickType_t _ticks_until(TickType_t tick, TickType_t now)
+{
+    TickType_t remaining = tick - now;
+    return remaining <= (portMAX_DELAY >> 1) ? remaining : 0;
+}
+
+// Public API
+
+#ifndef CONFIG_TSL2561_DISABLE_MALLOC
+tsl2561_scheduler_t * tsl2561_scheduler_malloc(void)
+{
+    tsl2561_scheduler_t * scheduler = malloc(sizeof(*scheduler));
+    if (scheduler != NULL)
+    {
+        memset(scheduler, 0, sizeof(*scheduler));
+        ESP_LOGD(TAG, "malloc tsl2561_scheduler_t %p", scheduler);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "malloc tsl2561_scheduler_t failed");
+    }
+    return scheduler;
+}
+
+void tsl2561_scheduler_free(tsl2561_scheduler_t ** scheduler)
+{
+    if (scheduler != NULL && (*scheduler != NULL))
+    {
+        ESP_LOGD(TAG, "free tsl2561_scheduler_t %p", *scheduler);
+        free(*scheduler);
+        *scheduler = NULL;
+    }
+    else
+    {
+        ESP_LOGE(TAG, "free tsl2561_scheduler_t failed");
+    }
+}
+#endif  // CONFIG_TSL2561_DISABLE_MALLOC
+
+esp_err_t tsl2561_scheduler_init(tsl2561_scheduler_t * scheduler)
+{
+    esp_err_t err = ESP_FAIL;
+    if (scheduler != NULL)
+    {
+        memset(scheduler, 0, sizeof(*scheduler));
+        scheduler->init = true;
+        err = ESP_OK;
+    }
+    else
+    {
+        ESP_LOGE(TAG, "scheduler is NULL");
+    }
+    return err;
+}
+
+esp_err_t tsl2561_scheduler_add(tsl2561_scheduler_t * scheduler, tsl2561_info_t * tsl2561_info)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(scheduler) && tsl2561_info != NULL)
+    {
+        if (scheduler->count < TSL2561_SCHEDULER_MAX_DEVICES)
+        {
+            scheduler->devices[scheduler->count++] = tsl2561_info;
+            err = ESP_OK;
+        }
+        else
+        {
+            ESP_LOGE(TAG, "scheduler is full");
+            err = ESP_ERR_NO_MEM;
+        }
+    }
+    return err;
+}
+
+esp_err_t tsl2561_scheduler_read(tsl2561_scheduler_t * scheduler, tsl2561_visible_t * visible, tsl2561_infrared_t * infrared)
+{
+    esp_err_t err = ESP_FAIL;
+    if (_is_init(scheduler) && visible && infrared)
+    {
+        err = ESP_OK;
+
+        // start all integrations together
+        uint32_t pending = 0;
+        for (size_t i = 0; i < scheduler->count; ++i)
+        {
+            tsl2561_info_t * tsl2561_info = scheduler->devices[i];
+            esp_err_t start_err = ESP_OK;
+            if (tsl2561_info->measurement_state != TSL2561_MEASUREMENT_CONTINUOUS)
+            {
+                start_err = tsl2561_start_measurement(tsl2561_info);
+            }
+
+            if (start_err == ESP_OK)
+            {
+                pending |= 1u << i;
+            }
+            else
+            {
+                ESP_LOGE(TAG, "Failed to start measurement on device %d", (int)i);
+                err = err == ESP_OK ? start_err : err;
+            }
+        }
+
+        // collect results in completion order
+        while (pending)
+        {
+            TickType_t now = xTaskGetTickCount();
+            TickType_t wait = portMAX_DELAY;
+            for (size_t i = 0; i < scheduler->count; ++i)
+            {
+                if (pending & (1u << i))
+                {
+                    TickType_t remaining = _ticks_until(tsl2561_get_ready_tick(scheduler->devices[i]), now);
+                    wait = remaining < wait ? remaining : wait;
+                }
+            }
+
+            if (wait > 0)
+            {
+                vTaskDelay(wait);
+            }
+
+            for (size_t i = 0; i < scheduler->count; ++i)
+            {
+                if (pending & (1u << i))
+                {
+                    bool ready = false;
+                    esp_err_t poll_err = tsl2561_poll_result(scheduler->devices[i], &ready, &visible[i], &infrared[i]);
+                    if (poll_err != ESP_OK)
+                    {
+                        ESP_LOGE(TAG, "Failed to read device %d", (int)i);
+                        err = err == ESP_OK ? poll_err : err;
+                        pending &= ~(1u << i);
+                    }
+                    else if (ready)
+                    {
+                        pending &= ~(1u << i);
+                    }
+                }
+            }
+        }
+    }
+    return err;
+}